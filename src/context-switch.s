@@ -50,4 +50,32 @@ process_context_switch:
     mov     eax, [esp + 4 + 0x1C]
 
     ; --- Lompat ke user ---
-    iret
\ No newline at end of file
+    iret
+
+global process_kernel_context_save_and_switch
+global process_kernel_context_resume
+extern scheduler_suspend_current_process
+
+; void process_kernel_context_save_and_switch(void);
+; Simpan callee-saved register di kernel stack process ini, lalu pindah ke process lain.
+; Process akan lanjut dari titik ini (seolah-olah fungsi return) lewat process_kernel_context_resume
+
+process_kernel_context_save_and_switch:
+    push    ebp
+    push    ebx
+    push    esi
+    push    edi
+    mov     eax, esp
+    push    eax                   ; saved_esp
+    call    scheduler_suspend_current_process ; noreturn
+
+; void process_kernel_context_resume(uint32_t saved_esp);
+; Kembali ke kernel stack yang disimpan process_kernel_context_save_and_switch
+
+process_kernel_context_resume:
+    mov     esp, [esp + 4]
+    pop     edi
+    pop     esi
+    pop     ebx
+    pop     ebp
+    ret
@@ -3,7 +3,12 @@
 #include "header/cpu/interrupt.h"
 #include "header/cpu/portio.h"
 #include "header/driver/keyboard.h"
+#include "header/driver/disk.h"
+#include "header/driver/virtio-blk.h"
+#include "header/driver/ahci.h"
 #include "header/filesystem/ext2.h"
+#include "header/filesystem/file.h"
+#include "header/driver/block-cache.h"
 #include "header/text/framebuffer.h"
 #include "header/process/scheduler.h"
 #include "header/process/process.h"
@@ -12,13 +17,31 @@
 #include "header/stdlib/string.h"
 #include "header/graphics/graphics.h"
 
-static uint8_t g_adapter_buffer[BLOCK_SIZE];
+static uint8_t g_adapter_buffer[EXT2_MAX_BLOCK_SIZE];
+static volatile uint32_t timer_ticks = 0; // PIT_TIMER_FREQUENCY ticks since activate_timer_interrupt()
+static uint32_t last_sync_tick = 0;
+
+// Process may sleep on disk I/O in the middle of ext2, only one process can be inside the filesystem
+static struct SleepLock filesystem_lock = {.locked = false, .owner = NULL};
 
 void io_wait(void)
 {
     out(0x80, 0);
 }
 
+uint32_t interrupt_disable_save(void)
+{
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(eflags) : /* <Empty> */ : "memory");
+    return eflags;
+}
+
+void interrupt_restore(uint32_t eflags)
+{
+    if (eflags & CPU_EFLAGS_FLAG_INTERRUPT_ENABLE)
+        __asm__ volatile("sti" : : : "memory");
+}
+
 void pic_ack(uint8_t irq)
 {
     if (irq >= 8)
@@ -52,31 +75,84 @@ void pic_remap(void)
     out(PIC2_DATA, PIC_DISABLE_ALL_MASK);
 }
 
+/**
+ * Periodic flusher: metadata changes stay in memory until FILESYSTEM_SYNC_INTERVAL_TICKS passed,
+ * the interrupted process does the write-back like a sync syscall, skipped while another process is inside the filesystem
+ */
+static void periodic_filesystem_sync(void)
+{
+    if (timer_ticks - last_sync_tick < FILESYSTEM_SYNC_INTERVAL_TICKS)
+        return;
+    last_sync_tick = timer_ticks;
+    if (filesystem_lock.locked || !filesystem_needs_sync())
+        return;
+
+    sleep_lock_acquire(&filesystem_lock);
+    sync_filesystem();
+    sleep_lock_release(&filesystem_lock);
+}
+
+static void preempt_current_process(struct InterruptFrame *frame)
+{
+    struct Context ctx = {
+        .cpu = frame->cpu,
+        .eip = frame->int_stack.eip,
+        .eflags = frame->int_stack.eflags,
+        .page_directory_virtual_addr = paging_get_current_page_directory_addr()};
+    scheduler_save_context_to_current_running_pcb(ctx);
+    scheduler_switch_to_next_process();
+}
+
 void main_interrupt_handler(struct InterruptFrame frame)
 {
+    // Interrupt from ring 0 hit the kernel idling / sleeping, there is no user context to save
+    bool from_user = (frame.int_stack.cs & 0x3) == 0x3;
+
     switch (frame.int_number)
     {
     case PIC1_OFFSET + IRQ_TIMER:
+        timer_ticks++;
         pic_ack(IRQ_TIMER);
-        struct Context ctx = {
-            .cpu = frame.cpu,
-            .eip = frame.int_stack.eip,
-            .eflags = frame.int_stack.eflags,
-            .page_directory_virtual_addr = paging_get_current_page_directory_addr()};
-        scheduler_save_context_to_current_running_pcb(ctx);
-        scheduler_switch_to_next_process();
+        if (from_user)
+        {
+            periodic_filesystem_sync();
+            preempt_current_process(&frame);
+        }
         break;
 
     case PIC1_OFFSET + IRQ_KEYBOARD:
         keyboard_isr();
         break;
 
+    case PIC1_OFFSET + IRQ_PRIMARY_ATA:
+        // Switch right away to the process waiting for this disk command
+        if (disk_isr() && from_user)
+            preempt_current_process(&frame);
+        break;
+
     case 0x30:
         syscall(frame);
         break;
+
+    case 0x06: // invalid opcode
+        // __builtin_trap() of a kernel check (ext2 scratch pool overflow), returning would trap again forever
+        if (!from_user)
+        {
+            graphics_puts("Kernel panic: invalid opcode di kernel\n", COLOR_RED);
+            while (true)
+                __asm__ volatile("cli; hlt");
+        }
+        break;
     default:
+    {
+        // PCI devices get their IRQ line from the firmware, it is not known at compile time
+        bool woken = virtio_blk_isr(frame.int_number);
+        woken |= ahci_isr(frame.int_number);
+        if (woken && from_user)
+            preempt_current_process(&frame);
         break;
     }
+    }
 }
 
 void activate_timer_interrupt(void)
@@ -91,11 +167,47 @@ void activate_timer_interrupt(void)
     __asm__ volatile("sti");
 }
 
+uint32_t calibrate_tsc(void)
+{
+    // Gate channel 2 with the speaker off, OUT2 rises once the one-shot count reaches 0
+    uint8_t gate = in(PIT_CHANNEL_2_GATE_PIO) & ~(PIT_CHANNEL_2_SPEAKER | PIT_CHANNEL_2_GATE);
+    out(PIT_CHANNEL_2_GATE_PIO, gate | PIT_CHANNEL_2_GATE);
+    out(PIT_COMMAND_REGISTER_PIO, PIT_COMMAND_CHANNEL_2_ONE_SHOT);
+    out(PIT_CHANNEL_2_DATA_PIO, (uint8_t)(TSC_CALIBRATION_COUNTER & 0xFF));
+    out(PIT_CHANNEL_2_DATA_PIO, (uint8_t)((TSC_CALIBRATION_COUNTER >> 8) & 0xFF));
+
+    uint64_t start = read_tsc();
+    while (!(in(PIT_CHANNEL_2_GATE_PIO) & PIT_CHANNEL_2_OUTPUT))
+        ;
+    uint64_t cycles = read_tsc() - start;
+    out(PIT_CHANNEL_2_GATE_PIO, gate);
+
+    uint32_t cycles_per_us = (uint32_t)cycles / TSC_CALIBRATION_US;
+    return cycles_per_us != 0 ? cycles_per_us : 1;
+}
+
 void activate_keyboard_interrupt(void)
 {
     out(PIC1_DATA, in(PIC1_DATA) & ~(1 << IRQ_KEYBOARD));
 }
 
+void activate_disk_interrupt(void)
+{
+    out(PIC1_DATA, in(PIC1_DATA) & ~(1 << IRQ_CASCADE));
+    out(PIC2_DATA, in(PIC2_DATA) & ~(1 << (IRQ_PRIMARY_ATA - 8)));
+}
+
+void activate_pci_interrupt(uint8_t irq)
+{
+    if (irq < 8)
+    {
+        out(PIC1_DATA, in(PIC1_DATA) & ~(1 << irq));
+        return;
+    }
+    out(PIC1_DATA, in(PIC1_DATA) & ~(1 << IRQ_CASCADE));
+    out(PIC2_DATA, in(PIC2_DATA) & ~(1 << (irq - 8)));
+}
+
 struct TSSEntry _interrupt_tss_entry = {
     .ss0 = GDT_KERNEL_DATA_SEGMENT_SELECTOR,
 };
@@ -109,38 +221,6 @@ void set_tss_kernel_current_stack(void)
     _interrupt_tss_entry.esp0 = stack_ptr + 8;
 }
 
-static uint32_t find_inode_by_path(const char *path)
-{
-    if (strcmp(path, "/") == 0)
-    {
-        return ROOT_INODE_NUM; // Root inode
-    }
-
-    struct EXT2Inode current_inode;
-    uint32_t current_inode_num = ROOT_INODE_NUM;
-    read_inode(current_inode_num, &current_inode);
-
-    char path_copy[1024];
-    strcpy(path_copy, path);
-
-    char *token = strtok(path_copy, "/");
-    while (token != NULL)
-    {
-        uint32_t next_inode_num = find_inode_by_name(&current_inode, token, strlen(token));
-        if (next_inode_num == 0)
-        {
-            return 0; // Entry tidak ditemukan
-        }
-
-        current_inode_num = next_inode_num;
-        read_inode(current_inode_num, &current_inode);
-
-        token = strtok(NULL, "/");
-    }
-
-    return current_inode_num;
-}
-
 static int32_t find_parent_inode_and_name(const char *full_path, uint32_t *parent_inode_out, char *name_out)
 {
     char path_copy[1024];
@@ -164,7 +244,7 @@ static int32_t find_parent_inode_and_name(const char *full_path, uint32_t *paren
     *last_slash = '\0';
     strcpy(name_out, last_slash + 1);
 
-    *parent_inode_out = find_inode_by_path(path_copy);
+    *parent_inode_out = ext2_resolve_path(path_copy);
     if (*parent_inode_out == 0)
     {
         return -1; // Parent path tidak ditemukan
@@ -193,9 +273,21 @@ int32_t ext2_read(const char *path, char *buffer)
     return (int32_t)read(req);
 }
 
+int32_t ext2_read_at(struct EXT2ReadAtRequest *request)
+{
+    request->bytes_read = 0;
+    uint32_t inode_num = ext2_resolve_path(request->path);
+    if (inode_num == 0)
+    {
+        return 3; // 3: not found
+    }
+
+    return (int32_t)read_at(inode_num, request->buf, request->offset, request->length, &request->bytes_read);
+}
+
 int32_t ext2_ls(const char *path, char *buffer)
 {
-    uint32_t dir_inode_num = find_inode_by_path(path);
+    uint32_t dir_inode_num = ext2_resolve_path(path);
     if (dir_inode_num == 0)
     {
         return -1; // Not found
@@ -209,46 +301,83 @@ int32_t ext2_ls(const char *path, char *buffer)
         return -2; // Not a directory
     }
 
-    *buffer = '\0';
+    // names are appended at the end of what is already there, not searched for with strcat
+    char *end = buffer;
+    *end = '\0';
 
-    for (int i = 0; i < 12; i++)
+    uint32_t block_size = ext2_block_size();
+    uint32_t block_count = dir_inode.i_size / block_size;
+    for (uint32_t i = 0; i < block_count; i++)
     {
-        uint32_t block_num = dir_inode.i_block[i];
+        uint32_t block_num = get_inode_block(&dir_inode, i);
         if (block_num == 0)
             continue;
 
-        read_blocks(g_adapter_buffer, block_num, 1);
+        ext2_read_blocks(g_adapter_buffer, block_num, 1);
 
         uint32_t offset = 0;
-        while (offset < BLOCK_SIZE)
+        while (offset < block_size)
         {
             struct EXT2DirectoryEntry *entry = get_directory_entry(g_adapter_buffer, offset);
-            if (entry->inode == 0 || entry->rec_len == 0)
+            if (entry->rec_len == 0)
             {
                 break;
             }
+            // removed entries and htree index blocks
+            if (entry->inode == 0)
+            {
+                offset += entry->rec_len;
+                continue;
+            }
 
-            char *entry_name_ptr = get_entry_name(entry);
-            char entry_name[256];
-            memcpy(entry_name, entry_name_ptr, entry->name_len);
-            entry_name[entry->name_len] = '\0';
-
-            if (strcmp(entry_name, ".") != 0 && strcmp(entry_name, "..") != 0)
+            char *entry_name = get_entry_name(entry);
+            bool is_dot = (entry->name_len == 1 && entry_name[0] == '.') ||
+                          (entry->name_len == 2 && entry_name[0] == '.' && entry_name[1] == '.');
+            if (!is_dot)
             {
-                strcat(buffer, entry_name);
-                strcat(buffer, "\n");
+                memcpy(end, entry_name, entry->name_len);
+                end += entry->name_len;
+                *end++ = '\n';
+                *end = '\0';
             }
 
             offset += entry->rec_len;
         }
     }
-    // belum indirect blocks
+    return 0; // Sukses
+}
+
+int32_t ext2_getdents(struct EXT2GetdentsRequest *request)
+{
+    request->count = 0;
+    uint32_t dir_inode_num = ext2_resolve_path(request->path);
+    if (dir_inode_num == 0)
+    {
+        return -1; // Not found
+    }
+
+    if (read_directory_entries(dir_inode_num, &request->cookie, request->records, request->max_records, &request->count) != 0)
+    {
+        return -2; // Not a directory
+    }
+    return 0; // Sukses
+}
+
+int32_t ext2_stat(const char *path, struct EXT2Stat *stat)
+{
+    uint32_t inode_num = ext2_resolve_path(path);
+    if (inode_num == 0)
+    {
+        return 3; // 3: not found
+    }
+
+    stat_inode(inode_num, stat);
     return 0; // Sukses
 }
 
 int32_t ext2_stat_dir(const char *path)
 {
-    uint32_t inode_num = find_inode_by_path(path);
+    uint32_t inode_num = ext2_resolve_path(path);
     if (inode_num == 0)
     {
         return -1; // Not found
@@ -269,7 +398,7 @@ int32_t ext2_stat_dir(const char *path)
 
 int32_t ext2_mkdir(const char *path, const char *name)
 {
-    uint32_t parent_ino = find_inode_by_path(path);
+    uint32_t parent_ino = ext2_resolve_path(path);
     if (parent_ino == 0)
     {
         return 2; // invalid parent folder
@@ -307,9 +436,74 @@ int32_t ext2_write(const char *path, const char *buffer, uint32_t size)
     return (int32_t)write(&req);
 }
 
+int32_t ext2_write_at(struct EXT2WriteAtRequest *request)
+{
+    request->bytes_written = 0;
+    uint32_t inode_num = ext2_resolve_path(request->path);
+    if (inode_num == 0)
+    {
+        // file baru dibuat kosong, lalu ditulis seperti file yang sudah ada
+        int32_t create_result = ext2_write(request->path, NULL, 0);
+        if (create_result != 0)
+        {
+            return create_result;
+        }
+        inode_num = ext2_resolve_path(request->path);
+    }
+
+    return (int32_t)write_at(inode_num, request->buf, request->offset, request->length, &request->bytes_written);
+}
+
+int32_t ext2_truncate(const char *path, uint32_t size)
+{
+    uint32_t inode_num = ext2_resolve_path(path);
+    if (inode_num == 0)
+    {
+        return 3; // 3: not found
+    }
+
+    return (int32_t)truncate_file(inode_num, size);
+}
+
+int32_t ext2_open(const char *path, uint32_t flags)
+{
+    struct ProcessControlBlock *pcb = process_get_current_running_pcb_pointer();
+    if (pcb == NULL)
+    {
+        return FILE_ERROR_INVALID;
+    }
+
+    // Path di-resolve sekali di sini, read/write/lseek berikutnya hanya memakai inode
+    uint32_t inode_num = ext2_resolve_path(path);
+    if (inode_num == 0)
+    {
+        if ((flags & FILE_OPEN_CREATE) == 0 || ext2_write(path, NULL, 0) != 0)
+        {
+            return FILE_ERROR_NOT_FOUND;
+        }
+        inode_num = ext2_resolve_path(path);
+    }
+
+    int32_t fd = file_open(&pcb->files, inode_num, flags);
+    if (fd >= 0 && (flags & FILE_OPEN_TRUNCATE) != 0 && (flags & FILE_OPEN_WRITE) != 0 &&
+        truncate_file(inode_num, 0) != 0)
+    {
+        file_close(&pcb->files, fd);
+        return FILE_ERROR_IO;
+    }
+    return fd;
+}
+
+// File descriptor syscalls work on the table of the calling process
+static struct FileDescriptorTable *current_file_table(void)
+{
+    struct ProcessControlBlock *pcb = process_get_current_running_pcb_pointer();
+    return pcb != NULL ? &pcb->files : NULL;
+}
+
 int32_t ext2_rm(const char *path, const char *name)
 {
-    uint32_t parent_ino = find_inode_by_path(path);
+    uint32_t parent_ino = ext2_resolve_path(path);
     if (parent_ino == 0)
     {
         return 3; // parent folder invalid
@@ -367,6 +561,36 @@ void sleep(uint32_t ticks)
 extern bool terminate_badapple;
 extern bool ctrl_down;
 
+static bool syscall_uses_filesystem(uint32_t syscall_number)
+{
+    switch (syscall_number)
+    {
+    case 0:  // read
+    case 11: // ls
+    case 12: // stat
+    case 13: // mkdir
+    case 14: // write
+    case 15: // rm
+    case 16: // rename
+    case 18: // create process
+    case 29: // pread
+    case 30: // pwrite
+    case 31: // truncate
+    case 32: // open
+    case 33: // read fd
+    case 34: // write fd
+    case 35: // lseek
+    case 36: // close
+    case 37: // sync
+    case 38: // getdents
+    case 39: // stat
+    case 40: // fstat
+        return true;
+    default:
+        return false;
+    }
+}
+
 void syscall(struct InterruptFrame frame)
 {
     uint32_t ebx = frame.cpu.general.ebx;
@@ -375,6 +599,10 @@ void syscall(struct InterruptFrame frame)
 
     int32_t *retcode_ptr = (int32_t *)edx;
 
+    bool filesystem_syscall = syscall_uses_filesystem(frame.cpu.general.eax);
+    if (filesystem_syscall)
+        sleep_lock_acquire(&filesystem_lock);
+
     switch (frame.cpu.general.eax)
     {
     case 0: // read
@@ -433,7 +661,7 @@ void syscall(struct InterruptFrame frame)
     case 18: // create process
     {
         char *path = (char *)ebx;
-        uint32_t inode_num = find_inode_by_path(path);
+        uint32_t inode_num = ext2_resolve_path(path);
 
         if (inode_num == 0)
         {
@@ -558,7 +786,78 @@ void syscall(struct InterruptFrame frame)
         frame.cpu.general.eax = 0;
         break;
     }
+    case 28: // iostat(stats_buf, name_buf, uptime_ms)
+    {
+        struct BlockDevice *device = ext2_get_device();
+        block_device_get_stats(device, (struct BlockDeviceStats *)ebx);
+
+        size_t name_len = strlen(device->name);
+        if (name_len >= BLOCK_DEVICE_NAME_LENGTH)
+            name_len = BLOCK_DEVICE_NAME_LENGTH - 1;
+        memset((char *)ecx, 0, BLOCK_DEVICE_NAME_LENGTH);
+        memcpy((char *)ecx, device->name, name_len);
+
+        *((uint32_t *)edx) = timer_ticks * (1000 / PIT_TIMER_FREQUENCY);
+        break;
+    }
+    case 29: // pread(request, 0, retcode)
+        *retcode_ptr = ext2_read_at((struct EXT2ReadAtRequest *)ebx);
+        break;
+    case 30: // pwrite(request, 0, retcode)
+        *retcode_ptr = ext2_write_at((struct EXT2WriteAtRequest *)ebx);
+        break;
+    case 31: // truncate(path, size, retcode)
+        *retcode_ptr = ext2_truncate((const char *)ebx, ecx);
+        break;
+    case 32: // open(path, flags, retcode)
+        *retcode_ptr = ext2_open((const char *)ebx, ecx);
+        break;
+    case 33: // read(request, 0, retcode)
+    case 34: // write(request, 0, retcode)
+    {
+        struct FileDescriptorTable *table = current_file_table();
+        struct FileIORequest *request = (struct FileIORequest *)ebx;
+        if (table == NULL)
+            *retcode_ptr = FILE_ERROR_BAD_DESCRIPTOR;
+        else if (frame.cpu.general.eax == 33)
+            *retcode_ptr = file_read(table, request->fd, request->buf, request->count);
+        else
+            *retcode_ptr = file_write(table, request->fd, request->buf, request->count);
+        break;
+    }
+    case 35: // lseek(request, 0, retcode)
+    {
+        struct FileDescriptorTable *table = current_file_table();
+        struct FileSeekRequest *request = (struct FileSeekRequest *)ebx;
+        *retcode_ptr = table != NULL ? file_lseek(table, request->fd, request->offset, request->whence) : FILE_ERROR_BAD_DESCRIPTOR;
+        break;
+    }
+    case 36: // close(fd, 0, retcode)
+    {
+        struct FileDescriptorTable *table = current_file_table();
+        *retcode_ptr = table != NULL ? file_close(table, (int32_t)ebx) : FILE_ERROR_BAD_DESCRIPTOR;
+        break;
+    }
+    case 37: // sync(0, 0, 0)
+        sync_filesystem();
+        last_sync_tick = timer_ticks;
+        break;
+    case 38: // getdents(request, 0, retcode)
+        *retcode_ptr = ext2_getdents((struct EXT2GetdentsRequest *)ebx);
+        break;
+    case 39: // stat(path, stat_buf, retcode)
+        *retcode_ptr = ext2_stat((const char *)ebx, (struct EXT2Stat *)ecx);
+        break;
+    case 40: // fstat(fd, stat_buf, retcode)
+    {
+        struct FileDescriptorTable *table = current_file_table();
+        *retcode_ptr = table != NULL ? file_fstat(table, (int32_t)ebx, (struct EXT2Stat *)ecx) : FILE_ERROR_BAD_DESCRIPTOR;
+        break;
+    }
     default:
         graphics_puts("Unknown Syscall\n", COLOR_RED);
     }
+
+    if (filesystem_syscall)
+        sleep_lock_release(&filesystem_lock);
 }
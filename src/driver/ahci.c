@@ -0,0 +1,388 @@
+#include "header/driver/ahci.h"
+#include "header/driver/disk.h"
+#include "header/driver/pci.h"
+#include "header/driver/block-device.h"
+#include "header/cpu/interrupt.h"
+#include "header/memory/paging.h"
+#include "header/process/process.h"
+#include "header/process/scheduler.h"
+#include "header/stdlib/string.h"
+
+// referensi https://wiki.osdev.org/AHCI & Serial ATA AHCI 1.3.1 specification
+
+static struct AHCIState ahci_state = {
+    .available = false,
+    .abar = NULL,
+    .port = 0,
+    .irq = 0,
+    .ncq = false,
+    .slot_count = 1,
+    .capacity = 0,
+    .slots_busy = 0,
+    .batching = false,
+    .flushing = false,
+    .error_count = 0,
+};
+
+static struct AHCICommandHeader command_list[AHCI_MAX_SLOTS] __attribute__((aligned(1024)));
+static uint8_t received_fis[256] __attribute__((aligned(256)));
+static struct AHCICommandTable command_tables[AHCI_MAX_SLOTS];
+static uint16_t identify_buffer[ATA_IDENTIFY_WORD_COUNT];
+
+static volatile uint32_t *hba_register(uint32_t offset)
+{
+    return (volatile uint32_t *)(ahci_state.abar + offset);
+}
+
+static volatile uint32_t *port_register(uint32_t offset)
+{
+    return hba_register(AHCI_PORT_BASE(ahci_state.port) + offset);
+}
+
+static void port_stop(void)
+{
+    *port_register(AHCI_PxCMD) &= ~AHCI_PxCMD_ST;
+    while (*port_register(AHCI_PxCMD) & AHCI_PxCMD_CR)
+        ;
+    *port_register(AHCI_PxCMD) &= ~AHCI_PxCMD_FRE;
+    while (*port_register(AHCI_PxCMD) & AHCI_PxCMD_FR)
+        ;
+}
+
+static void port_start(void)
+{
+    *port_register(AHCI_PxSERR) = 0xFFFFFFFF;
+    *port_register(AHCI_PxIS) = 0xFFFFFFFF;
+    *port_register(AHCI_PxCMD) |= AHCI_PxCMD_FRE;
+    while (*port_register(AHCI_PxTFD) & (AHCI_TFD_BSY | AHCI_TFD_DRQ))
+        ;
+    *port_register(AHCI_PxCMD) |= AHCI_PxCMD_ST;
+}
+
+// First implemented port with a spun up SATA disk behind it
+static bool find_disk_port(void)
+{
+    uint32_t implemented = *hba_register(AHCI_HBA_PI);
+    for (uint8_t port = 0; port < AHCI_PORT_COUNT; port++)
+    {
+        if (!(implemented & (1u << port)))
+            continue;
+        ahci_state.port = port;
+        if ((*port_register(AHCI_PxSSTS) & AHCI_PxSSTS_DET_MASK) == AHCI_PxSSTS_DET_PRESENT &&
+            *port_register(AHCI_PxSIG) == AHCI_SIG_SATA_DISK)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Fill the PRDT of a slot with the physically contiguous pieces of a buffer
+ * @return Number of PRDT entries used
+ */
+static uint16_t build_prdt(struct AHCICommandTable *table, uint8_t *ptr, uint32_t size)
+{
+    uint16_t count = 0;
+    while (size > 0 && count < AHCI_MAX_PRDT)
+    {
+        uint32_t physical = paging_virtual_to_physical(ptr);
+        uint32_t in_frame = PAGE_FRAME_SIZE - ((uint32_t)ptr & (PAGE_FRAME_SIZE - 1));
+        uint32_t len = size < in_frame ? size : in_frame;
+
+        struct AHCIPhysicalRegion *prev = count > 0 ? &table->prdt[count - 1] : NULL;
+        uint32_t prev_len = prev ? (prev->byte_count & (AHCI_PRD_MAX_BYTES - 1)) + 1 : 0;
+        if (prev && prev->data_base + prev_len == physical && prev_len + len <= AHCI_PRD_MAX_BYTES)
+        {
+            prev->byte_count = prev_len + len - 1;
+        }
+        else
+        {
+            table->prdt[count].data_base = physical;
+            table->prdt[count].data_base_upper = 0;
+            table->prdt[count].reserved = 0;
+            table->prdt[count].byte_count = len - 1;
+            count++;
+        }
+        ptr += len;
+        size -= len;
+    }
+    table->prdt[count - 1].byte_count |= AHCI_PRD_INTERRUPT;
+    return count;
+}
+
+static void build_command(uint8_t slot, uint8_t command, uint32_t logical_block_address, uint16_t block_count, bool is_write)
+{
+    struct FISRegisterH2D *fis = (struct FISRegisterH2D *)command_tables[slot].command_fis;
+    memset(fis, 0, sizeof(struct FISRegisterH2D));
+    fis->fis_type = FIS_TYPE_REG_H2D;
+    fis->flags = FIS_H2D_COMMAND;
+    fis->command = command;
+    fis->device = FIS_DEVICE_LBA;
+    fis->lba0 = (uint8_t)logical_block_address;
+    fis->lba1 = (uint8_t)(logical_block_address >> 8);
+    fis->lba2 = (uint8_t)(logical_block_address >> 16);
+    fis->lba3 = (uint8_t)(logical_block_address >> 24);
+
+    if (command == ATA_COMMAND_READ_FPDMA_QUEUED || command == ATA_COMMAND_WRITE_FPDMA_QUEUED)
+    {
+        // NCQ moves the sector count to the feature field, the count field carries the tag
+        fis->feature_low = (uint8_t)block_count;
+        fis->feature_high = (uint8_t)(block_count >> 8);
+        fis->count_low = slot << 3;
+    }
+    else
+    {
+        fis->count_low = (uint8_t)block_count;
+        fis->count_high = (uint8_t)(block_count >> 8);
+    }
+
+    struct AHCICommandHeader *header = &command_list[slot];
+    header->flags = (sizeof(struct FISRegisterH2D) / sizeof(uint32_t)) | (is_write ? AHCI_COMMAND_HEADER_WRITE : 0);
+    header->prd_byte_count = 0;
+}
+
+/**
+ * IDENTIFY DEVICE on slot 0, polled because it runs before the port interrupt is enabled.
+ * @return True if the disk answered
+ */
+static bool identify_disk(void)
+{
+    command_list[0].prdt_length = build_prdt(&command_tables[0], (uint8_t *)identify_buffer, sizeof(identify_buffer));
+    build_command(0, ATA_COMMAND_IDENTIFY, 0, 0, false);
+
+    *port_register(AHCI_PxCI) = 1;
+    while ((*port_register(AHCI_PxCI) & 1) && !(*port_register(AHCI_PxIS) & AHCI_PxIS_TFES))
+        ;
+    *port_register(AHCI_PxIS) = 0xFFFFFFFF;
+    if (*port_register(AHCI_PxTFD) & AHCI_TFD_ERR)
+        return false;
+
+    const uint16_t *sectors = &identify_buffer[ATA_IDENTIFY_LBA48_SECTORS];
+    ahci_state.capacity = (sectors[2] || sectors[3]) ? UINT32_MAX : (sectors[0] | ((uint32_t)sectors[1] << 16));
+
+    uint32_t hba_slots = ((*hba_register(AHCI_HBA_CAP) >> AHCI_CAP_NCS_SHIFT) & AHCI_CAP_NCS_MASK) + 1;
+    uint32_t disk_depth = (identify_buffer[ATA_IDENTIFY_QUEUE_DEPTH] & 0x1F) + 1;
+    ahci_state.ncq = (*hba_register(AHCI_HBA_CAP) & AHCI_CAP_SNCQ) &&
+                     (identify_buffer[ATA_IDENTIFY_SATA_CAPABILITIES] & ATA_IDENTIFY_NCQ_SUPPORTED);
+    ahci_state.slot_count = ahci_state.ncq ? (hba_slots < disk_depth ? hba_slots : disk_depth) : 1;
+    return true;
+}
+
+static void ahci_device_read(struct BlockDevice *device, void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    (void)device;
+    ahci_transfer(ptr, logical_block_address, block_count, false);
+}
+
+static void ahci_device_write(struct BlockDevice *device, const void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    (void)device;
+    ahci_transfer((void *)ptr, logical_block_address, block_count, true);
+}
+
+static void ahci_device_flush(struct BlockDevice *device)
+{
+    (void)device;
+    ahci_flush();
+}
+
+static uint32_t ahci_device_capacity(struct BlockDevice *device)
+{
+    (void)device;
+    return ahci_state.capacity;
+}
+
+static void ahci_device_batch_begin(struct BlockDevice *device)
+{
+    (void)device;
+    ahci_batch_begin();
+}
+
+static void ahci_device_batch_end(struct BlockDevice *device)
+{
+    (void)device;
+    ahci_batch_end();
+}
+
+static const struct BlockDeviceOperations ahci_device_operations = {
+    .read = ahci_device_read,
+    .write = ahci_device_write,
+    .flush = ahci_device_flush,
+    .capacity = ahci_device_capacity,
+    .batch_begin = ahci_device_batch_begin,
+    .batch_end = ahci_device_batch_end,
+};
+
+static struct BlockDevice ahci_device = {
+    .name = "ahci",
+    .ops = &ahci_device_operations,
+    .private_data = NULL,
+};
+
+struct BlockDevice *ahci_init(void)
+{
+    struct PCIDevice dev;
+    if (!pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_SATA, &dev))
+        return NULL;
+    if (pci_config_read8(dev, PCI_PROG_IF) != PCI_PROG_IF_AHCI)
+        return NULL;
+
+    uint32_t bar5 = pci_config_read32(dev, PCI_BAR5);
+    uint8_t irq = pci_config_read8(dev, PCI_INTERRUPT_LINE);
+    uint32_t abar = bar5 & PCI_BAR_MEM_MASK;
+    if ((bar5 & 0x1) || abar < PAGE_FRAME_SIZE || irq >= 16)
+        return NULL; // ABAR must be memory space outside the low identity page, completion needs a PIC line
+    if ((abar & ~(PAGE_FRAME_SIZE - 1)) == KERNEL_VIRTUAL_ADDRESS_BASE)
+        return NULL; // Would shadow the kernel mapping
+
+    pci_enable_command(dev, PCI_COMMAND_MEMORY_SPACE | PCI_COMMAND_BUS_MASTER);
+    ahci_state.abar = paging_map_kernel_mmio(abar);
+    *hba_register(AHCI_HBA_GHC) |= AHCI_GHC_AE;
+
+    if (!find_disk_port())
+        return NULL;
+
+    port_stop();
+    memset(command_list, 0, sizeof(command_list));
+    memset(received_fis, 0, sizeof(received_fis));
+    *port_register(AHCI_PxCLB) = paging_virtual_to_physical(command_list);
+    *port_register(AHCI_PxCLBU) = 0;
+    *port_register(AHCI_PxFB) = paging_virtual_to_physical(received_fis);
+    *port_register(AHCI_PxFBU) = 0;
+    for (uint32_t slot = 0; slot < AHCI_MAX_SLOTS; slot++)
+        command_list[slot].command_table_base = paging_virtual_to_physical(&command_tables[slot]);
+    port_start();
+
+    if (!identify_disk())
+    {
+        port_stop();
+        return NULL;
+    }
+
+    ahci_state.irq = irq;
+    *port_register(AHCI_PxIE) = AHCI_PxIS_DHRS | AHCI_PxIS_SDBS | AHCI_PxIS_TFES;
+    *hba_register(AHCI_HBA_GHC) |= AHCI_GHC_IE;
+    activate_pci_interrupt(irq);
+    ahci_state.available = true;
+    return &ahci_device;
+}
+
+/**
+ * Retire slots the disk has finished. A task file error fails every outstanding command:
+ * the port is restarted, which is the only way to clear CI and SACT.
+ * Caller must run with interrupt disabled.
+ */
+static void ahci_reap(void)
+{
+    uint32_t port_status = *port_register(AHCI_PxIS);
+    *port_register(AHCI_PxIS) = port_status;
+    *hba_register(AHCI_HBA_IS) = 1u << ahci_state.port;
+
+    if (port_status & AHCI_PxIS_TFES)
+    {
+        ahci_state.error_count++;
+        port_stop();
+        port_start();
+        ahci_state.slots_busy = 0;
+        return;
+    }
+
+    // NCQ commands stay in SACT until done, non-queued ones (DMA EXT, FLUSH) stay in CI
+    uint32_t still_running = *port_register(AHCI_PxSACT) | *port_register(AHCI_PxCI);
+    ahci_state.slots_busy &= still_running;
+}
+
+bool ahci_isr(uint32_t int_number)
+{
+    if (!ahci_state.available || int_number != (uint32_t)(PIC1_OFFSET + ahci_state.irq))
+        return false;
+
+    bool ours = *hba_register(AHCI_HBA_IS) & (1u << ahci_state.port);
+    if (ours)
+        ahci_reap();
+    pic_ack(ahci_state.irq);
+    return ours && scheduler_wakeup(&ahci_state);
+}
+
+// Sleep until none of the slots in mask is busy. Caller must run with interrupt disabled
+static void ahci_wait_slots(uint32_t mask)
+{
+    ahci_reap();
+    while (ahci_state.slots_busy & mask)
+    {
+        scheduler_sleep(&ahci_state);
+        ahci_reap();
+    }
+}
+
+static int8_t find_free_slot(void)
+{
+    if (ahci_state.flushing)
+        return -1; // Queued commands cannot be issued next to a non-queued one
+    for (uint8_t slot = 0; slot < ahci_state.slot_count; slot++)
+        if (!(ahci_state.slots_busy & (1u << slot)))
+            return slot;
+    return -1;
+}
+
+void ahci_transfer(void *ptr, uint32_t logical_block_address, uint16_t block_count, bool is_write)
+{
+    uint32_t eflags = interrupt_disable_save();
+
+    int8_t slot;
+    while ((slot = find_free_slot()) < 0)
+    {
+        // Every slot in flight or a flush in progress, sleep until the disk hands a slot back
+        scheduler_sleep(&ahci_state);
+        ahci_reap();
+    }
+
+    uint8_t command;
+    if (ahci_state.ncq)
+        command = is_write ? ATA_COMMAND_WRITE_FPDMA_QUEUED : ATA_COMMAND_READ_FPDMA_QUEUED;
+    else
+        command = is_write ? ATA_COMMAND_WRITE_DMA_EXT : ATA_COMMAND_READ_DMA_EXT;
+
+    command_list[slot].prdt_length = build_prdt(&command_tables[slot], ptr, block_count * AHCI_SECTOR_SIZE);
+    build_command(slot, command, logical_block_address, block_count, is_write);
+
+    uint32_t slot_bit = 1u << slot;
+    ahci_state.slots_busy |= slot_bit;
+    if (ahci_state.ncq)
+        *port_register(AHCI_PxSACT) = slot_bit;
+    *port_register(AHCI_PxCI) = slot_bit;
+
+    if (!ahci_state.batching)
+        ahci_wait_slots(slot_bit);
+    interrupt_restore(eflags);
+}
+
+void ahci_batch_begin(void)
+{
+    ahci_state.batching = true;
+}
+
+void ahci_batch_end(void)
+{
+    uint32_t eflags = interrupt_disable_save();
+    ahci_state.batching = false;
+    ahci_wait_slots(0xFFFFFFFF);
+    interrupt_restore(eflags);
+}
+
+void ahci_flush(void)
+{
+    uint32_t eflags = interrupt_disable_save();
+    ahci_state.flushing = true;
+    ahci_wait_slots(0xFFFFFFFF);
+
+    command_list[0].prdt_length = 0;
+    build_command(0, ATA_COMMAND_FLUSH_CACHE_EXT, 0, 0, false);
+    ahci_state.slots_busy |= 1;
+    *port_register(AHCI_PxCI) = 1;
+    ahci_wait_slots(1);
+
+    // Transfers that found no free slot meanwhile are asleep on the same channel, let them retry
+    ahci_state.flushing = false;
+    scheduler_wakeup(&ahci_state);
+    interrupt_restore(eflags);
+}
@@ -0,0 +1,263 @@
+#include "header/driver/block-cache.h"
+#include "header/stdlib/string.h"
+
+static struct BlockCacheEntry cache_entries[BLOCK_CACHE_ENTRY_COUNT];
+static int16_t hash_heads[BLOCK_CACHE_HASH_SIZE];
+static int16_t lru_head = BLOCK_CACHE_NONE; // most recently used
+static int16_t lru_tail = BLOCK_CACHE_NONE; // least recently used
+static bool cache_initialized = false;
+static struct BlockCacheStats cache_stats;
+
+static uint32_t hash_lba(uint32_t lba)
+{
+    // Fibonacci hashing, spreads consecutive metadata blocks over the buckets
+    return (lba * 2654435761u) >> (32 - BLOCK_CACHE_HASH_BITS);
+}
+
+static void lru_unlink(int16_t idx)
+{
+    struct BlockCacheEntry *entry = &cache_entries[idx];
+    if (entry->lru_prev != BLOCK_CACHE_NONE)
+        cache_entries[entry->lru_prev].lru_next = entry->lru_next;
+    else
+        lru_head = entry->lru_next;
+
+    if (entry->lru_next != BLOCK_CACHE_NONE)
+        cache_entries[entry->lru_next].lru_prev = entry->lru_prev;
+    else
+        lru_tail = entry->lru_prev;
+
+    entry->lru_prev = BLOCK_CACHE_NONE;
+    entry->lru_next = BLOCK_CACHE_NONE;
+}
+
+static void lru_push_front(int16_t idx)
+{
+    struct BlockCacheEntry *entry = &cache_entries[idx];
+    entry->lru_prev = BLOCK_CACHE_NONE;
+    entry->lru_next = lru_head;
+    if (lru_head != BLOCK_CACHE_NONE)
+        cache_entries[lru_head].lru_prev = idx;
+    lru_head = idx;
+    if (lru_tail == BLOCK_CACHE_NONE)
+        lru_tail = idx;
+}
+
+static void hash_remove(int16_t idx)
+{
+    uint32_t bucket = hash_lba(cache_entries[idx].lba);
+    int16_t *link = &hash_heads[bucket];
+    while (*link != BLOCK_CACHE_NONE)
+    {
+        if (*link == idx)
+        {
+            *link = cache_entries[idx].hash_next;
+            break;
+        }
+        link = &cache_entries[*link].hash_next;
+    }
+    cache_entries[idx].hash_next = BLOCK_CACHE_NONE;
+}
+
+static void hash_insert(int16_t idx)
+{
+    uint32_t bucket = hash_lba(cache_entries[idx].lba);
+    cache_entries[idx].hash_next = hash_heads[bucket];
+    hash_heads[bucket] = idx;
+}
+
+static void block_cache_init(void)
+{
+    for (uint32_t i = 0; i < BLOCK_CACHE_HASH_SIZE; i++)
+        hash_heads[i] = BLOCK_CACHE_NONE;
+
+    lru_head = BLOCK_CACHE_NONE;
+    lru_tail = BLOCK_CACHE_NONE;
+    for (int16_t i = 0; i < BLOCK_CACHE_ENTRY_COUNT; i++)
+    {
+        cache_entries[i].device = NULL;
+        cache_entries[i].valid = false;
+        cache_entries[i].dirty = false;
+        cache_entries[i].hash_next = BLOCK_CACHE_NONE;
+        lru_push_front(i);
+    }
+
+    memset(&cache_stats, 0, sizeof(cache_stats));
+    cache_initialized = true;
+}
+
+static int16_t lookup(struct BlockDevice *device, uint32_t lba)
+{
+    if (!cache_initialized)
+        block_cache_init();
+
+    int16_t idx = hash_heads[hash_lba(lba)];
+    while (idx != BLOCK_CACHE_NONE)
+    {
+        if (cache_entries[idx].valid && cache_entries[idx].lba == lba && cache_entries[idx].device == device)
+            return idx;
+        idx = cache_entries[idx].hash_next;
+    }
+    return BLOCK_CACHE_NONE;
+}
+
+static void writeback(struct BlockCacheEntry *entry)
+{
+    if (entry->valid && entry->dirty)
+    {
+        block_device_write(entry->device, entry->data.buf, entry->lba, 1);
+        entry->dirty = false;
+        cache_stats.writebacks++;
+    }
+}
+
+/**
+ * Take the least recently used entry, write it back if needed and rebind it to (device, lba).
+ * Content of the returned entry is undefined, caller must fill it.
+ */
+static int16_t allocate_entry(struct BlockDevice *device, uint32_t lba)
+{
+    int16_t idx = lru_tail;
+    struct BlockCacheEntry *entry = &cache_entries[idx];
+
+    if (entry->valid)
+    {
+        writeback(entry);
+        hash_remove(idx);
+        cache_stats.evictions++;
+    }
+
+    entry->device = device;
+    entry->lba = lba;
+    entry->valid = true;
+    entry->dirty = false;
+    hash_insert(idx);
+    return idx;
+}
+
+static void touch(int16_t idx)
+{
+    if (lru_head != idx)
+    {
+        lru_unlink(idx);
+        lru_push_front(idx);
+    }
+}
+
+void block_cache_read(struct BlockDevice *device, void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    uint8_t *target = (uint8_t *)ptr;
+
+    // Serve what is cached (it may be dirty), batch the rest into one command per run and keep it
+    uint32_t i = 0;
+    while (i < block_count)
+    {
+        int16_t idx = lookup(device, logical_block_address + i);
+        if (idx != BLOCK_CACHE_NONE)
+        {
+            cache_stats.hits++;
+            touch(idx);
+            memcpy(target + i * BLOCK_SIZE, cache_entries[idx].data.buf, BLOCK_SIZE);
+            i++;
+            continue;
+        }
+
+        uint32_t run = 1;
+        while (i + run < block_count && lookup(device, logical_block_address + i + run) == BLOCK_CACHE_NONE)
+            run++;
+
+        cache_stats.misses += run;
+        block_device_read(device, target + i * BLOCK_SIZE, logical_block_address + i, run);
+        for (uint32_t j = 0; j < run; j++)
+            block_cache_fill(device, logical_block_address + i + j, target + (i + j) * BLOCK_SIZE);
+        i += run;
+    }
+}
+
+void block_cache_write(struct BlockDevice *device, const void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    const uint8_t *source = (const uint8_t *)ptr;
+
+    for (uint32_t i = 0; i < block_count; i++)
+    {
+        int16_t idx = lookup(device, logical_block_address + i);
+        if (idx == BLOCK_CACHE_NONE)
+            idx = allocate_entry(device, logical_block_address + i);
+        touch(idx);
+        memcpy(cache_entries[idx].data.buf, source + i * BLOCK_SIZE, BLOCK_SIZE);
+        cache_entries[idx].dirty = true;
+    }
+}
+
+bool block_cache_lookup(struct BlockDevice *device, uint32_t logical_block_address, void *ptr)
+{
+    int16_t idx = lookup(device, logical_block_address);
+    if (idx == BLOCK_CACHE_NONE)
+        return false;
+
+    cache_stats.hits++;
+    memcpy(ptr, cache_entries[idx].data.buf, BLOCK_SIZE);
+    return true;
+}
+
+void block_cache_update(struct BlockDevice *device, uint32_t logical_block_address, const void *ptr)
+{
+    int16_t idx = lookup(device, logical_block_address);
+    if (idx == BLOCK_CACHE_NONE)
+        return;
+
+    memcpy(cache_entries[idx].data.buf, ptr, BLOCK_SIZE);
+    cache_entries[idx].dirty = false;
+}
+
+void block_cache_fill(struct BlockDevice *device, uint32_t logical_block_address, const void *ptr)
+{
+    int16_t idx = lookup(device, logical_block_address);
+    if (idx == BLOCK_CACHE_NONE)
+        idx = allocate_entry(device, logical_block_address);
+    touch(idx);
+    memcpy(cache_entries[idx].data.buf, ptr, BLOCK_SIZE);
+    cache_entries[idx].dirty = false;
+}
+
+void block_cache_flush(struct BlockDevice *device)
+{
+    if (cache_initialized)
+    {
+        for (int16_t i = 0; i < BLOCK_CACHE_ENTRY_COUNT; i++)
+            if (cache_entries[i].device == device)
+                writeback(&cache_entries[i]);
+    }
+    block_device_flush(device);
+}
+
+void block_cache_invalidate(struct BlockDevice *device)
+{
+    block_cache_flush(device);
+    for (int16_t i = 0; i < BLOCK_CACHE_ENTRY_COUNT; i++)
+    {
+        struct BlockCacheEntry *entry = &cache_entries[i];
+        if (!entry->valid || entry->device != device)
+            continue;
+
+        // Dropped entries are reused first
+        hash_remove(i);
+        entry->valid = false;
+        lru_unlink(i);
+        if (lru_tail != BLOCK_CACHE_NONE)
+        {
+            cache_entries[lru_tail].lru_next = i;
+            entry->lru_prev = lru_tail;
+        }
+        else
+        {
+            lru_head = i;
+        }
+        lru_tail = i;
+    }
+}
+
+void block_cache_get_stats(struct BlockCacheStats *stats)
+{
+    memcpy(stats, &cache_stats, sizeof(struct BlockCacheStats));
+}
@@ -0,0 +1,113 @@
+#include "header/driver/block-device.h"
+#include "header/cpu/portio.h"
+#include "header/stdlib/string.h"
+
+static uint32_t tsc_cycles_per_us = 0;
+
+void block_device_set_tsc_rate(uint32_t cycles_per_us)
+{
+    tsc_cycles_per_us = cycles_per_us;
+}
+
+static uint32_t cycles_to_us(uint64_t cycles)
+{
+    if (cycles >> 32)
+        return UINT32_MAX / tsc_cycles_per_us; // 64-bit division is not available, saturate
+    return (uint32_t)cycles / tsc_cycles_per_us;
+}
+
+static uint32_t latency_bucket(uint32_t us)
+{
+    if (us < 2)
+        return 0;
+    uint32_t bucket = 31 - __builtin_clz(us);
+    return bucket < BLOCK_STATS_HISTOGRAM_BUCKETS ? bucket : BLOCK_STATS_HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * Account one command that kept the device busy since start
+ * @param histogram Latency histogram of the command type, NULL to only count busy time
+ */
+static void account(struct BlockDevice *device, uint64_t start, uint32_t *histogram)
+{
+    if (tsc_cycles_per_us == 0)
+        return;
+    uint32_t us = cycles_to_us(read_tsc() - start);
+    device->stats.busy_us += us;
+    if (histogram != NULL)
+        histogram[latency_bucket(us)]++;
+}
+
+void block_device_read(struct BlockDevice *device, void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    uint64_t start = read_tsc();
+    device->ops->read(device, ptr, logical_block_address, block_count);
+    device->stats.reads++;
+    device->stats.sectors_read += block_count;
+    if (device->batching)
+        device->batch_reads++;
+    else
+        account(device, start, device->stats.read_latency);
+}
+
+void block_device_write(struct BlockDevice *device, const void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    uint64_t start = read_tsc();
+    device->ops->write(device, ptr, logical_block_address, block_count);
+    device->stats.writes++;
+    device->stats.sectors_written += block_count;
+    if (device->batching)
+        device->batch_writes++;
+    else
+        account(device, start, device->stats.write_latency);
+}
+
+void block_device_flush(struct BlockDevice *device)
+{
+    if (device->ops->flush == NULL)
+        return;
+
+    uint64_t start = read_tsc();
+    device->ops->flush(device);
+    device->stats.flushes++;
+    account(device, start, NULL);
+}
+
+uint32_t block_device_capacity(struct BlockDevice *device)
+{
+    return device->ops->capacity(device);
+}
+
+void block_device_batch_begin(struct BlockDevice *device)
+{
+    if (device->ops->batch_begin == NULL)
+        return;
+
+    device->batching = true;
+    device->batch_start = read_tsc();
+    device->batch_reads = 0;
+    device->batch_writes = 0;
+    device->ops->batch_begin(device);
+}
+
+void block_device_batch_end(struct BlockDevice *device)
+{
+    if (device->ops->batch_end == NULL)
+        return;
+
+    device->ops->batch_end(device);
+    device->batching = false;
+
+    // Requests of a batch are in flight together, each one is done only when the whole batch is
+    if (tsc_cycles_per_us == 0)
+        return;
+    uint32_t us = cycles_to_us(read_tsc() - device->batch_start);
+    device->stats.busy_us += us;
+    device->stats.read_latency[latency_bucket(us)] += device->batch_reads;
+    device->stats.write_latency[latency_bucket(us)] += device->batch_writes;
+}
+
+void block_device_get_stats(struct BlockDevice *device, struct BlockDeviceStats *stats)
+{
+    memcpy(stats, &device->stats, sizeof(struct BlockDeviceStats));
+}
@@ -0,0 +1,124 @@
+#include "header/driver/block-queue.h"
+#include "header/driver/block-cache.h"
+#include "header/stdlib/string.h"
+
+static struct BlockQueue block_queue = {
+    .device = NULL,
+    .count = 0,
+    .is_write = false,
+};
+
+static void block_queue_push(struct BlockDevice *device, uint8_t *buffer, uint32_t lba, bool is_write)
+{
+    if (block_queue.count > 0 && (block_queue.is_write != is_write || block_queue.device != device))
+        block_queue_dispatch();
+    if (block_queue.count == BLOCK_QUEUE_MAX_REQUESTS)
+        block_queue_dispatch();
+
+    block_queue.device = device;
+    block_queue.is_write = is_write;
+    block_queue.requests[block_queue.count].lba = lba;
+    block_queue.requests[block_queue.count].buffer = buffer;
+    block_queue.count++;
+}
+
+void block_queue_read(struct BlockDevice *device, void *buffer, uint32_t lba)
+{
+    block_queue_push(device, (uint8_t *)buffer, lba, false);
+}
+
+void block_queue_write(struct BlockDevice *device, const void *buffer, uint32_t lba)
+{
+    block_queue_push(device, (uint8_t *)buffer, lba, true);
+}
+
+/**
+ * Stable insertion sort by LBA. Requests mostly arrive in ascending order,
+ * so this is close to linear, and stability keeps the last write to a block last.
+ */
+static void sort_requests(void)
+{
+    for (uint32_t i = 1; i < block_queue.count; i++)
+    {
+        struct BlockRequest key = block_queue.requests[i];
+        int32_t j = (int32_t)i - 1;
+        while (j >= 0 && block_queue.requests[j].lba > key.lba)
+        {
+            block_queue.requests[j + 1] = block_queue.requests[j];
+            j--;
+        }
+        block_queue.requests[j + 1] = key;
+    }
+}
+
+// Number of requests starting at first that can be served by one disk command
+static uint32_t mergeable_run(uint32_t first)
+{
+    uint32_t run = 1;
+    while (first + run < block_queue.count && run < BLOCK_QUEUE_MAX_MERGE)
+    {
+        struct BlockRequest *prev = &block_queue.requests[first + run - 1];
+        struct BlockRequest *next = &block_queue.requests[first + run];
+        if (next->lba != prev->lba + 1 || next->buffer != prev->buffer + BLOCK_SIZE)
+            break;
+        run++;
+    }
+    return run;
+}
+
+void block_queue_dispatch(void)
+{
+    if (block_queue.count == 0)
+        return;
+
+    // Reads already cached (possibly dirty) never reach the disk
+    if (!block_queue.is_write)
+    {
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < block_queue.count; i++)
+        {
+            struct BlockRequest *request = &block_queue.requests[i];
+            if (!block_cache_lookup(block_queue.device, request->lba, request->buffer))
+                block_queue.requests[kept++] = *request;
+        }
+        block_queue.count = kept;
+    }
+
+    sort_requests();
+
+    // Only the last write to a block matters, and a batch gives no ordering between its requests
+    if (block_queue.is_write)
+    {
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < block_queue.count; i++)
+        {
+            bool overwritten = i + 1 < block_queue.count && block_queue.requests[i + 1].lba == block_queue.requests[i].lba;
+            if (!overwritten)
+                block_queue.requests[kept++] = block_queue.requests[i];
+        }
+        block_queue.count = kept;
+    }
+
+    block_device_batch_begin(block_queue.device);
+    uint32_t i = 0;
+    while (i < block_queue.count)
+    {
+        struct BlockRequest *request = &block_queue.requests[i];
+        uint32_t run = mergeable_run(i);
+
+        if (block_queue.is_write)
+        {
+            for (uint32_t j = 0; j < run; j++)
+                block_cache_update(block_queue.device, request[j].lba, request[j].buffer);
+            block_device_write(block_queue.device, request->buffer, request->lba, run);
+        }
+        else
+        {
+            block_device_read(block_queue.device, request->buffer, request->lba, run);
+        }
+        i += run;
+    }
+    block_device_batch_end(block_queue.device);
+
+    block_queue.count = 0;
+}
@@ -1,54 +1,400 @@
 #include "header/driver/disk.h"
+#include "header/driver/pci.h"
+#include "header/driver/virtio-blk.h"
+#include "header/driver/ahci.h"
+#include "header/driver/block-device.h"
 #include "header/cpu/portio.h"
+#include "header/cpu/interrupt.h"
+#include "header/process/process.h"
+#include "header/process/scheduler.h"
+#include "header/stdlib/string.h"
+
+// referensi https://wiki.osdev.org/ATA/ATAPI_using_DMA
+
+static struct DiskDriverState disk_driver_state = {
+    .sector_count = 0,
+    .lba48 = false,
+    .dma_available = false,
+    .bus_master_io = 0,
+    .dma_in_flight = false,
+    .irq_received = false,
+    .last_ata_status = 0,
+    .last_bm_status = 0,
+};
+
+// Bus master can only reach physical memory, user buffers are copied through this kernel buffer
+static uint8_t dma_bounce_buffer[DMA_BOUNCE_SIZE] __attribute__((aligned(DMA_BOUNCE_SIZE)));
+static struct PhysicalRegionDescriptor prd_table[1] __attribute__((aligned(8)));
 
 static void ATA_busy_wait()
 {
-    while (in(0x1F7) & ATA_STATUS_BSY)
+    while (in(ATA_PRIMARY_STATUS) & ATA_STATUS_BSY)
         ;
 }
 
 static void ATA_DRQ_wait()
 {
-    while (!(in(0x1F7) & ATA_STATUS_RDY))
+    while (!(in(ATA_PRIMARY_STATUS) & ATA_STATUS_RDY))
         ;
 }
 
-void read_blocks(void *ptr, uint32_t logical_block_address, uint8_t block_count)
+static uint32_t kernel_virtual_to_physical(void *virtual_addr)
+{
+    // Kernel image is mapped at KERNEL_VIRTUAL_ADDRESS_BASE -> physical 0
+    return (uint32_t)virtual_addr - KERNEL_VIRTUAL_ADDRESS_BASE;
+}
+
+static void ATA_setup_lba28(uint32_t logical_block_address, uint8_t block_count, uint8_t command)
 {
     ATA_busy_wait();
-    out(0x1F6, 0xE0 | ((logical_block_address >> 24) & 0xF));
-    out(0x1F2, block_count);
-    out(0x1F3, (uint8_t)logical_block_address);
-    out(0x1F4, (uint8_t)(logical_block_address >> 8));
-    out(0x1F5, (uint8_t)(logical_block_address >> 16));
-    out(0x1F7, 0x20);
+    out(ATA_PRIMARY_DRIVE_SELECT, ATA_DRIVE_SELECT_LBA | ((logical_block_address >> 24) & 0xF));
+    out(ATA_PRIMARY_SECTOR_COUNT, block_count);
+    out(ATA_PRIMARY_LBA_LOW, (uint8_t)logical_block_address);
+    out(ATA_PRIMARY_LBA_MID, (uint8_t)(logical_block_address >> 8));
+    out(ATA_PRIMARY_LBA_HIGH, (uint8_t)(logical_block_address >> 16));
+    out(ATA_PRIMARY_COMMAND, command);
+}
+
+static void ATA_setup_lba48(uint32_t logical_block_address, uint16_t block_count, uint8_t command)
+{
+    ATA_busy_wait();
+    out(ATA_PRIMARY_DRIVE_SELECT, ATA_DRIVE_SELECT_LBA48);
+    // Each register is a two byte FIFO, high order bytes go first (LBA bits 32-47 are always 0)
+    out(ATA_PRIMARY_SECTOR_COUNT, (uint8_t)(block_count >> 8));
+    out(ATA_PRIMARY_LBA_LOW, (uint8_t)(logical_block_address >> 24));
+    out(ATA_PRIMARY_LBA_MID, 0);
+    out(ATA_PRIMARY_LBA_HIGH, 0);
+    out(ATA_PRIMARY_SECTOR_COUNT, (uint8_t)block_count);
+    out(ATA_PRIMARY_LBA_LOW, (uint8_t)logical_block_address);
+    out(ATA_PRIMARY_LBA_MID, (uint8_t)(logical_block_address >> 8));
+    out(ATA_PRIMARY_LBA_HIGH, (uint8_t)(logical_block_address >> 16));
+    out(ATA_PRIMARY_COMMAND, command);
+}
+
+/**
+ * Issue a transfer command, the EXT variant is used only when LBA28 cannot express the request
+ * @param command     LBA28 command
+ * @param command_ext LBA48 equivalent of command
+ */
+static void ATA_setup(uint32_t logical_block_address, uint16_t block_count, uint8_t command, uint8_t command_ext)
+{
+    bool needs_lba48 = logical_block_address + block_count > ATA_LBA28_LIMIT || block_count > ATA_LBA28_MAX_SECTORS;
+    if (needs_lba48 && disk_driver_state.lba48)
+        ATA_setup_lba48(logical_block_address, block_count, command_ext);
+    else
+        ATA_setup_lba28(logical_block_address, (uint8_t)block_count, command); // 256 wraps to 0 as required
+}
+
+// Largest block_count one command can carry with the current transfer mode
+static uint16_t ATA_max_command_blocks(void)
+{
+    if (disk_driver_state.dma_available)
+        return DMA_BOUNCE_BLOCK_COUNT;
+    return disk_driver_state.lba48 ? UINT16_MAX : ATA_LBA28_MAX_SECTORS;
+}
+
+/**
+ * IDENTIFY DEVICE on the primary master, polled because it runs before IRQ 14 is enabled.
+ * Fill sector_count and lba48, both stay 0 if no ATA drive answers.
+ */
+static void ATA_identify(void)
+{
+    uint16_t identify[ATA_IDENTIFY_WORD_COUNT];
+
+    out(ATA_PRIMARY_DRIVE_SELECT, ATA_DRIVE_SELECT_LBA);
+    out(ATA_PRIMARY_SECTOR_COUNT, 0);
+    out(ATA_PRIMARY_LBA_LOW, 0);
+    out(ATA_PRIMARY_LBA_MID, 0);
+    out(ATA_PRIMARY_LBA_HIGH, 0);
+    out(ATA_PRIMARY_COMMAND, ATA_COMMAND_IDENTIFY);
+
+    uint8_t status = in(ATA_PRIMARY_STATUS);
+    if (status == 0 || status == 0xFF)
+        return; // No drive, or floating bus
+    ATA_busy_wait();
+    if (in(ATA_PRIMARY_LBA_MID) != 0 || in(ATA_PRIMARY_LBA_HIGH) != 0)
+        return; // ATAPI or SATA signature, not an ATA disk
+
+    do
+        status = in(ATA_PRIMARY_STATUS);
+    while (!(status & (ATA_STATUS_DRQ | ATA_STATUS_ERR)));
+    if (status & ATA_STATUS_ERR)
+        return;
+
+    for (uint32_t i = 0; i < ATA_IDENTIFY_WORD_COUNT; i++)
+        identify[i] = in16(ATA_PRIMARY_DATA);
+
+    disk_driver_state.lba48 = identify[ATA_IDENTIFY_COMMAND_SETS] & ATA_IDENTIFY_LBA48_SUPPORTED;
+    if (disk_driver_state.lba48)
+    {
+        const uint16_t *sectors = &identify[ATA_IDENTIFY_LBA48_SECTORS];
+        bool beyond_32bit = sectors[2] != 0 || sectors[3] != 0;
+        disk_driver_state.sector_count = beyond_32bit ? UINT32_MAX : (sectors[0] | ((uint32_t)sectors[1] << 16));
+    }
+    else
+    {
+        const uint16_t *sectors = &identify[ATA_IDENTIFY_LBA28_SECTORS];
+        disk_driver_state.sector_count = sectors[0] | ((uint32_t)sectors[1] << 16);
+    }
+}
+
+/**
+ * Sleep until IRQ 14 reports the drive is done with the current step.
+ * Calling process is BLOCKED meanwhile, so other READY processes can run.
+ * Caller must run with interrupt disabled.
+ */
+static void ATA_wait_irq(void)
+{
+    while (!disk_driver_state.irq_received)
+        scheduler_sleep(&disk_driver_state);
+    disk_driver_state.irq_received = false;
+}
+
+static void ATA_pio_read(void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    uint32_t eflags = interrupt_disable_save();
+    disk_driver_state.irq_received = false;
+    ATA_setup(logical_block_address, block_count, ATA_COMMAND_READ_PIO, ATA_COMMAND_READ_PIO_EXT);
 
     uint16_t *target = (uint16_t *)ptr;
     for (uint32_t i = 0; i < block_count; i++)
     {
-        ATA_busy_wait();
-        ATA_DRQ_wait();
+        // Drive raises IRQ 14 every time one sector is ready in its buffer
+        ATA_wait_irq();
+        if (disk_driver_state.last_ata_status & (ATA_STATUS_ERR | ATA_STATUS_DF))
+            break;
         for (uint32_t j = 0; j < HALF_BLOCK_SIZE; j++)
-            target[j] = in16(0x1F0);
+            target[j] = in16(ATA_PRIMARY_DATA);
         target += HALF_BLOCK_SIZE;
     }
+    interrupt_restore(eflags);
 }
 
-void write_blocks(const void *ptr, uint32_t logical_block_address, uint8_t block_count)
+static void ATA_pio_write(const void *ptr, uint32_t logical_block_address, uint16_t block_count)
 {
-    ATA_busy_wait();
-    out(0x1F6, 0xE0 | ((logical_block_address >> 24) & 0xF));
-    out(0x1F2, block_count);
-    out(0x1F3, (uint8_t)logical_block_address);
-    out(0x1F4, (uint8_t)(logical_block_address >> 8));
-    out(0x1F5, (uint8_t)(logical_block_address >> 16));
-    out(0x1F7, 0x30);
+    uint32_t eflags = interrupt_disable_save();
+    disk_driver_state.irq_received = false;
+    ATA_setup(logical_block_address, block_count, ATA_COMMAND_WRITE_PIO, ATA_COMMAND_WRITE_PIO_EXT);
 
+    // First sector is requested without interrupt
+    ATA_busy_wait();
+    ATA_DRQ_wait();
     for (uint32_t i = 0; i < block_count; i++)
     {
-        ATA_busy_wait();
-        ATA_DRQ_wait();
         for (uint32_t j = 0; j < HALF_BLOCK_SIZE; j++)
-            out16(0x1F0, ((uint16_t *)ptr)[HALF_BLOCK_SIZE * i + j]);
+            out16(ATA_PRIMARY_DATA, ((uint16_t *)ptr)[HALF_BLOCK_SIZE * i + j]);
+        // IRQ 14 after the sector is committed, asking for the next one or finishing the command
+        ATA_wait_irq();
+        if (disk_driver_state.last_ata_status & (ATA_STATUS_ERR | ATA_STATUS_DF))
+            break;
     }
-}
\ No newline at end of file
+    interrupt_restore(eflags);
+}
+
+/**
+ * Wait for the bus master to finish without spinning on the status port.
+ * Caller must run with interrupt disabled.
+ * @return Bus master status, BMIDE_STATUS_ERROR set if either bus master or drive failed
+ */
+static uint8_t DMA_wait_completion(void)
+{
+    uint16_t bm = disk_driver_state.bus_master_io;
+    ATA_wait_irq();
+
+    out(bm + BMIDE_COMMAND, 0);
+    disk_driver_state.dma_in_flight = false;
+    uint8_t status = disk_driver_state.last_bm_status;
+    out(bm + BMIDE_STATUS, BMIDE_STATUS_IRQ | BMIDE_STATUS_ERROR);
+
+    if (disk_driver_state.last_ata_status & (ATA_STATUS_ERR | ATA_STATUS_DF))
+        status |= BMIDE_STATUS_ERROR;
+    return status;
+}
+
+/**
+ * Run one DMA command on the bounce buffer.
+ * @return True if transfer completed without error
+ */
+static bool DMA_transfer(uint32_t logical_block_address, uint16_t block_count, bool is_write)
+{
+    uint16_t bm = disk_driver_state.bus_master_io;
+    uint32_t eflags = interrupt_disable_save();
+
+    prd_table[0].physical_addr = kernel_virtual_to_physical(dma_bounce_buffer);
+    prd_table[0].byte_count = (uint16_t)(block_count * BLOCK_SIZE); // 64 KiB wraps to 0 as required
+    prd_table[0].flags = PRD_END_OF_TABLE;
+
+    out(bm + BMIDE_COMMAND, 0);
+    out32(bm + BMIDE_PRDT_ADDRESS, kernel_virtual_to_physical(prd_table));
+    out(bm + BMIDE_STATUS, BMIDE_STATUS_IRQ | BMIDE_STATUS_ERROR);
+    out(bm + BMIDE_COMMAND, is_write ? 0 : BMIDE_COMMAND_READ);
+
+    disk_driver_state.irq_received = false;
+    disk_driver_state.dma_in_flight = true;
+    if (is_write)
+        ATA_setup(logical_block_address, block_count, ATA_COMMAND_WRITE_DMA, ATA_COMMAND_WRITE_DMA_EXT);
+    else
+        ATA_setup(logical_block_address, block_count, ATA_COMMAND_READ_DMA, ATA_COMMAND_READ_DMA_EXT);
+    out(bm + BMIDE_COMMAND, (is_write ? 0 : BMIDE_COMMAND_READ) | BMIDE_COMMAND_START);
+
+    uint8_t status = DMA_wait_completion();
+
+    interrupt_restore(eflags);
+    return !(status & BMIDE_STATUS_ERROR);
+}
+
+/**
+ * FLUSH CACHE, the drive commits its write cache before raising IRQ 14.
+ * Skipped when no drive answered IDENTIFY, no IRQ would ever come.
+ */
+static void ATA_flush_cache(void)
+{
+    if (disk_driver_state.sector_count == 0)
+        return;
+
+    uint32_t eflags = interrupt_disable_save();
+    disk_driver_state.irq_received = false;
+    ATA_busy_wait();
+    out(ATA_PRIMARY_DRIVE_SELECT, ATA_DRIVE_SELECT_LBA);
+    out(ATA_PRIMARY_COMMAND, disk_driver_state.lba48 ? ATA_COMMAND_FLUSH_CACHE_EXT : ATA_COMMAND_FLUSH_CACHE);
+    ATA_wait_irq();
+    interrupt_restore(eflags);
+}
+
+// Probe the PCI bus for an IDE bus master, DMA stays off if none is usable
+static void DMA_init(void)
+{
+    struct PCIDevice ide;
+    if (!pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_IDE, &ide))
+        return;
+    if (!(pci_config_read8(ide, PCI_PROG_IF) & PCI_PROG_IF_IDE_BUS_MASTER))
+        return;
+
+    uint32_t bar4 = pci_config_read32(ide, PCI_BAR4);
+    if (!(bar4 & 0x1) || (bar4 & PCI_BAR_IO_MASK) == 0)
+        return; // Bus master registers must live in I/O space
+
+    pci_enable_command(ide, PCI_COMMAND_IO_SPACE | PCI_COMMAND_BUS_MASTER);
+    disk_driver_state.bus_master_io = (uint16_t)(bar4 & PCI_BAR_IO_MASK);
+    disk_driver_state.dma_available = true;
+}
+
+static void ata_device_read(struct BlockDevice *device, void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    (void)device;
+    read_blocks(ptr, logical_block_address, block_count);
+}
+
+static void ata_device_write(struct BlockDevice *device, const void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    (void)device;
+    write_blocks(ptr, logical_block_address, block_count);
+}
+
+static void ata_device_flush(struct BlockDevice *device)
+{
+    (void)device;
+    ATA_flush_cache();
+}
+
+// Sectors past 2^32 are not addressable by read_blocks / write_blocks and are not reported
+static uint32_t ata_device_capacity(struct BlockDevice *device)
+{
+    (void)device;
+    return disk_driver_state.sector_count;
+}
+
+// One command at a time, every request completes before returning: no batch operations
+static const struct BlockDeviceOperations ata_device_operations = {
+    .read = ata_device_read,
+    .write = ata_device_write,
+    .flush = ata_device_flush,
+    .capacity = ata_device_capacity,
+    .batch_begin = NULL,
+    .batch_end = NULL,
+};
+
+static struct BlockDevice ata_block_device = {
+    .name = "ata",
+    .ops = &ata_device_operations,
+    .private_data = NULL,
+};
+
+struct BlockDevice *disk_init(void)
+{
+    struct BlockDevice *device = virtio_blk_init();
+    if (device == NULL)
+        device = ahci_init();
+    if (device != NULL)
+        return device;
+
+    out(ATA_PRIMARY_CONTROL, ATA_CONTROL_NIEN);
+    ATA_identify();
+
+    // Clear nIEN so the drive raises IRQ 14 on completion, PIO waits on it too
+    out(ATA_PRIMARY_CONTROL, 0);
+    activate_disk_interrupt();
+
+    DMA_init();
+    return &ata_block_device;
+}
+
+bool disk_isr(void)
+{
+    bool completed = true;
+    if (disk_driver_state.dma_in_flight)
+    {
+        uint8_t status = in(disk_driver_state.bus_master_io + BMIDE_STATUS);
+        disk_driver_state.last_bm_status = status;
+        completed = status & BMIDE_STATUS_IRQ;
+    }
+    // Reading the status register also deasserts the drive interrupt
+    uint8_t ata_status = in(ATA_PRIMARY_STATUS);
+    pic_ack(IRQ_PRIMARY_ATA);
+
+    if (!completed)
+        return false;
+    disk_driver_state.last_ata_status = ata_status;
+    disk_driver_state.irq_received = true;
+    return scheduler_wakeup(&disk_driver_state);
+}
+
+void read_blocks(void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    uint16_t max_chunk = ATA_max_command_blocks();
+    uint8_t *target = (uint8_t *)ptr;
+    while (block_count > 0)
+    {
+        uint16_t chunk = block_count < max_chunk ? block_count : max_chunk;
+        if (disk_driver_state.dma_available && DMA_transfer(logical_block_address, chunk, false))
+            memcpy(target, dma_bounce_buffer, chunk * BLOCK_SIZE);
+        else
+            ATA_pio_read(target, logical_block_address, chunk);
+
+        target += chunk * BLOCK_SIZE;
+        logical_block_address += chunk;
+        block_count -= chunk;
+    }
+}
+
+void write_blocks(const void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    uint16_t max_chunk = ATA_max_command_blocks();
+    const uint8_t *source = (const uint8_t *)ptr;
+    while (block_count > 0)
+    {
+        uint16_t chunk = block_count < max_chunk ? block_count : max_chunk;
+        bool done = false;
+        if (disk_driver_state.dma_available)
+        {
+            memcpy(dma_bounce_buffer, source, chunk * BLOCK_SIZE);
+            done = DMA_transfer(logical_block_address, chunk, true);
+        }
+        if (!done)
+            ATA_pio_write(source, logical_block_address, chunk);
+
+        source += chunk * BLOCK_SIZE;
+        logical_block_address += chunk;
+        block_count -= chunk;
+    }
+}
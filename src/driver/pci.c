@@ -0,0 +1,91 @@
+#include "header/driver/pci.h"
+#include "header/cpu/portio.h"
+
+// referensi https://wiki.osdev.org/PCI
+
+static uint32_t pci_config_address(struct PCIDevice dev, uint8_t offset)
+{
+    return 0x80000000 |
+           ((uint32_t)dev.bus << 16) |
+           ((uint32_t)(dev.slot & 0x1F) << 11) |
+           ((uint32_t)(dev.function & 0x7) << 8) |
+           (offset & 0xFC);
+}
+
+uint32_t pci_config_read32(struct PCIDevice dev, uint8_t offset)
+{
+    out32(PCI_CONFIG_ADDRESS, pci_config_address(dev, offset));
+    return in32(PCI_CONFIG_DATA);
+}
+
+void pci_config_write32(struct PCIDevice dev, uint8_t offset, uint32_t value)
+{
+    out32(PCI_CONFIG_ADDRESS, pci_config_address(dev, offset));
+    out32(PCI_CONFIG_DATA, value);
+}
+
+uint16_t pci_config_read16(struct PCIDevice dev, uint8_t offset)
+{
+    return (uint16_t)(pci_config_read32(dev, offset) >> ((offset & 2) * 8));
+}
+
+uint8_t pci_config_read8(struct PCIDevice dev, uint8_t offset)
+{
+    return (uint8_t)(pci_config_read32(dev, offset) >> ((offset & 3) * 8));
+}
+
+// Visit every present function, stop at the first one accepted by match
+static bool pci_scan(bool (*match)(struct PCIDevice dev, uint32_t a, uint32_t b), uint32_t a, uint32_t b, struct PCIDevice *out)
+{
+    for (uint32_t bus = 0; bus < PCI_BUS_COUNT; bus++)
+    {
+        for (uint8_t slot = 0; slot < PCI_SLOT_COUNT; slot++)
+        {
+            struct PCIDevice dev = {.bus = bus, .slot = slot, .function = 0};
+            if (pci_config_read16(dev, PCI_VENDOR_ID) == PCI_VENDOR_NONE)
+                continue;
+
+            uint8_t function_count = (pci_config_read8(dev, PCI_HEADER_TYPE) & PCI_HEADER_MULTI_FUNCTION) ? PCI_FUNCTION_COUNT : 1;
+            for (uint8_t function = 0; function < function_count; function++)
+            {
+                dev.function = function;
+                if (pci_config_read16(dev, PCI_VENDOR_ID) == PCI_VENDOR_NONE)
+                    continue;
+
+                if (match(dev, a, b))
+                {
+                    *out = dev;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+static bool match_class(struct PCIDevice dev, uint32_t class_code, uint32_t subclass)
+{
+    return pci_config_read8(dev, PCI_CLASS) == class_code && pci_config_read8(dev, PCI_SUBCLASS) == subclass;
+}
+
+static bool match_device(struct PCIDevice dev, uint32_t vendor_id, uint32_t device_id)
+{
+    return pci_config_read16(dev, PCI_VENDOR_ID) == vendor_id && pci_config_read16(dev, PCI_DEVICE_ID) == device_id;
+}
+
+bool pci_find_class(uint8_t class_code, uint8_t subclass, struct PCIDevice *out)
+{
+    return pci_scan(match_class, class_code, subclass, out);
+}
+
+bool pci_find_device(uint16_t vendor_id, uint16_t device_id, struct PCIDevice *out)
+{
+    return pci_scan(match_device, vendor_id, device_id, out);
+}
+
+void pci_enable_command(struct PCIDevice dev, uint16_t bits)
+{
+    uint32_t reg = pci_config_read32(dev, PCI_COMMAND);
+    // Keep the upper half (status) zero, status bits are write-one-to-clear
+    pci_config_write32(dev, PCI_COMMAND, (reg & 0xFFFF) | bits);
+}
@@ -0,0 +1,44 @@
+#include "header/driver/ramdisk.h"
+#include "header/driver/disk.h"
+#include "header/stdlib/string.h"
+
+static void ramdisk_read(struct BlockDevice *device, void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    struct RamDisk *disk = device->private_data;
+    if (logical_block_address + block_count > disk->block_count)
+        return;
+    memcpy(ptr, disk->memory + logical_block_address * BLOCK_SIZE, block_count * BLOCK_SIZE);
+}
+
+static void ramdisk_write(struct BlockDevice *device, const void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    struct RamDisk *disk = device->private_data;
+    if (logical_block_address + block_count > disk->block_count)
+        return;
+    memcpy(disk->memory + logical_block_address * BLOCK_SIZE, ptr, block_count * BLOCK_SIZE);
+}
+
+static uint32_t ramdisk_capacity(struct BlockDevice *device)
+{
+    struct RamDisk *disk = device->private_data;
+    return disk->block_count;
+}
+
+static const struct BlockDeviceOperations ramdisk_operations = {
+    .read = ramdisk_read,
+    .write = ramdisk_write,
+    .flush = NULL,
+    .capacity = ramdisk_capacity,
+    .batch_begin = NULL,
+    .batch_end = NULL,
+};
+
+void ramdisk_create(struct BlockDevice *device, struct RamDisk *disk, void *memory, uint32_t block_count)
+{
+    disk->memory = memory;
+    disk->block_count = block_count;
+    memset(device, 0, sizeof(struct BlockDevice));
+    device->name = "ram";
+    device->ops = &ramdisk_operations;
+    device->private_data = disk;
+}
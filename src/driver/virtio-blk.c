@@ -0,0 +1,313 @@
+#include "header/driver/virtio-blk.h"
+#include "header/driver/pci.h"
+#include "header/driver/block-device.h"
+#include "header/cpu/portio.h"
+#include "header/cpu/interrupt.h"
+#include "header/memory/paging.h"
+#include "header/process/scheduler.h"
+#include "header/stdlib/string.h"
+
+// referensi https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html (legacy interface)
+
+static struct VirtioBlkState virtio_blk_state = {
+    .available = false,
+    .io_base = 0,
+    .irq = 0,
+    .capacity = 0,
+    .queue_size = 0,
+    .free_head = VIRTIO_DESC_NONE,
+    .free_count = 0,
+    .last_used_idx = 0,
+    .in_flight = 0,
+    .batching = false,
+    .error_count = 0,
+};
+
+// Legacy virtqueue: descriptor table, available ring, then used ring on the next page boundary
+static uint8_t virtqueue_memory[VIRTQ_MEMORY_SIZE(VIRTQ_MAX_SIZE)] __attribute__((aligned(VIRTQ_ALIGN)));
+static struct VirtioBlkRequest virtio_blk_requests[VIRTIO_BLK_MAX_REQUESTS];
+static struct VirtioBlkRequest *request_of_head[VIRTQ_MAX_SIZE];
+
+static void virtq_setup(uint16_t queue_size)
+{
+    uint32_t ring_size = 16 * queue_size + 6 + 2 * queue_size;
+    uint32_t used_offset = (ring_size + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1);
+
+    memset(virtqueue_memory, 0, sizeof(virtqueue_memory));
+    virtio_blk_state.queue_size = queue_size;
+    virtio_blk_state.descriptors = (struct VirtqDescriptor *)virtqueue_memory;
+    virtio_blk_state.available_ring = (struct VirtqAvailable *)(virtqueue_memory + 16 * queue_size);
+    virtio_blk_state.used_ring = (struct VirtqUsed *)(virtqueue_memory + used_offset);
+
+    for (uint16_t i = 0; i < queue_size; i++)
+        virtio_blk_state.descriptors[i].next = (i + 1 < queue_size) ? i + 1 : VIRTIO_DESC_NONE;
+    virtio_blk_state.free_head = 0;
+    virtio_blk_state.free_count = queue_size;
+    virtio_blk_state.last_used_idx = 0;
+}
+
+static void virtio_blk_device_read(struct BlockDevice *device, void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    (void)device;
+    virtio_blk_transfer(ptr, logical_block_address, block_count, false);
+}
+
+static void virtio_blk_device_write(struct BlockDevice *device, const void *ptr, uint32_t logical_block_address, uint16_t block_count)
+{
+    (void)device;
+    virtio_blk_transfer((void *)ptr, logical_block_address, block_count, true);
+}
+
+static uint32_t virtio_blk_device_capacity(struct BlockDevice *device)
+{
+    (void)device;
+    return virtio_blk_state.capacity;
+}
+
+static void virtio_blk_device_batch_begin(struct BlockDevice *device)
+{
+    (void)device;
+    virtio_blk_batch_begin();
+}
+
+static void virtio_blk_device_batch_end(struct BlockDevice *device)
+{
+    (void)device;
+    virtio_blk_batch_end();
+}
+
+// VIRTIO_BLK_F_FLUSH is not negotiated, so the device is write-through and needs no flush
+static const struct BlockDeviceOperations virtio_blk_device_operations = {
+    .read = virtio_blk_device_read,
+    .write = virtio_blk_device_write,
+    .flush = NULL,
+    .capacity = virtio_blk_device_capacity,
+    .batch_begin = virtio_blk_device_batch_begin,
+    .batch_end = virtio_blk_device_batch_end,
+};
+
+static struct BlockDevice virtio_blk_device = {
+    .name = "virtio",
+    .ops = &virtio_blk_device_operations,
+    .private_data = NULL,
+};
+
+struct BlockDevice *virtio_blk_init(void)
+{
+    struct PCIDevice dev;
+    if (!pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_DEVICE_BLK, &dev))
+        return NULL;
+
+    uint32_t bar0 = pci_config_read32(dev, PCI_BAR0);
+    uint8_t irq = pci_config_read8(dev, PCI_INTERRUPT_LINE);
+    if (!(bar0 & 0x1) || irq >= 16)
+        return NULL; // Legacy header must be in I/O space and completion needs a PIC line
+
+    pci_enable_command(dev, PCI_COMMAND_IO_SPACE | PCI_COMMAND_BUS_MASTER);
+    uint16_t io = (uint16_t)(bar0 & PCI_BAR_IO_MASK);
+
+    out(io + VIRTIO_REG_DEVICE_STATUS, 0); // Reset
+    out(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    out(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    in32(io + VIRTIO_REG_DEVICE_FEATURES);
+    out32(io + VIRTIO_REG_GUEST_FEATURES, 0); // No optional feature needed, device stays write-through
+
+    out16(io + VIRTIO_REG_QUEUE_SELECT, 0);
+    uint16_t queue_size = in16(io + VIRTIO_REG_QUEUE_SIZE);
+    if (queue_size < VIRTIO_BLK_MAX_SEGMENTS + 2 || queue_size > VIRTQ_MAX_SIZE)
+    {
+        out(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+        return NULL;
+    }
+    virtq_setup(queue_size);
+    out32(io + VIRTIO_REG_QUEUE_ADDRESS, paging_virtual_to_physical(virtqueue_memory) / VIRTQ_ALIGN);
+
+    uint32_t capacity_low = in32(io + VIRTIO_REG_BLK_CAPACITY);
+    uint32_t capacity_high = in32(io + VIRTIO_REG_BLK_CAPACITY + 4);
+    virtio_blk_state.capacity = capacity_high ? UINT32_MAX : capacity_low;
+    virtio_blk_state.io_base = io;
+    virtio_blk_state.irq = irq;
+
+    activate_pci_interrupt(irq);
+    out(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    virtio_blk_state.available = true;
+    return &virtio_blk_device;
+}
+
+bool virtio_blk_isr(uint32_t int_number)
+{
+    if (!virtio_blk_state.available || int_number != (uint32_t)(PIC1_OFFSET + virtio_blk_state.irq))
+        return false;
+
+    uint8_t isr_status = in(virtio_blk_state.io_base + VIRTIO_REG_ISR_STATUS);
+    pic_ack(virtio_blk_state.irq);
+    if (!(isr_status & VIRTIO_ISR_QUEUE))
+        return false; // Another device on a shared line
+    return scheduler_wakeup(&virtio_blk_state);
+}
+
+static void virtq_notify(void)
+{
+    out16(virtio_blk_state.io_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+}
+
+// Give back every chain the device has finished with
+static void virtq_reap(void)
+{
+    struct VirtioBlkState *state = &virtio_blk_state;
+    while (state->last_used_idx != state->used_ring->idx)
+    {
+        uint16_t head = state->used_ring->ring[state->last_used_idx % state->queue_size].id;
+        struct VirtioBlkRequest *request = request_of_head[head];
+        if (request->status != VIRTIO_BLK_S_OK)
+            state->error_count++;
+        request->in_use = false;
+
+        uint16_t tail = head;
+        uint16_t length = 1;
+        while (state->descriptors[tail].flags & VIRTQ_DESC_F_NEXT)
+        {
+            tail = state->descriptors[tail].next;
+            length++;
+        }
+        state->descriptors[tail].next = state->free_head;
+        state->free_head = head;
+        state->free_count += length;
+
+        state->in_flight--;
+        state->last_used_idx++;
+    }
+}
+
+/**
+ * Sleep until the device completes at least one more request.
+ * Caller must run with interrupt disabled.
+ */
+static void virtq_wait_completion(void)
+{
+    uint32_t before = virtio_blk_state.in_flight;
+    virtq_reap();
+    while (before > 0 && virtio_blk_state.in_flight == before)
+    {
+        scheduler_sleep(&virtio_blk_state);
+        virtq_reap();
+    }
+}
+
+static struct VirtioBlkRequest *find_free_request(void)
+{
+    for (uint32_t i = 0; i < VIRTIO_BLK_MAX_REQUESTS; i++)
+        if (!virtio_blk_requests[i].in_use)
+            return &virtio_blk_requests[i];
+    return NULL;
+}
+
+static uint16_t allocate_descriptor(uint64_t addr, uint32_t len, uint16_t flags)
+{
+    uint16_t idx = virtio_blk_state.free_head;
+    volatile struct VirtqDescriptor *desc = &virtio_blk_state.descriptors[idx];
+    virtio_blk_state.free_head = desc->next;
+    virtio_blk_state.free_count--;
+    desc->addr = addr;
+    desc->len = len;
+    desc->flags = flags;
+    return idx;
+}
+
+/**
+ * Split a virtual buffer into physically contiguous pieces.
+ * User memory is made of 4 MiB frames that need not be adjacent physically.
+ * @return Number of pieces, at most VIRTIO_BLK_MAX_SEGMENTS (a 16-bit block count spans at most 9 frames)
+ */
+static uint16_t collect_segments(uint8_t *ptr, uint32_t size, uint32_t *segment_addr, uint32_t *segment_len)
+{
+    uint16_t count = 0;
+    while (size > 0 && count < VIRTIO_BLK_MAX_SEGMENTS)
+    {
+        uint32_t physical = paging_virtual_to_physical(ptr);
+        uint32_t in_frame = PAGE_FRAME_SIZE - ((uint32_t)ptr & (PAGE_FRAME_SIZE - 1));
+        uint32_t len = size < in_frame ? size : in_frame;
+
+        if (count > 0 && segment_addr[count - 1] + segment_len[count - 1] == physical)
+        {
+            segment_len[count - 1] += len;
+        }
+        else
+        {
+            segment_addr[count] = physical;
+            segment_len[count] = len;
+            count++;
+        }
+        ptr += len;
+        size -= len;
+    }
+    return count;
+}
+
+void virtio_blk_transfer(void *ptr, uint32_t logical_block_address, uint16_t block_count, bool is_write)
+{
+    uint32_t segment_addr[VIRTIO_BLK_MAX_SEGMENTS];
+    uint32_t segment_len[VIRTIO_BLK_MAX_SEGMENTS];
+    uint32_t eflags = interrupt_disable_save();
+
+    uint16_t segment_count = collect_segments(ptr, block_count * VIRTIO_BLK_SECTOR_SIZE, segment_addr, segment_len);
+    uint16_t needed = segment_count + 2;
+
+    // Queue full: let the device make progress (posted requests of a batch included)
+    struct VirtioBlkRequest *request;
+    while ((request = find_free_request()) == NULL || virtio_blk_state.free_count < needed)
+    {
+        virtq_notify();
+        virtq_wait_completion();
+    }
+
+    request->header.type = is_write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    request->header.reserved = 0;
+    request->header.sector = logical_block_address;
+    request->status = 0xFF;
+    request->in_use = true;
+
+    uint16_t head = allocate_descriptor(paging_virtual_to_physical(&request->header), sizeof(request->header), VIRTQ_DESC_F_NEXT);
+    uint16_t prev = head;
+    for (uint16_t i = 0; i < segment_count; i++)
+    {
+        uint16_t desc = allocate_descriptor(segment_addr[i], segment_len[i], VIRTQ_DESC_F_NEXT | (is_write ? 0 : VIRTQ_DESC_F_WRITE));
+        virtio_blk_state.descriptors[prev].next = desc;
+        prev = desc;
+    }
+    uint16_t status_desc = allocate_descriptor(paging_virtual_to_physical((void *)&request->status), 1, VIRTQ_DESC_F_WRITE);
+    virtio_blk_state.descriptors[prev].next = status_desc;
+    request_of_head[head] = request;
+
+    volatile struct VirtqAvailable *avail = virtio_blk_state.available_ring;
+    avail->ring[avail->idx % virtio_blk_state.queue_size] = head;
+    __asm__ volatile("" : : : "memory"); // Ring entry must be visible before the index moves
+    avail->idx++;
+    virtio_blk_state.in_flight++;
+
+    if (!virtio_blk_state.batching)
+    {
+        virtq_notify();
+        while (virtio_blk_state.in_flight > 0)
+            virtq_wait_completion();
+    }
+    interrupt_restore(eflags);
+}
+
+void virtio_blk_batch_begin(void)
+{
+    virtio_blk_state.batching = true;
+}
+
+void virtio_blk_batch_end(void)
+{
+    uint32_t eflags = interrupt_disable_save();
+    virtio_blk_state.batching = false;
+    if (virtio_blk_state.in_flight > 0)
+    {
+        virtq_notify();
+        while (virtio_blk_state.in_flight > 0)
+            virtq_wait_completion();
+    }
+    interrupt_restore(eflags);
+}
@@ -2,37 +2,64 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/mman.h>
 
 #include "header/filesystem/ext2.h"
 #include "header/driver/disk.h"
+#include "header/driver/block-device.h"
+#include "header/driver/block-cache.h"
 #include "header/stdlib/string.h"
 
 uint8_t *image_storage;
 uint8_t *file_buffer;
 uint8_t *read_buffer;
+size_t image_size;
 
-void read_blocks(void *ptr, uint32_t logical_block_address, uint8_t block_count)
+// Image file mapped MAP_SHARED: writes land in the page cache of the file, flush makes them durable
+static void image_read(struct BlockDevice *device, void *ptr, uint32_t logical_block_address, uint16_t block_count)
 {
-    for (int i = 0; i < block_count; i++)
-    {
-        memcpy(
-            (uint8_t *)ptr + BLOCK_SIZE * i,
-            image_storage + BLOCK_SIZE * (logical_block_address + i),
-            BLOCK_SIZE);
-    }
+    (void)device;
+    if ((size_t)(logical_block_address + block_count) * BLOCK_SIZE > image_size)
+        return;
+    memcpy(ptr, image_storage + (size_t)logical_block_address * BLOCK_SIZE, block_count * BLOCK_SIZE);
 }
 
-void write_blocks(const void *ptr, uint32_t logical_block_address, uint8_t block_count)
+static void image_write(struct BlockDevice *device, const void *ptr, uint32_t logical_block_address, uint16_t block_count)
 {
-    for (int i = 0; i < block_count; i++)
-    {
-        memcpy(
-            image_storage + BLOCK_SIZE * (logical_block_address + i),
-            (uint8_t *)ptr + BLOCK_SIZE * i,
-            BLOCK_SIZE);
-    }
+    (void)device;
+    if ((size_t)(logical_block_address + block_count) * BLOCK_SIZE > image_size)
+        return;
+    memcpy(image_storage + (size_t)logical_block_address * BLOCK_SIZE, ptr, block_count * BLOCK_SIZE);
+}
+
+static void image_flush(struct BlockDevice *device)
+{
+    (void)device;
+    msync(image_storage, image_size, MS_SYNC);
 }
 
+// Filesystem geometry follows the image size, like the kernel follows ATA IDENTIFY
+static uint32_t image_capacity(struct BlockDevice *device)
+{
+    (void)device;
+    return image_size / BLOCK_SIZE;
+}
+
+static const struct BlockDeviceOperations image_operations = {
+    .read = image_read,
+    .write = image_write,
+    .flush = image_flush,
+    .capacity = image_capacity,
+    .batch_begin = NULL,
+    .batch_end = NULL,
+};
+
+static struct BlockDevice image_device = {
+    .name = "image",
+    .ops = &image_operations,
+    .private_data = NULL,
+};
+
 int main(int argc, char *argv[])
 {
     if (argc < 4)
@@ -41,24 +68,26 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
-    image_storage = malloc(4 * 1024 * 1024);
-    file_buffer = malloc(4 * 1024 * 1024);
-    read_buffer = malloc(4 * 1024 * 1024);
-
-    if (image_storage == NULL || file_buffer == NULL || read_buffer == NULL)
+    FILE *fptr = fopen(argv[3], "r+");
+    if (fptr == NULL)
     {
-        fprintf(stderr, "Error: Failed to allocate memory.\n");
+        fprintf(stderr, "Error: Could not open storage file %s\n", argv[3]);
         exit(1);
     }
+    fseek(fptr, 0, SEEK_END);
+    image_size = ftell(fptr);
+    fseek(fptr, 0, SEEK_SET);
 
-    FILE *fptr = fopen(argv[3], "r");
-    if (fptr == NULL)
+    // Only blocks the filesystem touches are paged in and written back
+    image_storage = mmap(NULL, image_size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(fptr), 0);
+    file_buffer = malloc(4 * 1024 * 1024);
+    read_buffer = malloc(4 * 1024 * 1024);
+
+    if (image_storage == MAP_FAILED || file_buffer == NULL || read_buffer == NULL)
     {
-        fprintf(stderr, "Error: Could not open storage file %s\n", argv[3]);
+        fprintf(stderr, "Error: Failed to allocate memory.\n");
         exit(1);
     }
-    fread(image_storage, 4 * 1024 * 1024, 1, fptr);
-    fclose(fptr);
 
     FILE *fptr_target = fopen(argv[1], "r");
     size_t filesize = 0;
@@ -80,7 +109,7 @@ int main(int argc, char *argv[])
     printf("Filename : %s\n", argv[1]);
     printf("Filesize : %ld bytes\n", filesize);
 
-    initialize_filesystem_ext2();
+    initialize_filesystem_ext2(&image_device);
 
     char *name = argv[1];
     uint8_t filename_length = (uint8_t)strlen(name);
@@ -135,16 +164,10 @@ int main(int argc, char *argv[])
     else
         puts("Error: Unknown error");
 
-    fptr = fopen(argv[3], "w");
-    if (fptr == NULL)
-    {
-        fprintf(stderr, "Error: Could not open storage file %s for writing.\n", argv[3]);
-        exit(1);
-    }
-    fwrite(image_storage, 4 * 1024 * 1024, 1, fptr);
+    sync_filesystem();
+    munmap(image_storage, image_size);
     fclose(fptr);
 
-    free(image_storage);
     free(file_buffer);
     free(read_buffer);
 
@@ -0,0 +1,214 @@
+#include "header/filesystem/dentry-cache.h"
+#include "header/stdlib/string.h"
+
+static struct DentryCacheEntry cache_entries[DENTRY_CACHE_ENTRY_COUNT];
+static int16_t hash_heads[DENTRY_CACHE_HASH_SIZE];
+static int16_t lru_head = DENTRY_CACHE_NONE; // most recently used
+static int16_t lru_tail = DENTRY_CACHE_NONE; // least recently used
+static bool cache_initialized = false;
+static struct DentryCacheStats cache_stats;
+
+// FNV-1a over the name, seeded with the directory inode
+static uint32_t hash_dentry(uint32_t parent_inode, const char *name, uint8_t name_len)
+{
+    uint32_t hash = 2166136261u ^ parent_inode;
+    for (uint8_t i = 0; i < name_len; i++)
+    {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash & (DENTRY_CACHE_HASH_SIZE - 1);
+}
+
+static void lru_unlink(int16_t idx)
+{
+    struct DentryCacheEntry *entry = &cache_entries[idx];
+    if (entry->lru_prev != DENTRY_CACHE_NONE)
+        cache_entries[entry->lru_prev].lru_next = entry->lru_next;
+    else
+        lru_head = entry->lru_next;
+
+    if (entry->lru_next != DENTRY_CACHE_NONE)
+        cache_entries[entry->lru_next].lru_prev = entry->lru_prev;
+    else
+        lru_tail = entry->lru_prev;
+
+    entry->lru_prev = DENTRY_CACHE_NONE;
+    entry->lru_next = DENTRY_CACHE_NONE;
+}
+
+static void lru_push_front(int16_t idx)
+{
+    struct DentryCacheEntry *entry = &cache_entries[idx];
+    entry->lru_prev = DENTRY_CACHE_NONE;
+    entry->lru_next = lru_head;
+    if (lru_head != DENTRY_CACHE_NONE)
+        cache_entries[lru_head].lru_prev = idx;
+    lru_head = idx;
+    if (lru_tail == DENTRY_CACHE_NONE)
+        lru_tail = idx;
+}
+
+static void lru_push_back(int16_t idx)
+{
+    struct DentryCacheEntry *entry = &cache_entries[idx];
+    entry->lru_next = DENTRY_CACHE_NONE;
+    entry->lru_prev = lru_tail;
+    if (lru_tail != DENTRY_CACHE_NONE)
+        cache_entries[lru_tail].lru_next = idx;
+    lru_tail = idx;
+    if (lru_head == DENTRY_CACHE_NONE)
+        lru_head = idx;
+}
+
+static void hash_remove(int16_t idx)
+{
+    struct DentryCacheEntry *entry = &cache_entries[idx];
+    int16_t *link = &hash_heads[hash_dentry(entry->parent_inode, entry->name, entry->name_len)];
+    while (*link != DENTRY_CACHE_NONE)
+    {
+        if (*link == idx)
+        {
+            *link = entry->hash_next;
+            break;
+        }
+        link = &cache_entries[*link].hash_next;
+    }
+    entry->hash_next = DENTRY_CACHE_NONE;
+}
+
+static void hash_insert(int16_t idx)
+{
+    struct DentryCacheEntry *entry = &cache_entries[idx];
+    uint32_t bucket = hash_dentry(entry->parent_inode, entry->name, entry->name_len);
+    entry->hash_next = hash_heads[bucket];
+    hash_heads[bucket] = idx;
+}
+
+static void dentry_cache_init(void)
+{
+    for (uint32_t i = 0; i < DENTRY_CACHE_HASH_SIZE; i++)
+        hash_heads[i] = DENTRY_CACHE_NONE;
+
+    lru_head = DENTRY_CACHE_NONE;
+    lru_tail = DENTRY_CACHE_NONE;
+    for (int16_t i = 0; i < DENTRY_CACHE_ENTRY_COUNT; i++)
+    {
+        cache_entries[i].valid = false;
+        cache_entries[i].hash_next = DENTRY_CACHE_NONE;
+        lru_push_front(i);
+    }
+    cache_initialized = true;
+}
+
+static int16_t lookup(uint32_t parent_inode, const char *name, uint8_t name_len)
+{
+    int16_t idx = hash_heads[hash_dentry(parent_inode, name, name_len)];
+    while (idx != DENTRY_CACHE_NONE)
+    {
+        struct DentryCacheEntry *entry = &cache_entries[idx];
+        if (entry->valid && entry->parent_inode == parent_inode && entry->name_len == name_len &&
+            memcmp(entry->name, name, name_len) == 0)
+            return idx;
+        idx = entry->hash_next;
+    }
+    return DENTRY_CACHE_NONE;
+}
+
+// Unhash an entry and move it to the LRU tail so it is reused first
+static void drop_entry(int16_t idx)
+{
+    hash_remove(idx);
+    cache_entries[idx].valid = false;
+    lru_unlink(idx);
+    lru_push_back(idx);
+}
+
+bool dentry_cache_lookup(uint32_t parent_inode, const char *name, uint8_t name_len, uint32_t *child_inode)
+{
+    if (!cache_initialized)
+        dentry_cache_init();
+
+    int16_t idx = name_len <= DENTRY_NAME_MAX ? lookup(parent_inode, name, name_len) : DENTRY_CACHE_NONE;
+    if (idx == DENTRY_CACHE_NONE)
+    {
+        cache_stats.misses++;
+        return false;
+    }
+
+    if (lru_head != idx)
+    {
+        lru_unlink(idx);
+        lru_push_front(idx);
+    }
+    *child_inode = cache_entries[idx].child_inode;
+    if (*child_inode == 0)
+        cache_stats.negative_hits++;
+    else
+        cache_stats.hits++;
+    return true;
+}
+
+void dentry_cache_insert(uint32_t parent_inode, const char *name, uint8_t name_len, uint32_t child_inode)
+{
+    if (name_len > DENTRY_NAME_MAX)
+        return;
+    if (!cache_initialized)
+        dentry_cache_init();
+
+    int16_t idx = lookup(parent_inode, name, name_len);
+    if (idx == DENTRY_CACHE_NONE)
+    {
+        idx = lru_tail;
+        if (cache_entries[idx].valid)
+            hash_remove(idx);
+
+        struct DentryCacheEntry *entry = &cache_entries[idx];
+        entry->parent_inode = parent_inode;
+        entry->name_len = name_len;
+        memcpy(entry->name, name, name_len);
+        entry->valid = true;
+        hash_insert(idx);
+    }
+
+    cache_entries[idx].child_inode = child_inode;
+    if (lru_head != idx)
+    {
+        lru_unlink(idx);
+        lru_push_front(idx);
+    }
+}
+
+void dentry_cache_invalidate(uint32_t parent_inode, const char *name, uint8_t name_len)
+{
+    if (!cache_initialized || name_len > DENTRY_NAME_MAX)
+        return;
+
+    int16_t idx = lookup(parent_inode, name, name_len);
+    if (idx != DENTRY_CACHE_NONE)
+        drop_entry(idx);
+}
+
+void dentry_cache_invalidate_directory(uint32_t parent_inode)
+{
+    if (!cache_initialized)
+        return;
+
+    for (int16_t i = 0; i < DENTRY_CACHE_ENTRY_COUNT; i++)
+    {
+        if (cache_entries[i].valid && cache_entries[i].parent_inode == parent_inode)
+            drop_entry(i);
+    }
+}
+
+void dentry_cache_invalidate_all(void)
+{
+    struct DentryCacheStats saved = cache_stats;
+    dentry_cache_init();
+    cache_stats = saved;
+}
+
+void dentry_cache_get_stats(struct DentryCacheStats *stats)
+{
+    memcpy(stats, &cache_stats, sizeof(struct DentryCacheStats));
+}
@@ -2,11 +2,66 @@
 #include <stdbool.h>
 #include "header/stdlib/string.h"
 #include "header/driver/disk.h"
+#include "header/driver/block-cache.h"
+#include "header/driver/block-queue.h"
+#include "header/filesystem/inode-cache.h"
+#include "header/filesystem/dentry-cache.h"
 #include "header/filesystem/ext2.h"
 
-static uint8_t buffer[BLOCK_SIZE];
+static struct BlockDevice *g_device; // device the mounted filesystem lives on
+static uint8_t buffer[EXT2_MAX_BLOCK_SIZE];
+static uint8_t zero_blocks[EXT2_ZERO_WRITE_BYTES]; // never written, source of multi block zeroing
 static struct EXT2Superblock g_superblock;
-static struct EXT2BlockGroupDescriptor g_bgd_table[GROUPS_COUNT];
+static struct EXT2BlockGroupDescriptor g_bgd_table[EXT2_MAX_GROUPS];
+static struct EXT2BlockGroupDescriptor g_bgd_table_on_disk[EXT2_MAX_GROUPS]; // last bgd table written, to skip unchanged blocks
+static struct EXT2BitmapCacheEntry g_bitmap_cache[EXT2_BITMAP_CACHE_COUNT];
+static uint32_t g_bitmap_pool[EXT2_BITMAP_CACHE_BYTES / sizeof(uint32_t)]; // words of every bitmap cache entry
+static uint32_t g_bitmap_cache_count;                                      // entries in use, EXT2_BITMAP_CACHE_BYTES / block size
+static uint32_t g_bitmap_clock;
+static bool g_metadata_dirty; // superblock, bgd table, bitmaps, inodes or metadata blocks changed since the last sync_filesystem()
+static uint8_t g_journal_area[EXT2_JOURNAL_BUFFER_BYTES]; // running transaction: descriptor block, logged blocks, commit block
+static uint32_t g_journal_capacity;                         // blocks one transaction can log, 0 without a journal
+static uint32_t g_journal_chunk_blocks;                     // file blocks one operation maps or frees, bigger ranges go in pieces
+static uint32_t g_journal_sequence;                         // number of the last committed transaction
+static uint8_t g_delayed_pool[EXT2_DELAYED_POOL_BYTES];    // data of the delayed files, a block aligned slice each in the order they were created
+static struct EXT2DelayedFile g_delayed_files[EXT2_DELAYED_FILE_COUNT];
+static uint32_t g_delayed_used;     // pool bytes taken, the last file of the pool can grow in place
+static uint32_t g_delayed_reserved; // blocks the delayed files need once allocated, kept out of s_free_blocks_count
+static bool g_blocks_freed;         // blocks were freed since the last sync, files on disk may still map them
+static uint32_t g_groups_count;
+static uint32_t g_bgd_table_blocks;
+static uint32_t g_bgd_table_start; // first block of the bgd table, right after the superblock sector
+static uint32_t g_block_size;
+static uint32_t g_sectors_per_block;
+static uint32_t g_pointers_per_block;
+static uint32_t g_zero_blocks_count; // blocks held by zero_blocks
+static uint32_t g_inode_size;                                 // inode table stride, from s_inode_size
+static struct EXT2Extent g_extent_list[EXT2_EXTENT_MAX_COUNT]; // every extent of one file, filled by load_extents()
+static uint8_t g_scratch_pool[EXT2_SCRATCH_BLOCK_COUNT][EXT2_MAX_BLOCK_SIZE] __attribute__((aligned(4)));
+static uint32_t g_scratch_used; // pool buffers taken, given back in the reverse order
+
+/**
+ * @brief take the next buffer of the scratch pool, use it through EXT2_SCRATCH_BLOCK().
+ * Block buffers do not fit the 8 KiB kernel stack of a process, every filesystem path runs under filesystem_lock
+ * so one pool serves them all
+ */
+static void *scratch_block_get(void)
+{
+    // a path deeper than EXT2_SCRATCH_BLOCK_COUNT counts is a bug, trap (invalid opcode) rather than corrupt memory
+    if (g_scratch_used >= EXT2_SCRATCH_BLOCK_COUNT)
+        __builtin_trap();
+    return g_scratch_pool[g_scratch_used++];
+}
+
+// give back the buffer of a scratch variable leaving its scope, called through the cleanup attribute
+static void scratch_block_put(void *variable)
+{
+    (void)variable;
+    g_scratch_used--;
+}
+
+// declare name as a pointer to a block buffer of the scratch pool, given back when name goes out of scope
+#define EXT2_SCRATCH_BLOCK(type, name) type *name __attribute__((cleanup(scratch_block_put))) = (type *)scratch_block_get()
 
 const uint8_t fs_signature[BLOCK_SIZE] = {
     'C',
@@ -93,6 +148,328 @@ const uint8_t fs_signature[BLOCK_SIZE] = {
     [BLOCK_SIZE - 1] = 'k',
 };
 
+/* -- Metadata journal, metadata blocks stay in the running transaction until journal_commit() -- */
+
+static struct EXT2JournalDescriptor *journal_descriptor(void)
+{
+    return (struct EXT2JournalDescriptor *)g_journal_area;
+}
+
+// Content of logged block i, the descriptor takes the first block of the area
+static uint8_t *journal_slot(uint32_t i)
+{
+    return g_journal_area + (i + 1) * g_block_size;
+}
+
+static int32_t journal_find(uint32_t block)
+{
+    struct EXT2JournalDescriptor *descriptor = journal_descriptor();
+    for (uint32_t i = 0; i < descriptor->j_count; i++)
+    {
+        if (descriptor->j_home[i] == block)
+            return i;
+    }
+    return -1;
+}
+
+// FNV-1a over the descriptor block and the count logged blocks
+static uint32_t journal_checksum(uint32_t count)
+{
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < (count + 1) * g_block_size; i++)
+    {
+        hash ^= g_journal_area[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Write the count logged blocks home, sorted and merged by the block queue, then keep them cached for the next lookups
+static void journal_checkpoint(uint32_t count)
+{
+    struct EXT2JournalDescriptor *descriptor = journal_descriptor();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t home = descriptor->j_home[i];
+        for (uint32_t s = 0; s < g_sectors_per_block; s++)
+            block_queue_write(g_device, journal_slot(i) + s * BLOCK_SIZE, home * g_sectors_per_block + s);
+    }
+    block_queue_dispatch();
+    block_device_flush(g_device);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t home = descriptor->j_home[i];
+        for (uint32_t s = 0; s < g_sectors_per_block; s++)
+            block_cache_fill(g_device, home * g_sectors_per_block + s, journal_slot(i) + s * BLOCK_SIZE);
+    }
+
+    // an empty descriptor marks the transaction done, if this write is lost the replay rewrites identical blocks
+    descriptor->j_count = 0;
+    block_device_write(g_device, g_journal_area, g_superblock.s_journal_block * g_sectors_per_block, g_sectors_per_block);
+}
+
+/**
+ * @brief commit the running transaction: descriptor, logged blocks and commit block go to the journal area
+ * in one sequential write, after the barrier the blocks are checkpointed to their home location
+ */
+static void journal_commit(void)
+{
+    struct EXT2JournalDescriptor *descriptor = journal_descriptor();
+    uint32_t count = descriptor->j_count;
+    if (count == 0)
+        return;
+
+    descriptor->j_header.h_magic = EXT2_JOURNAL_MAGIC;
+    descriptor->j_header.h_blocktype = EXT2_JOURNAL_DESCRIPTOR_BLOCK;
+    descriptor->j_header.h_sequence = ++g_journal_sequence;
+
+    struct EXT2JournalCommit *commit = (struct EXT2JournalCommit *)journal_slot(count);
+    memset(commit, 0, g_block_size);
+    commit->c_header.h_magic = EXT2_JOURNAL_MAGIC;
+    commit->c_header.h_blocktype = EXT2_JOURNAL_COMMIT_BLOCK;
+    commit->c_header.h_sequence = g_journal_sequence;
+    commit->c_checksum = journal_checksum(count);
+
+    block_device_write(g_device, g_journal_area, g_superblock.s_journal_block * g_sectors_per_block,
+                       (count + 2) * g_sectors_per_block);
+    block_device_flush(g_device);
+    journal_checkpoint(count);
+}
+
+static void journal_write_block(const void *ptr, uint32_t block)
+{
+    struct EXT2JournalDescriptor *descriptor = journal_descriptor();
+    int32_t slot = journal_find(block);
+    if (slot < 0)
+    {
+        // every operation reserved its worst case in journal_begin_operation(), a full transaction is a bug:
+        // committing here would make half an operation durable, trap (invalid opcode) instead
+        if (descriptor->j_count == g_journal_capacity)
+            __builtin_trap();
+        slot = descriptor->j_count++;
+        descriptor->j_home[slot] = block;
+    }
+    memcpy(journal_slot(slot), ptr, g_block_size);
+}
+
+// A block rewritten as file data must not be overwritten by its old logged metadata at checkpoint
+static void journal_forget(uint32_t block)
+{
+    int32_t slot = journal_find(block);
+    if (slot < 0)
+        return;
+
+    struct EXT2JournalDescriptor *descriptor = journal_descriptor();
+    uint32_t last = --descriptor->j_count;
+    if ((uint32_t)slot != last)
+    {
+        descriptor->j_home[slot] = descriptor->j_home[last];
+        memcpy(journal_slot(slot), journal_slot(last), g_block_size);
+    }
+}
+
+// blocks the running transaction logs at its commit: the logged ones, then what memory still holds
+static uint32_t journal_pending_blocks(void)
+{
+    uint32_t pending = journal_descriptor()->j_count + inode_cache_dirty_count() + 1; // 1: superblock
+    for (uint32_t i = 0; i < g_bitmap_cache_count; i++)
+    {
+        if (g_bitmap_cache[i].dirty)
+            pending++;
+    }
+    uint32_t bgds_per_block = BGDS_PER_BLOCK(g_block_size);
+    for (uint32_t b = 0; b < g_bgd_table_blocks; b++)
+    {
+        uint32_t first = b * bgds_per_block;
+        uint32_t count = g_groups_count - first < bgds_per_block ? g_groups_count - first : bgds_per_block;
+        if (memcmp(&g_bgd_table[first], &g_bgd_table_on_disk[first], count * sizeof(struct EXT2BlockGroupDescriptor)) != 0)
+            pending++;
+    }
+    // the inode of a delayed file is stored again with size 0 if a commit comes before its blocks
+    for (uint32_t i = 0; i < EXT2_DELAYED_FILE_COUNT; i++)
+    {
+        if (g_delayed_files[i].inode != 0)
+            pending++;
+    }
+    return pending;
+}
+
+static bool journal_has_room(uint32_t blocks)
+{
+    return g_journal_capacity == 0 || journal_pending_blocks() + blocks <= g_journal_capacity;
+}
+
+/**
+ * @brief worst case of blocks logged for mapping or freeing blocks consecutive file blocks of one inode:
+ * the pointer blocks on every level (extent leaves are fewer), a bitmap and a group descriptor block
+ * for every group a run may come from, the inode and the superblock
+ */
+static uint32_t journal_data_blocks(uint32_t blocks)
+{
+    uint32_t tables = blocks / g_pointers_per_block * 2 + 5;
+    uint32_t groups = blocks + tables < g_groups_count ? blocks + tables : g_groups_count;
+    uint32_t bgd_blocks = groups < g_bgd_table_blocks ? groups : g_bgd_table_blocks;
+    return tables + groups + bgd_blocks + 2;
+}
+
+// bytes of file data one operation maps or frees, a multiple of the block size
+static uint32_t journal_chunk_bytes(void)
+{
+    return g_journal_chunk_blocks * g_block_size;
+}
+
+/**
+ * @brief start of a metadata changing operation that logs at most blocks more, before it changes anything:
+ * commit first (sync_filesystem) when the running transaction, counting the inodes, bitmaps, group descriptors
+ * and superblock still held in memory, has no room for them. An operation never spans two transactions
+ */
+static void journal_begin_operation(uint32_t blocks)
+{
+    if (!journal_has_room(blocks))
+        sync_filesystem();
+}
+
+/**
+ * @brief replay a transaction that was committed but maybe not checkpointed (power loss, killed emulator),
+ * runs at mount before anything else reads metadata
+ */
+static void journal_recover(void)
+{
+    uint32_t area = g_superblock.s_journal_block * g_sectors_per_block;
+    struct EXT2JournalDescriptor *descriptor = journal_descriptor();
+    block_device_read(g_device, g_journal_area, area, g_sectors_per_block);
+
+    if (descriptor->j_header.h_magic != EXT2_JOURNAL_MAGIC || descriptor->j_header.h_blocktype != EXT2_JOURNAL_DESCRIPTOR_BLOCK)
+    {
+        descriptor->j_count = 0;
+        return;
+    }
+    g_journal_sequence = descriptor->j_header.h_sequence;
+
+    uint32_t count = descriptor->j_count;
+    if (count == 0 || count > g_journal_capacity)
+    {
+        descriptor->j_count = 0;
+        return;
+    }
+
+    block_device_read(g_device, journal_slot(0), area + g_sectors_per_block, (count + 1) * g_sectors_per_block);
+    struct EXT2JournalCommit *commit = (struct EXT2JournalCommit *)journal_slot(count);
+    bool committed = commit->c_header.h_magic == EXT2_JOURNAL_MAGIC &&
+                     commit->c_header.h_blocktype == EXT2_JOURNAL_COMMIT_BLOCK &&
+                     commit->c_header.h_sequence == g_journal_sequence &&
+                     commit->c_checksum == journal_checksum(count);
+    if (!committed)
+    {
+        descriptor->j_count = 0; // torn commit, the home blocks still hold the previous transaction
+        return;
+    }
+    journal_checkpoint(count);
+}
+
+/**
+ * @brief enable the journal of the mounted filesystem, replaying what the last mount left behind
+ */
+static void journal_open(void)
+{
+    g_journal_capacity = 0;
+    g_journal_sequence = 0;
+    g_journal_chunk_blocks = 0xFFFFFFFFu / g_block_size; // without a journal nothing is split
+    if ((g_superblock.s_feature_compat & EXT2_FEATURE_COMPAT_HAS_JOURNAL) == 0 || g_superblock.s_journal_blocks <= 2)
+        return;
+
+    // an area made with a smaller buffer keeps its size, a larger one only uses what the buffer holds
+    uint32_t capacity = g_superblock.s_journal_blocks - 2;
+    if (capacity > EXT2_JOURNAL_BLOCKS(g_block_size) - 2)
+        capacity = EXT2_JOURNAL_BLOCKS(g_block_size) - 2;
+    g_journal_capacity = capacity;
+    journal_recover();
+
+    // a rewrite reserves a directory operation and two pieces (old and new data), a flush a full delayed pool,
+    // an older and smaller area that cannot hold them runs without the journal instead of splitting operations
+    uint32_t pool_blocks = EXT2_DELAYED_POOL_BYTES / g_block_size;
+    uint32_t pool_files = pool_blocks < EXT2_DELAYED_FILE_COUNT ? pool_blocks : EXT2_DELAYED_FILE_COUNT;
+    if (capacity < 1 + EXT2_JOURNAL_OPERATION_BLOCKS + 2 * journal_data_blocks(1) ||
+        capacity < 1 + pool_files + journal_data_blocks(pool_blocks))
+    {
+        g_journal_capacity = 0;
+        return;
+    }
+
+    // largest piece whose worst case fits, found by bisection as journal_data_blocks() only grows
+    uint32_t budget = (capacity - 1 - EXT2_JOURNAL_OPERATION_BLOCKS) / 2;
+    uint32_t low = 1;
+    uint32_t high = g_journal_chunk_blocks;
+    while (low < high)
+    {
+        uint32_t middle = high - (high - low) / 2;
+        if (journal_data_blocks(middle) <= budget)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    g_journal_chunk_blocks = low;
+}
+
+/* -- Filesystem block I/O, one block is g_sectors_per_block consecutive sectors of the device -- */
+
+void ext2_read_blocks(void *ptr, uint32_t block, uint32_t count)
+{
+    if (g_journal_capacity != 0 && count == 1)
+    {
+        int32_t slot = journal_find(block);
+        if (slot >= 0)
+        {
+            memcpy(ptr, journal_slot(slot), g_block_size);
+            return;
+        }
+    }
+
+    block_cache_read(g_device, ptr, block * g_sectors_per_block, count * g_sectors_per_block);
+
+    // logged blocks are newer than their home copy
+    struct EXT2JournalDescriptor *descriptor = journal_descriptor();
+    for (uint32_t i = 0; g_journal_capacity != 0 && i < descriptor->j_count; i++)
+    {
+        uint32_t home = descriptor->j_home[i];
+        if (home >= block && home - block < count)
+            memcpy((uint8_t *)ptr + (home - block) * g_block_size, journal_slot(i), g_block_size);
+    }
+}
+
+static void ext2_write_blocks(const void *ptr, uint32_t block, uint32_t count)
+{
+    g_metadata_dirty = true;
+    if (g_journal_capacity == 0)
+    {
+        block_cache_write(g_device, ptr, block * g_sectors_per_block, count * g_sectors_per_block);
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+        journal_write_block((const uint8_t *)ptr + i * g_block_size, block + i);
+}
+
+// Queued sectors of consecutive blocks in consecutive memory merge into one disk command
+static void ext2_queue_read(void *ptr, uint32_t block)
+{
+    for (uint32_t i = 0; i < g_sectors_per_block; i++)
+        block_queue_read(g_device, (uint8_t *)ptr + i * BLOCK_SIZE, block * g_sectors_per_block + i);
+}
+
+static void ext2_queue_write(const void *ptr, uint32_t block)
+{
+    if (g_journal_capacity != 0)
+        journal_forget(block);
+    for (uint32_t i = 0; i < g_sectors_per_block; i++)
+        block_queue_write(g_device, (const uint8_t *)ptr + i * BLOCK_SIZE, block * g_sectors_per_block + i);
+}
+
+uint32_t ext2_block_size(void)
+{
+    return g_block_size;
+}
+
 char *get_entry_name(void *entry)
 {
     return (char *)entry + sizeof(struct EXT2DirectoryEntry);
@@ -127,19 +504,19 @@ uint32_t get_dir_first_child_offset(void *ptr)
 
 uint32_t inode_to_bgd(uint32_t inode)
 {
-    return (inode - 1) / INODES_PER_GROUP;
+    return (inode - 1) / g_superblock.s_inodes_per_group;
 };
 
 uint32_t inode_to_local(uint32_t inode)
 {
-    return (inode - 1) % INODES_PER_GROUP;
+    return (inode - 1) % g_superblock.s_inodes_per_group;
 };
 
 void init_directory_table(struct EXT2Inode *node, uint32_t inode, uint32_t parent_inode)
 {
     node->i_mode = EXT2_S_IFDIR;
-    node->i_size = BLOCK_SIZE;
-    node->i_blocks = BLOCK_SIZE / 512;
+    node->i_size = g_block_size;
+    node->i_blocks = g_sectors_per_block;
 
     uint32_t bgd_index = inode_to_bgd(inode);
     uint32_t new_block = allocate_block(bgd_index);
@@ -149,8 +526,8 @@ void init_directory_table(struct EXT2Inode *node, uint32_t inode, uint32_t paren
     }
     node->i_block[0] = new_block;
 
-    uint8_t local_buffer[BLOCK_SIZE];
-    memset(local_buffer, 0, BLOCK_SIZE);
+    EXT2_SCRATCH_BLOCK(uint8_t, local_buffer);
+    memset(local_buffer, 0, g_block_size);
 
     struct EXT2DirectoryEntry *entry_dot = (struct EXT2DirectoryEntry *)local_buffer;
     entry_dot->inode = inode;
@@ -163,16 +540,16 @@ void init_directory_table(struct EXT2Inode *node, uint32_t inode, uint32_t paren
     entry_dot_dot->inode = parent_inode;
     entry_dot_dot->name_len = 2;
     entry_dot_dot->file_type = EXT2_FT_DIR;
-    entry_dot_dot->rec_len = BLOCK_SIZE - 12;
+    entry_dot_dot->rec_len = g_block_size - 12;
     memcpy(get_entry_name(entry_dot_dot), "..", 2);
 
-    write_blocks(local_buffer, new_block, 1);
+    ext2_write_blocks(local_buffer, new_block, 1);
 };
 
 bool is_empty_storage(void)
 {
     uint8_t boot_sector_buffer[BLOCK_SIZE];
-    read_blocks(boot_sector_buffer, BOOT_SECTOR, 1);
+    block_cache_read(g_device, boot_sector_buffer, BOOT_SECTOR, 1);
     int result = memcmp(boot_sector_buffer, fs_signature, sizeof(fs_signature));
     return (result != 0);
 };
@@ -182,241 +559,1490 @@ static void set_bit(uint8_t *bitmap, uint32_t bit)
     bitmap[bit / 8] |= (1 << (bit % 8));
 };
 
-static void clear_bit(uint8_t *bitmap, uint32_t bit)
-{
-    bitmap[bit / 8] &= ~(1 << (bit % 8));
-};
-
-static bool get_bit(uint8_t *bitmap, uint32_t bit)
+static void write_back_bitmap(struct EXT2BitmapCacheEntry *entry)
 {
-    return (bitmap[bit / 8] & (1 << (bit % 8))) != 0;
-};
+    if (entry->dirty)
+    {
+        ext2_write_blocks(entry->words, entry->block, 1);
+        entry->dirty = false;
+    }
+}
 
-void create_ext2(void)
+/**
+ * @brief get a group bitmap from memory, on a miss the least recently used one is written back and replaced
+ * @param bitmap_block bg_block_bitmap or bg_inode_bitmap of the group
+ */
+static struct EXT2BitmapCacheEntry *get_bitmap(uint32_t bitmap_block)
 {
-    uint32_t i, b;
-    uint32_t total_free_blocks = 0;
-    uint32_t total_free_inodes = 0;
+    struct EXT2BitmapCacheEntry *victim = &g_bitmap_cache[0];
+    for (uint32_t i = 0; i < g_bitmap_cache_count; i++)
+    {
+        struct EXT2BitmapCacheEntry *entry = &g_bitmap_cache[i];
+        if (entry->block == bitmap_block)
+        {
+            entry->last_used = ++g_bitmap_clock;
+            return entry;
+        }
+        if (entry->last_used < victim->last_used)
+            victim = entry;
+    }
 
-    memset(buffer, 0, BLOCK_SIZE);
-    memcpy(buffer, fs_signature, sizeof(fs_signature));
-    write_blocks(buffer, BOOT_SECTOR, 1);
+    write_back_bitmap(victim);
+    victim->block = bitmap_block;
+    ext2_read_blocks(victim->words, bitmap_block, 1);
+    victim->last_used = ++g_bitmap_clock;
+    return victim;
+}
 
-    memset(g_bgd_table, 0, sizeof(struct EXT2BlockGroupDescriptor) * GROUPS_COUNT);
+/**
+ * @brief next bit equal to value at or after from, 32 bits per step (__builtin_ctz is a single bsf)
+ * @return bit index, bit_count if there is none
+ */
+static uint32_t find_next_bit(const uint32_t *words, uint32_t bit_count, uint32_t from, bool value)
+{
+    while (from < bit_count)
+    {
+        uint32_t word = value ? words[from / 32] : ~words[from / 32];
+        word &= 0xFFFFFFFFu << (from % 32);
+        if (word != 0)
+        {
+            uint32_t bit = (from & ~31u) + __builtin_ctz(word);
+            return bit < bit_count ? bit : bit_count;
+        }
+        from = (from & ~31u) + 32;
+    }
+    return bit_count;
+}
 
-    for (i = 0; i < GROUPS_COUNT; i++)
+/**
+ * @brief find a run of clear bits: the first one of at least wanted bits, else the longest one
+ * @param start output, first bit of the run
+ * @return run length (at most wanted), 0 if every bit is set
+ */
+static uint32_t find_free_run(const uint32_t *words, uint32_t bit_count, uint32_t wanted, uint32_t *start)
+{
+    uint32_t best_length = 0;
+    uint32_t bit = find_next_bit(words, bit_count, 0, false);
+    while (bit < bit_count)
     {
-        uint32_t group_base_block = i * BLOCKS_PER_GROUP;
-        uint32_t blocks_used_for_meta = 0;
+        uint32_t end = find_next_bit(words, bit_count, bit, true);
+        if (end - bit > best_length)
+        {
+            best_length = end - bit;
+            *start = bit;
+            if (best_length >= wanted)
+                return wanted;
+        }
+        bit = find_next_bit(words, bit_count, end, false);
+    }
+    return best_length;
+}
 
-        if (i == 0)
+static void set_bit_range(uint32_t *words, uint32_t start, uint32_t length)
+{
+    while (length > 0)
+    {
+        if (start % 32 == 0 && length >= 32)
         {
-            g_bgd_table[i].bg_block_bitmap = 3;
-            g_bgd_table[i].bg_inode_bitmap = 4;
-            g_bgd_table[i].bg_inode_table = 5;
-            blocks_used_for_meta = 20;
+            words[start / 32] = 0xFFFFFFFFu;
+            start += 32;
+            length -= 32;
         }
         else
         {
-            g_bgd_table[i].bg_block_bitmap = group_base_block;
-            g_bgd_table[i].bg_inode_bitmap = group_base_block + 1;
-            g_bgd_table[i].bg_inode_table = group_base_block + 2;
-            blocks_used_for_meta = 18;
+            words[start / 32] |= 1u << (start % 32);
+            start++;
+            length--;
         }
+    }
+}
 
-        g_bgd_table[i].bg_free_blocks_count = BLOCKS_PER_GROUP - blocks_used_for_meta;
-        g_bgd_table[i].bg_free_inodes_count = INODES_PER_GROUP;
-        g_bgd_table[i].bg_used_dirs_count = 0;
-
-        total_free_blocks += g_bgd_table[i].bg_free_blocks_count;
-        total_free_inodes += g_bgd_table[i].bg_free_inodes_count;
-
-        memset(buffer, 0, BLOCK_SIZE);
-        write_blocks(buffer, g_bgd_table[i].bg_inode_bitmap, 1);
-        write_blocks(buffer, g_bgd_table[i].bg_inode_table, INODES_TABLE_BLOCK_COUNT);
-
-        if (i == 0)
+static void clear_bit_range(uint32_t *words, uint32_t start, uint32_t length)
+{
+    while (length > 0)
+    {
+        if (start % 32 == 0 && length >= 32)
         {
-            set_bit(buffer, 0);
-            for (b = 1; b <= 20; b++)
-            {
-                set_bit(buffer, b);
-            }
-
-            blocks_used_for_meta = 21;
+            words[start / 32] = 0;
+            start += 32;
+            length -= 32;
         }
         else
         {
-            for (b = 0; b < 18; b++)
-            {
-                set_bit(buffer, b);
-            }
+            words[start / 32] &= ~(1u << (start % 32));
+            start++;
+            length--;
         }
-        write_blocks(buffer, g_bgd_table[i].bg_block_bitmap, 1);
     }
+}
 
-    memset(&g_superblock, 0, sizeof(struct EXT2Superblock));
-    g_superblock.s_inodes_count = INODES_PER_GROUP * GROUPS_COUNT;
-    g_superblock.s_blocks_count = BLOCKS_PER_GROUP * GROUPS_COUNT;
-    g_superblock.s_r_blocks_count = 0;
-    g_superblock.s_free_blocks_count = total_free_blocks;
-    g_superblock.s_free_inodes_count = total_free_inodes;
-    g_superblock.s_first_data_block = 1;
-    g_superblock.s_blocks_per_group = BLOCKS_PER_GROUP;
-    g_superblock.s_frags_per_group = BLOCKS_PER_GROUP;
-    g_superblock.s_inodes_per_group = INODES_PER_GROUP;
-    g_superblock.s_magic = EXT2_SUPER_MAGIC;
-    g_superblock.s_first_ino = 1;
-
-    memset(buffer, 0, BLOCK_SIZE);
-    memcpy(buffer, &g_superblock, sizeof(struct EXT2Superblock));
-    write_blocks(buffer, 1, 1);
-
-    memset(buffer, 0, BLOCK_SIZE);
-    memcpy(buffer, g_bgd_table, sizeof(struct EXT2BlockGroupDescriptor) * GROUPS_COUNT);
-    write_blocks(buffer, 2, 1);
+// Bitmap changes always come with a free count change in the superblock and bgd table
+static void mark_bitmap_dirty(struct EXT2BitmapCacheEntry *bitmap)
+{
+    bitmap->dirty = true;
+    g_metadata_dirty = true;
+}
 
-    uint32_t root_inode_num = 1;
-    uint32_t root_group = 0;
-    uint32_t root_local_idx = 0;
+// Set the first clear bit of a group bitmap, -1 if the group is full
+static int32_t claim_first_free_bit(uint32_t bitmap_block, uint32_t bit_count)
+{
+    struct EXT2BitmapCacheEntry *bitmap = get_bitmap(bitmap_block);
+    uint32_t bit = find_next_bit(bitmap->words, bit_count, 0, false);
+    if (bit == bit_count)
+        return -1;
 
-    read_blocks(buffer, g_bgd_table[root_group].bg_inode_bitmap, 1);
-    set_bit(buffer, root_local_idx);
-    write_blocks(buffer, g_bgd_table[root_group].bg_inode_bitmap, 1);
+    bitmap->words[bit / 32] |= 1u << (bit % 32);
+    mark_bitmap_dirty(bitmap);
+    return bit;
+}
 
-    g_bgd_table[root_group].bg_free_inodes_count--;
-    g_bgd_table[root_group].bg_used_dirs_count++;
-    g_superblock.s_free_inodes_count--;
+static void release_bit(uint32_t bitmap_block, uint32_t bit)
+{
+    struct EXT2BitmapCacheEntry *bitmap = get_bitmap(bitmap_block);
+    bitmap->words[bit / 32] &= ~(1u << (bit % 32));
+    mark_bitmap_dirty(bitmap);
+}
 
-    struct EXT2Inode root_inode;
-    memset(&root_inode, 0, sizeof(struct EXT2Inode));
+/**
+ * @brief write the in-memory superblock (sector 1), the bgd table blocks that changed and the dirty group bitmaps into the block cache,
+ * the cache keeps them dirty so repeated updates during one operation cost a single disk write
+ */
+static void sync_fs_metadata(void)
+{
+    EXT2_SCRATCH_BLOCK(uint8_t, temp_buffer);
+
+    for (uint32_t i = 0; i < g_bitmap_cache_count; i++)
+        write_back_bitmap(&g_bitmap_cache[i]);
+
+    // the superblock sector shares its block with the boot sector once blocks are bigger than a sector
+    uint32_t superblock_block = EXT2_SUPERBLOCK_SECTOR / g_sectors_per_block;
+    uint8_t *superblock = temp_buffer + (EXT2_SUPERBLOCK_SECTOR % g_sectors_per_block) * BLOCK_SIZE;
+    ext2_read_blocks(temp_buffer, superblock_block, 1);
+    memset(superblock, 0, BLOCK_SIZE);
+    memcpy(superblock, &g_superblock, sizeof(struct EXT2Superblock));
+    ext2_write_blocks(temp_buffer, superblock_block, 1);
+
+    // big disks have tens of bgd table blocks, only the ones that differ from disk are written
+    uint32_t bgds_per_block = BGDS_PER_BLOCK(g_block_size);
+    for (uint32_t b = 0; b < g_bgd_table_blocks; b++)
+    {
+        uint32_t first = b * bgds_per_block;
+        uint32_t count = g_groups_count - first < bgds_per_block ? g_groups_count - first : bgds_per_block;
+        uint32_t size = count * sizeof(struct EXT2BlockGroupDescriptor);
+        if (memcmp(&g_bgd_table[first], &g_bgd_table_on_disk[first], size) == 0)
+            continue;
 
-    init_directory_table(&root_inode, root_inode_num, root_inode_num);
+        memset(temp_buffer, 0, g_block_size);
+        memcpy(temp_buffer, &g_bgd_table[first], size);
+        ext2_write_blocks(temp_buffer, g_bgd_table_start + b, 1);
+        memcpy(&g_bgd_table_on_disk[first], &g_bgd_table[first], size);
+    }
+};
 
-    g_bgd_table[root_group].bg_free_blocks_count--;
-    g_superblock.s_free_blocks_count--;
+// every metadata change to the disk, one transaction with a journal
+static void write_back_metadata(void)
+{
+    sync_fs_metadata();
+    inode_cache_flush();
+    if (g_journal_capacity != 0)
+        journal_commit();
+    else
+        block_cache_flush(g_device);
+    g_blocks_freed = false;
+}
 
-    sync_node(&root_inode, root_inode_num);
+/* -- Delayed allocation, file data stays in g_delayed_pool until sync_filesystem() gives it blocks -- */
 
-    memset(buffer, 0, BLOCK_SIZE);
-    memcpy(buffer, &g_superblock, sizeof(struct EXT2Superblock));
-    write_blocks(buffer, 1, 1);
+// blocks a delayed file of size bytes takes once allocated, the pool never needs more than one indirect block
+static uint32_t delayed_blocks(uint32_t size)
+{
+    uint32_t blocks = (size + g_block_size - 1) / g_block_size;
+    return blocks + (blocks > 12);
+}
 
-    memset(buffer, 0, BLOCK_SIZE);
-    memcpy(buffer, g_bgd_table, sizeof(struct EXT2BlockGroupDescriptor) * GROUPS_COUNT);
-    write_blocks(buffer, 2, 1);
-};
+// pool offset of the next new file, block aligned so the flush writes whole blocks straight from the pool
+static uint32_t delayed_next_start(void)
+{
+    return (g_delayed_used + g_block_size - 1) / g_block_size * g_block_size;
+}
 
-void initialize_filesystem_ext2(void)
+// entry holding the data of inode, with inode 0 an unused entry
+static struct EXT2DelayedFile *delayed_entry(uint32_t inode)
 {
-    if (is_empty_storage())
+    for (uint32_t i = 0; i < EXT2_DELAYED_FILE_COUNT; i++)
     {
-        create_ext2();
+        if (g_delayed_files[i].inode == inode)
+            return &g_delayed_files[i];
     }
+    return NULL;
+}
 
-    memset(buffer, 0, BLOCK_SIZE);
-
-    read_blocks(buffer, 1, 1);
-    memcpy(&g_superblock, buffer, sizeof(struct EXT2Superblock));
-
-    read_blocks(buffer, 2, 1);
-    memcpy(g_bgd_table, buffer, sizeof(struct EXT2BlockGroupDescriptor) * GROUPS_COUNT);
-
-    // if (g_superblock.s_magic != EXT2_SUPER_MAGIC)
-    // {
-    //     while (1)
-    //         ;
-    // }
-};
-
-void read_inode(uint32_t inode_num, struct EXT2Inode *out_node)
+// delayed data of inode, NULL if the file has its blocks
+static struct EXT2DelayedFile *delayed_find(uint32_t inode)
 {
-    uint32_t group = inode_to_bgd(inode_num);
-    uint32_t local_idx = inode_to_local(inode_num);
-    uint32_t table_start_block = g_bgd_table[group].bg_inode_table;
-
-    uint32_t block_offset = local_idx / INODES_PER_TABLE;
-    uint32_t index_in_block = local_idx % INODES_PER_TABLE;
-
-    uint32_t inode_block_to_read = table_start_block + block_offset;
-
-    memset(buffer, 0, BLOCK_SIZE);
-    read_blocks(buffer, inode_block_to_read, 1);
+    return inode != 0 ? delayed_entry(inode) : NULL;
+}
 
-    struct EXT2Inode *inode_table_in_block = (struct EXT2Inode *)buffer;
+/**
+ * @brief the delayed data of file (NULL for a file without any) can grow to end bytes:
+ * a new file needs a free entry, a growing one must be the last of the pool, and the added blocks must be free
+ */
+static bool delayed_has_room(struct EXT2DelayedFile *file, uint32_t end)
+{
+    uint32_t size = file != NULL ? file->size : 0;
+    if (end <= size)
+        return true;
+    if (file == NULL ? delayed_entry(0) == NULL : file->start + file->size != g_delayed_used)
+        return false;
 
-    memcpy(out_node, &inode_table_in_block[index_in_block], sizeof(struct EXT2Inode));
+    uint32_t start = file != NULL ? file->start : delayed_next_start();
+    uint32_t added = delayed_blocks(end) - delayed_blocks(size);
+    return end <= EXT2_DELAYED_POOL_BYTES - start && g_superblock.s_free_blocks_count >= g_delayed_reserved + added;
 }
 
-bool is_directory_empty(uint32_t inode)
+/**
+ * @brief copy length bytes of src (NULL writes zeroes) to offset of the delayed data of inode, a gap past the old end reads as zero.
+ * The caller checked delayed_has_room(), file is NULL for a file without delayed data
+ */
+static void delayed_write(struct EXT2DelayedFile *file, uint32_t inode, const void *src, uint32_t offset, uint32_t length)
 {
-    struct EXT2Inode dir_inode;
-    read_inode(inode, &dir_inode);
+    if (file == NULL)
+    {
+        file = delayed_entry(0);
+        file->inode = inode;
+        file->start = delayed_next_start();
+        file->size = 0;
+    }
 
-    if ((dir_inode.i_mode & EXT2_S_IFDIR) == 0)
+    uint8_t *data = g_delayed_pool + file->start;
+    uint32_t end = offset + length;
+    if (end > file->size)
     {
-        return false;
+        if (offset > file->size)
+            memset(data + file->size, 0, offset - file->size);
+        g_delayed_reserved += delayed_blocks(end) - delayed_blocks(file->size);
+        g_delayed_used = file->start + end;
+        file->size = end;
     }
 
-    uint32_t data_block_num = dir_inode.i_block[0];
+    if (src != NULL)
+        memcpy(data + offset, src, length);
+    else
+        memset(data + offset, 0, length);
+}
 
-    memset(buffer, 0, BLOCK_SIZE);
-    read_blocks(buffer, data_block_num, 1);
+// shrink the delayed data of file to size bytes, at 0 the file leaves the pool
+static void delayed_truncate(struct EXT2DelayedFile *file, uint32_t size)
+{
+    g_delayed_reserved -= delayed_blocks(file->size) - delayed_blocks(size);
+    if (file->start + file->size == g_delayed_used)
+        g_delayed_used = file->start + size;
+    file->size = size;
+    if (size == 0)
+        memset(file, 0, sizeof(struct EXT2DelayedFile));
+}
 
-    uint32_t first_child_offset = get_dir_first_child_offset(buffer);
+// drop the delayed data of a deleted or rewritten file, it never reaches the disk
+static void delayed_forget(uint32_t inode)
+{
+    struct EXT2DelayedFile *file = delayed_find(inode);
+    if (file != NULL)
+        delayed_truncate(file, 0);
+}
+
+/**
+ * @brief make room for a new delayed file of size bytes, a full pool is flushed with sync_filesystem() first,
+ * so call it before the operation changes anything
+ * @return false if the data must get its blocks right away: empty, bigger than the pool or not enough free blocks
+ */
+static bool delayed_reserve(uint32_t size)
+{
+    if (size == 0 || size > EXT2_DELAYED_POOL_BYTES)
+        return false;
+    if (!delayed_has_room(NULL, size))
+        sync_filesystem();
+    return delayed_has_room(NULL, size);
+}
+
+// delayed files committed before they have blocks are stored empty, a crash then leaves them empty rather than zero filled
+static void delayed_hide_sizes(uint32_t from)
+{
+    for (uint32_t i = from; i < EXT2_DELAYED_FILE_COUNT; i++)
+    {
+        if (g_delayed_files[i].inode == 0)
+            continue;
+
+        struct EXT2Inode node;
+        read_inode(g_delayed_files[i].inode, &node);
+        node.i_size = 0;
+        sync_node(&node, g_delayed_files[i].inode);
+    }
+}
+
+// give every delayed file its blocks, its whole size is known now so allocate_node_blocks() finds one run for it
+static void delayed_flush(void)
+{
+    g_delayed_reserved = 0; // the reserved blocks are taken now
+    for (uint32_t i = 0; i < EXT2_DELAYED_FILE_COUNT; i++)
+    {
+        struct EXT2DelayedFile *file = &g_delayed_files[i];
+        if (file->inode == 0)
+            continue;
+
+        // one file is one step: when the transaction cannot take its blocks, the files flushed so far are committed
+        // with the data already home and the files still waiting stored empty
+        if (!journal_has_room(journal_data_blocks(delayed_blocks(file->size))))
+        {
+            delayed_hide_sizes(i);
+            block_queue_dispatch();
+            write_back_metadata();
+        }
+
+        // the rest of the last block is written too, it must read as zero
+        uint8_t *data = g_delayed_pool + file->start;
+        memset(data + file->size, 0, (g_block_size - file->size % g_block_size) % g_block_size);
+
+        struct EXT2Inode node;
+        read_inode(file->inode, &node);
+        node.i_size = file->size;
+        allocate_node_blocks(data, &node, inode_to_bgd(file->inode));
+        sync_node(&node, file->inode);
+    }
+    block_queue_dispatch(); // data of consecutive files goes out merged, before the commit
+
+    memset(g_delayed_files, 0, sizeof(g_delayed_files));
+    g_delayed_used = 0;
+}
+
+void sync_filesystem(void)
+{
+    if (!g_metadata_dirty)
+        return;
+
+    // delayed data is written home before the commit, it may only reuse a freed block once the free is committed
+    if (g_journal_capacity != 0 && g_blocks_freed && g_delayed_used != 0)
+    {
+        delayed_hide_sizes(0);
+        write_back_metadata();
+    }
+    delayed_flush();
+    write_back_metadata();
+    g_metadata_dirty = false;
+}
+
+bool filesystem_needs_sync(void)
+{
+    return g_metadata_dirty;
+}
 
-    return (first_child_offset >= BLOCK_SIZE);
+/**
+ * @brief derive block size, group count and bgd table size from the superblock.
+ * The bitmap cache is emptied, its entries are resized to the block size
+ */
+static void load_geometry(void)
+{
+    g_block_size = BLOCK_SIZE << g_superblock.s_log_block_size;
+    g_sectors_per_block = EXT2_SECTORS_PER_BLOCK(g_block_size);
+    g_pointers_per_block = EXT2_POINTERS_PER_BLOCK(g_block_size);
+    g_zero_blocks_count = EXT2_ZERO_WRITE_BYTES / g_block_size;
+    g_bgd_table_start = EXT2_SUPERBLOCK_SECTOR / g_sectors_per_block + 1;
+
+    uint32_t blocks_per_group = g_superblock.s_blocks_per_group;
+    g_groups_count = (g_superblock.s_blocks_count + blocks_per_group - 1) / blocks_per_group;
+    if (g_groups_count > EXT2_MAX_GROUPS)
+        g_groups_count = EXT2_MAX_GROUPS;
+    g_bgd_table_blocks = (g_groups_count + BGDS_PER_BLOCK(g_block_size) - 1) / BGDS_PER_BLOCK(g_block_size);
+    g_inode_size = g_superblock.s_inode_size != 0 ? g_superblock.s_inode_size : EXT2_LEGACY_INODE_SIZE;
+
+    memset(g_bitmap_cache, 0, sizeof(g_bitmap_cache));
+    g_bitmap_cache_count = EXT2_BITMAP_CACHE_BYTES / g_block_size;
+    for (uint32_t i = 0; i < g_bitmap_cache_count; i++)
+        g_bitmap_cache[i].words = g_bitmap_pool + i * (g_block_size / sizeof(uint32_t));
 };
 
-uint32_t find_inode_by_name(struct EXT2Inode *parent_inode, const char *name, uint8_t name_len)
+/**
+ * @brief choose block size, blocks per group, inodes per group and block count for a disk of disk_sectors sectors.
+ * Disks from EXT2_LARGE_DISK_SECTORS up get EXT2_LARGE_BLOCK_SIZE blocks, smaller ones EXT2_SMALL_BLOCK_SIZE blocks.
+ * Disk is split into at least EXT2_MIN_GROUPS groups (4 MB disk keeps 8 groups of 512 blocks),
+ * groups grow up to one block bitmap worth of blocks, a trailing partial group is kept if its metadata fits
+ * @param disk_sectors number of sectors reported by the disk
+ */
+static void compute_geometry(uint32_t disk_sectors)
+{
+    uint32_t block_size = disk_sectors >= EXT2_LARGE_DISK_SECTORS ? EXT2_LARGE_BLOCK_SIZE : EXT2_SMALL_BLOCK_SIZE;
+    uint32_t log_block_size = 0;
+    while (((uint32_t)BLOCK_SIZE << log_block_size) < block_size)
+        log_block_size++;
+
+    uint32_t disk_blocks = disk_sectors / EXT2_SECTORS_PER_BLOCK(block_size);
+    uint32_t max_blocks = EXT2_MAX_GROUPS * EXT2_MAX_BLOCKS_PER_GROUP(block_size);
+    if (disk_blocks > max_blocks)
+        disk_blocks = max_blocks;
+
+    uint32_t blocks_per_group = disk_blocks / EXT2_MIN_GROUPS;
+    blocks_per_group -= blocks_per_group % EXT2_BLOCKS_PER_INODE_TABLE_BLOCK;
+    if (blocks_per_group > EXT2_MAX_BLOCKS_PER_GROUP(block_size))
+        blocks_per_group = EXT2_MAX_BLOCKS_PER_GROUP(block_size);
+    if (blocks_per_group < EXT2_MIN_BLOCKS_PER_GROUP)
+        blocks_per_group = EXT2_MIN_BLOCKS_PER_GROUP;
+
+    uint32_t inode_table_blocks = blocks_per_group / EXT2_BLOCKS_PER_INODE_TABLE_BLOCK;
+    uint32_t blocks_count = disk_blocks - disk_blocks % blocks_per_group;
+    if (disk_blocks % blocks_per_group > 2 + inode_table_blocks)
+        blocks_count = disk_blocks;
+
+    memset(&g_superblock, 0, sizeof(struct EXT2Superblock));
+    g_superblock.s_blocks_count = blocks_count;
+    g_superblock.s_blocks_per_group = blocks_per_group;
+    g_superblock.s_frags_per_group = blocks_per_group;
+    g_superblock.s_inodes_per_group = INODES_PER_TABLE(block_size) * inode_table_blocks;
+    g_superblock.s_inode_size = INODE_SIZE;
+    g_superblock.s_log_block_size = log_block_size;
+    load_geometry();
+};
+
+void create_ext2(void)
+{
+    uint32_t i, b;
+    uint32_t total_free_blocks = 0;
+    uint32_t total_free_inodes = 0;
+
+    memcpy(buffer, fs_signature, sizeof(fs_signature));
+    block_cache_write(g_device, buffer, BOOT_SECTOR, 1);
+
+    uint32_t disk_sectors = block_device_capacity(g_device);
+    compute_geometry(disk_sectors != 0 ? disk_sectors : EXT2_DEFAULT_DISK_SECTORS);
+
+    uint32_t blocks_per_group = g_superblock.s_blocks_per_group;
+    uint32_t inode_table_blocks = g_superblock.s_inodes_per_group / INODES_PER_TABLE(g_block_size);
+
+    memset(g_bgd_table, 0, sizeof(g_bgd_table));
+    memset(g_bgd_table_on_disk, 0, sizeof(g_bgd_table_on_disk));
+
+    for (i = 0; i < g_groups_count; i++)
+    {
+        uint32_t group_base_block = i * blocks_per_group;
+        uint32_t group_blocks = g_superblock.s_blocks_count - group_base_block;
+        if (group_blocks > blocks_per_group)
+            group_blocks = blocks_per_group;
+
+        // group 0 also holds the boot sector, superblock and bgd table before its own metadata
+        uint32_t meta_base_block = (i == 0) ? g_bgd_table_start + g_bgd_table_blocks : group_base_block;
+        g_bgd_table[i].bg_block_bitmap = meta_base_block;
+        g_bgd_table[i].bg_inode_bitmap = meta_base_block + 1;
+        g_bgd_table[i].bg_inode_table = meta_base_block + 2;
+        uint32_t blocks_used_for_meta = meta_base_block + 2 + inode_table_blocks - group_base_block;
+        if (i == 0)
+        {
+            // journal area right after the inode table of group 0, an empty descriptor means nothing to replay
+            g_superblock.s_journal_block = meta_base_block + 2 + inode_table_blocks;
+            g_superblock.s_journal_blocks = EXT2_JOURNAL_BLOCKS(g_block_size);
+            blocks_used_for_meta += g_superblock.s_journal_blocks;
+            ext2_write_blocks(zero_blocks, g_superblock.s_journal_block, 1);
+        }
+
+        g_bgd_table[i].bg_free_blocks_count = group_blocks - blocks_used_for_meta;
+        g_bgd_table[i].bg_free_inodes_count = g_superblock.s_inodes_per_group;
+        g_bgd_table[i].bg_used_dirs_count = 0;
+
+        total_free_blocks += g_bgd_table[i].bg_free_blocks_count;
+        total_free_inodes += g_bgd_table[i].bg_free_inodes_count;
+
+        memset(buffer, 0, g_block_size);
+        ext2_write_blocks(buffer, g_bgd_table[i].bg_inode_bitmap, 1);
+        // streamed through the block queue, the whole inode table would only flush the cache
+        for (b = 0; b < inode_table_blocks; b++)
+            ext2_queue_write(zero_blocks + (b % g_zero_blocks_count) * g_block_size, g_bgd_table[i].bg_inode_table + b);
+        block_queue_dispatch();
+
+        for (b = 0; b < blocks_used_for_meta; b++)
+        {
+            set_bit(buffer, b);
+        }
+        // blocks past the end of a trailing partial group never become free
+        for (b = group_blocks; b < blocks_per_group; b++)
+        {
+            set_bit(buffer, b);
+        }
+        ext2_write_blocks(buffer, g_bgd_table[i].bg_block_bitmap, 1);
+    }
+
+    g_superblock.s_inodes_count = g_superblock.s_inodes_per_group * g_groups_count;
+    g_superblock.s_r_blocks_count = 0;
+    g_superblock.s_free_blocks_count = total_free_blocks;
+    g_superblock.s_free_inodes_count = total_free_inodes;
+    g_superblock.s_first_data_block = 1;
+    g_superblock.s_magic = EXT2_SUPER_MAGIC;
+    g_superblock.s_first_ino = 1;
+    g_superblock.s_feature_compat = EXT2_FEATURE_COMPAT_DIR_INDEX | EXT2_FEATURE_COMPAT_HAS_JOURNAL;
+    g_superblock.s_feature_incompat = EXT2_FEATURE_INCOMPAT_EXTENTS;
+
+    sync_fs_metadata();
+
+    uint32_t root_inode_num = ROOT_INODE_NUM;
+    uint32_t root_group = 0;
+    uint32_t root_local_idx = 0;
+
+    struct EXT2BitmapCacheEntry *inode_bitmap = get_bitmap(g_bgd_table[root_group].bg_inode_bitmap);
+    inode_bitmap->words[root_local_idx / 32] |= 1u << (root_local_idx % 32);
+    mark_bitmap_dirty(inode_bitmap);
+
+    g_bgd_table[root_group].bg_free_inodes_count--;
+    g_bgd_table[root_group].bg_used_dirs_count++;
+    g_superblock.s_free_inodes_count--;
+
+    struct EXT2Inode root_inode;
+    memset(&root_inode, 0, sizeof(struct EXT2Inode));
+
+    init_directory_table(&root_inode, root_inode_num, root_inode_num); // allocate_block already counts the root block
+
+    sync_node(&root_inode, root_inode_num);
+
+    sync_filesystem();
+};
+
+void initialize_filesystem_ext2(struct BlockDevice *device)
+{
+    g_device = device;
+    g_journal_capacity = 0; // create_ext2() and the replay write straight to the disk
+    inode_cache_invalidate();
+    dentry_cache_invalidate_all();
+    if (is_empty_storage())
+    {
+        create_ext2();
+    }
+
+    memset(buffer, 0, BLOCK_SIZE);
+
+    block_cache_read(g_device, buffer, EXT2_SUPERBLOCK_SECTOR, 1);
+    memcpy(&g_superblock, buffer, sizeof(struct EXT2Superblock));
+    load_geometry();
+
+    // a replayed transaction may hold the superblock, read it again
+    journal_open();
+    block_cache_read(g_device, buffer, EXT2_SUPERBLOCK_SECTOR, 1);
+    memcpy(&g_superblock, buffer, sizeof(struct EXT2Superblock));
+
+    uint32_t bgds_per_block = BGDS_PER_BLOCK(g_block_size);
+    for (uint32_t b = 0; b < g_bgd_table_blocks; b++)
+    {
+        uint32_t first = b * bgds_per_block;
+        uint32_t count = g_groups_count - first < bgds_per_block ? g_groups_count - first : bgds_per_block;
+        ext2_read_blocks(buffer, g_bgd_table_start + b, 1);
+        memcpy(&g_bgd_table[first], buffer, count * sizeof(struct EXT2BlockGroupDescriptor));
+    }
+    memcpy(g_bgd_table_on_disk, g_bgd_table, sizeof(g_bgd_table));
+
+    // every path lookup starts at the root, keep its inode resident for the whole mount
+    inode_cache_get(ROOT_INODE_NUM);
+
+    // if (g_superblock.s_magic != EXT2_SUPER_MAGIC)
+    // {
+    //     while (1)
+    //         ;
+    // }
+};
+
+struct BlockDevice *ext2_get_device(void)
+{
+    return g_device;
+};
+
+void ext2_load_inode(uint32_t inode_num, struct EXT2Inode *out_node)
+{
+    uint32_t group = inode_to_bgd(inode_num);
+    uint32_t local_idx = inode_to_local(inode_num);
+    uint32_t table_start_block = g_bgd_table[group].bg_inode_table;
+
+    uint32_t block_offset = local_idx / (g_block_size / g_inode_size);
+    uint32_t index_in_block = local_idx % (g_block_size / g_inode_size);
+
+    uint32_t inode_block_to_read = table_start_block + block_offset;
+
+    // own buffer, called from the inode cache in the middle of callers using the shared one
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, inode_block);
+    ext2_read_blocks(inode_block->buf, inode_block_to_read, 1);
+
+    // legacy 70 byte inodes have no i_flags, it reads as 0
+    memset(out_node, 0, sizeof(struct EXT2Inode));
+    memcpy(out_node, inode_block->buf + index_in_block * g_inode_size, g_inode_size < INODE_SIZE ? g_inode_size : INODE_SIZE);
+}
+
+void read_inode(uint32_t inode_num, struct EXT2Inode *out_node)
+{
+    struct InodeCacheEntry *entry = inode_cache_get(inode_num);
+    memcpy(out_node, &entry->inode, sizeof(struct EXT2Inode));
+    inode_cache_put(entry);
+}
+
+void stat_inode(uint32_t inode_num, struct EXT2Stat *stat)
+{
+    struct InodeCacheEntry *entry = inode_cache_get(inode_num);
+    stat->inode = inode_num;
+    stat->mode = entry->inode.i_mode;
+    stat->size = entry->inode.i_size;
+    stat->blocks = entry->inode.i_blocks;
+    stat->block_size = g_block_size;
+    inode_cache_put(entry);
+}
+
+static bool uses_extents(struct EXT2Inode *node)
+{
+    return (node->i_flags & EXT2_EXTENTS_FL) != 0;
+}
+
+/**
+ * @brief binary search of an extent tree node
+ * @return index of the last entry starting at or before logical, -1 if there is none.
+ * Extents and index entries both start with their first file block, the same search serves both
+ */
+static int32_t extent_search(struct EXT2ExtentHeader *header, uint32_t logical)
+{
+    struct EXT2Extent *entries = (struct EXT2Extent *)(header + 1);
+    int32_t low = 0;
+    int32_t high = (int32_t)header->eh_entries - 1;
+    int32_t found = -1;
+    while (low <= high)
+    {
+        int32_t mid = (low + high) / 2;
+        if (entries[mid].ee_block <= logical)
+        {
+            found = mid;
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+    return found;
+}
+
+static bool is_extent_node(struct EXT2ExtentHeader *header, uint32_t max_entries)
+{
+    return header->eh_magic == EXT2_EXTENT_MAGIC && header->eh_entries <= max_entries && header->eh_depth <= 1;
+}
+
+static uint32_t get_extent_block(struct EXT2Inode *node, uint32_t logical)
+{
+    // i_block is copied out, EXT2Inode is packed
+    uint32_t root[15];
+    memcpy(root, node->i_block, sizeof(root));
+    struct EXT2ExtentHeader *header = (struct EXT2ExtentHeader *)root;
+    if (!is_extent_node(header, EXT2_EXTENT_INODE_ENTRIES))
+        return 0;
+
+    int32_t i = extent_search(header, logical);
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, leaf);
+    if (i >= 0 && header->eh_depth == 1)
+    {
+        struct EXT2ExtentIndex *index = (struct EXT2ExtentIndex *)(header + 1);
+        ext2_read_blocks(leaf->buf, index[i].ei_leaf, 1);
+        header = (struct EXT2ExtentHeader *)leaf->buf;
+        if (!is_extent_node(header, EXT2_EXTENT_BLOCK_ENTRIES(g_block_size)) || header->eh_depth != 0)
+            return 0;
+        i = extent_search(header, logical);
+    }
+    if (i < 0)
+        return 0;
+
+    struct EXT2Extent *extent = (struct EXT2Extent *)(header + 1) + i;
+    if (logical - extent->ee_block >= extent->ee_len)
+        return 0;
+    return extent->ee_start + (logical - extent->ee_block);
+}
+
+/**
+ * @brief copy every extent of an extent mapped inode, in file order, into g_extent_list
+ * @param leaves output, leaf blocks of a depth 1 tree (EXT2_EXTENT_INODE_ENTRIES entries)
+ * @param leaf_count output, number of leaves
+ * @return number of extents
+ */
+static uint32_t load_extents(struct EXT2Inode *node, uint32_t *leaves, uint32_t *leaf_count)
+{
+    uint32_t root[15];
+    memcpy(root, node->i_block, sizeof(root));
+    struct EXT2ExtentHeader *header = (struct EXT2ExtentHeader *)root;
+    *leaf_count = 0;
+    if (!is_extent_node(header, EXT2_EXTENT_INODE_ENTRIES))
+        return 0;
+
+    if (header->eh_depth == 0)
+    {
+        memcpy(g_extent_list, header + 1, header->eh_entries * sizeof(struct EXT2Extent));
+        return header->eh_entries;
+    }
+
+    uint32_t count = 0;
+    struct EXT2ExtentIndex *index = (struct EXT2ExtentIndex *)(header + 1);
+    for (uint32_t i = 0; i < header->eh_entries; i++)
+    {
+        leaves[(*leaf_count)++] = index[i].ei_leaf;
+
+        EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, leaf);
+        ext2_read_blocks(leaf->buf, index[i].ei_leaf, 1);
+        struct EXT2ExtentHeader *leaf_header = (struct EXT2ExtentHeader *)leaf->buf;
+        if (!is_extent_node(leaf_header, EXT2_EXTENT_BLOCK_ENTRIES(g_block_size)) || leaf_header->eh_depth != 0)
+            continue;
+        memcpy(&g_extent_list[count], leaf_header + 1, leaf_header->eh_entries * sizeof(struct EXT2Extent));
+        count += leaf_header->eh_entries;
+    }
+    return count;
+}
+
+uint32_t get_inode_block(struct EXT2Inode *node, uint32_t logical)
+{
+    if (uses_extents(node))
+        return get_extent_block(node, logical);
+
+    if (logical < 12)
+        return node->i_block[logical];
+    logical -= 12;
+
+    EXT2_SCRATCH_BLOCK(uint32_t, pointers);
+    if (logical < g_pointers_per_block)
+    {
+        if (node->i_block[12] == 0)
+            return 0;
+        ext2_read_blocks(pointers, node->i_block[12], 1);
+        return pointers[logical];
+    }
+    logical -= g_pointers_per_block;
+
+    if (logical >= g_pointers_per_block * g_pointers_per_block || node->i_block[13] == 0)
+        return 0;
+    ext2_read_blocks(pointers, node->i_block[13], 1);
+    uint32_t indirect_block = pointers[logical / g_pointers_per_block];
+    if (indirect_block == 0)
+        return 0;
+    ext2_read_blocks(pointers, indirect_block, 1);
+    return pointers[logical % g_pointers_per_block];
+}
+
+/**
+ * @brief return pointer_block, or a newly allocated zeroed indirect block when pointer_block is 0
+ */
+static uint32_t get_or_allocate_pointer_block(uint32_t pointer_block, struct EXT2Inode *node, uint32_t prefered_bgd)
+{
+    if (pointer_block != 0)
+        return pointer_block;
+
+    uint32_t new_block = allocate_block(prefered_bgd);
+    if (new_block != 0)
+    {
+        ext2_write_blocks(zero_blocks, new_block, 1);
+        node->i_blocks += g_sectors_per_block;
+    }
+    return new_block;
+}
+
+/**
+ * @brief map block number block at index logical of node, allocating the indirect blocks on the way
+ * @return false if the disk is full or logical is past the doubly indirect range
+ */
+static bool set_inode_block(struct EXT2Inode *node, uint32_t prefered_bgd, uint32_t logical, uint32_t block)
+{
+    if (logical < 12)
+    {
+        node->i_block[logical] = block;
+        return true;
+    }
+    logical -= 12;
+
+    uint32_t table_block;
+    if (logical < g_pointers_per_block)
+    {
+        table_block = get_or_allocate_pointer_block(node->i_block[12], node, prefered_bgd);
+        node->i_block[12] = table_block;
+    }
+    else
+    {
+        logical -= g_pointers_per_block;
+        if (logical >= g_pointers_per_block * g_pointers_per_block)
+            return false;
+
+        uint32_t d_indirect_block = get_or_allocate_pointer_block(node->i_block[13], node, prefered_bgd);
+        node->i_block[13] = d_indirect_block;
+        if (d_indirect_block == 0)
+            return false;
+
+        EXT2_SCRATCH_BLOCK(uint32_t, d_indirect_table);
+        ext2_read_blocks(d_indirect_table, d_indirect_block, 1);
+        uint32_t index = logical / g_pointers_per_block;
+        table_block = get_or_allocate_pointer_block(d_indirect_table[index], node, prefered_bgd);
+        if (table_block != d_indirect_table[index])
+        {
+            d_indirect_table[index] = table_block;
+            ext2_write_blocks(d_indirect_table, d_indirect_block, 1);
+        }
+        logical %= g_pointers_per_block;
+    }
+    if (table_block == 0)
+        return false;
+
+    EXT2_SCRATCH_BLOCK(uint32_t, table);
+    ext2_read_blocks(table, table_block, 1);
+    table[logical] = block;
+    ext2_write_blocks(table, table_block, 1);
+    return true;
+}
+
+/**
+ * @brief allocate one more block at the end of a directory, caller fills it and syncs the inode
+ * @return block number, 0 if the disk is full
+ */
+static uint32_t append_directory_block(struct EXT2Inode *dir, uint32_t dir_inode_num)
+{
+    uint32_t prefered_bgd = inode_to_bgd(dir_inode_num);
+    uint32_t new_block = allocate_block(prefered_bgd);
+    if (new_block == 0)
+        return 0;
+
+    if (!set_inode_block(dir, prefered_bgd, dir->i_size / g_block_size, new_block))
+    {
+        deallocate_blocks(&new_block, 1);
+        return 0;
+    }
+    dir->i_size += g_block_size;
+    dir->i_blocks += g_sectors_per_block;
+    return new_block;
+}
+
+/* -- One directory block, shared by linear directories and htree leaves -- */
+
+static uint32_t find_entry_in_block(uint8_t *block, const char *name, uint8_t name_len)
+{
+    uint32_t offset = 0;
+    while (offset < g_block_size)
+    {
+        struct EXT2DirectoryEntry *entry = get_directory_entry(block, offset);
+        if (entry->rec_len == 0)
+            break;
+
+        if (entry->inode != 0 && entry->name_len == name_len &&
+            memcmp(name, get_entry_name(entry), name_len) == 0)
+        {
+            return entry->inode;
+        }
+        offset += entry->rec_len;
+    }
+    return 0;
+}
+
+/**
+ * @brief put a new entry in the slack after an existing entry of the block
+ * @return false if no entry has enough slack
+ */
+static bool insert_entry_in_block(uint8_t *block, uint32_t inode, const char *name, uint8_t name_len, uint8_t file_type)
+{
+    uint16_t needed_len = get_entry_record_len(name_len);
+    uint32_t offset = 0;
+
+    while (offset < g_block_size)
+    {
+        struct EXT2DirectoryEntry *entry = get_directory_entry(block, offset);
+        if (entry->rec_len == 0)
+            break;
+
+        uint16_t actual_len = get_entry_record_len(entry->name_len);
+        uint16_t padding = entry->rec_len - actual_len;
+
+        if (padding >= needed_len)
+        {
+            uint16_t old_rec_len = entry->rec_len;
+            entry->rec_len = actual_len;
+
+            struct EXT2DirectoryEntry *new_entry = get_directory_entry(block, offset + actual_len);
+            new_entry->inode = inode;
+            new_entry->name_len = name_len;
+            new_entry->file_type = file_type;
+            new_entry->rec_len = old_rec_len - actual_len;
+            memcpy(get_entry_name(new_entry), name, name_len);
+            return true;
+        }
+        offset += entry->rec_len;
+    }
+    return false;
+}
+
+static bool remove_entry_in_block(uint8_t *block, const char *name, uint8_t name_len)
+{
+    uint32_t offset = 0;
+    struct EXT2DirectoryEntry *prev_entry = NULL;
+
+    while (offset < g_block_size)
+    {
+        struct EXT2DirectoryEntry *entry = get_directory_entry(block, offset);
+        if (entry->rec_len == 0)
+            break;
+
+        if (entry->inode != 0 && entry->name_len == name_len &&
+            memcmp(name, get_entry_name(entry), name_len) == 0)
+        {
+            uint16_t this_len = entry->rec_len;
+
+            if (prev_entry == NULL)
+            {
+                // first entry of a block keeps its rec_len so the block stays walkable
+                memset(entry, 0, this_len);
+                entry->rec_len = this_len;
+            }
+            else
+            {
+                prev_entry->rec_len += this_len;
+                memset(entry, 0, this_len);
+            }
+            return true;
+        }
+
+        prev_entry = entry;
+        offset += entry->rec_len;
+    }
+    return false;
+}
+
+/* -- Hashed directory index (htree) -- */
+
+/**
+ * DxFrame - Position taken in one index block (root or node) on the way from the root to a leaf
+ *
+ * @param physical_block Disk block of the index block
+ * @param block          Content of the index block, a buffer of the scratch pool
+ * @param entries        Index entries inside block, entry 0 holds the count & limit
+ * @param at             Entry followed to the next level
+ */
+struct DxFrame
+{
+    uint32_t physical_block;
+    struct EXT2BlockBuffer *block;
+    struct EXT2DxEntry *entries;
+    struct EXT2DxEntry *at;
+};
+
+// Live entry of a leaf being split, sorted by hash
+struct DxMapEntry
+{
+    uint32_t hash;
+    uint16_t offset;
+};
+
+static uint32_t dx_hash(const char *name, uint8_t name_len)
+{
+    uint32_t hash = 2166136261u;
+    for (uint8_t i = 0; i < name_len; i++)
+    {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash & ~EXT2_DX_HASH_CONTINUED;
+}
+
+static struct EXT2DxCountLimit *dx_countlimit(struct EXT2DxEntry *entries)
+{
+    return (struct EXT2DxCountLimit *)entries;
+}
+
+static struct EXT2DxRootInfo *dx_root_info(uint8_t *block)
+{
+    return (struct EXT2DxRootInfo *)(block + EXT2_DX_ROOT_INFO_OFFSET);
+}
+
+/**
+ * @brief check block 0 of a directory for an index root, directories without one are scanned linearly
+ */
+static bool is_indexed_directory(uint8_t *first_block)
+{
+    if ((g_superblock.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) == 0)
+        return false;
+
+    struct EXT2DirectoryEntry *entry_dot_dot = get_directory_entry(first_block, get_directory_entry(first_block, 0)->rec_len);
+    struct EXT2DxRootInfo *info = dx_root_info(first_block);
+    return entry_dot_dot->rec_len == g_block_size - 12 && info->reserved_zero == 0 &&
+           info->info_length == EXT2_DX_INFO_LENGTH && info->hash_version == EXT2_DX_HASH_FNV1A;
+}
+
+// Write an empty index node: one unused entry spanning the block, then count & limit
+static struct EXT2DxEntry *dx_init_node(uint8_t *block)
+{
+    memset(block, 0, g_block_size);
+    get_directory_entry(block, 0)->rec_len = g_block_size;
+    struct EXT2DxEntry *entries = (struct EXT2DxEntry *)(block + EXT2_DX_NODE_ENTRIES_OFFSET);
+    dx_countlimit(entries)->limit = EXT2_DX_NODE_LIMIT(g_block_size);
+    return entries;
+}
+
+static bool dx_load_frame(struct DxFrame *frame, uint32_t physical_block, bool is_root)
 {
+    if (physical_block == 0)
+        return false;
+    frame->physical_block = physical_block;
+    ext2_read_blocks(frame->block->buf, physical_block, 1);
+    uint32_t offset = is_root ? EXT2_DX_ROOT_ENTRIES_OFFSET : EXT2_DX_NODE_ENTRIES_OFFSET;
+    frame->entries = (struct EXT2DxEntry *)(frame->block->buf + offset);
+    frame->at = frame->entries;
+    return true;
+}
 
-    memset(buffer, 0, BLOCK_SIZE);
-    uint32_t current_block_size;
+/**
+ * @brief walk from the root to the leaf that holds hash, binary searching every index block
+ * @param frames one frame per level, frames[*levels].at is the leaf entry
+ * @return false if the index is damaged
+ */
+static bool dx_probe(struct EXT2Inode *dir, uint32_t hash, struct DxFrame *frames, uint8_t *levels)
+{
+    if (!dx_load_frame(&frames[0], dir->i_block[0], true))
+        return false;
+    *levels = dx_root_info(frames[0].block->buf)->indirect_levels;
+    if (*levels >= EXT2_DX_MAX_LEVELS)
+        return false;
 
-    for (int i = 0; i < 12; i++)
+    for (uint8_t level = 0;; level++)
     {
-        uint32_t block_num = parent_inode->i_block[i];
-        if (block_num == 0)
+        struct DxFrame *frame = &frames[level];
+        uint16_t count = dx_countlimit(frame->entries)->count;
+        if (count == 0)
+            return false;
+
+        // first entry with a bigger hash, entry 0 covers everything below entries[1].hash
+        uint16_t low = 1;
+        uint16_t high = count;
+        while (low < high)
         {
-            continue;
+            uint16_t mid = (low + high) / 2;
+            if (frame->entries[mid].hash > hash)
+                high = mid;
+            else
+                low = mid + 1;
         }
+        frame->at = &frame->entries[low - 1];
+
+        if (level == *levels)
+            return true;
+        if (!dx_load_frame(&frames[level + 1], get_inode_block(dir, frame->at->block), false))
+            return false;
+    }
+}
+
+/**
+ * @brief move to the next leaf if names of this hash continue there (the split landed inside a run of equal hashes)
+ */
+static bool dx_next_leaf(struct EXT2Inode *dir, struct DxFrame *frames, uint8_t levels, uint32_t hash)
+{
+    int8_t level = levels;
+    while (frames[level].at + 1 >= frames[level].entries + dx_countlimit(frames[level].entries)->count)
+    {
+        if (level == 0)
+            return false;
+        level--;
+    }
+
+    frames[level].at++;
+    uint32_t next_hash = frames[level].at->hash;
+    if ((next_hash & EXT2_DX_HASH_CONTINUED) == 0 || (next_hash & ~EXT2_DX_HASH_CONTINUED) != hash)
+        return false;
+
+    for (level++; level <= levels; level++)
+    {
+        if (!dx_load_frame(&frames[level], get_inode_block(dir, frames[level - 1].at->block), false))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief find the leaf holding name
+ * @param leaf output, content of that leaf
+ * @return disk block of the leaf, 0 if name is not in the directory
+ */
+static uint32_t dx_find_leaf(struct EXT2Inode *dir, const char *name, uint8_t name_len, uint8_t *leaf)
+{
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, root_block);
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, node_block);
+    struct DxFrame frames[EXT2_DX_MAX_LEVELS] = {{.block = root_block}, {.block = node_block}};
+    uint8_t levels;
+    uint32_t hash = dx_hash(name, name_len);
+    if (!dx_probe(dir, hash, frames, &levels))
+        return 0;
+
+    do
+    {
+        uint32_t leaf_block = get_inode_block(dir, frames[levels].at->block);
+        if (leaf_block == 0)
+            return 0;
+        ext2_read_blocks(leaf, leaf_block, 1);
+        if (find_entry_in_block(leaf, name, name_len) != 0)
+            return leaf_block;
+    } while (dx_next_leaf(dir, frames, levels, hash));
+
+    return 0;
+}
+
+// Insert an index entry right after frame->at and write the index block back
+static void dx_insert_index(struct DxFrame *frame, uint32_t hash, uint32_t logical_block)
+{
+    struct EXT2DxCountLimit *countlimit = dx_countlimit(frame->entries);
+    struct EXT2DxEntry *new_entry = frame->at + 1;
+    struct EXT2DxEntry *end = frame->entries + countlimit->count;
+
+    memmove(new_entry + 1, new_entry, (end - new_entry) * sizeof(struct EXT2DxEntry));
+    new_entry->hash = hash;
+    new_entry->block = logical_block;
+    countlimit->count++;
+    ext2_write_blocks(frame->block->buf, frame->physical_block, 1);
+}
+
+// Copy entries map[from..to) of src back to back into dst, the last one takes the rest of the block
+static void dx_pack_entries(uint8_t *dst, uint8_t *src, struct DxMapEntry *map, uint32_t from, uint32_t to)
+{
+    memset(dst, 0, g_block_size);
+    uint32_t offset = 0;
+    struct EXT2DirectoryEntry *last = get_directory_entry(dst, 0);
+
+    for (uint32_t i = from; i < to; i++)
+    {
+        struct EXT2DirectoryEntry *entry = get_directory_entry(src, map[i].offset);
+        uint16_t len = get_entry_record_len(entry->name_len);
+        memcpy(dst + offset, entry, len);
+        last = get_directory_entry(dst, offset);
+        last->rec_len = len;
+        offset += len;
+    }
+    last->rec_len += g_block_size - offset;
+}
+
+/**
+ * @brief move the upper half (by hash) of a full leaf to a new block and index it
+ * @param hash hash of the name being inserted, decides the split of a single entry leaf
+ */
+static int8_t dx_split_leaf(struct EXT2Inode *dir, uint32_t dir_inode_num, struct DxFrame *frame,
+                            uint32_t leaf_block, uint8_t *leaf, uint32_t hash)
+{
+    EXT2_SCRATCH_BLOCK(struct DxMapEntry, map); // EXT2_MAX_BLOCK_SIZE / 12 entries at most, they fit one block
+    uint32_t count = 0;
+    uint32_t offset = 0;
 
-        if (parent_inode->i_size < (uint32_t)(i + 1) * BLOCK_SIZE)
+    while (offset < g_block_size)
+    {
+        struct EXT2DirectoryEntry *entry = get_directory_entry(leaf, offset);
+        if (entry->rec_len == 0)
+            break;
+        if (entry->inode != 0)
         {
-            current_block_size = parent_inode->i_size % BLOCK_SIZE;
+            map[count].hash = dx_hash(get_entry_name(entry), entry->name_len);
+            map[count].offset = offset;
+            count++;
         }
-        else
+        offset += entry->rec_len;
+    }
+    if (count == 0)
+        return -1;
+
+    for (uint32_t i = 1; i < count; i++)
+    {
+        struct DxMapEntry key = map[i];
+        int32_t j = (int32_t)i - 1;
+        while (j >= 0 && map[j].hash > key.hash)
         {
-            current_block_size = BLOCK_SIZE;
+            map[j + 1] = map[j];
+            j--;
         }
+        map[j + 1] = key;
+    }
+
+    uint32_t split = count / 2;
+    uint32_t split_hash;
+    if (count == 1)
+    {
+        // a single long name fills the leaf, put the new name alone on its side
+        split = hash < map[0].hash ? 0 : 1;
+        split_hash = split == 0 ? map[0].hash : hash;
+    }
+    else
+    {
+        split_hash = map[split].hash;
+    }
+    if (split > 0 && map[split - 1].hash == split_hash)
+        split_hash |= EXT2_DX_HASH_CONTINUED;
+
+    uint32_t new_logical = dir->i_size / g_block_size;
+    uint32_t new_block = append_directory_block(dir, dir_inode_num);
+    if (new_block == 0)
+        return -1;
+    sync_node(dir, dir_inode_num);
+
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, half);
+    dx_pack_entries(half->buf, leaf, map, split, count);
+    ext2_write_blocks(half->buf, new_block, 1);
+    dx_pack_entries(half->buf, leaf, map, 0, split);
+    ext2_write_blocks(half->buf, leaf_block, 1);
+
+    dx_insert_index(frame, split_hash, new_logical);
+    return 0;
+}
+
+/**
+ * @brief root is full and has no node level yet: move its entries to a new index node below it
+ */
+static int8_t dx_grow_root(struct EXT2Inode *dir, uint32_t dir_inode_num, struct DxFrame *root)
+{
+    uint32_t new_logical = dir->i_size / g_block_size;
+    uint32_t new_block = append_directory_block(dir, dir_inode_num);
+    if (new_block == 0)
+        return -1;
+    sync_node(dir, dir_inode_num);
+
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, node);
+    struct EXT2DxEntry *node_entries = dx_init_node(node->buf);
+    uint16_t count = dx_countlimit(root->entries)->count;
+    memcpy(node_entries, root->entries, count * sizeof(struct EXT2DxEntry));
+    dx_countlimit(node_entries)->limit = EXT2_DX_NODE_LIMIT(g_block_size);
+    ext2_write_blocks(node->buf, new_block, 1);
+
+    dx_countlimit(root->entries)->count = 1;
+    root->entries[0].block = new_logical;
+    dx_root_info(root->block->buf)->indirect_levels = 1;
+    ext2_write_blocks(root->block->buf, root->physical_block, 1);
+    return 0;
+}
+
+/**
+ * @brief move the upper half of a full index node to a new node and index it in the root
+ */
+static int8_t dx_split_node(struct EXT2Inode *dir, uint32_t dir_inode_num, struct DxFrame *root, struct DxFrame *node)
+{
+    uint32_t new_logical = dir->i_size / g_block_size;
+    uint32_t new_block = append_directory_block(dir, dir_inode_num);
+    if (new_block == 0)
+        return -1;
+    sync_node(dir, dir_inode_num);
+
+    struct EXT2DxCountLimit *countlimit = dx_countlimit(node->entries);
+    uint16_t split = countlimit->count / 2;
+    uint32_t split_hash = node->entries[split].hash;
+
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, new_node);
+    struct EXT2DxEntry *new_entries = dx_init_node(new_node->buf);
+    new_entries[0].block = node->entries[split].block;
+    memcpy(&new_entries[1], &node->entries[split + 1], (countlimit->count - split - 1) * sizeof(struct EXT2DxEntry));
+    dx_countlimit(new_entries)->count = countlimit->count - split;
+    ext2_write_blocks(new_node->buf, new_block, 1);
+
+    countlimit->count = split;
+    ext2_write_blocks(node->block->buf, node->physical_block, 1);
+
+    dx_insert_index(root, split_hash, new_logical);
+    return 0;
+}
+
+static int8_t dx_add_entry(struct EXT2Inode *dir, uint32_t dir_inode_num,
+                           uint32_t new_inode_num, const char *name, uint8_t name_len, uint8_t file_type)
+{
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, root_block);
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, node_block);
+    struct DxFrame frames[EXT2_DX_MAX_LEVELS] = {{.block = root_block}, {.block = node_block}};
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, leaf);
+    uint8_t levels;
+    uint32_t hash = dx_hash(name, name_len);
+
+    // every pass either inserts the entry or makes room one level up, then probes again
+    for (uint8_t pass = 0; pass < 8; pass++)
+    {
+        if (!dx_probe(dir, hash, frames, &levels))
+            return -1;
 
-        read_blocks(buffer, block_num, 1);
+        struct DxFrame *frame = &frames[levels];
+        uint32_t leaf_block = get_inode_block(dir, frame->at->block);
+        if (leaf_block == 0)
+            return -1;
+        ext2_read_blocks(leaf->buf, leaf_block, 1);
 
-        uint32_t offset = 0;
-        while (offset < current_block_size)
+        if (insert_entry_in_block(leaf->buf, new_inode_num, name, name_len, file_type))
         {
-            struct EXT2DirectoryEntry *entry = get_directory_entry(buffer, offset);
+            ext2_write_blocks(leaf->buf, leaf_block, 1);
+            return 0;
+        }
 
-            if (entry->inode == 0)
-            {
-                offset += entry->rec_len;
-                continue;
-            }
+        struct EXT2DxCountLimit *countlimit = dx_countlimit(frame->entries);
+        int8_t result;
+        if (countlimit->count < countlimit->limit)
+            result = dx_split_leaf(dir, dir_inode_num, frame, leaf_block, leaf->buf, hash);
+        else if (levels == 0)
+            result = dx_grow_root(dir, dir_inode_num, &frames[0]);
+        else if (dx_countlimit(frames[0].entries)->count < dx_countlimit(frames[0].entries)->limit)
+            result = dx_split_node(dir, dir_inode_num, &frames[0], &frames[1]);
+        else
+            result = -1; // index full, EXT2_DX_ROOT_LIMIT * EXT2_DX_NODE_LIMIT leaves
 
-            if (entry->name_len == name_len &&
-                memcmp(name, get_entry_name(entry), name_len) == 0)
-            {
-                return entry->inode;
-            }
+        if (result != 0)
+            return -1;
+    }
+    return -1;
+}
+
+/**
+ * @brief turn a full one block linear directory into an indexed one: its entries move to a single leaf
+ * (logical block 1) and block 0 becomes the index root
+ */
+static int8_t dx_make_indexed(struct EXT2Inode *dir, uint32_t dir_inode_num)
+{
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, root);
+    ext2_read_blocks(root->buf, dir->i_block[0], 1);
+
+    uint32_t leaf_block = append_directory_block(dir, dir_inode_num);
+    if (leaf_block == 0)
+        return -1;
+    sync_node(dir, dir_inode_num);
+
+    EXT2_SCRATCH_BLOCK(struct DxMapEntry, map); // EXT2_MAX_BLOCK_SIZE / 12 entries at most, they fit one block
+    uint32_t count = 0;
+    uint32_t offset = get_dir_first_child_offset(root->buf);
+    while (offset < g_block_size)
+    {
+        struct EXT2DirectoryEntry *entry = get_directory_entry(root->buf, offset);
+        if (entry->rec_len == 0)
+            break;
+        if (entry->inode != 0)
+            map[count++].offset = offset;
+        offset += entry->rec_len;
+    }
+
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, leaf);
+    dx_pack_entries(leaf->buf, root->buf, map, 0, count);
+    ext2_write_blocks(leaf->buf, leaf_block, 1);
+
+    uint32_t dot_rec_len = get_directory_entry(root->buf, 0)->rec_len;
+    struct EXT2DirectoryEntry *entry_dot_dot = get_directory_entry(root->buf, dot_rec_len);
+    entry_dot_dot->rec_len = g_block_size - dot_rec_len;
+    memset(root->buf + EXT2_DX_ROOT_INFO_OFFSET, 0, g_block_size - EXT2_DX_ROOT_INFO_OFFSET);
+
+    struct EXT2DxRootInfo *info = dx_root_info(root->buf);
+    info->hash_version = EXT2_DX_HASH_FNV1A;
+    info->info_length = EXT2_DX_INFO_LENGTH;
+    struct EXT2DxEntry *entries = (struct EXT2DxEntry *)(root->buf + EXT2_DX_ROOT_ENTRIES_OFFSET);
+    dx_countlimit(entries)->limit = EXT2_DX_ROOT_LIMIT(g_block_size);
+    dx_countlimit(entries)->count = 1;
+    entries[0].block = 1;
+    ext2_write_blocks(root->buf, dir->i_block[0], 1);
+    return 0;
+}
+
+bool is_directory_empty(uint32_t inode)
+{
+    struct EXT2Inode dir_inode;
+    read_inode(inode, &dir_inode);
+
+    if ((dir_inode.i_mode & EXT2_S_IFDIR) == 0)
+    {
+        return false;
+    }
+
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, dir_block);
+    uint32_t block_count = dir_inode.i_size / g_block_size;
+    for (uint32_t i = 0; i < block_count; i++)
+    {
+        uint32_t block_num = get_inode_block(&dir_inode, i);
+        if (block_num == 0)
+            continue;
 
+        ext2_read_blocks(dir_block->buf, block_num, 1);
+        uint32_t offset = (i == 0) ? get_dir_first_child_offset(dir_block->buf) : 0;
+        while (offset < g_block_size)
+        {
+            struct EXT2DirectoryEntry *entry = get_directory_entry(dir_block->buf, offset);
+            if (entry->rec_len == 0)
+                break;
+            if (entry->inode != 0)
+                return false;
             offset += entry->rec_len;
         }
     }
 
+    return true;
+};
+
+uint32_t find_inode_by_name(struct EXT2Inode *parent_inode, const char *name, uint8_t name_len)
+{
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, dir_block);
+    if (parent_inode->i_block[0] == 0)
+        return 0;
+
+    ext2_read_blocks(dir_block->buf, parent_inode->i_block[0], 1);
+
+    // "." and ".." live in block 0, an index root is not a leaf the hash leads to
+    if (name_len <= 2 && name[0] == '.' && (name_len == 1 || name[1] == '.'))
+        return find_entry_in_block(dir_block->buf, name, name_len);
+
+    if (is_indexed_directory(dir_block->buf))
+    {
+        if (dx_find_leaf(parent_inode, name, name_len, dir_block->buf) == 0)
+            return 0;
+        return find_entry_in_block(dir_block->buf, name, name_len);
+    }
+
+    uint32_t block_count = parent_inode->i_size / g_block_size;
+    for (uint32_t i = 0; i < block_count; i++)
+    {
+        if (i > 0)
+        {
+            uint32_t block_num = get_inode_block(parent_inode, i);
+            if (block_num == 0)
+                continue;
+            ext2_read_blocks(dir_block->buf, block_num, 1);
+        }
+
+        uint32_t inode = find_entry_in_block(dir_block->buf, name, name_len);
+        if (inode != 0)
+            return inode;
+    }
+
     return 0;
 }
 
+uint32_t ext2_lookup(uint32_t parent_inode_num, const char *name, uint8_t name_len)
+{
+    uint32_t child_inode_num;
+    if (dentry_cache_lookup(parent_inode_num, name, name_len, &child_inode_num))
+        return child_inode_num;
+
+    struct EXT2Inode parent_inode;
+    read_inode(parent_inode_num, &parent_inode);
+    if ((parent_inode.i_mode & EXT2_S_IFDIR) == 0)
+        return 0;
+
+    child_inode_num = find_inode_by_name(&parent_inode, name, name_len);
+    dentry_cache_insert(parent_inode_num, name, name_len, child_inode_num);
+    return child_inode_num;
+}
+
+uint32_t ext2_resolve_path(const char *path)
+{
+    uint32_t current_inode_num = ROOT_INODE_NUM;
+    const char *component = path;
+
+    while (*component != '\0')
+    {
+        if (*component == '/')
+        {
+            component++;
+            continue;
+        }
+
+        const char *end = component;
+        while (*end != '\0' && *end != '/')
+            end++;
+        if (end - component > 255)
+            return 0;
+
+        // ext2_lookup refuses to look inside anything but a directory, so "file/x" fails here
+        current_inode_num = ext2_lookup(current_inode_num, component, (uint8_t)(end - component));
+        if (current_inode_num == 0)
+            return 0;
+        component = end;
+    }
+
+    return current_inode_num;
+}
+
 int8_t read_directory(struct EXT2DriverRequest *prequest)
 {
     struct EXT2Inode parent_inode;
@@ -427,8 +2053,8 @@ int8_t read_directory(struct EXT2DriverRequest *prequest)
         return 3; // 3: parent folder invalid
     }
 
-    uint32_t target_inode_num = find_inode_by_name(
-        &parent_inode, prequest->name, prequest->name_len);
+    uint32_t target_inode_num = ext2_lookup(
+        prequest->parent_inode, prequest->name, prequest->name_len);
 
     if (target_inode_num == 0)
     {
@@ -449,20 +2075,20 @@ int8_t read_directory(struct EXT2DriverRequest *prequest)
     }
 
     uint32_t bytes_copied = 0;
-    uint8_t temp_buffer[BLOCK_SIZE];
+    EXT2_SCRATCH_BLOCK(uint8_t, temp_buffer);
 
-    for (int i = 0; i < 12; i++)
+    for (uint32_t i = 0; bytes_copied < target_inode.i_size; i++)
     {
-        uint32_t block_num = target_inode.i_block[i];
-        if (block_num == 0 || bytes_copied >= target_inode.i_size)
+        uint32_t block_num = get_inode_block(&target_inode, i);
+        if (block_num == 0)
         {
             break;
         }
 
-        read_blocks(temp_buffer, block_num, 1);
+        ext2_read_blocks(temp_buffer, block_num, 1);
 
-        uint32_t bytes_to_copy = BLOCK_SIZE;
-        if (bytes_copied + BLOCK_SIZE > target_inode.i_size)
+        uint32_t bytes_to_copy = g_block_size;
+        if (bytes_copied + g_block_size > target_inode.i_size)
         {
             bytes_to_copy = target_inode.i_size - bytes_copied;
         }
@@ -479,6 +2105,148 @@ int8_t read_directory(struct EXT2DriverRequest *prequest)
     return 0; // 0: success
 };
 
+int8_t read_directory_entries(uint32_t dir_inode, uint32_t *cookie, struct EXT2DirentRecord *records, uint32_t max_records,
+                              uint32_t *count)
+{
+    *count = 0;
+
+    struct EXT2Inode dir;
+    read_inode(dir_inode, &dir);
+    if ((dir.i_mode & EXT2_S_IFDIR) == 0)
+    {
+        return 1; // 1: not a folder
+    }
+
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, block);
+    uint32_t position = *cookie;
+    while (position < dir.i_size && *count < max_records)
+    {
+        uint32_t block_num = get_inode_block(&dir, position / g_block_size);
+        if (block_num == 0)
+        {
+            position = (position / g_block_size + 1) * g_block_size;
+            continue;
+        }
+        ext2_read_blocks(block->buf, block_num, 1);
+
+        uint32_t offset = position % g_block_size;
+        while (offset + sizeof(struct EXT2DirectoryEntry) <= g_block_size && *count < max_records)
+        {
+            struct EXT2DirectoryEntry *entry = get_directory_entry(block->buf, offset);
+            if (entry->rec_len < sizeof(struct EXT2DirectoryEntry))
+            {
+                break; // a cookie from before the folder changed can land inside an entry
+            }
+            offset += entry->rec_len;
+
+            // removed entries and htree index blocks
+            char *name = get_entry_name(entry);
+            if (entry->inode == 0 || (entry->name_len == 1 && name[0] == '.') ||
+                (entry->name_len == 2 && name[0] == '.' && name[1] == '.'))
+            {
+                continue;
+            }
+
+            struct EXT2Inode node;
+            read_inode(entry->inode, &node);
+
+            struct EXT2DirentRecord *record = &records[(*count)++];
+            record->inode = entry->inode;
+            record->size = node.i_size;
+            record->file_type = (node.i_mode & EXT2_S_IFDIR) != 0 ? EXT2_FT_DIR : EXT2_FT_REG_FILE;
+            record->name_len = entry->name_len;
+            memcpy(record->name, name, entry->name_len);
+            record->name[entry->name_len] = '\0';
+        }
+
+        // the rest of a block is skipped once its entries are copied or it turns out unreadable
+        position = offset < g_block_size && *count == max_records ? (position / g_block_size) * g_block_size + offset
+                                                                  : (position / g_block_size + 1) * g_block_size;
+    }
+
+    *cookie = position;
+    return 0; // 0: success
+}
+
+/**
+ * @brief queue the read of one data block of a file being read into buf, a partial last block goes to tail_buffer.
+ * Block 0 is a hole, it reads as zero without touching the disk
+ * @return bytes_copied advanced past the block
+ */
+static uint32_t queue_data_block_read(void *buf, uint32_t bytes_copied, uint32_t size, uint32_t block, uint8_t *tail_buffer)
+{
+    uint8_t *dst = size - bytes_copied >= g_block_size ? (uint8_t *)buf + bytes_copied : tail_buffer;
+    if (block == 0)
+        memset(dst, 0, g_block_size);
+    else
+        ext2_queue_read(dst, block);
+    return bytes_copied + (size - bytes_copied > g_block_size ? g_block_size : size - bytes_copied);
+}
+
+/**
+ * @brief queue reads of the file blocks under one pointer table, a 0 table maps a hole as long as its whole span
+ * @param depth 0 for a data block, 1 for an indirect block, 2 for a doubly indirect block
+ * @return bytes_copied advanced past the span, or to size
+ */
+static uint32_t queue_pointer_table_reads(uint32_t table_block, uint32_t depth, void *buf, uint32_t bytes_copied,
+                                          uint32_t size, uint8_t *tail_buffer)
+{
+    if (depth == 0)
+        return queue_data_block_read(buf, bytes_copied, size, table_block, tail_buffer);
+
+    EXT2_SCRATCH_BLOCK(uint32_t, table);
+    if (table_block != 0)
+        ext2_read_blocks(table, table_block, 1);
+    else
+        memset(table, 0, g_block_size);
+
+    for (uint32_t i = 0; i < g_pointers_per_block && bytes_copied < size; i++)
+        bytes_copied = queue_pointer_table_reads(table[i], depth - 1, buf, bytes_copied, size, tail_buffer);
+    return bytes_copied;
+}
+
+/**
+ * @brief queue reads of the first size bytes of a block mapped (direct and indirect blocks) file, 0 entries are holes
+ * @return bytes queued, less than size if the file is past the doubly indirect range
+ */
+static uint32_t queue_block_map_reads(struct EXT2Inode *node, void *buf, uint32_t size, uint8_t *tail_buffer)
+{
+    uint32_t bytes_copied = 0;
+    for (uint32_t i = 0; i < 12 && bytes_copied < size; i++)
+        bytes_copied = queue_data_block_read(buf, bytes_copied, size, node->i_block[i], tail_buffer);
+    if (bytes_copied < size)
+        bytes_copied = queue_pointer_table_reads(node->i_block[12], 1, buf, bytes_copied, size, tail_buffer);
+    if (bytes_copied < size)
+        bytes_copied = queue_pointer_table_reads(node->i_block[13], 2, buf, bytes_copied, size, tail_buffer);
+    return bytes_copied;
+}
+
+/**
+ * @brief queue reads of the first size bytes of an extent mapped file, one run of reads per extent.
+ * File blocks between extents and after the last one are holes
+ * @return bytes queued, always size
+ */
+static uint32_t queue_extent_reads(struct EXT2Inode *node, void *buf, uint32_t size, uint8_t *tail_buffer)
+{
+    uint32_t leaves[EXT2_EXTENT_INODE_ENTRIES];
+    uint32_t leaf_count;
+    uint32_t count = load_extents(node, leaves, &leaf_count);
+
+    uint32_t bytes_copied = 0;
+    for (uint32_t e = 0; e < count && bytes_copied < size; e++)
+    {
+        struct EXT2Extent *extent = &g_extent_list[e];
+        while (bytes_copied < size && bytes_copied / g_block_size < extent->ee_block)
+            bytes_copied = queue_data_block_read(buf, bytes_copied, size, 0, tail_buffer);
+
+        for (uint32_t j = 0; j < extent->ee_len && bytes_copied < size; j++)
+            bytes_copied = queue_data_block_read(buf, bytes_copied, size, extent->ee_start + j, tail_buffer);
+    }
+    while (bytes_copied < size)
+        bytes_copied = queue_data_block_read(buf, bytes_copied, size, 0, tail_buffer);
+    return bytes_copied;
+}
+
 int8_t read(struct EXT2DriverRequest request)
 {
     struct EXT2Inode parent_inode;
@@ -489,8 +2257,8 @@ int8_t read(struct EXT2DriverRequest request)
         return 4; // 4: parent folder invalid
     }
 
-    uint32_t target_inode_num = find_inode_by_name(
-        &parent_inode, request.name, request.name_len);
+    uint32_t target_inode_num = ext2_lookup(
+        request.parent_inode, request.name, request.name_len);
 
     if (target_inode_num == 0)
     {
@@ -515,242 +2283,335 @@ int8_t read(struct EXT2DriverRequest request)
     }
     bytes_to_read = target_inode.i_size;
 
-    uint32_t bytes_copied = 0;
-    uint8_t temp_buffer[BLOCK_SIZE];
-    uint32_t pointers_per_block = BLOCK_SIZE / sizeof(uint32_t);
-
-    for (int i = 0; i < 12; i++)
+    struct EXT2DelayedFile *delayed = delayed_find(target_inode_num);
+    if (delayed != NULL)
     {
-        if (bytes_copied >= bytes_to_read)
-            break;
-
-        uint32_t block_num = target_inode.i_block[i];
-        if (block_num == 0)
-            break;
-
-        read_blocks(temp_buffer, block_num, 1);
+        memcpy(request.buf, g_delayed_pool + delayed->start, bytes_to_read);
+        return 0;
+    }
 
-        uint32_t bytes_this_block = (bytes_to_read - bytes_copied > BLOCK_SIZE)
-                                        ? BLOCK_SIZE
-                                        : (bytes_to_read - bytes_copied);
+    EXT2_SCRATCH_BLOCK(uint8_t, tail_buffer);
+    uint32_t bytes_copied;
+    if (uses_extents(&target_inode))
+        bytes_copied = queue_extent_reads(&target_inode, request.buf, bytes_to_read, tail_buffer);
+    else
+        bytes_copied = queue_block_map_reads(&target_inode, request.buf, bytes_to_read, tail_buffer);
 
-        memcpy((char *)request.buf + bytes_copied, temp_buffer, bytes_this_block);
-        bytes_copied += bytes_this_block;
+    block_queue_dispatch();
+    if (bytes_to_read % g_block_size != 0 && bytes_copied == bytes_to_read)
+    {
+        uint32_t tail_offset = bytes_to_read - (bytes_to_read % g_block_size);
+        memcpy((char *)request.buf + tail_offset, tail_buffer, bytes_to_read % g_block_size);
     }
 
-    if (bytes_copied < bytes_to_read && target_inode.i_block[12] != 0)
+    if (bytes_copied < bytes_to_read)
     {
-        uint32_t indirect_block[pointers_per_block];
-        read_blocks(indirect_block, target_inode.i_block[12], 1);
-
-        for (int j = 0; j < (int)pointers_per_block; j++)
-        {
-            if (bytes_copied >= bytes_to_read)
-                break;
-
-            uint32_t block_num = indirect_block[j];
-            if (block_num == 0)
-                break;
+        return -1; // -1 unknown
+    }
 
-            read_blocks(temp_buffer, block_num, 1);
+    return 0; // 0: success
+};
 
-            uint32_t bytes_this_block = (bytes_to_read - bytes_copied > BLOCK_SIZE)
-                                            ? BLOCK_SIZE
-                                            : (bytes_to_read - bytes_copied);
+int8_t read_at(uint32_t inode_num, void *buf, uint32_t offset, uint32_t length, uint32_t *bytes_read)
+{
+    *bytes_read = 0;
 
-            memcpy((char *)request.buf + bytes_copied, temp_buffer, bytes_this_block);
-            bytes_copied += bytes_this_block;
-        }
+    struct EXT2Inode node;
+    read_inode(inode_num, &node);
+    if ((node.i_mode & EXT2_S_IFREG) == 0)
+    {
+        return 1; // 1: not a file
     }
 
-    if (bytes_copied < bytes_to_read && target_inode.i_block[13] != 0)
+    if (offset >= node.i_size)
     {
-        uint32_t d_indirect_block[pointers_per_block];
-        read_blocks(d_indirect_block, target_inode.i_block[13], 1);
-
-        for (int j = 0; j < (int)pointers_per_block; j++)
-        {
-            if (bytes_copied >= bytes_to_read)
-                break;
-            if (d_indirect_block[j] == 0)
-                continue;
-
-            uint32_t indirect_block[pointers_per_block];
-            read_blocks(indirect_block, d_indirect_block[j], 1);
-
-            for (int k = 0; k < (int)pointers_per_block; k++)
-            {
-                if (bytes_copied >= bytes_to_read)
-                    break;
-
-                uint32_t block_num = indirect_block[k];
-                if (block_num == 0)
-                    break;
-
-                read_blocks(temp_buffer, block_num, 1);
-
-                uint32_t bytes_this_block = (bytes_to_read - bytes_copied > BLOCK_SIZE)
-                                                ? BLOCK_SIZE
-                                                : (bytes_to_read - bytes_copied);
+        return 0; // end of file
+    }
+    if (length > node.i_size - offset)
+    {
+        length = node.i_size - offset;
+    }
 
-                memcpy((char *)request.buf + bytes_copied, temp_buffer, bytes_this_block);
-                bytes_copied += bytes_this_block;
-            }
-        }
+    struct EXT2DelayedFile *delayed = delayed_find(inode_num);
+    if (delayed != NULL)
+    {
+        memcpy(buf, g_delayed_pool + delayed->start + offset, length);
+        *bytes_read = length;
+        return 0;
     }
 
-    if (bytes_copied < bytes_to_read)
+    // only the first and the last block of the range can be partial, they are read aside and copied after dispatch.
+    // Data blocks always go through the block queue, never the block cache, like read()
+    EXT2_SCRATCH_BLOCK(uint8_t, head_buffer);
+    EXT2_SCRATCH_BLOCK(uint8_t, tail_buffer);
+    uint32_t head_offset = offset % g_block_size;
+    uint32_t head_length = 0;
+    uint32_t tail_length = 0;
+
+    uint8_t *dst = (uint8_t *)buf;
+    uint32_t done = 0;
+    while (done < length)
     {
-        return -1; // -1 unknown
+        uint32_t position = offset + done;
+        uint32_t in_block = position % g_block_size;
+        uint32_t chunk = g_block_size - in_block;
+        if (chunk > length - done)
+            chunk = length - done;
+
+        uint32_t block = get_inode_block(&node, position / g_block_size);
+        if (block == 0)
+        {
+            memset(dst + done, 0, chunk); // hole
+        }
+        else if (chunk == g_block_size)
+        {
+            ext2_queue_read(dst + done, block);
+        }
+        else if (done == 0)
+        {
+            ext2_queue_read(head_buffer, block);
+            head_length = chunk;
+        }
+        else
+        {
+            ext2_queue_read(tail_buffer, block);
+            tail_length = chunk;
+        }
+        done += chunk;
     }
+    block_queue_dispatch();
 
+    if (head_length != 0)
+        memcpy(dst, head_buffer + head_offset, head_length);
+    if (tail_length != 0)
+        memcpy(dst + length - tail_length, tail_buffer, tail_length);
+
+    *bytes_read = length;
     return 0; // 0: success
-};
+}
 
-uint32_t allocate_block(uint32_t prefered_bgd)
+// free blocks that are not reserved by delayed files, the only ones an allocation may take
+static uint32_t unreserved_free_blocks(void)
 {
-    uint8_t bitmap_buffer[BLOCK_SIZE];
+    return g_superblock.s_free_blocks_count > g_delayed_reserved ? g_superblock.s_free_blocks_count - g_delayed_reserved : 0;
+}
 
-    if (g_bgd_table[prefered_bgd].bg_free_blocks_count > 0)
-    {
-        read_blocks(bitmap_buffer, g_bgd_table[prefered_bgd].bg_block_bitmap, 1);
-        for (uint32_t i = 0; i < BLOCKS_PER_GROUP; i++)
-        {
-            if (get_bit(bitmap_buffer, i) == 0)
-            {
-                set_bit(bitmap_buffer, i);
-                write_blocks(bitmap_buffer, g_bgd_table[prefered_bgd].bg_block_bitmap, 1);
+// Take the first free block of group g, 0 if the group is full
+static uint32_t allocate_block_in_group(uint32_t g)
+{
+    if (g_bgd_table[g].bg_free_blocks_count == 0)
+        return 0;
 
-                g_bgd_table[prefered_bgd].bg_free_blocks_count--;
-                g_superblock.s_free_blocks_count--;
+    int32_t bit = claim_first_free_bit(g_bgd_table[g].bg_block_bitmap, g_superblock.s_blocks_per_group);
+    if (bit < 0)
+        return 0;
 
-                return (prefered_bgd * BLOCKS_PER_GROUP) + i;
-            }
-        }
+    g_bgd_table[g].bg_free_blocks_count--;
+    g_superblock.s_free_blocks_count--;
+    return (g * g_superblock.s_blocks_per_group) + bit;
+}
+
+uint32_t allocate_block(uint32_t prefered_bgd)
+{
+    if (unreserved_free_blocks() == 0)
+        return 0; // Disk penuh
+
+    uint32_t block = allocate_block_in_group(prefered_bgd);
+    for (uint32_t g = 0; block == 0 && g < g_groups_count; g++)
+    {
+        block = allocate_block_in_group(g);
     }
+    return block; // 0: Disk penuh
+}
 
-    for (uint32_t g = 0; g < GROUPS_COUNT; g++)
+uint32_t allocate_blocks(uint32_t prefered_bgd, uint32_t wanted, uint32_t *count)
+{
+    uint32_t best_group = 0;
+    uint32_t best_start = 0;
+    uint32_t best_length = 0;
+    if (wanted > unreserved_free_blocks())
+        wanted = unreserved_free_blocks();
+
+    // groups are tried from the preferred one onwards, the first that holds the whole run wins
+    for (uint32_t i = 0; i < g_groups_count && best_length < wanted; i++)
     {
-        if (g_bgd_table[g].bg_free_blocks_count > 0)
+        uint32_t g = (prefered_bgd + i) % g_groups_count;
+        if (g_bgd_table[g].bg_free_blocks_count <= best_length)
+            continue;
+
+        uint32_t start;
+        struct EXT2BitmapCacheEntry *bitmap = get_bitmap(g_bgd_table[g].bg_block_bitmap);
+        uint32_t length = find_free_run(bitmap->words, g_superblock.s_blocks_per_group, wanted, &start);
+        if (length > best_length)
         {
-            read_blocks(bitmap_buffer, g_bgd_table[g].bg_block_bitmap, 1);
-            for (uint32_t i = 0; i < BLOCKS_PER_GROUP; i++)
-            {
-                if (get_bit(bitmap_buffer, i) == 0)
-                {
-                    set_bit(bitmap_buffer, i);
-                    write_blocks(bitmap_buffer, g_bgd_table[g].bg_block_bitmap, 1);
-                    g_bgd_table[g].bg_free_blocks_count--;
-                    g_superblock.s_free_blocks_count--;
-                    return (g * BLOCKS_PER_GROUP) + i;
-                }
-            }
+            best_group = g;
+            best_start = start;
+            best_length = length;
         }
     }
 
-    return 0; // Disk penuh
+    *count = best_length;
+    if (best_length == 0)
+        return 0; // Disk penuh
+
+    struct EXT2BitmapCacheEntry *bitmap = get_bitmap(g_bgd_table[best_group].bg_block_bitmap);
+    set_bit_range(bitmap->words, best_start, best_length);
+    mark_bitmap_dirty(bitmap);
+
+    g_bgd_table[best_group].bg_free_blocks_count -= best_length;
+    g_superblock.s_free_blocks_count -= best_length;
+    return (best_group * g_superblock.s_blocks_per_group) + best_start;
+}
+
+/**
+ * @brief allocate_blocks() that first tries the free run starting exactly at goal,
+ * so a file growing at its end stays contiguous (and its last extent just gets longer)
+ * @param goal wanted first block, 0 for no goal
+ */
+static uint32_t allocate_blocks_near(uint32_t goal, uint32_t prefered_bgd, uint32_t wanted, uint32_t *count)
+{
+    uint32_t group = goal / g_superblock.s_blocks_per_group;
+    uint32_t bit = goal % g_superblock.s_blocks_per_group;
+    if (goal == 0 || goal >= g_superblock.s_blocks_count || g_bgd_table[group].bg_free_blocks_count == 0)
+        return allocate_blocks(prefered_bgd, wanted, count);
+
+    struct EXT2BitmapCacheEntry *bitmap = get_bitmap(g_bgd_table[group].bg_block_bitmap);
+    uint32_t end = find_next_bit(bitmap->words, g_superblock.s_blocks_per_group, bit, true);
+    if (end == bit)
+        return allocate_blocks(prefered_bgd, wanted, count);
+
+    uint32_t length = end - bit < wanted ? end - bit : wanted;
+    if (length > unreserved_free_blocks())
+        return allocate_blocks(prefered_bgd, wanted, count);
+    set_bit_range(bitmap->words, bit, length);
+    mark_bitmap_dirty(bitmap);
+    g_bgd_table[group].bg_free_blocks_count -= length;
+    g_superblock.s_free_blocks_count -= length;
+    *count = length;
+    return goal;
 }
 
 static int8_t add_entry_to_directory(struct EXT2Inode *parent_inode, uint32_t parent_inode_num,
                                      uint32_t new_inode_num, const char *name, uint8_t name_len, uint8_t file_type)
 {
-    uint16_t needed_len = get_entry_record_len(name_len);
-
-    memset(buffer, 0, BLOCK_SIZE);
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, dir_block);
+    ext2_read_blocks(dir_block->buf, parent_inode->i_block[0], 1);
 
-    for (int i = 0; i < 12; i++)
+    int8_t result;
+    if (is_indexed_directory(dir_block->buf))
     {
-        uint32_t block_num = parent_inode->i_block[i];
-        if (block_num == 0)
-            continue;
-
-        read_blocks(buffer, block_num, 1);
-        uint32_t offset = 0;
-
-        while (offset < BLOCK_SIZE)
+        result = dx_add_entry(parent_inode, parent_inode_num, new_inode_num, name, name_len, file_type);
+    }
+    else
+    {
+        result = -1;
+        uint32_t block_count = parent_inode->i_size / g_block_size;
+        for (uint32_t i = 0; i < block_count && result != 0; i++)
         {
-            struct EXT2DirectoryEntry *entry = get_directory_entry(buffer, offset);
-
-            if (entry->rec_len == 0)
-                break;
-
-            uint16_t actual_len = get_entry_record_len(entry->name_len);
-            uint16_t padding = entry->rec_len - actual_len;
+            uint32_t block_num = get_inode_block(parent_inode, i);
+            if (block_num == 0)
+                continue;
 
-            if (padding >= needed_len)
+            ext2_read_blocks(dir_block->buf, block_num, 1);
+            if (insert_entry_in_block(dir_block->buf, new_inode_num, name, name_len, file_type))
             {
-                uint16_t old_rec_len = entry->rec_len;
-                entry->rec_len = actual_len;
-
-                struct EXT2DirectoryEntry *new_entry = get_directory_entry(buffer, offset + actual_len);
-                new_entry->inode = new_inode_num;
-                new_entry->name_len = name_len;
-                new_entry->file_type = file_type;
-                new_entry->rec_len = old_rec_len - actual_len;
-                memcpy(get_entry_name(new_entry), name, name_len);
-
-                write_blocks(buffer, block_num, 1);
-                return 0;
+                ext2_write_blocks(dir_block->buf, block_num, 1);
+                result = 0;
             }
-            offset += entry->rec_len;
         }
-    }
 
-    for (int i = 0; i < 12; i++)
-    {
-        if (parent_inode->i_block[i] == 0)
+        if (result != 0 && block_count == 1 && (g_superblock.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) != 0)
+        {
+            // like ext3, a directory gets its index when it outgrows its first block
+            if (dx_make_indexed(parent_inode, parent_inode_num) != 0)
+                return -1;
+            result = dx_add_entry(parent_inode, parent_inode_num, new_inode_num, name, name_len, file_type);
+        }
+        else if (result != 0)
         {
-            uint32_t new_block = allocate_block(inode_to_bgd(parent_inode_num));
+            uint32_t new_block = append_directory_block(parent_inode, parent_inode_num);
             if (new_block == 0)
                 return -1;
-
-            parent_inode->i_block[i] = new_block;
-            parent_inode->i_size += BLOCK_SIZE;
-            parent_inode->i_blocks++;
             sync_node(parent_inode, parent_inode_num);
 
-            memset(buffer, 0, BLOCK_SIZE);
-            struct EXT2DirectoryEntry *new_entry = (struct EXT2DirectoryEntry *)buffer;
+            memset(dir_block->buf, 0, g_block_size);
+            struct EXT2DirectoryEntry *new_entry = (struct EXT2DirectoryEntry *)dir_block->buf;
             new_entry->inode = new_inode_num;
             new_entry->name_len = name_len;
             new_entry->file_type = file_type;
-            new_entry->rec_len = BLOCK_SIZE;
+            new_entry->rec_len = g_block_size;
             memcpy(get_entry_name(new_entry), name, name_len);
 
-            write_blocks(buffer, new_block, 1);
-            return 0;
+            ext2_write_blocks(dir_block->buf, new_block, 1);
+            result = 0;
         }
     }
 
-    return -1;
+    if (result == 0)
+        dentry_cache_insert(parent_inode_num, name, name_len, new_inode_num);
+    return result;
 }
 
-static void deallocate_node_data_blocks(struct EXT2Inode *node)
+// data blocks of a file of size bytes
+static uint32_t size_to_blocks(uint32_t size)
+{
+    return size / g_block_size + (size % g_block_size != 0);
+}
+
+/**
+ * @brief free length consecutive blocks starting at first, a bitmap word at a time
+ */
+static void deallocate_run(uint32_t first, uint32_t length)
+{
+    while (length > 0)
+    {
+        uint32_t grp = first / g_superblock.s_blocks_per_group;
+        uint32_t bit = first % g_superblock.s_blocks_per_group;
+        uint32_t chunk = g_superblock.s_blocks_per_group - bit < length ? g_superblock.s_blocks_per_group - bit : length;
+
+        struct EXT2BitmapCacheEntry *bitmap = get_bitmap(g_bgd_table[grp].bg_block_bitmap);
+        clear_bit_range(bitmap->words, bit, chunk);
+        mark_bitmap_dirty(bitmap);
+        g_bgd_table[grp].bg_free_blocks_count += chunk;
+        g_superblock.s_free_blocks_count += chunk;
+        g_blocks_freed = true;
+
+        first += chunk;
+        length -= chunk;
+    }
+}
+
+/**
+ * @brief free every block of node, data and the blocks mapping it (indirect blocks or extent leaves)
+ */
+static void deallocate_inode_blocks(struct EXT2Inode *node)
 {
-    struct BlockBuffer temp_buffer;
-    uint32_t last_bgd_cache = 0;
+    if (uses_extents(node))
+    {
+        uint32_t leaves[EXT2_EXTENT_INODE_ENTRIES];
+        uint32_t leaf_count;
+        uint32_t count = load_extents(node, leaves, &leaf_count);
+        for (uint32_t e = 0; e < count; e++)
+            deallocate_run(g_extent_list[e].ee_start, g_extent_list[e].ee_len);
+        deallocate_blocks(leaves, leaf_count);
+        return;
+    }
 
     uint32_t i_block_copy[15];
     memcpy(i_block_copy, node->i_block, sizeof(i_block_copy));
 
-    deallocate_block(
-        i_block_copy, 12,
-        &temp_buffer, 0,
-        &last_bgd_cache, false);
-    deallocate_block(
-        &i_block_copy[12], 1,
-        &temp_buffer, 1,
-        &last_bgd_cache, false);
-    deallocate_block(
-        &i_block_copy[13], 1,
-        &temp_buffer, 2,
-        &last_bgd_cache, false);
-    deallocate_block(
-        &i_block_copy[14], 1,
-        &temp_buffer, 3,
-        &last_bgd_cache, false);
+    deallocate_block(i_block_copy, 12, 0);
+    deallocate_block(&i_block_copy[12], 1, 1);
+    deallocate_block(&i_block_copy[13], 1, 2);
+    deallocate_block(&i_block_copy[14], 1, 3);
+}
+
+static void deallocate_node_data_blocks(struct EXT2Inode *node)
+{
+    deallocate_inode_blocks(node);
 
     memset(node->i_block, 0, sizeof(node->i_block));
+    node->i_flags &= ~EXT2_EXTENTS_FL;
     node->i_size = 0;
     node->i_blocks = 0;
 }
@@ -765,8 +2626,8 @@ int8_t write(struct EXT2DriverRequest *request)
         return 2; // 2: invalid parent folder
     }
 
-    uint32_t existing_inode_num = find_inode_by_name(
-        &parent_inode, request->name, request->name_len);
+    uint32_t existing_inode_num = ext2_lookup(
+        request->parent_inode, request->name, request->name_len);
 
     if (request->is_directory)
     {
@@ -775,6 +2636,7 @@ int8_t write(struct EXT2DriverRequest *request)
             return 1; // 1: file/folder already exist
         }
 
+        journal_begin_operation(EXT2_JOURNAL_OPERATION_BLOCKS);
         uint32_t new_inode_num = allocate_node();
         if (new_inode_num == 0)
             return -1;
@@ -800,6 +2662,8 @@ int8_t write(struct EXT2DriverRequest *request)
         struct EXT2Inode target_inode;
         uint32_t target_inode_num;
         uint32_t prefered_bgd;
+        bool delay; // file data gets its blocks on the next sync, unless it does not fit the delayed pool
+        uint32_t size = request->buffer_size; // bytes mapped by this operation, the rest is appended in pieces
 
         if (existing_inode_num != 0)
         {
@@ -812,10 +2676,35 @@ int8_t write(struct EXT2DriverRequest *request)
                 return 1;
             }
 
+            delay = delayed_reserve(size);
+            if (!delay && size > journal_chunk_bytes())
+                size = journal_chunk_bytes();
+
+            // a sync, in delayed_reserve() or journal_begin_operation(), may give the old delayed content its blocks:
+            // they are reserved with the old blocks, past one piece they are freed in pieces first
+            read_inode(target_inode_num, &target_inode);
+            struct EXT2DelayedFile *old_delayed = delayed_find(target_inode_num);
+            uint32_t old_blocks = target_inode.i_blocks / g_sectors_per_block;
+            if (old_delayed != NULL)
+                old_blocks += delayed_blocks(old_delayed->size);
+            if (old_blocks > g_journal_chunk_blocks)
+            {
+                truncate_file(target_inode_num, 0);
+                old_blocks = 0;
+            }
+            journal_begin_operation(EXT2_JOURNAL_OPERATION_BLOCKS + journal_data_blocks(old_blocks) +
+                                    journal_data_blocks(size_to_blocks(size)));
+            read_inode(target_inode_num, &target_inode);
+
             deallocate_node_data_blocks(&target_inode);
+            delayed_forget(target_inode_num);
 
-            target_inode.i_size = request->buffer_size;
-            if (target_inode.i_size > 0)
+            target_inode.i_size = size;
+            if (delay)
+            {
+                delayed_write(NULL, target_inode_num, request->buf, 0, request->buffer_size);
+            }
+            else if (target_inode.i_size > 0)
             {
                 allocate_node_blocks(request->buf, &target_inode, prefered_bgd);
             }
@@ -823,14 +2712,27 @@ int8_t write(struct EXT2DriverRequest *request)
         }
         else
         {
+            // without a free inode the write fails before delayed_reserve() or journal_begin_operation() may sync for it
+            if (g_superblock.s_free_inodes_count == 0)
+                return -1;
+
+            // reserve before the inode is taken, a sync must not commit it without its directory entry
+            delay = delayed_reserve(size);
+            if (!delay && size > journal_chunk_bytes())
+                size = journal_chunk_bytes();
+            journal_begin_operation(EXT2_JOURNAL_OPERATION_BLOCKS + journal_data_blocks(size_to_blocks(size)));
             target_inode_num = allocate_node();
             if (target_inode_num == 0)
                 return -1;
             memset(&target_inode, 0, sizeof(struct EXT2Inode));
             prefered_bgd = inode_to_bgd(target_inode_num);
             target_inode.i_mode = EXT2_S_IFREG;
-            target_inode.i_size = request->buffer_size;
-            if (target_inode.i_size > 0)
+            target_inode.i_size = size;
+            if (delay)
+            {
+                delayed_write(NULL, target_inode_num, request->buf, 0, request->buffer_size);
+            }
+            else if (target_inode.i_size > 0)
             {
                 allocate_node_blocks(request->buf, &target_inode, prefered_bgd);
             }
@@ -845,15 +2747,15 @@ int8_t write(struct EXT2DriverRequest *request)
             sync_node(&parent_inode, request->parent_inode);
             sync_node(&target_inode, target_inode_num);
         }
-    }
 
-    uint8_t temp_buffer[BLOCK_SIZE];
-    memset(temp_buffer, 0, BLOCK_SIZE);
-    memcpy(temp_buffer, &g_superblock, sizeof(struct EXT2Superblock));
-    write_blocks(temp_buffer, 1, 1);
-    memset(temp_buffer, 0, BLOCK_SIZE);
-    memcpy(temp_buffer, g_bgd_table, sizeof(struct EXT2BlockGroupDescriptor) * GROUPS_COUNT);
-    write_blocks(temp_buffer, 2, 1);
+        // data past one piece is appended in pieces, each its own operation
+        if (size < request->buffer_size)
+        {
+            uint32_t bytes_written;
+            if (write_at(target_inode_num, (const uint8_t *)request->buf + size, size, request->buffer_size - size, &bytes_written) != 0)
+                return -1;
+        }
+    }
 
     return 0; // 0: success
 }
@@ -867,8 +2769,8 @@ static void update_dot_dot_pointer(uint32_t dir_inode_num, uint32_t new_parent_i
     if (block_num == 0)
         return;
 
-    uint8_t local_buffer[BLOCK_SIZE];
-    read_blocks(local_buffer, block_num, 1);
+    EXT2_SCRATCH_BLOCK(uint8_t, local_buffer);
+    ext2_read_blocks(local_buffer, block_num, 1);
 
     struct EXT2DirectoryEntry *entry_dot = get_directory_entry(local_buffer, 0);
 
@@ -876,7 +2778,8 @@ static void update_dot_dot_pointer(uint32_t dir_inode_num, uint32_t new_parent_i
 
     entry_dot_dot->inode = new_parent_ino;
 
-    write_blocks(local_buffer, block_num, 1);
+    ext2_write_blocks(local_buffer, block_num, 1);
+    dentry_cache_invalidate(dir_inode_num, "..", 2);
 }
 
 static uint8_t get_file_type_from_inode(struct EXT2Inode *node)
@@ -892,57 +2795,46 @@ static uint8_t get_file_type_from_inode(struct EXT2Inode *node)
     return EXT2_FT_UNKNOWN;
 }
 
-static int8_t remove_entry_from_directory(struct EXT2Inode *parent_inode, const char *name, uint8_t name_len)
+static int8_t remove_entry_from_directory(struct EXT2Inode *parent_inode, uint32_t parent_inode_num,
+                                          const char *name, uint8_t name_len)
 {
-    uint8_t buffer[BLOCK_SIZE];
-    memset(buffer, 0, BLOCK_SIZE);
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, dir_block);
+    ext2_read_blocks(dir_block->buf, parent_inode->i_block[0], 1);
 
-    for (int i = 0; i < 12; i++)
+    uint32_t block_num = 0;
+    if (is_indexed_directory(dir_block->buf))
     {
-        uint32_t block_num = parent_inode->i_block[i];
-        if (block_num == 0)
-            continue;
-
-        read_blocks(buffer, block_num, 1);
-        uint32_t offset = 0;
-        struct EXT2DirectoryEntry *prev_entry = NULL;
-
-        while (offset < BLOCK_SIZE)
+        block_num = dx_find_leaf(parent_inode, name, name_len, dir_block->buf);
+    }
+    else
+    {
+        uint32_t block_count = parent_inode->i_size / g_block_size;
+        for (uint32_t i = 0; i < block_count; i++)
         {
-            struct EXT2DirectoryEntry *entry = get_directory_entry(buffer, offset);
-            if (entry->rec_len == 0)
-                break;
-
-            char *target_name = get_entry_name(entry);
-            if (entry->inode != 0 && entry->name_len == name_len &&
-                memcmp(name, target_name, name_len) == 0)
+            uint32_t candidate = get_inode_block(parent_inode, i);
+            if (candidate == 0)
+                continue;
+            ext2_read_blocks(dir_block->buf, candidate, 1);
+            if (find_entry_in_block(dir_block->buf, name, name_len) != 0)
             {
-                uint16_t this_len = entry->rec_len;
-
-                if (prev_entry == NULL)
-                {
-                    memset(entry, 0, this_len);
-                }
-                else
-                {
-                    prev_entry->rec_len += this_len;
-                    memset(entry, 0, this_len);
-                }
-
-                write_blocks(buffer, block_num, 1);
-                return 0; // sukses
+                block_num = candidate;
+                break;
             }
-
-            prev_entry = entry;
-            offset += entry->rec_len;
         }
     }
 
-    return 1; // tidak ditemukan
+    if (block_num == 0 || !remove_entry_in_block(dir_block->buf, name, name_len))
+        return 1; // tidak ditemukan
+
+    ext2_write_blocks(dir_block->buf, block_num, 1);
+    dentry_cache_invalidate(parent_inode_num, name, name_len);
+    return 0; // sukses
 }
 
 int8_t rename_entry(uint32_t old_parent_ino, const char *old_name, uint32_t new_parent_ino, const char *new_name)
 {
+    journal_begin_operation(EXT2_JOURNAL_OPERATION_BLOCKS);
+
     uint8_t old_name_len = strlen(old_name);
     uint8_t new_name_len = strlen(new_name);
 
@@ -964,13 +2856,13 @@ int8_t rename_entry(uint32_t old_parent_ino, const char *old_name, uint32_t new_
         read_inode(new_parent_ino, &new_parent_inode);
     }
 
-    uint32_t target_inode_num = find_inode_by_name(&old_parent_inode, old_name, old_name_len);
+    uint32_t target_inode_num = ext2_lookup(old_parent_ino, old_name, old_name_len);
     if (target_inode_num == 0)
     {
         return 1; // 1: Not found
     }
 
-    if (find_inode_by_name(&new_parent_inode, new_name, new_name_len) != 0)
+    if (ext2_lookup(new_parent_ino, new_name, new_name_len) != 0)
     {
         return -1; // Gagal: Nama tujuan sudah ada
     }
@@ -979,7 +2871,7 @@ int8_t rename_entry(uint32_t old_parent_ino, const char *old_name, uint32_t new_
     read_inode(target_inode_num, &target_inode);
     uint8_t file_type = get_file_type_from_inode(&target_inode);
 
-    int8_t rm_result = remove_entry_from_directory(&old_parent_inode, old_name, old_name_len);
+    int8_t rm_result = remove_entry_from_directory(&old_parent_inode, old_parent_ino, old_name, old_name_len);
     if (rm_result != 0)
     {
         return -1; // Gagal menghapus entri lama
@@ -1005,397 +2897,1011 @@ int8_t rename_entry(uint32_t old_parent_ino, const char *old_name, uint32_t new_
 
     sync_node(&new_parent_inode, new_parent_ino);
 
-    uint8_t temp_buffer[BLOCK_SIZE];
+    return 0; // Sukses
+}
+
+int8_t delete(struct EXT2DriverRequest request)
+{
+    if (request.name_len == 1 && request.name[0] == '.')
+    {
+        return -1; // -1 unknown (operasi tidak valid)
+    }
+    if (request.name_len == 2 && request.name[0] == '.' && request.name[1] == '.')
+    {
+        return -1; // -1 unknown (operasi tidak valid)
+    }
+
+    struct EXT2Inode parent_inode;
+    read_inode(request.parent_inode, &parent_inode);
+
+    if ((parent_inode.i_mode & EXT2_S_IFDIR) == 0)
+    {
+        return 3; // 3: parent folder invalid
+    }
+
+    uint32_t target_inode_num = ext2_lookup(
+        request.parent_inode, request.name, request.name_len);
+
+    if (target_inode_num == 0)
+    {
+        return 1; // 1: not found
+    }
+
+    struct EXT2Inode target_inode;
+    read_inode(target_inode_num, &target_inode);
+
+    bool is_target_dir = (target_inode.i_mode & EXT2_S_IFDIR) != 0;
+
+    if (request.is_directory != is_target_dir)
+    {
+        return 1; // 1: not found (atau error "tipe tidak cocok")
+    }
+
+    if (is_target_dir)
+    {
+        if (!is_directory_empty(target_inode_num))
+        {
+            return 2; // 2: folder is not empty
+        }
+    }
+
+    // an open descriptor still reads and writes the inode, its number must not be freed and reused
+    if (inode_cache_refcount(target_inode_num) > 0)
+    {
+        return 4; // 4: file is open
+    }
+
+    // blocks past one piece are given back in pieces first, the delete then frees at most one
+    uint32_t data_blocks = target_inode.i_blocks / g_sectors_per_block;
+    if (data_blocks > g_journal_chunk_blocks)
+    {
+        if (is_target_dir)
+            shrink_empty_directory(target_inode_num);
+        else
+            truncate_file(target_inode_num, 0);
+        read_inode(target_inode_num, &target_inode);
+        data_blocks = target_inode.i_blocks / g_sectors_per_block;
+    }
+    journal_begin_operation(EXT2_JOURNAL_OPERATION_BLOCKS + journal_data_blocks(data_blocks));
+
+    int8_t remove_result = remove_entry_from_directory(
+        &parent_inode, request.parent_inode, request.name, request.name_len);
+
+    if (remove_result != 0)
+    {
+        return -1; // -1 unknown
+    }
+
+    deallocate_node(target_inode_num);
+
+    return 0; // 0: success
+};
+
+uint32_t allocate_node(void)
+{
+    for (uint32_t g = 0; g < g_groups_count; g++)
+    {
+        if (g_bgd_table[g].bg_free_inodes_count == 0)
+            continue;
+
+        int32_t bit = claim_first_free_bit(g_bgd_table[g].bg_inode_bitmap, g_superblock.s_inodes_per_group);
+        if (bit >= 0)
+        {
+            g_bgd_table[g].bg_free_inodes_count--;
+            g_superblock.s_free_inodes_count--;
+
+            return (g * g_superblock.s_inodes_per_group) + bit + 1;
+        }
+    }
+
+    return 0; // Disk penuh
+};
+
+void deallocate_node(uint32_t inode)
+{
+    // the inode number may come back as a different directory, or a file
+    dentry_cache_invalidate_directory(inode);
+
+    struct EXT2Inode node_to_delete;
+    read_inode(inode, &node_to_delete);
+
+    deallocate_inode_blocks(&node_to_delete);
+    delayed_forget(inode);
+
+    uint32_t group = inode_to_bgd(inode);
+    uint32_t local_idx = inode_to_local(inode);
+
+    release_bit(g_bgd_table[group].bg_inode_bitmap, local_idx);
+
+    g_superblock.s_free_inodes_count++;
+    g_bgd_table[group].bg_free_inodes_count++;
+
+    if ((node_to_delete.i_mode & EXT2_S_IFDIR) != 0)
+    {
+        g_bgd_table[group].bg_used_dirs_count--;
+    }
+
+    memset(&node_to_delete, 0, sizeof(struct EXT2Inode));
+    sync_node(&node_to_delete, inode);
+};
+
+void deallocate_blocks(void *loc, uint32_t blocks)
+{
+    deallocate_block((uint32_t *)loc, blocks, 0);
+};
+
+void deallocate_block(uint32_t *locations, uint32_t blocks, uint32_t depth)
+{
+    for (uint32_t i = 0; i < blocks; i++)
+    {
+        uint32_t blk = locations[i];
+        if (blk == 0)
+            continue;
+
+        if (depth > 0)
+        {
+            EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, ptr_buf);
+            ext2_read_blocks(ptr_buf->buf, blk, 1);
+            deallocate_block((uint32_t *)ptr_buf->buf, g_pointers_per_block, depth - 1);
+        }
+
+        uint32_t grp = blk / g_superblock.s_blocks_per_group;
+        release_bit(g_bgd_table[grp].bg_block_bitmap, blk % g_superblock.s_blocks_per_group);
+        g_bgd_table[grp].bg_free_blocks_count++;
+        g_superblock.s_free_blocks_count++;
+        g_blocks_freed = true;
+    }
+};
+
+// Zero padded last block of the file being written, stays valid until block_queue_dispatch()
+static uint8_t tail_block_buffer[EXT2_MAX_BLOCK_SIZE];
+
+// data of the delayed pool is zero padded to whole blocks and stays valid until delayed_flush() dispatches the queue
+static bool is_delayed_data(const void *src)
+{
+    return (const uint8_t *)src >= g_delayed_pool && (const uint8_t *)src < g_delayed_pool + EXT2_DELAYED_POOL_BYTES;
+}
+
+/**
+ * @brief the bytes src brings to file block logical are all zero, so a block that has none yet can stay a hole
+ * @param src file bytes offset .. end - 1, NULL for zeroes
+ */
+static bool is_zero_block(const uint8_t *src, uint32_t offset, uint32_t end, uint32_t logical)
+{
+    if (src == NULL)
+        return true;
+
+    uint32_t from = logical * g_block_size > offset ? logical * g_block_size : offset;
+    uint32_t to = end - logical * g_block_size > g_block_size ? logical * g_block_size + g_block_size : end;
+    for (uint32_t i = from; i < to; i++)
+    {
+        if (src[i - offset] != 0)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief find the next run of blocks that are not all zero in the first data_blocks blocks of a file written from ptr
+ * @param logical in/out, first block to look at, moved to the start of the run (data_blocks if only zeroes are left)
+ * @return end of the run, exclusive
+ */
+static uint32_t next_data_run(const uint8_t *ptr, uint32_t size, uint32_t data_blocks, uint32_t *logical)
+{
+    while (*logical < data_blocks && is_zero_block(ptr, 0, size, *logical))
+        (*logical)++;
+
+    uint32_t end = *logical;
+    while (end < data_blocks && !is_zero_block(ptr, 0, size, end))
+        end++;
+    return end;
+}
 
-    memset(temp_buffer, 0, BLOCK_SIZE);
-    memcpy(temp_buffer, &g_superblock, sizeof(struct EXT2Superblock));
-    write_blocks(temp_buffer, 1, 1);
+// pointer table that maps file block logical (12 or more): 0 for the indirect block, 1 + i for table i under the doubly indirect block
+static uint32_t pointer_table_of(uint32_t logical)
+{
+    uint32_t d_indirect_first = 12 + g_pointers_per_block;
+    return logical < d_indirect_first ? 0 : 1 + (logical - d_indirect_first) / g_pointers_per_block;
+}
 
-    memset(temp_buffer, 0, BLOCK_SIZE);
-    memcpy(temp_buffer, g_bgd_table, sizeof(struct EXT2BlockGroupDescriptor) * GROUPS_COUNT);
-    write_blocks(temp_buffer, 2, 1);
+/**
+ * @brief queue write of one data block, a partial last block is padded with zeroes
+ * instead of reading past the end of the caller buffer
+ */
+static void write_data_block(const uint8_t *src, uint32_t size, uint32_t block)
+{
+    if (size == g_block_size || is_delayed_data(src))
+    {
+        ext2_queue_write(src, block);
+        return;
+    }
 
-    return 0; // Sukses
+    // Only one tail per file, flush the previous one before reusing the buffer
+    block_queue_dispatch();
+    memset(tail_block_buffer, 0, g_block_size);
+    memcpy(tail_block_buffer, src, size);
+    ext2_queue_write(tail_block_buffer, block);
 }
 
-int8_t delete(struct EXT2DriverRequest request)
+/**
+ * @brief write the count extents of g_extent_list as the extent tree of node, in i_block (depth 0) or in leaf blocks (depth 1).
+ * Leaves are reused in order, missing ones are allocated and extra ones freed. i_blocks is left to the caller.
+ * @param leaves in/out, leaf blocks of the tree (EXT2_EXTENT_INODE_ENTRIES entries)
+ * @param leaf_count in/out, number of leaves
+ * @return false, with leaves unchanged, if the extents do not fit a depth 1 tree or there is no block left for a leaf
+ */
+static bool store_extent_tree(struct EXT2Inode *node, uint32_t count, uint32_t *leaves, uint32_t *leaf_count, uint32_t prefered_bgd)
 {
-    if (request.name_len == 1 && request.name[0] == '.')
+    uint32_t leaf_entries = EXT2_EXTENT_BLOCK_ENTRIES(g_block_size);
+    uint32_t needed = 0;
+    if (count > EXT2_EXTENT_INODE_ENTRIES)
+        needed = (count + leaf_entries - 1) / leaf_entries;
+    if (needed > EXT2_EXTENT_INODE_ENTRIES)
+        return false;
+
+    for (uint32_t i = *leaf_count; i < needed; i++)
     {
-        return -1; // -1 unknown (operasi tidak valid)
+        leaves[i] = allocate_block(prefered_bgd);
+        if (leaves[i] == 0)
+        {
+            deallocate_blocks(&leaves[*leaf_count], i - *leaf_count);
+            return false; // Disk penuh
+        }
     }
-    if (request.name_len == 2 && request.name[0] == '.' && request.name[1] == '.')
+    if (*leaf_count > needed)
+        deallocate_blocks(&leaves[needed], *leaf_count - needed);
+    *leaf_count = needed;
+
+    uint32_t root[15];
+    memset(root, 0, sizeof(root));
+    struct EXT2ExtentHeader *header = (struct EXT2ExtentHeader *)root;
+    header->eh_magic = EXT2_EXTENT_MAGIC;
+    header->eh_max = EXT2_EXTENT_INODE_ENTRIES;
+    if (needed == 0)
     {
-        return -1; // -1 unknown (operasi tidak valid)
+        header->eh_entries = count;
+        memcpy(header + 1, g_extent_list, count * sizeof(struct EXT2Extent));
     }
-
-    struct EXT2Inode parent_inode;
-    read_inode(request.parent_inode, &parent_inode);
-
-    if ((parent_inode.i_mode & EXT2_S_IFDIR) == 0)
+    else
     {
-        return 3; // 3: parent folder invalid
+        header->eh_entries = needed;
+        header->eh_depth = 1;
+        struct EXT2ExtentIndex *index = (struct EXT2ExtentIndex *)(header + 1);
+        for (uint32_t i = 0; i < needed; i++)
+        {
+            uint32_t first = i * leaf_entries;
+            uint32_t entries = count - first < leaf_entries ? count - first : leaf_entries;
+            index[i].ei_block = g_extent_list[first].ee_block;
+            index[i].ei_leaf = leaves[i];
+
+            EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, leaf);
+            memset(leaf->buf, 0, g_block_size);
+            struct EXT2ExtentHeader *leaf_header = (struct EXT2ExtentHeader *)leaf->buf;
+            leaf_header->eh_magic = EXT2_EXTENT_MAGIC;
+            leaf_header->eh_entries = entries;
+            leaf_header->eh_max = leaf_entries;
+            memcpy(leaf_header + 1, &g_extent_list[first], entries * sizeof(struct EXT2Extent));
+            ext2_write_blocks(leaf->buf, leaves[i], 1);
+        }
     }
+    memcpy(node->i_block, root, sizeof(root));
+    node->i_flags |= EXT2_EXTENTS_FL;
+    return true;
+}
 
-    uint32_t target_inode_num = find_inode_by_name(
-        &parent_inode, request.name, request.name_len);
-
-    if (target_inode_num == 0)
+/**
+ * @brief map the data of node with an extent tree, one extent per allocated run
+ * @return false, with nothing allocated, if the runs do not fit a depth 1 tree or there is no block left for its leaves
+ */
+static bool allocate_extent_blocks(void *ptr, struct EXT2Inode *node, uint32_t prefered_bgd)
+{
+    uint32_t data_blocks = (node->i_size + g_block_size - 1) / g_block_size;
+    uint32_t leaf_entries = EXT2_EXTENT_BLOCK_ENTRIES(g_block_size);
+    uint32_t count = 0;
+    uint32_t logical = 0;
+    uint32_t run_end = 0; // blocks logical .. run_end - 1 are not all zero
+    uint32_t mapped = 0;
+
+    // 1. Runs first, the number of extents decides the depth of the tree. All-zero blocks are left as holes
+    while (logical < data_blocks)
     {
-        return 1; // 1: not found
-    }
+        if (logical >= run_end)
+        {
+            run_end = next_data_run(ptr, node->i_size, data_blocks, &logical);
+            if (logical == data_blocks)
+                break;
+        }
 
-    struct EXT2Inode target_inode;
-    read_inode(target_inode_num, &target_inode);
+        uint32_t wanted = run_end - logical < EXT2_EXTENT_MAX_LEN ? run_end - logical : EXT2_EXTENT_MAX_LEN;
+        uint32_t run_length;
+        uint32_t first = allocate_blocks(prefered_bgd, wanted, &run_length);
+        if (first == 0)
+            break; // Disk penuh
 
-    bool is_target_dir = (target_inode.i_mode & EXT2_S_IFDIR) != 0;
+        struct EXT2Extent *last = count > 0 ? &g_extent_list[count - 1] : NULL;
+        if (last != NULL && last->ee_block + last->ee_len == logical && last->ee_start + last->ee_len == first &&
+            last->ee_len + run_length <= EXT2_EXTENT_MAX_LEN)
+        {
+            last->ee_len += run_length;
+        }
+        else if (count < EXT2_EXTENT_INODE_ENTRIES * leaf_entries)
+        {
+            g_extent_list[count].ee_block = logical;
+            g_extent_list[count].ee_len = run_length;
+            g_extent_list[count].ee_start_hi = 0;
+            g_extent_list[count].ee_start = first;
+            count++;
+        }
+        else
+        {
+            deallocate_run(first, run_length);
+            for (uint32_t e = 0; e < count; e++)
+                deallocate_run(g_extent_list[e].ee_start, g_extent_list[e].ee_len);
+            return false;
+        }
+        logical += run_length;
+        mapped += run_length;
+    }
 
-    if (request.is_directory != is_target_dir)
+    // 2. More extents than i_block holds go to leaf blocks indexed from i_block (depth 1)
+    uint32_t leaves[EXT2_EXTENT_INODE_ENTRIES];
+    uint32_t leaf_count = 0;
+    if (!store_extent_tree(node, count, leaves, &leaf_count, prefered_bgd))
     {
-        return 1; // 1: not found (atau error "tipe tidak cocok")
+        for (uint32_t e = 0; e < count; e++)
+            deallocate_run(g_extent_list[e].ee_start, g_extent_list[e].ee_len);
+        return false;
     }
 
-    if (is_target_dir)
+    // 3. Data, every extent is a single run of queued writes
+    uint8_t *data_ptr = (uint8_t *)ptr;
+    for (uint32_t e = 0; e < count; e++)
     {
-        if (!is_directory_empty(target_inode_num))
+        for (uint32_t j = 0; j < g_extent_list[e].ee_len; j++)
         {
-            return 2; // 2: folder is not empty
+            uint32_t offset = (g_extent_list[e].ee_block + j) * g_block_size;
+            uint32_t write_size = (node->i_size - offset > g_block_size) ? g_block_size : (node->i_size - offset);
+            write_data_block(data_ptr + offset, write_size, g_extent_list[e].ee_start + j);
         }
     }
 
-    int8_t remove_result = remove_entry_from_directory(
-        &parent_inode, request.name, request.name_len);
-
-    if (remove_result != 0)
-    {
-        return -1; // -1 unknown
-    }
+    if (!is_delayed_data(ptr))
+        block_queue_dispatch();
+    node->i_blocks = (mapped + leaf_count) * g_sectors_per_block;
+    return true;
+}
 
-    deallocate_node(target_inode_num);
+void allocate_node_blocks(void *ptr, struct EXT2Inode *node, uint32_t prefered_bgd)
+{
+    if ((g_superblock.s_feature_incompat & EXT2_FEATURE_INCOMPAT_EXTENTS) != 0 && (node->i_mode & EXT2_S_IFREG) != 0 &&
+        allocate_extent_blocks(ptr, node, prefered_bgd))
+        return;
 
-    uint8_t temp_buffer[BLOCK_SIZE];
+    uint8_t *data_ptr = (uint8_t *)ptr;
+    uint32_t data_blocks = (node->i_size + g_block_size - 1) / g_block_size;
+    uint32_t max_blocks = 12 + g_pointers_per_block + g_pointers_per_block * g_pointers_per_block;
+    if (data_blocks > max_blocks)
+        data_blocks = max_blocks;
+
+    // 1. Indirect blocks first, in one run ahead of the data they map. Only tables that map a block that is not all zero
+    static uint32_t pointer_list[2 + EXT2_MAX_POINTERS_PER_BLOCK]; // more than a block, not taken from the scratch pool
+    uint32_t pointer_blocks = 0;
+    uint32_t next_table = 0; // pointer tables below it are counted
+    for (uint32_t logical = 12; logical < data_blocks;)
+    {
+        uint32_t run_end = next_data_run(data_ptr, node->i_size, data_blocks, &logical);
+        if (logical == data_blocks)
+            break;
 
-    memset(temp_buffer, 0, BLOCK_SIZE);
-    memcpy(temp_buffer, &g_superblock, sizeof(struct EXT2Superblock));
-    write_blocks(temp_buffer, 1, 1);
+        uint32_t first_table = pointer_table_of(logical);
+        uint32_t last_table = pointer_table_of(run_end - 1);
+        pointer_blocks += last_table + 1 - (first_table > next_table ? first_table : next_table);
+        next_table = last_table + 1;
+        logical = run_end;
+    }
+    if (next_table > 1)
+        pointer_blocks++; // doubly indirect block above the tables
 
-    memset(temp_buffer, 0, BLOCK_SIZE);
-    memcpy(temp_buffer, g_bgd_table, sizeof(struct EXT2BlockGroupDescriptor) * GROUPS_COUNT);
-    write_blocks(temp_buffer, 2, 1);
+    uint32_t pointers_allocated = 0;
+    while (pointers_allocated < pointer_blocks)
+    {
+        uint32_t run_length;
+        uint32_t first = allocate_blocks(prefered_bgd, pointer_blocks - pointers_allocated, &run_length);
+        if (first == 0)
+        {
+            deallocate_blocks(pointer_list, pointers_allocated);
+            node->i_blocks = 0;
+            return; // Disk penuh
+        }
+        for (uint32_t j = 0; j < run_length; j++)
+            pointer_list[pointers_allocated++] = first + j;
+    }
 
-    return 0; // 0: success
-};
+    // 2. Data blocks in as few runs as the free space allows, each run becomes merged disk commands. All-zero blocks stay holes
+    EXT2_SCRATCH_BLOCK(uint32_t, indirect_table);
+    EXT2_SCRATCH_BLOCK(uint32_t, d_indirect_table);
+    uint32_t indirect_block = 0;   // indirect block being filled
+    uint32_t current_table = 0;    // pointer_table_of() the blocks indirect_block maps
+    uint32_t d_indirect_block = 0;
+    uint32_t pointers_used = 0;
+    uint32_t mapped = 0;
+    uint32_t logical = 0;
+    uint32_t run_end = 0; // blocks logical .. run_end - 1 are not all zero
+
+    while (logical < data_blocks)
+    {
+        if (logical >= run_end)
+        {
+            run_end = next_data_run(data_ptr, node->i_size, data_blocks, &logical);
+            if (logical == data_blocks)
+                break;
+        }
 
-uint32_t allocate_node(void)
-{
-    uint8_t bitmap_buffer[BLOCK_SIZE];
+        uint32_t run_length;
+        uint32_t first = allocate_blocks(prefered_bgd, run_end - logical, &run_length);
+        if (first == 0)
+            break; // Disk penuh
 
-    for (uint32_t g = 0; g < GROUPS_COUNT; g++)
-    {
-        if (g_bgd_table[g].bg_free_inodes_count > 0)
+        for (uint32_t j = 0; j < run_length; j++, logical++)
         {
-            read_blocks(bitmap_buffer, g_bgd_table[g].bg_inode_bitmap, 1);
-            for (uint32_t i = 0; i < INODES_PER_GROUP; i++)
+            uint32_t block = first + j;
+            if (logical < 12)
             {
-                if (get_bit(bitmap_buffer, i) == 0)
+                node->i_block[logical] = block;
+            }
+            else
+            {
+                uint32_t table = pointer_table_of(logical);
+                if (indirect_block == 0 || table != current_table)
                 {
-                    set_bit(bitmap_buffer, i);
-                    write_blocks(bitmap_buffer, g_bgd_table[g].bg_inode_bitmap, 1);
-
-                    g_bgd_table[g].bg_free_inodes_count--;
-                    g_superblock.s_free_inodes_count--;
-
-                    return (g * INODES_PER_GROUP) + i + 1;
+                    if (indirect_block != 0)
+                        ext2_write_blocks(indirect_table, indirect_block, 1);
+                    if (table > 0 && d_indirect_block == 0)
+                    {
+                        d_indirect_block = pointer_list[pointers_used++];
+                        node->i_block[13] = d_indirect_block;
+                        memset(d_indirect_table, 0, g_block_size);
+                    }
+
+                    indirect_block = pointer_list[pointers_used++];
+                    if (table == 0)
+                        node->i_block[12] = indirect_block;
+                    else
+                        d_indirect_table[table - 1] = indirect_block;
+                    memset(indirect_table, 0, g_block_size);
+                    current_table = table;
                 }
+                indirect_table[(logical - 12) % g_pointers_per_block] = block;
             }
+
+            uint32_t offset = logical * g_block_size;
+            uint32_t write_size = (node->i_size - offset > g_block_size) ? g_block_size : (node->i_size - offset);
+            write_data_block(data_ptr + offset, write_size, block);
+            mapped++;
         }
     }
 
-    return 0; // Disk penuh
+    if (indirect_block != 0)
+        ext2_write_blocks(indirect_table, indirect_block, 1);
+    if (d_indirect_block != 0)
+        ext2_write_blocks(d_indirect_table, d_indirect_block, 1);
+    deallocate_blocks(&pointer_list[pointers_used], pointers_allocated - pointers_used);
+
+    if (!is_delayed_data(ptr))
+        block_queue_dispatch();
+    node->i_blocks = (mapped + pointers_used) * g_sectors_per_block;
 };
 
-void deallocate_node(uint32_t inode)
+void ext2_store_inode(uint32_t inode, const struct EXT2Inode *node)
 {
-    struct BlockBuffer temp_buffer;
-    uint32_t last_bgd_cache = 0;
-
-    struct EXT2Inode node_to_delete;
-    read_inode(inode, &node_to_delete);
-
-    uint32_t i_block_copy[15];
-    memcpy(i_block_copy, node_to_delete.i_block, sizeof(i_block_copy));
-
-    deallocate_block(
-        i_block_copy, 12,
-        &temp_buffer, 0,
-        &last_bgd_cache, false);
-
-    deallocate_block(
-        &i_block_copy[12], 1,
-        &temp_buffer, 1,
-        &last_bgd_cache, false);
-
-    deallocate_block(
-        &i_block_copy[13], 1,
-        &temp_buffer, 2,
-        &last_bgd_cache, false);
-
-    deallocate_block(
-        &i_block_copy[14], 1,
-        &temp_buffer, 3,
-        &last_bgd_cache, false);
-
     uint32_t group = inode_to_bgd(inode);
     uint32_t local_idx = inode_to_local(inode);
+    uint32_t table_start_block = g_bgd_table[group].bg_inode_table;
 
-    read_blocks(temp_buffer.buf, g_bgd_table[group].bg_inode_bitmap, 1);
-    clear_bit(temp_buffer.buf, local_idx);
-    write_blocks(temp_buffer.buf, g_bgd_table[group].bg_inode_bitmap, 1);
-
-    g_superblock.s_free_inodes_count++;
-    g_bgd_table[group].bg_free_inodes_count++;
-
-    if ((node_to_delete.i_mode & EXT2_S_IFDIR) != 0)
-    {
-        g_bgd_table[group].bg_used_dirs_count--;
-    }
+    uint32_t block_offset = local_idx / (g_block_size / g_inode_size);
+    uint32_t index_in_block = local_idx % (g_block_size / g_inode_size);
+    uint32_t block_to_rw = table_start_block + block_offset;
 
-    memset(&node_to_delete, 0, sizeof(struct EXT2Inode));
-    sync_node(&node_to_delete, inode);
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, inode_block);
+    ext2_read_blocks(inode_block->buf, block_to_rw, 1);
 
-    memset(temp_buffer.buf, 0, BLOCK_SIZE);
-    memcpy(temp_buffer.buf, &g_superblock, sizeof(struct EXT2Superblock));
-    write_blocks(temp_buffer.buf, 1, 1);
+    memcpy(inode_block->buf + index_in_block * g_inode_size, node, g_inode_size < INODE_SIZE ? g_inode_size : INODE_SIZE);
 
-    memset(temp_buffer.buf, 0, BLOCK_SIZE);
-    memcpy(temp_buffer.buf, g_bgd_table, sizeof(struct EXT2BlockGroupDescriptor) * GROUPS_COUNT);
-    write_blocks(temp_buffer.buf, 2, 1);
+    ext2_write_blocks(inode_block->buf, block_to_rw, 1);
 };
 
-void deallocate_blocks(void *loc, uint32_t blocks)
+void sync_node(struct EXT2Inode *node, uint32_t inode)
 {
-    uint32_t *locations = (uint32_t *)loc;
-
-    struct BlockBuffer temp_bitmap_buffer;
-    uint32_t last_bgd_cache = 0;
-
-    deallocate_block(
-        locations,
-        blocks,
-        &temp_bitmap_buffer,
-        0,
-        &last_bgd_cache,
-        false);
+    struct InodeCacheEntry *entry = inode_cache_get(inode);
+    memcpy(&entry->inode, node, sizeof(struct EXT2Inode));
+    inode_cache_mark_dirty(entry);
+    inode_cache_put(entry);
+    g_metadata_dirty = true;
 };
-
-uint32_t deallocate_block(uint32_t *locations, uint32_t blocks, struct BlockBuffer *bitmap, uint32_t depth, uint32_t *last_bgd, bool bgd_loaded)
+/* -- In-place writes, append and truncate, only the blocks of the affected range are touched -- */
+
+/**
+ * @brief drop the extents, or the part of them, that map file blocks from .. to - 1, their blocks are freed.
+ * An extent starting in the range must end in it, one starting before keeps its head.
+ * @param count extents in g_extent_list
+ * @return extents left in g_extent_list
+ */
+static uint32_t release_extents_range(uint32_t count, uint32_t from, uint32_t to)
 {
-    if (blocks == 0 || locations == NULL)
+    uint32_t kept = 0;
+    for (uint32_t e = 0; e < count; e++)
     {
-        return *last_bgd;
+        struct EXT2Extent *extent = &g_extent_list[e];
+        if (extent->ee_block >= from && extent->ee_block < to)
+        {
+            deallocate_run(extent->ee_start, extent->ee_len);
+            continue;
+        }
+        if (extent->ee_block < from && extent->ee_block + extent->ee_len > from)
+        {
+            uint32_t cut = from - extent->ee_block;
+            deallocate_run(extent->ee_start + cut, extent->ee_len - cut);
+            extent->ee_len = cut;
+        }
+        g_extent_list[kept++] = *extent;
     }
+    return kept;
+}
 
-    if (depth == 0)
+/**
+ * @brief free the blocks of the pointer tree rooted at *pointer_block that map entry keep onwards.
+ * A pointer block left without entries is freed as well, *pointer_block becomes 0.
+ * @param keep first entry to free, relative to the tree
+ * @param depth 0 for a data block, 1 for an indirect block, 2 for a doubly indirect block
+ */
+static void release_pointer_tree_from(uint32_t *pointer_block, uint32_t keep, uint32_t depth)
+{
+    if (*pointer_block == 0)
+        return;
+    if (keep == 0)
     {
-        for (uint32_t i = 0; i < blocks; i++)
-        {
-            uint32_t blk = locations[i];
-            if (blk == 0)
-                continue;
+        deallocate_block(pointer_block, 1, depth);
+        *pointer_block = 0;
+        return;
+    }
 
-            uint32_t grp = blk / BLOCKS_PER_GROUP;
-            if (!bgd_loaded || grp != *last_bgd)
-            {
-                read_blocks(bitmap,
-                            g_bgd_table[grp].bg_block_bitmap,
-                            1);
-                *last_bgd = grp;
-                bgd_loaded = true;
-            }
+    uint32_t span = 1; // file blocks under one entry of this table
+    for (uint32_t d = 1; d < depth; d++)
+        span *= g_pointers_per_block;
+    if (keep >= span * g_pointers_per_block)
+        return;
+
+    EXT2_SCRATCH_BLOCK(uint32_t, table);
+    ext2_read_blocks(table, *pointer_block, 1);
+    for (uint32_t i = keep / span; i < g_pointers_per_block; i++)
+    {
+        uint32_t entry_first = i * span;
+        release_pointer_tree_from(&table[i], keep > entry_first ? keep - entry_first : 0, depth - 1);
+    }
+    ext2_write_blocks(table, *pointer_block, 1);
+}
 
-            uint32_t local = blk % BLOCKS_PER_GROUP;
-            uint32_t byte = local / 8;
-            uint32_t bit = local % 8;
-            bitmap->buf[byte] &= ~(1 << bit);
+/**
+ * @brief free every data block of node at or after file block keep, and the mapping blocks that no longer map anything
+ */
+static void release_blocks_from(struct EXT2Inode *node, uint32_t keep, uint32_t prefered_bgd)
+{
+    uint32_t free_before = g_superblock.s_free_blocks_count;
+    if (uses_extents(node))
+    {
+        uint32_t leaves[EXT2_EXTENT_INODE_ENTRIES];
+        uint32_t leaf_count;
+        uint32_t count = load_extents(node, leaves, &leaf_count);
+        count = release_extents_range(count, keep, 0xFFFFFFFF);
+        // fewer extents never need another leaf, this cannot fail
+        store_extent_tree(node, count, leaves, &leaf_count, prefered_bgd);
+    }
+    else
+    {
+        // i_block is copied out, EXT2Inode is packed
+        uint32_t i_block_copy[15];
+        memcpy(i_block_copy, node->i_block, sizeof(i_block_copy));
 
-            g_bgd_table[grp].bg_free_blocks_count++;
-            g_superblock.s_free_blocks_count++;
+        uint32_t d_indirect_first = 12 + g_pointers_per_block;
+        for (uint32_t i = keep; i < 12; i++)
+            release_pointer_tree_from(&i_block_copy[i], 0, 0);
+        release_pointer_tree_from(&i_block_copy[12], keep > 12 ? keep - 12 : 0, 1);
+        release_pointer_tree_from(&i_block_copy[13], keep > d_indirect_first ? keep - d_indirect_first : 0, 2);
 
-            write_blocks(bitmap,
-                         g_bgd_table[grp].bg_block_bitmap,
-                         1);
-            write_blocks(&g_superblock, 1, 1);
-            write_blocks(&g_bgd_table, 2, 1);
-        }
-        return *last_bgd;
+        memcpy(node->i_block, i_block_copy, sizeof(i_block_copy));
     }
+    node->i_blocks -= (g_superblock.s_free_blocks_count - free_before) * g_sectors_per_block;
+}
 
-    uint32_t ptr_blk = locations[0];
-    if (ptr_blk == 0)
+/**
+ * @brief allocate and map file blocks from_logical .. to_logical - 1 of node, a hole or the range past its end.
+ * Their content is not written. Runs are taken right after the block before the range when it is free, so appending
+ * keeps extending the last extent.
+ * A regular file without any block yet gets an extent tree when the filesystem has the extents feature.
+ * @return false if the disk is full or the mapping cannot hold more blocks, blocks mapped so far stay mapped
+ */
+static bool map_new_blocks(struct EXT2Inode *node, uint32_t prefered_bgd, uint32_t from_logical, uint32_t to_logical)
+{
+    if (!uses_extents(node) && node->i_blocks == 0 &&
+        (g_superblock.s_feature_incompat & EXT2_FEATURE_INCOMPAT_EXTENTS) != 0 && (node->i_mode & EXT2_S_IFREG) != 0)
     {
-        return *last_bgd;
+        memset(node->i_block, 0, sizeof(node->i_block));
+        node->i_flags |= EXT2_EXTENTS_FL;
     }
 
-    struct BlockBuffer ptr_buf = {0};
-    read_blocks(&ptr_buf, ptr_blk, 1);
-    uint32_t *ptrs = (uint32_t *)ptr_buf.buf;
+    bool extents = uses_extents(node);
+    uint32_t leaves[EXT2_EXTENT_INODE_ENTRIES];
+    uint32_t leaf_count = 0;
+    uint32_t count = 0;
+    if (extents)
+        count = load_extents(node, leaves, &leaf_count);
+    uint32_t old_leaf_count = leaf_count;
+    uint32_t max_extents = EXT2_EXTENT_INODE_ENTRIES * EXT2_EXTENT_BLOCK_ENTRIES(g_block_size);
+
+    // new extents go in front of the ones mapping blocks after a hole
+    uint32_t insert = count;
+    while (insert > 0 && g_extent_list[insert - 1].ee_block >= from_logical)
+        insert--;
+
+    uint32_t goal = from_logical > 0 ? get_inode_block(node, from_logical - 1) : 0;
+    if (goal != 0)
+        goal++;
+
+    uint32_t logical = from_logical;
+    bool mapping_full = false;
+    while (logical < to_logical)
+    {
+        uint32_t wanted = to_logical - logical < EXT2_EXTENT_MAX_LEN ? to_logical - logical : EXT2_EXTENT_MAX_LEN;
+        uint32_t run_length;
+        uint32_t first = allocate_blocks_near(goal, prefered_bgd, wanted, &run_length);
+        if (first == 0)
+            break; // Disk penuh
 
-    uint32_t max_ptrs = BLOCK_SIZE / sizeof(uint32_t);
-    uint32_t cnt = (blocks < max_ptrs ? blocks : max_ptrs);
+        if (extents)
+        {
+            struct EXT2Extent *last = insert > 0 ? &g_extent_list[insert - 1] : NULL;
+            if (last != NULL && last->ee_block + last->ee_len == logical && last->ee_start + last->ee_len == first &&
+                last->ee_len + run_length <= EXT2_EXTENT_MAX_LEN)
+            {
+                last->ee_len += run_length;
+            }
+            else if (count < max_extents)
+            {
+                memmove(&g_extent_list[insert + 1], &g_extent_list[insert], (count - insert) * sizeof(struct EXT2Extent));
+                g_extent_list[insert].ee_block = logical;
+                g_extent_list[insert].ee_len = run_length;
+                g_extent_list[insert].ee_start_hi = 0;
+                g_extent_list[insert].ee_start = first;
+                insert++;
+                count++;
+            }
+            else
+            {
+                deallocate_run(first, run_length);
+                break;
+            }
+        }
+        else
+        {
+            for (uint32_t j = 0; j < run_length; j++)
+            {
+                if (!set_inode_block(node, prefered_bgd, logical + j, first + j))
+                {
+                    deallocate_run(first + j, run_length - j);
+                    run_length = j;
+                    mapping_full = true;
+                    break;
+                }
+            }
+        }
 
-    *last_bgd = deallocate_block(ptrs,
-                                 cnt,
-                                 bitmap,
-                                 depth - 1,
-                                 last_bgd,
-                                 true);
+        node->i_blocks += run_length * g_sectors_per_block;
+        logical += run_length;
+        goal = first + run_length;
+        if (mapping_full)
+            break;
+    }
 
-    uint32_t grp = ptr_blk / BLOCKS_PER_GROUP;
-    if (!bgd_loaded || grp != *last_bgd)
+    if (extents && !store_extent_tree(node, count, leaves, &leaf_count, prefered_bgd))
     {
-        read_blocks(bitmap,
-                    g_bgd_table[grp].bg_block_bitmap,
-                    1);
-        *last_bgd = grp;
-        bgd_loaded = true;
+        // no block left for a new leaf, give this call's blocks back, the old tree holds what is left
+        uint32_t free_before = g_superblock.s_free_blocks_count;
+        count = release_extents_range(count, from_logical, to_logical);
+        node->i_blocks -= (g_superblock.s_free_blocks_count - free_before) * g_sectors_per_block;
+        store_extent_tree(node, count, leaves, &leaf_count, prefered_bgd);
+        return false;
     }
-    uint32_t local = ptr_blk % BLOCKS_PER_GROUP;
-    uint32_t byte = local / 8;
-    uint32_t bit = local % 8;
-    bitmap->buf[byte] &= ~(1 << bit);
+    node->i_blocks += leaf_count * g_sectors_per_block;
+    node->i_blocks -= old_leaf_count * g_sectors_per_block;
+    return logical == to_logical;
+}
 
-    g_bgd_table[grp].bg_free_blocks_count++;
-    g_superblock.s_free_blocks_count++;
+/**
+ * @brief zero the bytes of the last block of node past size, so they read as zero if the file grows again
+ */
+static void zero_block_tail(struct EXT2Inode *node, uint32_t size)
+{
+    if (size % g_block_size == 0)
+        return;
 
-    write_blocks(bitmap,
-                 g_bgd_table[grp].bg_block_bitmap,
-                 1);
-    write_blocks(&g_superblock, 1, 1);
-    write_blocks(&g_bgd_table, 2, 1);
+    uint32_t block = get_inode_block(node, size / g_block_size);
+    if (block == 0)
+        return;
 
-    return *last_bgd;
-};
+    EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, tail);
+    ext2_queue_read(tail->buf, block);
+    block_queue_dispatch();
+    memset(tail->buf + size % g_block_size, 0, g_block_size - size % g_block_size);
+    ext2_queue_write(tail->buf, block);
+    block_queue_dispatch();
+}
 
-void allocate_node_blocks(void *ptr, struct EXT2Inode *node, uint32_t prefered_bgd)
+// Store an inode changed by write_at() or truncate_file(), it reaches the disk with the bitmaps and counters on the next sync
+static void sync_file_update(struct EXT2Inode *node, uint32_t inode_num)
 {
-    uint32_t bytes_to_write = node->i_size;
-    uint32_t bytes_written = 0;
-    uint32_t blocks_allocated = 0;
-    uint8_t *data_ptr = (uint8_t *)ptr;
+    sync_node(node, inode_num);
+}
 
-    uint32_t pointers_per_block = BLOCK_SIZE / sizeof(uint32_t);
+/**
+ * @brief write_at() of one piece, a range the caller reserved in the running transaction
+ */
+static int8_t write_range(uint32_t inode_num, const void *buf, uint32_t offset, uint32_t length, uint32_t *bytes_written)
+{
+    *bytes_written = 0;
 
-    for (int i = 0; i < 12 && bytes_written < bytes_to_write; i++)
-    {
-        uint32_t new_block = allocate_block(prefered_bgd);
-        if (new_block == 0)
-            return; // Disk penuh
-        node->i_block[i] = new_block;
-        blocks_allocated++;
+    struct EXT2Inode node;
+    read_inode(inode_num, &node);
+    uint32_t end = offset + length;
 
-        uint32_t write_size = (bytes_to_write - bytes_written > BLOCK_SIZE) ? BLOCK_SIZE : (bytes_to_write - bytes_written);
+    // delayed data is written in memory, an empty file starts delayed; data that cannot stay in the pool gets its blocks first
+    struct EXT2DelayedFile *delayed = delayed_find(inode_num);
+    if (delayed != NULL && !delayed_has_room(delayed, end))
+    {
+        sync_filesystem();
+        read_inode(inode_num, &node);
+        delayed = NULL;
+    }
+    else if (delayed != NULL || (node.i_size == 0 && delayed_reserve(end)))
+    {
+        delayed_write(delayed, inode_num, buf, offset, length);
+        if (end > node.i_size)
+            node.i_size = end;
+        sync_file_update(&node, inode_num);
+        *bytes_written = length;
+        return 0;
+    }
 
-        if (ptr)
+    uint32_t prefered_bgd = inode_to_bgd(inode_num);
+    uint32_t old_blocks = size_to_blocks(node.i_size);
+    uint32_t first_logical = offset / g_block_size;
+    uint32_t last_logical = (end - 1) / g_block_size;
+    const uint8_t *src = (const uint8_t *)buf;
+
+    // 1. A hole or a block past the old end reads as zero
+    bool head_mapped = first_logical < old_blocks && get_inode_block(&node, first_logical) != 0;
+    bool tail_mapped = last_logical < old_blocks && get_inode_block(&node, last_logical) != 0;
+
+    // 2. Blocks without one get it only when their new content is not all zero, the gap before offset stays a hole
+    uint32_t unmapped = last_logical + 1; // first block the disk had no room for
+    uint32_t run_start = 0;
+    bool in_run = false;
+    for (uint32_t logical = first_logical; logical <= last_logical + 1; logical++)
+    {
+        bool needed = logical <= last_logical && (logical >= old_blocks || get_inode_block(&node, logical) == 0) &&
+                      !is_zero_block(src, offset, end, logical);
+        if (needed && !in_run)
         {
-            write_blocks(data_ptr + bytes_written, new_block, 1);
+            run_start = logical;
+            in_run = true;
         }
-        else
+        else if (!needed && in_run)
         {
-            uint8_t empty_buffer[BLOCK_SIZE];
-            memset(empty_buffer, 0, BLOCK_SIZE);
-            write_blocks(empty_buffer, new_block, 1);
+            in_run = false;
+            if (!map_new_blocks(&node, prefered_bgd, run_start, logical))
+            {
+                unmapped = run_start;
+                while (get_inode_block(&node, unmapped) != 0)
+                    unmapped++;
+                break;
+            }
         }
-        bytes_written += write_size;
     }
 
-    // 2. Single Indirect Block
-    if (bytes_written < bytes_to_write)
+    bool disk_full = unmapped <= last_logical;
+    if (disk_full)
     {
-        uint32_t indirect_table[pointers_per_block];
-        memset(indirect_table, 0, BLOCK_SIZE);
-
-        uint32_t indirect_block_ptr = allocate_block(prefered_bgd);
-        if (indirect_block_ptr == 0)
-            return;
-        node->i_block[12] = indirect_block_ptr;
-        blocks_allocated++;
-
-        for (int j = 0; j < (int)pointers_per_block && bytes_written < bytes_to_write; j++)
+        // Disk penuh, the data before the first block without room is still written
+        if (unmapped * g_block_size <= offset)
         {
-            uint32_t new_block = allocate_block(prefered_bgd);
-            if (new_block == 0)
-                break; // Disk penuh, hentikan alokasi
-            indirect_table[j] = new_block;
-            blocks_allocated++;
-
-            uint32_t write_size = (bytes_to_write - bytes_written > BLOCK_SIZE) ? BLOCK_SIZE : (bytes_to_write - bytes_written);
-            if (ptr)
-                write_blocks(data_ptr + bytes_written, new_block, 1);
-            bytes_written += write_size;
+            sync_file_update(&node, inode_num);
+            return -1;
         }
-        write_blocks(indirect_table, indirect_block_ptr, 1);
+        end = unmapped * g_block_size;
+        length = end - offset;
+        last_logical = unmapped - 1;
+    }
+
+    // 3. Partial first and last blocks are merged with their current content
+    EXT2_SCRATCH_BLOCK(uint8_t, head_buffer);
+    EXT2_SCRATCH_BLOCK(uint8_t, tail_buffer);
+    uint32_t head_offset = offset % g_block_size;
+    uint32_t head_length = g_block_size - head_offset < length ? g_block_size - head_offset : length;
+    uint32_t tail_length = end - last_logical * g_block_size;
+    bool head_partial = head_length < g_block_size;
+    bool tail_partial = last_logical != first_logical && tail_length < g_block_size;
+
+    if (head_partial)
+    {
+        if (head_mapped)
+            ext2_queue_read(head_buffer, get_inode_block(&node, first_logical));
+        else
+            memset(head_buffer, 0, g_block_size);
     }
+    if (tail_partial)
+    {
+        if (tail_mapped)
+            ext2_queue_read(tail_buffer, get_inode_block(&node, last_logical));
+        else
+            memset(tail_buffer, 0, g_block_size);
+    }
+    block_queue_dispatch();
+
+    if (head_partial)
+        memcpy(head_buffer + head_offset, src, head_length);
+    if (tail_partial)
+        memcpy(tail_buffer, src + (last_logical * g_block_size - offset), tail_length);
 
-    // 3. Doubly Indirect Block
-    if (bytes_written < bytes_to_write)
+    // 4. Data, whole blocks straight from the caller buffer. Zeroes over a hole are not written
+    for (uint32_t logical = first_logical; logical <= last_logical; logical++)
     {
-        uint32_t d_indirect_table[pointers_per_block];
-        memset(d_indirect_table, 0, BLOCK_SIZE);
+        uint32_t block = get_inode_block(&node, logical);
+        if (block == 0)
+            continue;
+        if (logical == first_logical && head_partial)
+            ext2_queue_write(head_buffer, block);
+        else if (logical == last_logical && tail_partial)
+            ext2_queue_write(tail_buffer, block);
+        else
+            ext2_queue_write(src + (logical * g_block_size - offset), block);
+    }
+    block_queue_dispatch();
 
-        uint32_t d_indirect_block_ptr = allocate_block(prefered_bgd);
-        if (d_indirect_block_ptr == 0)
-            return;
-        node->i_block[13] = d_indirect_block_ptr;
-        blocks_allocated++;
+    if (end > node.i_size)
+    {
+        node.i_size = end;
+    }
+    sync_file_update(&node, inode_num);
 
-        for (int j = 0; j < (int)pointers_per_block && bytes_written < bytes_to_write; j++)
-        {
-            uint32_t indirect_table[pointers_per_block];
-            memset(indirect_table, 0, BLOCK_SIZE);
+    *bytes_written = length;
+    return disk_full ? -1 : 0; // 0: success
+}
 
-            uint32_t indirect_block_ptr = allocate_block(prefered_bgd);
-            if (indirect_block_ptr == 0)
-                break;
-            d_indirect_table[j] = indirect_block_ptr;
-            blocks_allocated++;
+int8_t write_at(uint32_t inode_num, const void *buf, uint32_t offset, uint32_t length, uint32_t *bytes_written)
+{
+    *bytes_written = 0;
 
-            for (int k = 0; k < (int)pointers_per_block && bytes_written < bytes_to_write; k++)
-            {
-                uint32_t new_block = allocate_block(prefered_bgd);
-                if (new_block == 0)
-                    break;
-                indirect_table[k] = new_block;
-                blocks_allocated++;
+    struct EXT2Inode node;
+    read_inode(inode_num, &node);
+    if ((node.i_mode & EXT2_S_IFREG) == 0)
+    {
+        return 1; // 1: not a file
+    }
 
-                uint32_t write_size = (bytes_to_write - bytes_written > BLOCK_SIZE) ? BLOCK_SIZE : (bytes_to_write - bytes_written);
-                if (ptr)
-                    write_blocks(data_ptr + bytes_written, new_block, 1);
-                bytes_written += write_size;
-            }
-            write_blocks(indirect_table, indirect_block_ptr, 1);
-        }
-        write_blocks(d_indirect_table, d_indirect_block_ptr, 1);
+    if (offset == EXT2_WRITE_APPEND)
+    {
+        offset = node.i_size;
+    }
+    if (offset + length < offset)
+    {
+        return -1; // past the 32 bit file size
     }
 
-    node->i_blocks = blocks_allocated;
-};
+    // a piece ends on a block boundary and maps at most g_journal_chunk_blocks blocks, one transaction holds it
+    const uint8_t *src = (const uint8_t *)buf;
+    while (length > 0)
+    {
+        uint32_t piece = journal_chunk_bytes() - offset % g_block_size;
+        if (piece > length)
+            piece = length;
+        journal_begin_operation(journal_data_blocks(size_to_blocks(offset % g_block_size + piece)));
+
+        uint32_t written;
+        int8_t result = write_range(inode_num, src + *bytes_written, offset, piece, &written);
+        *bytes_written += written;
+        if (result != 0)
+            return result;
+        offset += piece;
+        length -= piece;
+    }
+    return 0; // 0: success
+}
 
-void sync_node(struct EXT2Inode *node, uint32_t inode)
+/**
+ * @brief truncate_file() of one step, at most g_journal_chunk_blocks blocks freed
+ */
+static int8_t truncate_range(uint32_t inode_num, uint32_t size)
 {
-    uint32_t group = inode_to_bgd(inode);
-    uint32_t local_idx = inode_to_local(inode);
-    uint32_t table_start_block = g_bgd_table[group].bg_inode_table;
+    struct EXT2Inode node;
+    read_inode(inode_num, &node);
 
-    uint32_t block_offset = local_idx / INODES_PER_TABLE;
-    uint32_t index_in_block = local_idx % INODES_PER_TABLE;
-    uint32_t block_to_rw = table_start_block + block_offset;
+    struct EXT2DelayedFile *delayed = delayed_find(inode_num);
+    if (delayed != NULL && delayed_has_room(delayed, size))
+    {
+        if (size < delayed->size)
+            delayed_truncate(delayed, size);
+        else if (size > delayed->size)
+            delayed_write(delayed, inode_num, NULL, delayed->size, size - delayed->size);
+        node.i_size = size;
+        sync_file_update(&node, inode_num);
+        return 0;
+    }
+    if (delayed != NULL)
+    {
+        sync_filesystem(); // growth past the pool, the data gets its blocks first
+        read_inode(inode_num, &node);
+    }
 
-    memset(buffer, 0, BLOCK_SIZE);
-    read_blocks(buffer, block_to_rw, 1);
+    // growth leaves a hole, it takes no blocks
+    if (size < node.i_size)
+    {
+        release_blocks_from(&node, size_to_blocks(size), inode_to_bgd(inode_num));
+        zero_block_tail(&node, size);
+    }
+
+    node.i_size = size;
+    sync_file_update(&node, inode_num);
+    return 0; // 0: success
+}
 
-    struct EXT2Inode *inode_table_in_block = (struct EXT2Inode *)buffer;
+int8_t truncate_file(uint32_t inode_num, uint32_t size)
+{
+    struct EXT2Inode node;
+    read_inode(inode_num, &node);
+    if ((node.i_mode & EXT2_S_IFREG) == 0)
+    {
+        return 1; // 1: not a file
+    }
+
+    // shrinking steps down from the end, every step frees at most one piece and leaves a shorter consistent file
+    uint32_t step = node.i_size;
+    do
+    {
+        uint32_t from = step;
+        step = step > size && step - size > journal_chunk_bytes() ? step - journal_chunk_bytes() : size;
+        journal_begin_operation(journal_data_blocks(from > step ? size_to_blocks(from) - size_to_blocks(step) : 0));
+        int8_t result = truncate_range(inode_num, step);
+        if (result != 0)
+            return result;
+    } while (step != size);
+    return 0; // 0: success
+}
 
-    memcpy(&inode_table_in_block[index_in_block], node, sizeof(struct EXT2Inode));
+// block 0 loses its index root first, the directory is then a linear one of unused entries after every piece
+void shrink_empty_directory(uint32_t inode_num)
+{
+    journal_begin_operation(EXT2_JOURNAL_OPERATION_BLOCKS);
+    struct EXT2Inode dir;
+    read_inode(inode_num, &dir);
+    {
+        // the scratch block goes back before the pieces, their syncs may run the deepest paths
+        EXT2_SCRATCH_BLOCK(struct EXT2BlockBuffer, first);
+        ext2_read_blocks(first->buf, dir.i_block[0], 1);
+        if (is_indexed_directory(first->buf))
+        {
+            memset(first->buf + EXT2_DX_ROOT_INFO_OFFSET, 0, g_block_size - EXT2_DX_ROOT_INFO_OFFSET);
+            ext2_write_blocks(first->buf, dir.i_block[0], 1);
+        }
+    }
 
-    write_blocks(buffer, block_to_rw, 1);
-};
\ No newline at end of file
+    uint32_t blocks = dir.i_size / g_block_size;
+    while (blocks > 1)
+    {
+        uint32_t keep = blocks - 1 > g_journal_chunk_blocks ? blocks - g_journal_chunk_blocks : 1;
+        journal_begin_operation(journal_data_blocks(blocks - keep));
+        read_inode(inode_num, &dir);
+        release_blocks_from(&dir, keep, inode_to_bgd(inode_num));
+        dir.i_size = keep * g_block_size;
+        sync_node(&dir, inode_num);
+        blocks = keep;
+    }
+}
@@ -0,0 +1,151 @@
+#include "header/filesystem/file.h"
+#include "header/filesystem/ext2.h"
+#include "header/filesystem/inode-cache.h"
+#include "header/stdlib/string.h"
+
+static struct OpenFile *get_open_file(struct FileDescriptorTable *table, int32_t fd)
+{
+    if (fd < 0 || fd >= FILE_DESCRIPTOR_COUNT_MAX || !table->files[fd].used)
+        return NULL;
+    return &table->files[fd];
+}
+
+int32_t file_open(struct FileDescriptorTable *table, uint32_t inode, uint32_t flags)
+{
+    if ((flags & (FILE_OPEN_READ | FILE_OPEN_WRITE)) == 0)
+        return FILE_ERROR_INVALID;
+
+    struct EXT2Inode node;
+    read_inode(inode, &node);
+    if ((node.i_mode & EXT2_S_IFREG) == 0)
+        return FILE_ERROR_NOT_A_FILE;
+
+    for (int32_t fd = 0; fd < FILE_DESCRIPTOR_COUNT_MAX; fd++)
+    {
+        struct OpenFile *file = &table->files[fd];
+        if (file->used)
+            continue;
+
+        // the reference keeps the inode from being deleted and its number from being reused
+        if (inode_cache_referenced_count() >= INODE_CACHE_PINNED_MAX)
+            return FILE_ERROR_TABLE_FULL;
+
+        file->inode = inode;
+        file->entry = inode_cache_get(inode);
+        file->offset = 0;
+        file->flags = flags;
+        file->used = true;
+        return fd;
+    }
+    return FILE_ERROR_TABLE_FULL;
+}
+
+int32_t file_read(struct FileDescriptorTable *table, int32_t fd, void *buf, uint32_t count)
+{
+    struct OpenFile *file = get_open_file(table, fd);
+    if (file == NULL)
+        return FILE_ERROR_BAD_DESCRIPTOR;
+    if ((file->flags & FILE_OPEN_READ) == 0)
+        return FILE_ERROR_ACCESS;
+
+    // result must fit the signed return value
+    if (count > 0x7FFFFFFFu)
+        count = 0x7FFFFFFFu;
+
+    uint32_t bytes_read;
+    if (read_at(file->inode, buf, file->offset, count, &bytes_read) != 0)
+        return FILE_ERROR_IO;
+
+    file->offset += bytes_read;
+    return (int32_t)bytes_read;
+}
+
+int32_t file_write(struct FileDescriptorTable *table, int32_t fd, const void *buf, uint32_t count)
+{
+    struct OpenFile *file = get_open_file(table, fd);
+    if (file == NULL)
+        return FILE_ERROR_BAD_DESCRIPTOR;
+    if ((file->flags & FILE_OPEN_WRITE) == 0)
+        return FILE_ERROR_ACCESS;
+
+    if (count > 0x7FFFFFFFu)
+        count = 0x7FFFFFFFu;
+
+    uint32_t offset = file->offset;
+    if ((file->flags & FILE_OPEN_APPEND) != 0)
+    {
+        struct EXT2Inode node;
+        read_inode(file->inode, &node);
+        offset = node.i_size;
+    }
+
+    // a full disk still writes what fits, the short count is returned
+    uint32_t bytes_written;
+    if (write_at(file->inode, buf, offset, count, &bytes_written) != 0 && bytes_written == 0)
+        return FILE_ERROR_IO;
+
+    file->offset = offset + bytes_written;
+    return (int32_t)bytes_written;
+}
+
+int32_t file_lseek(struct FileDescriptorTable *table, int32_t fd, int32_t offset, uint32_t whence)
+{
+    struct OpenFile *file = get_open_file(table, fd);
+    if (file == NULL)
+        return FILE_ERROR_BAD_DESCRIPTOR;
+
+    int64_t base;
+    switch (whence)
+    {
+    case FILE_SEEK_SET:
+        base = 0;
+        break;
+    case FILE_SEEK_CUR:
+        base = file->offset;
+        break;
+    case FILE_SEEK_END:
+    {
+        struct EXT2Inode node;
+        read_inode(file->inode, &node);
+        base = node.i_size;
+        break;
+    }
+    default:
+        return FILE_ERROR_INVALID;
+    }
+
+    int64_t position = base + offset;
+    if (position < 0 || position > 0x7FFFFFFF)
+        return FILE_ERROR_INVALID;
+
+    file->offset = (uint32_t)position;
+    return (int32_t)position;
+}
+
+int32_t file_fstat(struct FileDescriptorTable *table, int32_t fd, struct EXT2Stat *stat)
+{
+    struct OpenFile *file = get_open_file(table, fd);
+    if (file == NULL)
+        return FILE_ERROR_BAD_DESCRIPTOR;
+
+    stat_inode(file->inode, stat);
+    return 0;
+}
+
+int32_t file_close(struct FileDescriptorTable *table, int32_t fd)
+{
+    struct OpenFile *file = get_open_file(table, fd);
+    if (file == NULL)
+        return FILE_ERROR_BAD_DESCRIPTOR;
+
+    inode_cache_put(file->entry);
+    memset(file, 0, sizeof(struct OpenFile));
+    return 0;
+}
+
+void file_close_all(struct FileDescriptorTable *table)
+{
+    for (int32_t fd = 0; fd < FILE_DESCRIPTOR_COUNT_MAX; fd++)
+        if (table->files[fd].used)
+            file_close(table, fd);
+}
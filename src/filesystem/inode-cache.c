@@ -0,0 +1,227 @@
+#include "header/filesystem/inode-cache.h"
+#include "header/stdlib/string.h"
+
+static struct InodeCacheEntry cache_entries[INODE_CACHE_ENTRY_COUNT];
+static int16_t hash_heads[INODE_CACHE_HASH_SIZE];
+static int16_t lru_head = INODE_CACHE_NONE; // most recently used
+static int16_t lru_tail = INODE_CACHE_NONE; // least recently used
+static bool cache_initialized = false;
+static struct InodeCacheStats cache_stats;
+
+static uint32_t hash_inode(uint32_t inode_num)
+{
+    // Fibonacci hashing, inodes of one directory are usually consecutive numbers
+    return (inode_num * 2654435761u) >> (32 - INODE_CACHE_HASH_BITS);
+}
+
+static void lru_unlink(int16_t idx)
+{
+    struct InodeCacheEntry *entry = &cache_entries[idx];
+    if (entry->lru_prev != INODE_CACHE_NONE)
+        cache_entries[entry->lru_prev].lru_next = entry->lru_next;
+    else
+        lru_head = entry->lru_next;
+
+    if (entry->lru_next != INODE_CACHE_NONE)
+        cache_entries[entry->lru_next].lru_prev = entry->lru_prev;
+    else
+        lru_tail = entry->lru_prev;
+
+    entry->lru_prev = INODE_CACHE_NONE;
+    entry->lru_next = INODE_CACHE_NONE;
+}
+
+static void lru_push_front(int16_t idx)
+{
+    struct InodeCacheEntry *entry = &cache_entries[idx];
+    entry->lru_prev = INODE_CACHE_NONE;
+    entry->lru_next = lru_head;
+    if (lru_head != INODE_CACHE_NONE)
+        cache_entries[lru_head].lru_prev = idx;
+    lru_head = idx;
+    if (lru_tail == INODE_CACHE_NONE)
+        lru_tail = idx;
+}
+
+static void hash_remove(int16_t idx)
+{
+    uint32_t bucket = hash_inode(cache_entries[idx].inode_num);
+    int16_t *link = &hash_heads[bucket];
+    while (*link != INODE_CACHE_NONE)
+    {
+        if (*link == idx)
+        {
+            *link = cache_entries[idx].hash_next;
+            break;
+        }
+        link = &cache_entries[*link].hash_next;
+    }
+    cache_entries[idx].hash_next = INODE_CACHE_NONE;
+}
+
+static void hash_insert(int16_t idx)
+{
+    uint32_t bucket = hash_inode(cache_entries[idx].inode_num);
+    cache_entries[idx].hash_next = hash_heads[bucket];
+    hash_heads[bucket] = idx;
+}
+
+static void inode_cache_init(void)
+{
+    for (uint32_t i = 0; i < INODE_CACHE_HASH_SIZE; i++)
+        hash_heads[i] = INODE_CACHE_NONE;
+
+    lru_head = INODE_CACHE_NONE;
+    lru_tail = INODE_CACHE_NONE;
+    for (int16_t i = 0; i < INODE_CACHE_ENTRY_COUNT; i++)
+    {
+        cache_entries[i].valid = false;
+        cache_entries[i].dirty = false;
+        cache_entries[i].refcount = 0;
+        cache_entries[i].hash_next = INODE_CACHE_NONE;
+        lru_push_front(i);
+    }
+    cache_initialized = true;
+}
+
+static int16_t lookup(uint32_t inode_num)
+{
+    int16_t idx = hash_heads[hash_inode(inode_num)];
+    while (idx != INODE_CACHE_NONE)
+    {
+        if (cache_entries[idx].valid && cache_entries[idx].inode_num == inode_num)
+            return idx;
+        idx = cache_entries[idx].hash_next;
+    }
+    return INODE_CACHE_NONE;
+}
+
+static void writeback(struct InodeCacheEntry *entry)
+{
+    if (entry->valid && entry->dirty)
+    {
+        ext2_store_inode(entry->inode_num, &entry->inode);
+        entry->dirty = false;
+        cache_stats.writebacks++;
+    }
+}
+
+/**
+ * Take the least recently used unreferenced entry, write it back if needed and rebind it to inode_num.
+ * ext2 holds a handful of short references and open files stop at INODE_CACHE_PINNED_MAX,
+ * together below INODE_CACHE_ENTRY_COUNT.
+ */
+static int16_t allocate_entry(uint32_t inode_num)
+{
+    int16_t idx = lru_tail;
+    while (idx != INODE_CACHE_NONE && cache_entries[idx].refcount > 0)
+        idx = cache_entries[idx].lru_prev;
+    if (idx == INODE_CACHE_NONE)
+        idx = lru_tail;
+
+    struct InodeCacheEntry *entry = &cache_entries[idx];
+    if (entry->valid)
+    {
+        writeback(entry);
+        hash_remove(idx);
+        cache_stats.evictions++;
+    }
+
+    entry->inode_num = inode_num;
+    entry->valid = true;
+    entry->dirty = false;
+    entry->refcount = 0;
+    hash_insert(idx);
+    return idx;
+}
+
+struct InodeCacheEntry *inode_cache_get(uint32_t inode_num)
+{
+    if (!cache_initialized)
+        inode_cache_init();
+
+    int16_t idx = lookup(inode_num);
+    if (idx == INODE_CACHE_NONE)
+    {
+        cache_stats.misses++;
+        idx = allocate_entry(inode_num);
+        ext2_load_inode(inode_num, &cache_entries[idx].inode);
+    }
+    else
+    {
+        cache_stats.hits++;
+    }
+
+    if (lru_head != idx)
+    {
+        lru_unlink(idx);
+        lru_push_front(idx);
+    }
+    cache_entries[idx].refcount++;
+    return &cache_entries[idx];
+}
+
+void inode_cache_put(struct InodeCacheEntry *entry)
+{
+    if (entry->refcount > 0)
+        entry->refcount--;
+}
+
+uint16_t inode_cache_refcount(uint32_t inode_num)
+{
+    if (!cache_initialized)
+        return 0;
+
+    int16_t idx = lookup(inode_num);
+    return idx == INODE_CACHE_NONE ? 0 : cache_entries[idx].refcount;
+}
+
+uint32_t inode_cache_referenced_count(void)
+{
+    if (!cache_initialized)
+        return 0;
+
+    uint32_t count = 0;
+    for (int16_t i = 0; i < INODE_CACHE_ENTRY_COUNT; i++)
+        if (cache_entries[i].valid && cache_entries[i].refcount > 0)
+            count++;
+    return count;
+}
+
+void inode_cache_mark_dirty(struct InodeCacheEntry *entry)
+{
+    entry->dirty = true;
+}
+
+void inode_cache_flush(void)
+{
+    if (!cache_initialized)
+        return;
+
+    for (int16_t i = 0; i < INODE_CACHE_ENTRY_COUNT; i++)
+        writeback(&cache_entries[i]);
+}
+
+uint32_t inode_cache_dirty_count(void)
+{
+    if (!cache_initialized)
+        return 0;
+
+    uint32_t count = 0;
+    for (int16_t i = 0; i < INODE_CACHE_ENTRY_COUNT; i++)
+        if (cache_entries[i].valid && cache_entries[i].dirty)
+            count++;
+    return count;
+}
+
+void inode_cache_invalidate(void)
+{
+    struct InodeCacheStats saved = cache_stats;
+    inode_cache_init();
+    cache_stats = saved;
+}
+
+void inode_cache_get_stats(struct InodeCacheStats *stats)
+{
+    memcpy(stats, &cache_stats, sizeof(struct InodeCacheStats));
+}
@@ -61,6 +61,7 @@
 #define PIT_MAX_FREQUENCY 1193182
 #define PIT_TIMER_FREQUENCY 40
 #define PIT_TIMER_COUNTER (PIT_MAX_FREQUENCY / PIT_TIMER_FREQUENCY)
+#define FILESYSTEM_SYNC_INTERVAL_TICKS (5 * PIT_TIMER_FREQUENCY) // dirty filesystem metadata is written back every 5 seconds
 
 #define PIT_COMMAND_REGISTER_PIO 0x43
 #define PIT_COMMAND_VALUE_BINARY_MODE 0b0
@@ -70,6 +71,14 @@
 #define PIT_COMMAND_VALUE (PIT_COMMAND_VALUE_BINARY_MODE | PIT_COMMAND_VALUE_OPR_SQUARE_WAVE | PIT_COMMAND_VALUE_ACC_LOHIBYTE | PIT_COMMAND_VALUE_CHANNEL)
 
 #define PIT_CHANNEL_0_DATA_PIO 0x40
+#define PIT_CHANNEL_2_DATA_PIO 0x42
+#define PIT_CHANNEL_2_GATE_PIO 0x61 // bit 0 gate, bit 1 speaker, bit 5 channel 2 output
+#define PIT_CHANNEL_2_GATE 0x01
+#define PIT_CHANNEL_2_SPEAKER 0x02
+#define PIT_CHANNEL_2_OUTPUT 0x20
+#define PIT_COMMAND_CHANNEL_2_ONE_SHOT ((0b10 << 6) | PIT_COMMAND_VALUE_ACC_LOHIBYTE) // mode 0, interrupt on terminal count
+#define TSC_CALIBRATION_US 10000
+#define TSC_CALIBRATION_COUNTER (PIT_MAX_FREQUENCY / (1000000 / TSC_CALIBRATION_US))
 
 /**
  * CPURegister, store CPU registers values.
@@ -146,9 +155,21 @@ struct InterruptFrame
 // Activate PIC mask for keyboard only
 void activate_keyboard_interrupt(void);
 
+// Activate PIC mask for primary ATA (IRQ 14) and the slave PIC cascade line
+void activate_disk_interrupt(void);
+
+// Activate PIC mask for an IRQ line assigned to a PCI device by the firmware - @param irq IRQ line (0-15)
+void activate_pci_interrupt(uint8_t irq);
+
 // I/O port wait, around 1-4 microsecond, for I/O synchronization purpose
 void io_wait(void);
 
+// Disable interrupt and return previous eflags - @return eflags before cli
+uint32_t interrupt_disable_save(void);
+
+// Restore interrupt flag saved by interrupt_disable_save() - @param eflags Saved eflags
+void interrupt_restore(uint32_t eflags);
+
 // Send ACK to PIC - @param irq Interrupt request number destination, note: ACKED_IRQ = irq+PIC1_OFFSET
 void pic_ack(uint8_t irq);
 
@@ -191,13 +212,32 @@ void syscall(struct InterruptFrame frame);
 
 void activate_timer_interrupt(void);
 
+/**
+ * Measure the TSC rate against PIT channel 2, polled so it works before interrupts are enabled.
+ * Busy waits TSC_CALIBRATION_US.
+ *
+ * @return TSC cycles per microsecond
+ */
+uint32_t calibrate_tsc(void);
+
 void sleep(uint32_t ticks);
 
+struct EXT2ReadAtRequest;
+struct EXT2WriteAtRequest;
+struct EXT2GetdentsRequest;
+struct EXT2Stat;
+
 int32_t ext2_read(const char *path, char *buffer);
+int32_t ext2_read_at(struct EXT2ReadAtRequest *request);
 int32_t ext2_ls(const char *path, char *buffer);
+int32_t ext2_getdents(struct EXT2GetdentsRequest *request);
+int32_t ext2_stat(const char *path, struct EXT2Stat *stat);
 int32_t ext2_stat_dir(const char *path);
 int32_t ext2_mkdir(const char *path, const char *name);
 int32_t ext2_write(const char *path, const char *buffer, uint32_t size);
+int32_t ext2_write_at(struct EXT2WriteAtRequest *request);
+int32_t ext2_truncate(const char *path, uint32_t size);
+int32_t ext2_open(const char *path, uint32_t flags);
 int32_t ext2_rm(const char *path, const char *name);
 
 #endif
\ No newline at end of file
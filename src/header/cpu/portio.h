@@ -25,4 +25,20 @@ void out16(uint16_t port, uint16_t data);
 
 uint16_t in16(uint16_t port);
 
+void out32(uint16_t port, uint32_t data);
+
+uint32_t in32(uint16_t port);
+
+/**
+ * Read the CPU time stamp counter, cycles since reset
+ *
+ * @return 64-bit TSC value
+ */
+static inline uint64_t read_tsc(void)
+{
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,205 @@
+#ifndef _AHCI_H
+#define _AHCI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/driver/block-device.h"
+
+/* -- HBA generic host control registers, offset from ABAR (BAR5) -- */
+#define AHCI_HBA_CAP 0x00
+#define AHCI_HBA_GHC 0x04
+#define AHCI_HBA_IS 0x08
+#define AHCI_HBA_PI 0x0C
+
+#define AHCI_CAP_NCS_SHIFT 8 // Number of command slots - 1, 5 bits
+#define AHCI_CAP_NCS_MASK 0x1F
+#define AHCI_CAP_SNCQ (1u << 30)
+#define AHCI_GHC_IE (1u << 1)
+#define AHCI_GHC_AE (1u << 31)
+
+/* -- Port registers, offset from the port base -- */
+#define AHCI_PORT_BASE(port) (0x100 + (port) * 0x80)
+#define AHCI_PORT_COUNT 32
+#define AHCI_PxCLB 0x00
+#define AHCI_PxCLBU 0x04
+#define AHCI_PxFB 0x08
+#define AHCI_PxFBU 0x0C
+#define AHCI_PxIS 0x10
+#define AHCI_PxIE 0x14
+#define AHCI_PxCMD 0x18
+#define AHCI_PxTFD 0x20
+#define AHCI_PxSIG 0x24
+#define AHCI_PxSSTS 0x28
+#define AHCI_PxSERR 0x30
+#define AHCI_PxSACT 0x34
+#define AHCI_PxCI 0x38
+
+#define AHCI_PxCMD_ST (1u << 0)
+#define AHCI_PxCMD_FRE (1u << 4)
+#define AHCI_PxCMD_FR (1u << 14)
+#define AHCI_PxCMD_CR (1u << 15)
+
+#define AHCI_PxIS_DHRS (1u << 0) // Device to host register FIS, non-queued command done
+#define AHCI_PxIS_SDBS (1u << 3) // Set device bits FIS, NCQ command done
+#define AHCI_PxIS_TFES (1u << 30) // Task file error
+
+#define AHCI_PxSSTS_DET_MASK 0x0F
+#define AHCI_PxSSTS_DET_PRESENT 0x03
+#define AHCI_SIG_SATA_DISK 0x00000101
+
+#define AHCI_TFD_ERR 0x01
+#define AHCI_TFD_DRQ 0x08
+#define AHCI_TFD_BSY 0x80
+
+/* -- FIS & commands -- */
+#define FIS_TYPE_REG_H2D 0x27
+#define FIS_H2D_COMMAND 0x80 // C bit, FIS carries a command
+#define FIS_DEVICE_LBA 0x40
+
+#define ATA_COMMAND_READ_FPDMA_QUEUED 0x60
+#define ATA_COMMAND_WRITE_FPDMA_QUEUED 0x61
+
+#define AHCI_COMMAND_HEADER_WRITE (1 << 6)
+#define AHCI_MAX_SLOTS 32
+#define AHCI_MAX_PRDT 16 // A 16-bit block count spans at most 10 pieces
+#define AHCI_PRD_MAX_BYTES (4u << 20) // Data byte count field is 22 bits
+#define AHCI_PRD_INTERRUPT (1u << 31)
+#define AHCI_SECTOR_SIZE 512
+
+/**
+ * AHCICommandHeader - Entry of the port command list, one per command slot
+ *
+ * @param flags               Command FIS length in dwords (bit 0-4), AHCI_COMMAND_HEADER_WRITE
+ * @param port_multiplier     Port multiplier & control bits, unused
+ * @param prdt_length         Number of PRDT entries in the command table
+ * @param prd_byte_count      Bytes transferred, updated by the HBA
+ * @param command_table_base  Physical address of the command table, 128 byte aligned
+ */
+struct AHCICommandHeader
+{
+    uint8_t flags;
+    uint8_t port_multiplier;
+    uint16_t prdt_length;
+    volatile uint32_t prd_byte_count;
+    uint32_t command_table_base;
+    uint32_t command_table_base_upper;
+    uint32_t reserved[4];
+} __attribute__((packed));
+
+// Host to device register FIS, ATA task file as sent on the wire
+struct FISRegisterH2D
+{
+    uint8_t fis_type;
+    uint8_t flags;
+    uint8_t command;
+    uint8_t feature_low;
+    uint8_t lba0;
+    uint8_t lba1;
+    uint8_t lba2;
+    uint8_t device;
+    uint8_t lba3;
+    uint8_t lba4;
+    uint8_t lba5;
+    uint8_t feature_high;
+    uint8_t count_low;
+    uint8_t count_high;
+    uint8_t icc;
+    uint8_t control;
+    uint32_t reserved;
+} __attribute__((packed));
+
+// Physical region descriptor - @param byte_count Bytes - 1 (bit 0-21), AHCI_PRD_INTERRUPT
+struct AHCIPhysicalRegion
+{
+    uint32_t data_base;
+    uint32_t data_base_upper;
+    uint32_t reserved;
+    uint32_t byte_count;
+} __attribute__((packed));
+
+/**
+ * AHCICommandTable - Command FIS and scatter-gather list of one slot
+ *
+ * @param command_fis Command FIS, struct FISRegisterH2D
+ * @param atapi       ATAPI command, unused
+ * @param prdt        Data regions
+ */
+struct AHCICommandTable
+{
+    uint8_t command_fis[64];
+    uint8_t atapi[16];
+    uint8_t reserved[48];
+    struct AHCIPhysicalRegion prdt[AHCI_MAX_PRDT];
+} __attribute__((packed)) __attribute__((aligned(128)));
+
+/**
+ * AHCIState - Contain all AHCI driver states
+ *
+ * @param available    Controller found and a SATA disk port is running
+ * @param abar         Virtual address of the HBA registers
+ * @param port         Port number of the disk
+ * @param irq          PIC IRQ line given by the firmware
+ * @param ncq          Both HBA and disk support native command queuing
+ * @param slot_count   Commands the port may hold at once (1 without NCQ)
+ * @param capacity     Disk size in sectors, clamped to 32-bit
+ * @param slots_busy   Slots issued and not yet completed
+ * @param batching     Commands are not waited until ahci_batch_end()
+ * @param flushing     FLUSH CACHE EXT owns the port, no new command may be issued
+ * @param error_count  Commands that ended with a task file error
+ */
+struct AHCIState
+{
+    bool available;
+    volatile uint8_t *abar;
+    uint8_t port;
+    uint8_t irq;
+    bool ncq;
+    uint8_t slot_count;
+    uint32_t capacity;
+    volatile uint32_t slots_busy;
+    bool batching;
+    bool flushing;
+    uint32_t error_count;
+};
+
+/**
+ * Probe the PCI bus for an AHCI controller, map its registers and start the first port with a SATA disk.
+ *
+ * @return Block device of the disk, NULL if no usable controller or disk was found
+ */
+struct BlockDevice *ahci_init(void);
+
+/**
+ * Interrupt handler for the IRQ line of the controller, retire finished command slots.
+ *
+ * @param int_number Interrupt vector that fired
+ * @return           True if a sleeping process was woken up
+ */
+bool ahci_isr(uint32_t int_number);
+
+/**
+ * Transfer blocks with one command slot, data goes straight to the buffer through the PRDT.
+ * With NCQ, slots of several requests (or several processes) are in flight at once.
+ * Outside a batch, sleeps until this command completes. Inside a batch, only issues it.
+ *
+ * @param ptr                   Buffer in the current address space, size block_count * AHCI_SECTOR_SIZE
+ * @param logical_block_address First sector
+ * @param block_count           Number of sectors
+ * @param is_write              Direction
+ */
+void ahci_transfer(void *ptr, uint32_t logical_block_address, uint16_t block_count, bool is_write);
+
+// Start a batch, following ahci_transfer() calls return once their command is issued
+void ahci_batch_begin(void);
+
+// Sleep until every command issued since ahci_batch_begin() completed
+void ahci_batch_end(void);
+
+/**
+ * Drain every slot, then issue FLUSH CACHE EXT so the disk commits its write cache.
+ * Sleeps until the disk reports completion.
+ */
+void ahci_flush(void);
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef _BLOCK_CACHE_H
+#define _BLOCK_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/driver/disk.h"
+#include "header/driver/block-device.h"
+
+/* -- Block cache constants -- */
+#define BLOCK_CACHE_ENTRY_COUNT 128 // number of cached sectors (128 * BLOCK_SIZE = 64 KiB, 64 blocks of 1 KiB or 16 of 4 KiB)
+#define BLOCK_CACHE_HASH_BITS 7
+#define BLOCK_CACHE_HASH_SIZE (1u << BLOCK_CACHE_HASH_BITS) // hash buckets
+#define BLOCK_CACHE_NONE -1         // null index for hash chain and LRU list
+
+/**
+ * BlockCacheStats - Counters exposed for diagnostics
+ *
+ * @param hits       Block requests served from memory
+ * @param misses     Block requests that had to go to the disk
+ * @param evictions  Valid entries reused for another block
+ * @param writebacks Dirty blocks written back to the disk (eviction or flush)
+ */
+struct BlockCacheStats
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;
+};
+
+/**
+ * BlockCacheEntry - One cached disk block
+ *
+ * @param device    Device the cached block belongs to
+ * @param lba       Logical block address of the cached block
+ * @param valid     Entry holds data for lba
+ * @param dirty     Data is newer than the disk and must be written back
+ * @param hash_next Next entry index in the same hash bucket
+ * @param lru_prev  Previous (more recently used) entry index
+ * @param lru_next  Next (less recently used) entry index
+ * @param data      Cached block content
+ */
+struct BlockCacheEntry
+{
+    struct BlockDevice *device;
+    uint32_t lba;
+    bool valid;
+    bool dirty;
+    int16_t hash_next;
+    int16_t lru_prev;
+    int16_t lru_next;
+    struct BlockBuffer data;
+};
+
+/**
+ * Read blocks through the cache.
+ * Cached blocks are served from memory, each missing run is read with one disk command
+ * and its blocks are added to the cache.
+ *
+ * @param device                Source device
+ * @param ptr                   Destination buffer, size block_count * BLOCK_SIZE
+ * @param logical_block_address First block to read
+ * @param block_count           Number of blocks to read
+ */
+void block_cache_read(struct BlockDevice *device, void *ptr, uint32_t logical_block_address, uint16_t block_count);
+
+/**
+ * Write blocks through the cache, write-back: every block is marked dirty and only reaches
+ * the disk on eviction or block_cache_flush(). Streaming data goes through the block queue instead.
+ *
+ * @param device                Target device
+ * @param ptr                   Source buffer, size block_count * BLOCK_SIZE
+ * @param logical_block_address First block to write
+ * @param block_count           Number of blocks to write
+ */
+void block_cache_write(struct BlockDevice *device, const void *ptr, uint32_t logical_block_address, uint16_t block_count);
+
+/**
+ * Copy a block only if it is cached, without touching the disk or the LRU order.
+ * Used by callers that bypass the cache for data blocks but must see dirty metadata.
+ *
+ * @param device                Device of the block
+ * @param logical_block_address Block to look up
+ * @param ptr                   Destination buffer, size BLOCK_SIZE
+ * @return                      True if the block was cached and copied
+ */
+bool block_cache_lookup(struct BlockDevice *device, uint32_t logical_block_address, void *ptr);
+
+/**
+ * Refresh the cached copy of a block that the caller writes to the disk directly.
+ * Cached copy becomes clean, nothing happens if the block is not cached.
+ *
+ * @param device                Device of the block
+ * @param logical_block_address Block being written
+ * @param ptr                   New block content, size BLOCK_SIZE
+ */
+void block_cache_update(struct BlockDevice *device, uint32_t logical_block_address, const void *ptr);
+
+/**
+ * Keep a clean copy of a block that the caller wrote to the disk directly, caching it if needed.
+ * Used for metadata the caller will read again soon.
+ *
+ * @param device                Device of the block
+ * @param logical_block_address Block being written
+ * @param ptr                   New block content, size BLOCK_SIZE
+ */
+void block_cache_fill(struct BlockDevice *device, uint32_t logical_block_address, const void *ptr);
+
+/**
+ * Write every dirty block of a device back, then flush the device itself
+ * @param device Device to flush
+ */
+void block_cache_flush(struct BlockDevice *device);
+
+/**
+ * Flush then drop every cached block of a device
+ * @param device Device to drop
+ */
+void block_cache_invalidate(struct BlockDevice *device);
+
+/**
+ * Copy current cache counters
+ * @param stats Output counters
+ */
+void block_cache_get_stats(struct BlockCacheStats *stats);
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef _BLOCK_DEVICE_H
+#define _BLOCK_DEVICE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* -- Block device statistics -- */
+#define BLOCK_STATS_HISTOGRAM_BUCKETS 20 // Bucket i counts latencies in [2^i, 2^(i+1)) us, bucket 0 also < 1 us, last one is open ended
+#define BLOCK_DEVICE_NAME_LENGTH 8
+
+struct BlockDevice;
+
+/**
+ * BlockDeviceStats - I/O accounting of one device, kept by block_device_read / write / flush
+ *
+ * @param reads           Read commands sent to the backend
+ * @param writes          Write commands sent to the backend
+ * @param flushes         Flush commands sent to the backend
+ * @param sectors_read    BLOCK_SIZE blocks read
+ * @param sectors_written BLOCK_SIZE blocks written
+ * @param busy_us         Time the device had a command outstanding, in microseconds (wraps after ~71 minutes)
+ * @param read_latency    log2 histogram of read latencies in microseconds
+ * @param write_latency   log2 histogram of write latencies in microseconds
+ */
+struct BlockDeviceStats
+{
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t flushes;
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+    uint32_t busy_us;
+    uint32_t read_latency[BLOCK_STATS_HISTOGRAM_BUCKETS];
+    uint32_t write_latency[BLOCK_STATS_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * BlockDeviceOperations - Entry points of a block device backend, block size is BLOCK_SIZE
+ *
+ * @param read        Read block_count blocks starting at logical_block_address into ptr
+ * @param write       Write block_count blocks from ptr starting at logical_block_address
+ * @param flush       Make every completed write durable, NULL if the backend is write-through
+ * @param capacity    Number of blocks on the device
+ * @param batch_begin Following requests may be left in flight, NULL if every request completes before returning
+ * @param batch_end   Wait for every request since batch_begin, NULL together with batch_begin
+ */
+struct BlockDeviceOperations
+{
+    void (*read)(struct BlockDevice *device, void *ptr, uint32_t logical_block_address, uint16_t block_count);
+    void (*write)(struct BlockDevice *device, const void *ptr, uint32_t logical_block_address, uint16_t block_count);
+    void (*flush)(struct BlockDevice *device);
+    uint32_t (*capacity)(struct BlockDevice *device);
+    void (*batch_begin)(struct BlockDevice *device);
+    void (*batch_end)(struct BlockDevice *device);
+};
+
+/**
+ * BlockDevice - A disk-like target the block cache, block queue and ext2 work on
+ *
+ * @param name          Short backend name for diagnostics ("ata", "virtio", "ahci", "ram", "image")
+ * @param ops           Backend entry points
+ * @param private_data  Backend state, NULL for backends with a single global instance
+ * @param stats         I/O accounting, starts zeroed
+ * @param batching      Inside block_device_batch_begin() of a backend with batch operations
+ * @param batch_start   TSC at block_device_batch_begin()
+ * @param batch_reads   Reads issued in the current batch, their latency is known at batch end
+ * @param batch_writes  Writes issued in the current batch
+ */
+struct BlockDevice
+{
+    const char *name;
+    const struct BlockDeviceOperations *ops;
+    void *private_data;
+    struct BlockDeviceStats stats;
+    bool batching;
+    uint64_t batch_start;
+    uint32_t batch_reads;
+    uint32_t batch_writes;
+};
+
+/**
+ * Read blocks from a device. Will blocking until read is completed (unless inside a batch).
+ *
+ * @param device                Source device
+ * @param ptr                   Destination buffer, size block_count * BLOCK_SIZE
+ * @param logical_block_address First block
+ * @param block_count           Number of blocks
+ */
+void block_device_read(struct BlockDevice *device, void *ptr, uint32_t logical_block_address, uint16_t block_count);
+
+/**
+ * Write blocks into a device. Will blocking until write is completed (unless inside a batch).
+ *
+ * @param device                Target device
+ * @param ptr                   Source buffer, size block_count * BLOCK_SIZE
+ * @param logical_block_address First block
+ * @param block_count           Number of blocks
+ */
+void block_device_write(struct BlockDevice *device, const void *ptr, uint32_t logical_block_address, uint16_t block_count);
+
+// Make completed writes durable - @param device Target device
+void block_device_flush(struct BlockDevice *device);
+
+// @param device Target device @return Number of BLOCK_SIZE blocks on the device
+uint32_t block_device_capacity(struct BlockDevice *device);
+
+/**
+ * Group the following reads / writes: a backend that can keep several requests in flight
+ * (virtio-blk, AHCI NCQ) posts them all and waits once at block_device_batch_end().
+ * Buffers must stay untouched until block_device_batch_end() returns.
+ *
+ * @param device Target device
+ */
+void block_device_batch_begin(struct BlockDevice *device);
+
+// Wait for every request since block_device_batch_begin() - @param device Target device
+void block_device_batch_end(struct BlockDevice *device);
+
+/**
+ * Set the TSC rate used to turn command durations into microseconds.
+ * Latencies are not accounted while the rate is 0 (host tools, before calibration).
+ *
+ * @param cycles_per_us TSC cycles per microsecond
+ */
+void block_device_set_tsc_rate(uint32_t cycles_per_us);
+
+/**
+ * Copy the statistics of a device
+ *
+ * @param device Source device
+ * @param stats  Destination
+ */
+void block_device_get_stats(struct BlockDevice *device, struct BlockDeviceStats *stats);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _BLOCK_QUEUE_H
+#define _BLOCK_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/driver/disk.h"
+#include "header/driver/block-device.h"
+
+/* -- Block queue constants -- */
+#define BLOCK_QUEUE_MAX_REQUESTS 256 // pending requests before the queue dispatches by itself
+#define BLOCK_QUEUE_MAX_MERGE BLOCK_QUEUE_MAX_REQUESTS // LBA48 lets one disk command carry the whole queue
+
+/**
+ * BlockRequest - One pending single block transfer
+ *
+ * @param lba    Logical block address
+ * @param buffer Caller memory of size BLOCK_SIZE, must stay valid until dispatch
+ */
+struct BlockRequest
+{
+    uint32_t lba;
+    uint8_t *buffer;
+};
+
+/**
+ * BlockQueue - Pending requests of one direction on one device
+ *
+ * @param device   Device every pending request targets
+ * @param requests Pending requests, in submission order until dispatch sorts them
+ * @param count    Number of pending requests
+ * @param is_write Direction of every pending request
+ */
+struct BlockQueue
+{
+    struct BlockDevice *device;
+    struct BlockRequest requests[BLOCK_QUEUE_MAX_REQUESTS];
+    uint32_t count;
+    bool is_write;
+};
+
+/**
+ * Queue a single block read. Data is only in buffer after block_queue_dispatch().
+ * Pending writes (or requests of another device) are dispatched first, the queue only holds one direction.
+ *
+ * @param device Source device
+ * @param buffer Destination, size BLOCK_SIZE
+ * @param lba    Block to read
+ */
+void block_queue_read(struct BlockDevice *device, void *buffer, uint32_t lba);
+
+/**
+ * Queue a single block write. Buffer is only read at block_queue_dispatch().
+ * Pending reads (or requests of another device) are dispatched first, the queue only holds one direction.
+ *
+ * @param device Target device
+ * @param buffer Source, size BLOCK_SIZE
+ * @param lba    Block to write
+ */
+void block_queue_write(struct BlockDevice *device, const void *buffer, uint32_t lba);
+
+/**
+ * Issue every pending request: sort by LBA (one elevator sweep), drop writes overwritten later,
+ * merge requests that are adjacent both on disk and in memory into multi block commands,
+ * submit them as one disk batch, keep block cache coherent.
+ */
+void block_queue_dispatch(void);
+
+#endif
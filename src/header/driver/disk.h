@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "header/driver/block-device.h"
 
 /* -- ATA PIO status codes -- */
 #define ATA_STATUS_BSY 0x80
@@ -12,6 +13,62 @@
 #define ATA_STATUS_DF 0x20
 #define ATA_STATUS_ERR 0x01
 
+/* -- ATA primary channel ports & commands -- */
+#define ATA_PRIMARY_DATA 0x1F0
+#define ATA_PRIMARY_SECTOR_COUNT 0x1F2
+#define ATA_PRIMARY_LBA_LOW 0x1F3
+#define ATA_PRIMARY_LBA_MID 0x1F4
+#define ATA_PRIMARY_LBA_HIGH 0x1F5
+#define ATA_PRIMARY_DRIVE_SELECT 0x1F6
+#define ATA_PRIMARY_COMMAND 0x1F7
+#define ATA_PRIMARY_STATUS 0x1F7
+#define ATA_PRIMARY_CONTROL 0x3F6
+
+#define ATA_CONTROL_NIEN 0x02 // Drive does not raise IRQ 14 while set
+
+#define ATA_COMMAND_READ_PIO 0x20
+#define ATA_COMMAND_WRITE_PIO 0x30
+#define ATA_COMMAND_READ_DMA 0xC8
+#define ATA_COMMAND_WRITE_DMA 0xCA
+#define ATA_COMMAND_READ_PIO_EXT 0x24
+#define ATA_COMMAND_WRITE_PIO_EXT 0x34
+#define ATA_COMMAND_READ_DMA_EXT 0x25
+#define ATA_COMMAND_WRITE_DMA_EXT 0x35
+#define ATA_COMMAND_IDENTIFY 0xEC
+#define ATA_COMMAND_FLUSH_CACHE 0xE7
+#define ATA_COMMAND_FLUSH_CACHE_EXT 0xEA
+
+/* -- ATA addressing limits -- */
+#define ATA_LBA28_LIMIT 0x10000000u // First sector LBA28 cannot reach
+#define ATA_LBA28_MAX_SECTORS 256 // Sector count 0 means 256 in LBA28 commands
+#define ATA_DRIVE_SELECT_LBA 0xE0 // Master drive, LBA mode
+#define ATA_DRIVE_SELECT_LBA48 0x40 // Master drive, LBA mode, upper nibble unused
+
+/* -- ATA IDENTIFY DEVICE data, word offsets -- */
+#define ATA_IDENTIFY_WORD_COUNT 256
+#define ATA_IDENTIFY_LBA28_SECTORS 60 // 2 words
+#define ATA_IDENTIFY_QUEUE_DEPTH 75 // Queue depth - 1, 5 bits
+#define ATA_IDENTIFY_SATA_CAPABILITIES 76
+#define ATA_IDENTIFY_NCQ_SUPPORTED (1 << 8)
+#define ATA_IDENTIFY_COMMAND_SETS 83
+#define ATA_IDENTIFY_LBA48_SECTORS 100 // 4 words
+#define ATA_IDENTIFY_LBA48_SUPPORTED (1 << 10)
+
+/* -- PCI IDE bus master (primary channel, offset from BAR4) -- */
+#define BMIDE_COMMAND 0x0
+#define BMIDE_STATUS 0x2
+#define BMIDE_PRDT_ADDRESS 0x4
+
+#define BMIDE_COMMAND_START 0x01
+#define BMIDE_COMMAND_READ 0x08 // Bus master writes into memory
+#define BMIDE_STATUS_ACTIVE 0x01
+#define BMIDE_STATUS_ERROR 0x02
+#define BMIDE_STATUS_IRQ 0x04
+
+#define PRD_END_OF_TABLE 0x8000
+#define DMA_BOUNCE_BLOCK_COUNT 128 // One PRD entry can move at most 64 KiB
+#define DMA_BOUNCE_SIZE (DMA_BOUNCE_BLOCK_COUNT * BLOCK_SIZE)
+
 #define BLOCK_SIZE 512
 #define HALF_BLOCK_SIZE (BLOCK_SIZE / 2)
 
@@ -22,8 +79,68 @@ struct BlockBuffer
 } __attribute__((packed));
 
 /**
- * ATA PIO logical block address read blocks. Will blocking until read is completed.
- * Note: ATA PIO will use 2-bytes per read/write operation.
+ * PhysicalRegionDescriptor - Entry of the bus master PRD table.
+ * Region must not cross a 64 KiB boundary, byte_count 0 means 64 KiB.
+ *
+ * @param physical_addr Physical address of the memory region
+ * @param byte_count    Region size in bytes
+ * @param flags         PRD_END_OF_TABLE on the last entry
+ */
+struct PhysicalRegionDescriptor
+{
+    uint32_t physical_addr;
+    uint16_t byte_count;
+    uint16_t flags;
+} __attribute__((packed));
+
+/**
+ * DiskDriverState - Contain all driver states
+ *
+ * @param sector_count    Drive capacity reported by IDENTIFY DEVICE, 0 if no drive answered
+ * @param lba48           Drive supports the 48-bit EXT commands
+ * @param dma_available   PCI IDE bus master found, DMA is used for transfers
+ * @param bus_master_io   Bus master I/O base (BAR4) of the IDE controller
+ * @param dma_in_flight   DMA command started, IRQ 14 must be confirmed by the bus master status
+ * @param irq_received    Set by the IRQ 14 handler, consumed by the waiting request
+ * @param last_ata_status Drive status captured by the IRQ handler
+ * @param last_bm_status  Bus master status captured by the IRQ handler
+ */
+struct DiskDriverState
+{
+    uint32_t sector_count;
+    bool lba48;
+    bool dma_available;
+    uint16_t bus_master_io;
+    bool dma_in_flight;
+    volatile bool irq_received;
+    volatile uint8_t last_ata_status;
+    volatile uint8_t last_bm_status;
+};
+
+/**
+ * Pick the disk backend. A virtio-blk device is preferred when present (QEMU -drive if=virtio),
+ * then an AHCI controller with a SATA disk (QEMU -device ich9-ahci).
+ * Otherwise identify the ATA drive, enable IRQ 14 and probe the PCI bus for an IDE bus master.
+ * If no bus master is found, read_blocks / write_blocks stay on interrupt-driven ATA PIO.
+ *
+ * @return Block device of the chosen backend, ATA device as the fallback
+ */
+struct BlockDevice *disk_init(void);
+
+/**
+ * IRQ 14 handler, acknowledge the drive & the bus master and wake the waiting process.
+ * Called from main_interrupt_handler
+ *
+ * @return True if a sleeping process was woken up
+ */
+bool disk_isr(void);
+
+/**
+ * ATA logical block address read blocks. Will blocking until read is completed.
+ * Calling process sleeps (PROCESS_STATE_BLOCKED) between IRQ 14, other processes run meanwhile.
+ * Uses bus master DMA when available, ATA PIO otherwise. Other backends are reached through struct BlockDevice.
+ * Note: ATA PIO will use 2-bytes per read/write operation, DMA goes through a bounce buffer.
+ * LBA48 EXT commands are used when the range or the count does not fit LBA28.
  * Recommended to use struct BlockBuffer
  *
  * @param ptr                   Pointer for storing reading data, this pointer should point to already allocated memory location.
@@ -31,17 +148,20 @@ struct BlockBuffer
  * @param logical_block_address Block address to read data from. Use LBA addressing
  * @param block_count           How many block to read, starting from block logical_block_address to lba-1
  */
-void read_blocks(void *ptr, uint32_t logical_block_address, uint8_t block_count);
+void read_blocks(void *ptr, uint32_t logical_block_address, uint16_t block_count);
 
 /**
- * ATA PIO logical block address write blocks. Will blocking until write is completed.
- * Note: ATA PIO will use 2-bytes per read/write operation.
+ * ATA logical block address write blocks. Will blocking until write is completed.
+ * Calling process sleeps (PROCESS_STATE_BLOCKED) between IRQ 14, other processes run meanwhile.
+ * Uses bus master DMA when available, ATA PIO otherwise. Other backends are reached through struct BlockDevice.
+ * Note: ATA PIO will use 2-bytes per read/write operation, DMA goes through a bounce buffer.
+ * LBA48 EXT commands are used when the range or the count does not fit LBA28.
  * Recommended to use struct BlockBuffer
  *
  * @param ptr                   Pointer to data that to be written into disk. Memory pointed should be positive integer multiple of BLOCK_SIZE
  * @param logical_block_address Block address to write data into. Use LBA addressing
  * @param block_count           How many block to write, starting from block logical_block_address to lba-1
  */
-void write_blocks(const void *ptr, uint32_t logical_block_address, uint8_t block_count);
+void write_blocks(const void *ptr, uint32_t logical_block_address, uint16_t block_count);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,117 @@
+#ifndef _PCI_H
+#define _PCI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* -- PCI configuration mechanism #1 ports -- */
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+#define PCI_BUS_COUNT 256
+#define PCI_SLOT_COUNT 32
+#define PCI_FUNCTION_COUNT 8
+
+/* -- PCI configuration space offsets -- */
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND 0x04
+#define PCI_STATUS 0x06
+#define PCI_PROG_IF 0x09
+#define PCI_SUBCLASS 0x0A
+#define PCI_CLASS 0x0B
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0 0x10
+#define PCI_BAR4 0x20
+#define PCI_BAR5 0x24
+#define PCI_SUBSYSTEM_ID 0x2E
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_VENDOR_NONE 0xFFFF
+#define PCI_HEADER_MULTI_FUNCTION 0x80
+#define PCI_BAR_IO_MASK 0xFFFFFFFC
+#define PCI_BAR_MEM_MASK 0xFFFFFFF0
+
+// Command register bits
+#define PCI_COMMAND_IO_SPACE 0x0001
+#define PCI_COMMAND_MEMORY_SPACE 0x0002
+#define PCI_COMMAND_BUS_MASTER 0x0004
+
+// Class codes used by the storage drivers
+#define PCI_CLASS_MASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+#define PCI_SUBCLASS_SATA 0x06
+
+// Programming interface bit of IDE controllers that support bus mastering
+#define PCI_PROG_IF_IDE_BUS_MASTER 0x80
+// Programming interface of SATA controllers in AHCI mode
+#define PCI_PROG_IF_AHCI 0x01
+
+/**
+ * PCIDevice - Location of a function on the PCI bus
+ *
+ * @param bus      Bus number
+ * @param slot     Device number on the bus
+ * @param function Function number of the device
+ */
+struct PCIDevice
+{
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+};
+
+/**
+ * Read 32-bit value from PCI configuration space
+ *
+ * @param dev    Target function
+ * @param offset Register offset, rounded down to 4-byte boundary
+ * @return       Register value
+ */
+uint32_t pci_config_read32(struct PCIDevice dev, uint8_t offset);
+
+/**
+ * Write 32-bit value into PCI configuration space
+ *
+ * @param dev    Target function
+ * @param offset Register offset, rounded down to 4-byte boundary
+ * @param value  Value to write
+ */
+void pci_config_write32(struct PCIDevice dev, uint8_t offset, uint32_t value);
+
+// Read 16-bit PCI configuration register - @param dev Target function @param offset Register offset
+uint16_t pci_config_read16(struct PCIDevice dev, uint8_t offset);
+
+// Read 8-bit PCI configuration register - @param dev Target function @param offset Register offset
+uint8_t pci_config_read8(struct PCIDevice dev, uint8_t offset);
+
+/**
+ * Scan the PCI bus for the first function with given class and subclass
+ *
+ * @param class_code Base class code
+ * @param subclass   Subclass code
+ * @param out        Found device location
+ * @return           True if a matching function is found
+ */
+bool pci_find_class(uint8_t class_code, uint8_t subclass, struct PCIDevice *out);
+
+/**
+ * Scan the PCI bus for the first function with given vendor and device id
+ *
+ * @param vendor_id Vendor id
+ * @param device_id Device id
+ * @param out       Found device location
+ * @return          True if a matching function is found
+ */
+bool pci_find_device(uint16_t vendor_id, uint16_t device_id, struct PCIDevice *out);
+
+/**
+ * Set bits in the command register of a function
+ *
+ * @param dev  Target function
+ * @param bits PCI_COMMAND_* bits to enable
+ */
+void pci_enable_command(struct PCIDevice dev, uint16_t bits);
+
+#endif
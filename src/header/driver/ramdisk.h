@@ -0,0 +1,32 @@
+#ifndef _RAMDISK_H
+#define _RAMDISK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/driver/block-device.h"
+
+/**
+ * RamDisk - Block device backed by a memory region
+ *
+ * @param memory      First byte of the region
+ * @param block_count Region size in BLOCK_SIZE blocks
+ */
+struct RamDisk
+{
+    uint8_t *memory;
+    uint32_t block_count;
+};
+
+/**
+ * Turn a memory region into a block device. Content of the region is kept, so an image
+ * already in memory (e.g. loaded by the bootloader or a host tool) can be mounted as is.
+ *
+ * @param device      Device to initialize
+ * @param disk        Backend state, must outlive the device
+ * @param memory      Region, size block_count * BLOCK_SIZE
+ * @param block_count Region size in blocks
+ */
+void ramdisk_create(struct BlockDevice *device, struct RamDisk *disk, void *memory, uint32_t block_count);
+
+#endif
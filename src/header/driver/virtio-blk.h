@@ -0,0 +1,184 @@
+#ifndef _VIRTIO_BLK_H
+#define _VIRTIO_BLK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/driver/block-device.h"
+
+/* -- Legacy (transitional) virtio PCI device -- */
+#define VIRTIO_PCI_VENDOR 0x1AF4
+#define VIRTIO_PCI_DEVICE_BLK 0x1001
+
+/* -- Legacy virtio header, offset from BAR0 I/O base -- */
+#define VIRTIO_REG_DEVICE_FEATURES 0x00
+#define VIRTIO_REG_GUEST_FEATURES 0x04
+#define VIRTIO_REG_QUEUE_ADDRESS 0x08 // Physical page number of the virtqueue
+#define VIRTIO_REG_QUEUE_SIZE 0x0C
+#define VIRTIO_REG_QUEUE_SELECT 0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY 0x10
+#define VIRTIO_REG_DEVICE_STATUS 0x12
+#define VIRTIO_REG_ISR_STATUS 0x13 // Reading it acknowledges the interrupt
+#define VIRTIO_REG_BLK_CAPACITY 0x14 // 64-bit, in 512 byte sectors (no MSI-X)
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+
+#define VIRTIO_ISR_QUEUE 0x01
+
+/* -- virtio-blk request -- */
+#define VIRTIO_BLK_T_IN 0  // Read
+#define VIRTIO_BLK_T_OUT 1 // Write
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+/* -- Virtqueue -- */
+#define VIRTQ_DESC_F_NEXT 0x1
+#define VIRTQ_DESC_F_WRITE 0x2 // Buffer is written by the device
+#define VIRTQ_ALIGN 0x1000
+#define VIRTQ_MAX_SIZE 256 // QEMU default queue size of virtio-blk
+#define VIRTQ_MEMORY_SIZE(n) ((((16 * (n) + 6 + 2 * (n)) + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1)) + \
+                              (((6 + 8 * (n)) + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1)))
+
+#define VIRTIO_BLK_MAX_REQUESTS 32 // Requests in flight at once
+#define VIRTIO_BLK_MAX_SEGMENTS 16 // Physically contiguous pieces of one request buffer
+#define VIRTIO_DESC_NONE 0xFFFF
+
+/**
+ * VirtqDescriptor - One buffer of a descriptor chain
+ *
+ * @param addr  Physical address of the buffer
+ * @param len   Buffer length in bytes
+ * @param flags VIRTQ_DESC_F_*
+ * @param next  Next descriptor index if VIRTQ_DESC_F_NEXT
+ */
+struct VirtqDescriptor
+{
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed));
+
+// Driver -> device ring, ring has queue size entries followed by used_event
+struct VirtqAvailable
+{
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} __attribute__((packed));
+
+// Completed chain - @param id Head descriptor index @param len Bytes written by the device
+struct VirtqUsedElement
+{
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed));
+
+// Device -> driver ring, ring has queue size entries followed by avail_event
+struct VirtqUsed
+{
+    uint16_t flags;
+    uint16_t idx;
+    struct VirtqUsedElement ring[];
+} __attribute__((packed));
+
+// First descriptor of every request - @param type VIRTIO_BLK_T_* @param sector First 512 byte sector
+struct VirtioBlkRequestHeader
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed));
+
+/**
+ * VirtioBlkRequest - In flight request, header & status must live in kernel memory the device can reach
+ *
+ * @param header Request header, read by the device
+ * @param status VIRTIO_BLK_S_*, written by the device
+ * @param in_use Slot owns a descriptor chain
+ */
+struct VirtioBlkRequest
+{
+    struct VirtioBlkRequestHeader header;
+    volatile uint8_t status;
+    bool in_use;
+};
+
+/**
+ * VirtioBlkState - Contain all virtio-blk driver states
+ *
+ * @param available      Device found and queue 0 is live
+ * @param io_base        Legacy virtio header I/O base (BAR0)
+ * @param irq            PIC IRQ line given by the firmware
+ * @param capacity       Disk size in sectors, clamped to 32-bit
+ * @param queue_size     Number of descriptors chosen by the device
+ * @param descriptors    Descriptor table
+ * @param available_ring Driver -> device ring
+ * @param used_ring      Device -> driver ring
+ * @param free_head      First free descriptor, free descriptors are chained with next
+ * @param free_count     Number of free descriptors
+ * @param last_used_idx  used_ring->idx value already processed
+ * @param in_flight      Requests submitted and not yet completed
+ * @param batching       Submissions are not notified until virtio_blk_batch_end()
+ * @param error_count    Requests completed with a status other than VIRTIO_BLK_S_OK
+ */
+struct VirtioBlkState
+{
+    bool available;
+    uint16_t io_base;
+    uint8_t irq;
+    uint32_t capacity;
+    uint16_t queue_size;
+    volatile struct VirtqDescriptor *descriptors;
+    volatile struct VirtqAvailable *available_ring;
+    volatile struct VirtqUsed *used_ring;
+    uint16_t free_head;
+    uint16_t free_count;
+    uint16_t last_used_idx;
+    uint32_t in_flight;
+    bool batching;
+    uint32_t error_count;
+};
+
+/**
+ * Probe the PCI bus for a legacy virtio-blk device and bring up its request queue.
+ *
+ * @return Block device of the disk, NULL if no usable device was found
+ */
+struct BlockDevice *virtio_blk_init(void);
+
+/**
+ * Interrupt handler for the IRQ line of the device, shared lines are checked with the ISR status.
+ *
+ * @param int_number Interrupt vector that fired
+ * @return           True if a sleeping process was woken up
+ */
+bool virtio_blk_isr(uint32_t int_number);
+
+/**
+ * Transfer blocks through the virtqueue, buffer is described with one descriptor per
+ * physically contiguous piece (scatter-gather), no bounce copy.
+ * Outside a batch, sleeps until the request completes. Inside a batch, only queues it.
+ *
+ * @param ptr                   Buffer in the current address space, size block_count * VIRTIO_BLK_SECTOR_SIZE
+ * @param logical_block_address First sector
+ * @param block_count           Number of sectors
+ * @param is_write              Direction
+ */
+void virtio_blk_transfer(void *ptr, uint32_t logical_block_address, uint16_t block_count, bool is_write);
+
+/**
+ * Start collecting requests: they are posted to the available ring without notifying the device.
+ */
+void virtio_blk_batch_begin(void);
+
+/**
+ * Notify the device once for every collected request and sleep until all of them completed.
+ * Buffers of the batch may be used again afterwards.
+ */
+void virtio_blk_batch_end(void);
+
+#endif
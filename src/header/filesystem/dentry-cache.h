@@ -0,0 +1,100 @@
+#ifndef _DENTRY_CACHE_H
+#define _DENTRY_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* -- Dentry cache constants -- */
+#define DENTRY_CACHE_ENTRY_COUNT 128 // number of cached (directory, name) pairs
+#define DENTRY_CACHE_HASH_BITS 7
+#define DENTRY_CACHE_HASH_SIZE (1u << DENTRY_CACHE_HASH_BITS) // hash buckets
+#define DENTRY_CACHE_NONE -1         // null index for hash chain and LRU list
+#define DENTRY_NAME_MAX 32           // longer names are looked up without the cache
+
+/**
+ * DentryCacheStats - Counters exposed for diagnostics
+ *
+ * @param hits          Lookups answered with a child inode
+ * @param negative_hits Lookups answered with "no such entry"
+ * @param misses        Lookups that had to scan the directory blocks
+ */
+struct DentryCacheStats
+{
+    uint32_t hits;
+    uint32_t negative_hits;
+    uint32_t misses;
+};
+
+/**
+ * DentryCacheEntry - One cached directory entry
+ *
+ * @param parent_inode Inode number of the directory
+ * @param child_inode  Inode number the name resolves to, 0 for a negative entry (name does not exist)
+ * @param name_len     Length of name
+ * @param valid        Entry holds a name
+ * @param hash_next    Next entry index in the same hash bucket
+ * @param lru_prev     Previous (more recently used) entry index
+ * @param lru_next     Next (less recently used) entry index
+ * @param name         Entry name, not null terminated
+ */
+struct DentryCacheEntry
+{
+    uint32_t parent_inode;
+    uint32_t child_inode;
+    uint8_t name_len;
+    bool valid;
+    int16_t hash_next;
+    int16_t lru_prev;
+    int16_t lru_next;
+    char name[DENTRY_NAME_MAX];
+};
+
+/**
+ * Look a name up in a directory without touching the disk
+ *
+ * @param parent_inode Inode number of the directory
+ * @param name         Entry name, not null terminated
+ * @param name_len     Length of name
+ * @param child_inode  Output, resolved inode number or 0 if the name is known not to exist
+ * @return             True if the answer came from the cache
+ */
+bool dentry_cache_lookup(uint32_t parent_inode, const char *name, uint8_t name_len, uint32_t *child_inode);
+
+/**
+ * Remember the result of a directory scan, replacing any older entry of the same name
+ *
+ * @param parent_inode Inode number of the directory
+ * @param name         Entry name, not null terminated
+ * @param name_len     Length of name, names longer than DENTRY_NAME_MAX are ignored
+ * @param child_inode  Inode number of the entry, 0 to cache a negative entry
+ */
+void dentry_cache_insert(uint32_t parent_inode, const char *name, uint8_t name_len, uint32_t child_inode);
+
+/**
+ * Forget one name of a directory
+ *
+ * @param parent_inode Inode number of the directory
+ * @param name         Entry name, not null terminated
+ * @param name_len     Length of name
+ */
+void dentry_cache_invalidate(uint32_t parent_inode, const char *name, uint8_t name_len);
+
+/**
+ * Forget every name of a directory, used when its inode is freed and may be reused
+ * @param parent_inode Inode number of the directory
+ */
+void dentry_cache_invalidate_directory(uint32_t parent_inode);
+
+/**
+ * Drop every cached entry, used when a filesystem is (re)mounted
+ */
+void dentry_cache_invalidate_all(void);
+
+/**
+ * Copy current cache counters
+ * @param stats Output counters
+ */
+void dentry_cache_get_stats(struct DentryCacheStats *stats);
+
+#endif
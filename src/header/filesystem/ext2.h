@@ -2,6 +2,7 @@
 #define _EXT2_H
 
 #include "header/driver/disk.h"
+#include "header/driver/block-device.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -9,14 +10,141 @@
 
 /* -- IF2130 File System constants -- */
 #define BOOT_SECTOR 0                                                              // legacy from FAT32 filesystem IF2130 OS
-#define DISK_SPACE 4194304u                                                        // 4MB disk space (because our disk or storage.bin is 4MB)
 #define EXT2_SUPER_MAGIC 0xEF53                                                    // this indicating that the filesystem used by OS is ext2
 #define INODE_SIZE sizeof(struct EXT2Inode)                                        // size of inode
-#define INODES_PER_TABLE (BLOCK_SIZE / INODE_SIZE)                                 // number of inode per block (512 / )
-#define GROUPS_COUNT ((BLOCK_SIZE / sizeof(struct EXT2BlockGroupDescriptor)) / 2u) // number of groups in the filesystem
-#define BLOCKS_PER_GROUP (DISK_SPACE / BLOCK_SIZE / GROUPS_COUNT)                  // number of blocks per group
-#define INODES_TABLE_BLOCK_COUNT 16u
-#define INODES_PER_GROUP (INODES_PER_TABLE * INODES_TABLE_BLOCK_COUNT) // number of inodes per group
+#define INODES_PER_TABLE(block_size) ((block_size) / INODE_SIZE)                   // number of inode per block (7 in 512 bytes)
+#define BGDS_PER_BLOCK(block_size) ((block_size) / sizeof(struct EXT2BlockGroupDescriptor)) // number of group descriptor per block
+#define EXT2_SUPERBLOCK_SECTOR 1                                                   // superblock location, sector (not block) so it is found before the block size is known
+
+/**
+ * Scratch block buffers held at once, counted per function on the deepest call path (htree leaf split):
+ *   add_entry_to_directory 1 -> dx_add_entry 3 -> dx_split_leaf 2 -> set_inode_block 2
+ *   -> ext2_store_inode 1 when an inode cache eviction runs under them                     = 9
+ * The other paths hold fewer:
+ *   write_range 2 -> allocate_node_blocks 2 -> store_extent_tree 1 -> deallocate_block 2  = 7
+ *   read 1 -> find_inode_by_name 1 -> dx_find_leaf 2 -> get_inode_block 1 -> get_extent_block 1 = 6
+ * deallocate_block holds one per pointer level below the inode, 2 with doubly indirect blocks.
+ * A path past the count stops the kernel instead of writing over the data after the pool.
+ */
+#define EXT2_SCRATCH_BLOCK_COUNT (1u + 3u + 2u + 2u + 1u)
+
+/**
+ * Filesystem block size, a multiple of the BLOCK_SIZE sector chosen by create_ext2() and stored in the superblock
+ * - every filesystem block is read and written as EXT2_SECTORS_PER_BLOCK consecutive sectors
+ * - the bgd table starts at the first block after the superblock sector (block 2 with 512 byte blocks, block 1 otherwise)
+ */
+#define EXT2_MIN_BLOCK_SIZE BLOCK_SIZE                                                     // images made before s_log_block_size existed
+#define EXT2_MAX_BLOCK_SIZE 4096u                                                          // largest block size, sizes every block buffer
+#define EXT2_SMALL_BLOCK_SIZE 1024u                                                        // block size of disks under EXT2_LARGE_DISK_SECTORS
+#define EXT2_LARGE_BLOCK_SIZE 4096u                                                        // block size of bigger disks
+#define EXT2_LARGE_DISK_SECTORS (536870912u / BLOCK_SIZE)                                  // 512 MB, same threshold as mke2fs "small" filesystems
+#define EXT2_SECTORS_PER_BLOCK(block_size) ((block_size) / BLOCK_SIZE)
+
+/**
+ * Geometry limits, actual geometry is chosen by create_ext2() from the disk size and stored in the superblock
+ * - groups count, blocks & inodes per group are read from superblock, not compile-time constant
+ */
+#define EXT2_MIN_GROUPS 8u                                                                 // small disk is still split into 8 groups
+#define EXT2_MAX_GROUPS 512u                                                               // bgd table kept in memory, 512 groups x 2MB = 1GB filesystem with 512 byte blocks
+#define EXT2_MIN_BLOCKS_PER_GROUP 256u                                                     // smallest group that still has a useful inode table
+#define EXT2_MAX_BLOCKS_PER_GROUP(block_size) ((block_size) * 8u)                          // block bitmap is a single block
+#define EXT2_BLOCKS_PER_INODE_TABLE_BLOCK 64u                                              // one inode table block for every 64 blocks of a group
+#define EXT2_MAX_INODES_PER_GROUP (INODES_PER_TABLE(EXT2_MAX_BLOCK_SIZE) * (EXT2_MAX_BLOCKS_PER_GROUP(EXT2_MAX_BLOCK_SIZE) / EXT2_BLOCKS_PER_INODE_TABLE_BLOCK))
+#define EXT2_ZERO_WRITE_BYTES 16384u                                                       // inode tables are zeroed 16 KB per disk command
+#define EXT2_DEFAULT_DISK_SECTORS (4194304u / BLOCK_SIZE)                                  // used when the disk does not report its size (legacy 4MB storage.bin)
+#define EXT2_POINTERS_PER_BLOCK(block_size) ((block_size) / sizeof(uint32_t))              // block numbers held by one indirect block
+#define EXT2_MAX_POINTERS_PER_BLOCK EXT2_POINTERS_PER_BLOCK(EXT2_MAX_BLOCK_SIZE)
+#define EXT2_BITMAP_CACHE_BYTES 16384u                                                     // group bitmaps (block or inode) resident in memory, 32 of 512 bytes down to 4 of 4 KB
+#define EXT2_BITMAP_CACHE_COUNT (EXT2_BITMAP_CACHE_BYTES / EXT2_MIN_BLOCK_SIZE)            // most bitmaps the cache can hold (smallest blocks)
+
+/**
+ * Compatible feature flags (s_feature_compat), an image without a flag is still mounted
+ * - reference: https://www.nongnu.org/ext2-doc/ext2.html#s-feature-compat
+ */
+#define EXT2_FEATURE_COMPAT_HAS_JOURNAL 0x0004 // metadata changes go through the journal area (s_journal_block)
+#define EXT2_FEATURE_COMPAT_DIR_INDEX 0x0020 // directories that outgrow one block get a hashed index (htree)
+
+/**
+ * Incompatible feature flags (s_feature_incompat), a driver that does not know a flag must not touch the image
+ * - reference: https://www.nongnu.org/ext2-doc/ext2.html#s-feature-incompat
+ */
+#define EXT2_FEATURE_INCOMPAT_EXTENTS 0x0040 // regular files are written with an extent tree (EXT2_EXTENTS_FL)
+
+/**
+ * Metadata journal, a write-ahead log in the spirit of ext3 JBD
+ * - one transaction at a time: descriptor block (home block numbers), the logged blocks, commit block
+ * - the whole transaction is written with a single sequential disk command, the commit checksum covers
+ *   descriptor and blocks so a torn write is never replayed
+ * - after the commit is flushed the blocks are written home (checkpoint), initialize_filesystem_ext2() replays
+ *   a committed transaction that was not checkpointed
+ * - reference: https://www.kernel.org/doc/html/latest/filesystems/ext4/journal.html
+ */
+#define EXT2_JOURNAL_MAGIC 0xC03B3998u                         // h_magic, same as JBD
+#define EXT2_JOURNAL_DESCRIPTOR_BLOCK 1                        // h_blocktype
+#define EXT2_JOURNAL_COMMIT_BLOCK 2                            // h_blocktype
+#define EXT2_JOURNAL_MIN_CAPACITY 64u                          // blocks one transaction can log with the largest block size
+#define EXT2_JOURNAL_BUFFER_BYTES ((EXT2_JOURNAL_MIN_CAPACITY + 2) * EXT2_MAX_BLOCK_SIZE) // running transaction in memory, descriptor and commit block included
+/**
+ * Blocks a directory operation (mkdir, create, rename, delete) logs at worst, file data blocks not counted:
+ *   htree insert: root, two index nodes, two leaves, the block the entry leaves (rename, delete)  6
+ *   pointer blocks the two appended directory blocks may rewrite                                  4
+ *   first block of a new directory, ".." block of a moved one                                     2
+ *   inode table blocks: parent, old parent or child, target                                       3
+ *   block bitmaps of the 6 allocated blocks and the inode bitmap, their group descriptor blocks   7 + 7
+ *   superblock                                                                                    1
+ * Mapping or freeing file data is reserved on top of it, see journal_data_blocks()
+ */
+#define EXT2_JOURNAL_OPERATION_BLOCKS (6u + 4u + 2u + 3u + 7u + 7u + 1u)
+#define EXT2_JOURNAL_DESCRIPTOR_SLOTS(block_size) (((block_size) - sizeof(struct EXT2JournalDescriptor)) / sizeof(uint32_t)) // j_home entries
+/**
+ * Journal area made by create_ext2() in blocks: as many as the buffer holds, at least EXT2_JOURNAL_MIN_CAPACITY + 2,
+ * without more logged blocks than one descriptor can name (252 of 1 KiB, 130 of 2 KiB, 64 of 4 KiB)
+ */
+#define EXT2_JOURNAL_BLOCKS(block_size)                                                         \
+    (EXT2_JOURNAL_BUFFER_BYTES / (block_size) < EXT2_JOURNAL_DESCRIPTOR_SLOTS(block_size) + 2 \
+         ? EXT2_JOURNAL_BUFFER_BYTES / (block_size)                                             \
+         : EXT2_JOURNAL_DESCRIPTOR_SLOTS(block_size) + 2)
+
+/**
+ * Delayed allocation, file data written by write(), write_at() and truncate_file() waits in memory without blocks
+ * - blocks are only picked by sync_filesystem(), when the final size of every file is known, so each file gets one run
+ * - a file deleted before the next sync never touches the disk
+ * - the blocks a delayed file will need are reserved against s_free_blocks_count, so the flush cannot run out of space
+ */
+#define EXT2_DELAYED_POOL_BYTES 65536u // file data waiting for its blocks
+#define EXT2_DELAYED_FILE_COUNT 64u    // files with delayed data at once, each starts on a block boundary of the pool
+
+#define EXT2_LEGACY_INODE_SIZE 70 // inode size of images without s_inode_size, made before i_flags existed
+
+/**
+ * Extent tree, same layout as ext4 extents
+ * - i_block (60 bytes) holds a header and 4 entries, with depth 1 the entries index leaf blocks of extents
+ * - an extent maps up to EXT2_EXTENT_MAX_LEN consecutive file blocks to consecutive disk blocks
+ * - reference: https://www.kernel.org/doc/html/latest/filesystems/ext4/dynamic.html#extent-tree
+ */
+#define EXT2_EXTENTS_FL 0x0001                                                                           // i_flags: i_block holds an extent tree, not block pointers
+#define EXT2_EXTENT_MAGIC 0xF30A                                                                         // eh_magic
+#define EXT2_EXTENT_MAX_LEN 32768u                                                                       // longest extent, ee_len above it marks unwritten extents in ext4
+#define EXT2_EXTENT_INODE_ENTRIES ((sizeof(uint32_t) * 15 - sizeof(struct EXT2ExtentHeader)) / sizeof(struct EXT2Extent)) // 4 in i_block
+#define EXT2_EXTENT_BLOCK_ENTRIES(block_size) (((block_size) - sizeof(struct EXT2ExtentHeader)) / sizeof(struct EXT2Extent)) // 41 in a 512 byte leaf
+#define EXT2_EXTENT_MAX_COUNT (EXT2_EXTENT_INODE_ENTRIES * EXT2_EXTENT_BLOCK_ENTRIES(EXT2_MAX_BLOCK_SIZE))                   // extents of a depth 1 tree, largest blocks
+
+/**
+ * Hashed directory index (htree), same layout as ext3 dir_index
+ * - block 0 of an indexed directory keeps "." and "..", ".." spans the rest of the block and hides the index root
+ * - index node blocks start with an empty entry spanning the whole block, so linear readers skip them
+ * - leaf blocks are ordinary directory blocks, the index only tells which leaf a name hash belongs to
+ * - reference: https://www.kernel.org/doc/html/latest/filesystems/ext4/directory.html#hash-tree-directories
+ */
+#define EXT2_DX_HASH_FNV1A 0x10                                                     // hash_version of our indexes, FNV-1a 32 bit
+#define EXT2_DX_HASH_CONTINUED 1u                                                   // low hash bit: names of this hash continue from the previous leaf
+#define EXT2_DX_INFO_LENGTH 8                                                       // sizeof(struct EXT2DxRootInfo)
+#define EXT2_DX_MAX_LEVELS 2                                                        // root plus one level of index nodes
+#define EXT2_DX_ROOT_INFO_OFFSET 24                                                 // after "." (12 bytes) and ".." header + name (12 bytes)
+#define EXT2_DX_ROOT_ENTRIES_OFFSET (EXT2_DX_ROOT_INFO_OFFSET + EXT2_DX_INFO_LENGTH)
+#define EXT2_DX_NODE_ENTRIES_OFFSET 8                                               // after the empty directory entry
+#define EXT2_DX_ROOT_LIMIT(block_size) (((block_size) - EXT2_DX_ROOT_ENTRIES_OFFSET) / sizeof(struct EXT2DxEntry))
+#define EXT2_DX_NODE_LIMIT(block_size) (((block_size) - EXT2_DX_NODE_ENTRIES_OFFSET) / sizeof(struct EXT2DxEntry))
 
 /**
  * inodes constant
@@ -53,6 +181,101 @@ struct EXT2DriverRequest
     bool is_directory;
 } __attribute__((packed));
 
+/**
+ * EXT2ReadAtRequest
+ * Positioned read of a file by path, argument block of the pread syscall
+ * @param path       Absolute path of the file
+ * @param buf        Destination, at least length bytes
+ * @param offset     First byte of the file to read
+ * @param length     Bytes wanted, reading stops early at the end of the file
+ * @param bytes_read Output, bytes copied into buf (0 at or past the end of the file)
+ */
+struct EXT2ReadAtRequest
+{
+    const char *path;
+    void *buf;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t bytes_read;
+};
+
+#define EXT2_DIRENT_NAME_LENGTH 256 // name bytes of an EXT2DirentRecord, a 255 byte name and its terminator
+
+/**
+ * EXT2DirentRecord
+ * One directory entry with its inline metadata, fixed layout record of the getdents syscall
+ * @param inode     Inode of the entry
+ * @param size      Size in bytes, of the directory table for a folder
+ * @param file_type EXT2_FT_REG_FILE or EXT2_FT_DIR, taken from the inode
+ * @param name_len  Length of name
+ * @param name      Name, null terminated
+ */
+struct EXT2DirentRecord
+{
+    uint32_t inode;
+    uint32_t size;
+    uint8_t file_type;
+    uint8_t name_len;
+    char name[EXT2_DIRENT_NAME_LENGTH];
+};
+
+/**
+ * EXT2GetdentsRequest
+ * Directory stream by path, argument block of the getdents syscall
+ * @param path        Absolute path of the folder
+ * @param records     Destination, room for max_records records
+ * @param max_records Records that fit in records
+ * @param cookie      In/out, where to resume: 0 on the first call, then left as the previous call set it
+ * @param count       Output, records filled (0 once the folder is exhausted)
+ */
+struct EXT2GetdentsRequest
+{
+    const char *path;
+    struct EXT2DirentRecord *records;
+    uint32_t max_records;
+    uint32_t cookie;
+    uint32_t count;
+};
+
+/**
+ * EXT2Stat
+ * Metadata of one inode, filled by stat_inode() for the stat and fstat syscalls.
+ * The inode format keeps no link count or timestamps, so there are none to report
+ * @param inode      Inode number
+ * @param mode       i_mode, EXT2_S_IFREG or EXT2_S_IFDIR
+ * @param size       Size in bytes
+ * @param blocks     512 byte sectors in use, data and mapping blocks (holes take none)
+ * @param block_size Filesystem block size, the preferred I/O size
+ */
+struct EXT2Stat
+{
+    uint32_t inode;
+    uint32_t mode;
+    uint32_t size;
+    uint32_t blocks;
+    uint32_t block_size;
+};
+
+#define EXT2_WRITE_APPEND 0xFFFFFFFFu // write_at() offset meaning the current end of file
+
+/**
+ * EXT2WriteAtRequest
+ * Positioned write of a file by path, argument block of the pwrite syscall
+ * @param path          Absolute path of the file, created empty if missing
+ * @param buf           Source, length bytes
+ * @param offset        First byte of the file to write, EXT2_WRITE_APPEND to append
+ * @param length        Bytes to write
+ * @param bytes_written Output, bytes written
+ */
+struct EXT2WriteAtRequest
+{
+    const char *path;
+    const void *buf;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t bytes_written;
+};
+
 /**
  * EXT2Superblock:
  * - https://www.nongnu.org/ext2-doc/ext2.html#superblock
@@ -90,6 +313,13 @@ struct EXT2Superblock
     uint8_t s_prealloc_blocks;     // 8bit value indicating the number of blocks to preallocate for files.
     uint8_t s_prealloc_dir_blocks; // 8bit value indicating the number of blocks to preallocate for directories.
 
+    uint32_t s_feature_compat;   // 32bit bitmask of compatible features (EXT2_FEATURE_COMPAT_*), zero on images made before the field existed
+    uint32_t s_feature_incompat; // 32bit bitmask of incompatible features (EXT2_FEATURE_INCOMPAT_*)
+    uint16_t s_inode_size;       // 16bit size of an inode table entry, zero means EXT2_LEGACY_INODE_SIZE
+    uint32_t s_log_block_size;   // block size is BLOCK_SIZE << s_log_block_size, zero (512 bytes) on images made before the field existed
+    uint32_t s_journal_block;    // first block of the journal area, with EXT2_FEATURE_COMPAT_HAS_JOURNAL
+    uint32_t s_journal_blocks;   // length of the journal area in blocks
+
 } __attribute__((packed));
 
 /**
@@ -143,7 +373,7 @@ struct EXT2BlockGroupDescriptor
  */
 struct EXT2BlockGroupDescriptorTable
 {
-    struct EXT2BlockGroupDescriptor table[GROUPS_COUNT]; // can be change with fixed size array
+    struct EXT2BlockGroupDescriptor table[EXT2_MAX_GROUPS]; // can be change with fixed size array
 };
 
 /**
@@ -155,7 +385,7 @@ struct EXT2Inode
 {
     uint16_t i_mode;   // 16bit value indicating the file type and the access rights.
     uint32_t i_size;   // 32bit value indicating the size of the file in bytes.
-    uint32_t i_blocks; // 32bit value indicating the number of blocks used by the file.
+    uint32_t i_blocks; // 32bit value indicating the number of 512 byte sectors used by the file, data and mapping blocks.
 
     /**
      * 15 x 32bit block numbers pointing to the blocks containing the data for this inode
@@ -172,11 +402,13 @@ struct EXT2Inode
      */
     uint32_t i_block[15];
 
+    uint16_t i_flags; // 16bit inode flags (EXT2_EXTENTS_FL), still 7 inodes per inode table block
+
 } __attribute__((packed));
 
 struct EXT2InodeTable
 {
-    struct EXT2Inode table[INODES_PER_GROUP]; // can be change with fixed size array
+    struct EXT2Inode table[EXT2_MAX_INODES_PER_GROUP]; // can be change with fixed size array
 };
 
 /**
@@ -209,6 +441,187 @@ struct EXT2DirectoryEntry
 
 } __attribute__((packed));
 
+/**
+ * EXT2DxRootInfo
+ * Header of the index root, right after the ".." entry of block 0
+ *
+ * @param reserved_zero   Always 0
+ * @param hash_version    Hash function of the index, EXT2_DX_HASH_FNV1A
+ * @param info_length     EXT2_DX_INFO_LENGTH, also what tells an indexed block 0 from a linear one
+ * @param indirect_levels Index node levels between the root and the leaves (0 or 1)
+ * @param unused_flags    Unused
+ */
+struct EXT2DxRootInfo
+{
+    uint32_t reserved_zero;
+    uint8_t hash_version;
+    uint8_t info_length;
+    uint8_t indirect_levels;
+    uint8_t unused_flags;
+} __attribute__((packed));
+
+/**
+ * EXT2DxEntry
+ * One index entry, sorted by hash. Entry 0 of a root or node has no hash, its hash field is a struct EXT2DxCountLimit
+ *
+ * @param hash  Smallest name hash stored under block (EXT2_DX_HASH_CONTINUED may be set)
+ * @param block Logical block, inside the directory, of the leaf or index node
+ */
+struct EXT2DxEntry
+{
+    uint32_t hash;
+    uint32_t block;
+} __attribute__((packed));
+
+/**
+ * EXT2DxCountLimit
+ * @param limit Index entries the block can hold
+ * @param count Index entries in use, entry 0 included
+ */
+struct EXT2DxCountLimit
+{
+    uint16_t limit;
+    uint16_t count;
+} __attribute__((packed));
+
+/**
+ * EXT2ExtentHeader
+ * Start of every extent tree node, in i_block or in a leaf block
+ *
+ * @param eh_magic      EXT2_EXTENT_MAGIC
+ * @param eh_entries    Entries in use
+ * @param eh_max        Entries the node can hold
+ * @param eh_depth      0 if the entries are extents, 1 if they index leaf blocks
+ * @param eh_generation Unused
+ */
+struct EXT2ExtentHeader
+{
+    uint16_t eh_magic;
+    uint16_t eh_entries;
+    uint16_t eh_max;
+    uint16_t eh_depth;
+    uint32_t eh_generation;
+} __attribute__((packed));
+
+/**
+ * EXT2Extent
+ * Leaf entry, sorted by ee_block
+ *
+ * @param ee_block    First file block covered
+ * @param ee_len      Number of blocks covered
+ * @param ee_start_hi Upper 16 bits of the disk block, always 0 (block numbers are 32 bit)
+ * @param ee_start    First disk block
+ */
+struct EXT2Extent
+{
+    uint32_t ee_block;
+    uint16_t ee_len;
+    uint16_t ee_start_hi;
+    uint32_t ee_start;
+} __attribute__((packed));
+
+/**
+ * EXT2ExtentIndex
+ * Index entry of a depth 1 node, sorted by ei_block
+ *
+ * @param ei_block   First file block covered by the leaf
+ * @param ei_leaf    Disk block of the leaf
+ * @param ei_leaf_hi Upper 16 bits of ei_leaf, always 0
+ * @param ei_unused  Unused
+ */
+struct EXT2ExtentIndex
+{
+    uint32_t ei_block;
+    uint32_t ei_leaf;
+    uint16_t ei_leaf_hi;
+    uint16_t ei_unused;
+} __attribute__((packed));
+
+/**
+ * EXT2JournalHeader
+ * Start of every journal block
+ *
+ * @param h_magic     EXT2_JOURNAL_MAGIC
+ * @param h_blocktype EXT2_JOURNAL_DESCRIPTOR_BLOCK or EXT2_JOURNAL_COMMIT_BLOCK
+ * @param h_sequence  Transaction number, descriptor and commit block of one transaction carry the same one
+ */
+struct EXT2JournalHeader
+{
+    uint32_t h_magic;
+    uint32_t h_blocktype;
+    uint32_t h_sequence;
+} __attribute__((packed));
+
+/**
+ * EXT2JournalDescriptor
+ * First block of the journal area, the logged blocks follow it in the same order as j_home
+ *
+ * @param j_header Block header
+ * @param j_count  Logged blocks, 0 once the transaction is checkpointed
+ * @param j_home   Home block of every logged block, fills the rest of the descriptor block
+ */
+struct EXT2JournalDescriptor
+{
+    struct EXT2JournalHeader j_header;
+    uint32_t j_count;
+    uint32_t j_home[];
+} __attribute__((packed));
+
+/**
+ * EXT2JournalCommit
+ * Block right after the last logged block, a transaction without a valid one is ignored
+ *
+ * @param c_header   Block header
+ * @param c_checksum FNV-1a of the descriptor block and every logged block
+ */
+struct EXT2JournalCommit
+{
+    struct EXT2JournalHeader c_header;
+    uint32_t c_checksum;
+} __attribute__((packed));
+
+/**
+ * EXT2DelayedFile
+ * Data of one regular file that has no blocks yet, the inode already holds the final i_size
+ *
+ * @param inode Inode number of the file, 0 for an unused entry
+ * @param start Offset of the data in the delayed pool
+ * @param size  Bytes of data, same as i_size
+ */
+struct EXT2DelayedFile
+{
+    uint32_t inode;
+    uint32_t start;
+    uint32_t size;
+};
+
+/**
+ * EXT2BitmapCacheEntry
+ * One block or inode bitmap kept in memory, changes reach the block cache with the group descriptors (sync_fs_metadata)
+ *
+ * @param block     Disk block of the bitmap, 0 for an unused entry (block 0 is the boot sector)
+ * @param dirty     Changed since it was last written to the block cache
+ * @param last_used Access clock of the last use, the smallest one is evicted
+ * @param words     Bitmap content (one block of the bitmap pool), bit i of the group is bit i % 32 of words[i / 32]
+ */
+struct EXT2BitmapCacheEntry
+{
+    uint32_t block;
+    bool dirty;
+    uint32_t last_used;
+    uint32_t *words;
+};
+
+/**
+ * EXT2BlockBuffer
+ * One filesystem block, sized for the largest supported block size
+ * @param buf Byte buffer, the first ext2_block_size() bytes are used
+ */
+struct EXT2BlockBuffer
+{
+    uint8_t buf[EXT2_MAX_BLOCK_SIZE];
+};
+
 /**
  *  REGULAR function
  */
@@ -249,18 +662,26 @@ uint16_t get_entry_record_len(uint8_t name_len);
  */
 uint32_t get_dir_first_child_offset(void *ptr);
 
+/**
+ * get the disk block holding one block of an inode's data, following indirect blocks or the extent tree
+ * @param node the inode
+ * @param logical block index inside the file or directory
+ * @return the block number, 0 for a hole or an index past the mapped range
+ */
+uint32_t get_inode_block(struct EXT2Inode *node, uint32_t logical);
+
 /* =================== MAIN FUNCTION OF EXT32 FILESYSTEM ============================*/
 
 /**
  * @brief get bgd index from inode, inode will starts at index 1
- * @param inode 1 to INODES_PER_GROUP * GROUP_COUNT
- * @return bgd index (0 to GROUP_COUNT - 1)
+ * @param inode 1 to s_inodes_count
+ * @return bgd index (0 to groups count - 1)
  */
 uint32_t inode_to_bgd(uint32_t inode);
 
 /**
  * @brief get inode local index in the corrresponding bgd
- * @param inode 1 to INODES_PER_GROUP * GROUP_COUNT
+ * @param inode 1 to s_inodes_count
  * @return local index
  */
 uint32_t inode_to_local(uint32_t inode);
@@ -283,15 +704,51 @@ bool is_empty_storage(void);
 
 /**
  * @brief create a new EXT2 filesystem. Will write fs_signature into boot sector,
- * initialize super block, bgd table, block and inode bitmap, and create root directory
+ * size the groups from the device capacity, initialize super block, bgd table,
+ * block and inode bitmap, and create root directory
  */
 void create_ext2(void);
 
 /**
  * @brief Initialize file system driver state, if is_empty_storage() then create_ext2()
- * Else, read and cache super block (located at block 1) and bgd table (located at block 2) into state
+ * Else, read and cache super block (located at block 1) and bgd table (starting at block 2) into state,
+ * geometry (groups count, blocks & inodes per group) comes from the super block,
+ * a committed journal transaction left by an interrupted mount is replayed first
+ * @param device block device holding the filesystem, every later block access goes to it
+ */
+void initialize_filesystem_ext2(struct BlockDevice *device);
+
+/**
+ * @brief write every metadata change back to the disk: superblock, bgd table, bitmaps and the dirty inodes,
+ * operations only update them in memory, so this runs from the sync syscall and the periodic flusher.
+ * Delayed file data gets its blocks first. With a journal everything changed since the last sync is committed as one transaction
+ */
+void sync_filesystem(void);
+
+/**
+ * @brief metadata changed since the last sync_filesystem()
+ */
+bool filesystem_needs_sync(void);
+
+/**
+ * @brief block device the filesystem was mounted from
+ * @return device given to initialize_filesystem_ext2()
+ */
+struct BlockDevice *ext2_get_device(void);
+
+/**
+ * @brief block size of the mounted filesystem
+ * @return bytes per block, BLOCK_SIZE << s_log_block_size
+ */
+uint32_t ext2_block_size(void);
+
+/**
+ * @brief read filesystem blocks through the block cache, each one is a multi-sector transfer
+ * @param ptr destination, count * ext2_block_size() bytes
+ * @param block first filesystem block
+ * @param count number of blocks
  */
-void initialize_filesystem_ext2(void);
+void ext2_read_blocks(void *ptr, uint32_t block, uint32_t count);
 
 /**
  * @brief check whether a directory table has children or not
@@ -309,6 +766,19 @@ bool is_directory_empty(uint32_t inode);
  */
 int8_t read_directory(struct EXT2DriverRequest *prequest);
 
+/**
+ * @brief EXT2 directory stream, copy the entries of a folder as EXT2DirentRecord, resuming where the previous call stopped.
+ * "." and ".." are left out. Each call is one pass over the directory blocks it covers, indirect ones included
+ * @param dir_inode inode of the folder
+ * @param cookie in/out, byte position in the directory table: 0 to start, moved past the entries copied
+ * @param records destination
+ * @param max_records room in records
+ * @param count output, records copied, 0 once the folder is exhausted
+ * @return Error code: 0 success - 1 not a folder
+ */
+int8_t read_directory_entries(uint32_t dir_inode, uint32_t *cookie, struct EXT2DirentRecord *records, uint32_t max_records,
+                              uint32_t *count);
+
 /**
  * @brief EXT2 read, read a file from file system
  * @param request All attribute will be used except is_dir for read, buffer_size will limit reading count
@@ -316,6 +786,19 @@ int8_t read_directory(struct EXT2DriverRequest *prequest);
  */
 int8_t read(struct EXT2DriverRequest request);
 
+/**
+ * @brief EXT2 positioned read, copy length bytes of a file starting at offset.
+ * Only the blocks covering the range are mapped and read, memory use does not depend on the file size.
+ * Holes (unmapped blocks) read as zero.
+ * @param inode_num inode of the file
+ * @param buf destination, at least length bytes
+ * @param offset first byte of the file to read
+ * @param length bytes wanted, clamped to the end of the file
+ * @param bytes_read output, bytes copied into buf
+ * @return Error code: 0 success - 1 not a file - -1 unknown
+ */
+int8_t read_at(uint32_t inode_num, void *buf, uint32_t offset, uint32_t length, uint32_t *bytes_read);
+
 /**
  * @brief EXT2 write, write a file or a folder to file system
  *
@@ -324,10 +807,43 @@ int8_t read(struct EXT2DriverRequest request);
  */
 int8_t write(struct EXT2DriverRequest *request);
 
+/**
+ * @brief EXT2 positioned write, overwrite or extend a regular file in place.
+ * Blocks already mapped are rewritten, a hole or a block past the end of file is allocated (next to the block before it
+ * when free) only when the data written to it is not all zero. Writing past the end of file leaves the gap as a hole.
+ * Appending costs O(bytes appended), not O(file size). A range bigger than one journal transaction holds is written in
+ * pieces ending on a block boundary, each its own operation.
+ * @param inode_num inode of the file
+ * @param buf source, length bytes
+ * @param offset first byte of the file to write, EXT2_WRITE_APPEND for the end of file
+ * @param length bytes to write
+ * @param bytes_written output, bytes written, on disk full the data before the first block without room is still written
+ * @return Error code: 0 success - 1 not a file - -1 disk full or file too large
+ */
+int8_t write_at(uint32_t inode_num, const void *buf, uint32_t offset, uint32_t length, uint32_t *bytes_written);
+
+/**
+ * @brief EXT2 truncate, set the size of a regular file.
+ * Shrinking frees only the blocks past the new end (and mapping blocks left empty),
+ * growing leaves a hole after the current end and allocates nothing. Freeing more than one journal transaction holds
+ * goes in steps from the end, each leaves a shorter consistent file.
+ * @param inode_num inode of the file
+ * @param size new size in bytes
+ * @return Error code: 0 success - 1 not a file - -1 disk full
+ */
+int8_t truncate_file(uint32_t inode_num, uint32_t size);
+
+/**
+ * @brief give back the blocks of an empty directory past its first one, in pieces that each fit one journal transaction.
+ * delete() runs it before a directory too big to free in one operation
+ * @param inode_num inode of the empty directory
+ */
+void shrink_empty_directory(uint32_t inode_num);
+
 /**
  * @brief EXT2 delete, delete a file or empty directory in file system
  *  @param request buf and buffer_size is unused, is_dir == true means delete folder (possible file with name same as folder)
- * @return Error code: 0 success - 1 not found - 2 folder is not empty - 3 parent folder invalid -1 unknown
+ * @return Error code: 0 success - 1 not found - 2 folder is not empty - 3 parent folder invalid - 4 file is open -1 unknown
  */
 int8_t delete (struct EXT2DriverRequest request);
 
@@ -356,21 +872,20 @@ void deallocate_blocks(void *loc, uint32_t blocks);
 
 /**
  * @brief deallocate block from the disk
- * @param locations block locations
+ * @param locations block locations, 0 entries are skipped
  * @param blocks number of blocks
- * @param bitmap block bitmap
- * @param depth depth of the block
- * @param last_bgd last bgd that is used
- * @param bgd_loaded whether bgd is loaded or not
- * @return new last bgd
+ * @param depth 0 for data blocks, 1 single indirect, 2 doubly indirect, 3 triply indirect: everything they point to is freed too
  */
-uint32_t deallocate_block(uint32_t *locations, uint32_t blocks, struct BlockBuffer *bitmap, uint32_t depth, uint32_t *last_bgd, bool bgd_loaded);
+void deallocate_block(uint32_t *locations, uint32_t blocks, uint32_t depth);
 
 /**
  * @brief write node->block in the given node, will allocate
  * at least node->blocks number of blocks, if first 12 item of node-> block
- * is not enough, will use indirect blocks
- * @param ptr the buffer that needs to be written
+ * is not enough, will use indirect blocks.
+ * With EXT2_FEATURE_INCOMPAT_EXTENTS a regular file is mapped with an extent tree instead,
+ * indirect blocks stay the fallback when free space is too fragmented for EXT2_EXTENT_MAX_COUNT extents.
+ * Blocks of ptr that are all zero are left as holes, without a data block (or a pointer table) of their own
+ * @param ptr the buffer that needs to be written, NULL for a file of zeroes
  * @param node pointer of the node
  * @param preffered_bgd it is located at the node inode bgd
  *
@@ -379,18 +894,70 @@ uint32_t deallocate_block(uint32_t *locations, uint32_t blocks, struct BlockBuff
 void allocate_node_blocks(void *ptr, struct EXT2Inode *node, uint32_t prefered_bgd);
 
 /**
- * @brief update the node to the disk
+ * @brief update the node, through the inode cache: it reaches the disk on the next inode_cache_flush()
  * @param node pointer of node
  * @param inode location of the node
  */
 void sync_node(struct EXT2Inode *node, uint32_t inode);
 
+/**
+ * @brief write an inode straight into its inode table block (block cache), used by the inode cache
+ * @param inode location of the node
+ * @param node pointer of node
+ */
+void ext2_store_inode(uint32_t inode, const struct EXT2Inode *node);
+
+/**
+ * @brief read an inode straight from its inode table block (block cache), used by the inode cache
+ * @param inode_num location of the node
+ * @param out_node pointer of node
+ */
+void ext2_load_inode(uint32_t inode_num, struct EXT2Inode *out_node);
+
 uint32_t allocate_block(uint32_t prefered_bgd);
 
+/**
+ * @brief allocate a run of contiguous blocks, the whole run if some group has it (preferred group first),
+ * else the longest free run found
+ * @param prefered_bgd group tried first
+ * @param wanted number of blocks wanted
+ * @param count output, number of blocks allocated (1 to wanted), 0 if the disk is full
+ * @return first block of the run, 0 if the disk is full
+ */
+uint32_t allocate_blocks(uint32_t prefered_bgd, uint32_t wanted, uint32_t *count);
+
 uint32_t find_inode_by_name(struct EXT2Inode *parent_inode, const char *name, uint8_t name_len);
 
+/**
+ * @brief resolve one name inside a directory, through the dentry cache
+ * @param parent_inode_num inode of the directory
+ * @param name entry name, not null terminated
+ * @param name_len length of name
+ * @return inode of the entry, 0 if it does not exist or parent_inode_num is not a directory
+ */
+uint32_t ext2_lookup(uint32_t parent_inode_num, const char *name, uint8_t name_len);
+
+/**
+ * @brief walk an absolute path from the root one component at a time, every component but the last must be a directory
+ * @param path path like "/usr/bin/sh", repeated and trailing '/' are ignored, "" and "/" give the root
+ * @return inode the path points to, 0 if any component is missing
+ */
+uint32_t ext2_resolve_path(const char *path);
+
+/**
+ * @brief copy an inode out of the inode cache
+ * @param inode_num location of the node
+ * @param out_node pointer of node
+ */
 void read_inode(uint32_t inode_num, struct EXT2Inode *out_node);
 
+/**
+ * @brief metadata of an inode without reading its data, served by the inode cache
+ * @param inode_num location of the node
+ * @param stat output
+ */
+void stat_inode(uint32_t inode_num, struct EXT2Stat *stat);
+
 int8_t rename_entry(uint32_t old_parent_ino, const char *old_name, uint32_t new_parent_ino, const char *new_name);
 
 #endif
\ No newline at end of file
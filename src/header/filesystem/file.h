@@ -0,0 +1,159 @@
+#ifndef _FILE_H
+#define _FILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* -- File descriptor constants -- */
+#define FILE_DESCRIPTOR_COUNT_MAX 16 // open files per process, a file descriptor indexes the table
+
+// open() flags
+#define FILE_OPEN_READ 0x01     // read() allowed
+#define FILE_OPEN_WRITE 0x02    // write() allowed
+#define FILE_OPEN_CREATE 0x04   // create an empty file if the path does not exist
+#define FILE_OPEN_TRUNCATE 0x08 // drop the content on open, needs FILE_OPEN_WRITE
+#define FILE_OPEN_APPEND 0x10   // every write() goes to the end of file
+
+// lseek() whence
+#define FILE_SEEK_SET 0 // offset from the start of file
+#define FILE_SEEK_CUR 1 // offset from the current position
+#define FILE_SEEK_END 2 // offset from the end of file
+
+// Error codes, every file syscall returns a negative one on failure
+#define FILE_ERROR_NOT_FOUND -1      // path does not exist
+#define FILE_ERROR_NOT_A_FILE -2     // path is a directory
+#define FILE_ERROR_TABLE_FULL -3     // FILE_DESCRIPTOR_COUNT_MAX files already open
+#define FILE_ERROR_BAD_DESCRIPTOR -4 // descriptor is not open
+#define FILE_ERROR_ACCESS -5         // read without FILE_OPEN_READ or write without FILE_OPEN_WRITE
+#define FILE_ERROR_INVALID -6        // bad flags, whence or resulting offset
+#define FILE_ERROR_IO -7             // filesystem failure, disk full
+
+/**
+ * OpenFile - One open file, what a file descriptor refers to
+ *
+ * @param inode  Inode number of the file, path is only resolved by open()
+ * @param entry  Inode cache reference held until close, delete() refuses the file while it is held
+ * @param offset Position of the next read() / write()
+ * @param flags  FILE_OPEN_* flags given to open()
+ * @param used   Descriptor is open
+ */
+struct OpenFile
+{
+    uint32_t inode;
+    struct InodeCacheEntry *entry;
+    uint32_t offset;
+    uint32_t flags;
+    bool used;
+} __attribute__((packed));
+
+/**
+ * FileDescriptorTable - Open files of one process, lives in the process control block
+ * @param files Open file of every descriptor
+ */
+struct FileDescriptorTable
+{
+    struct OpenFile files[FILE_DESCRIPTOR_COUNT_MAX];
+} __attribute__((packed));
+
+/**
+ * FileIORequest - Argument block of the read and write syscalls
+ *
+ * @param fd    File descriptor
+ * @param buf   Destination (read) or source (write)
+ * @param count Bytes to transfer
+ */
+struct FileIORequest
+{
+    int32_t fd;
+    void *buf;
+    uint32_t count;
+};
+
+/**
+ * FileSeekRequest - Argument block of the lseek syscall
+ *
+ * @param fd     File descriptor
+ * @param offset Signed distance from whence
+ * @param whence FILE_SEEK_SET, FILE_SEEK_CUR or FILE_SEEK_END
+ */
+struct FileSeekRequest
+{
+    int32_t fd;
+    int32_t offset;
+    uint32_t whence;
+};
+
+struct EXT2Stat;
+struct InodeCacheEntry;
+
+/**
+ * Open an already resolved regular file in the lowest free descriptor
+ *
+ * @param table Descriptor table of the process
+ * @param inode Inode number of the file
+ * @param flags FILE_OPEN_* flags, FILE_OPEN_CREATE is handled by the caller that resolves the path
+ * @return      File descriptor, negative FILE_ERROR_* on failure,
+ *              FILE_ERROR_TABLE_FULL also when INODE_CACHE_PINNED_MAX inodes are already referenced
+ */
+int32_t file_open(struct FileDescriptorTable *table, uint32_t inode, uint32_t flags);
+
+/**
+ * Read from the current position and advance it, no path lookup
+ *
+ * @param table Descriptor table of the process
+ * @param fd    File descriptor
+ * @param buf   Destination, at least count bytes
+ * @param count Bytes wanted
+ * @return      Bytes read (0 at end of file), negative FILE_ERROR_* on failure
+ */
+int32_t file_read(struct FileDescriptorTable *table, int32_t fd, void *buf, uint32_t count);
+
+/**
+ * Write at the current position (end of file with FILE_OPEN_APPEND) and advance it
+ *
+ * @param table Descriptor table of the process
+ * @param fd    File descriptor
+ * @param buf   Source, count bytes
+ * @param count Bytes to write
+ * @return      Bytes written, fewer than count when the disk fills up, negative FILE_ERROR_* on failure
+ */
+int32_t file_write(struct FileDescriptorTable *table, int32_t fd, const void *buf, uint32_t count);
+
+/**
+ * Move the position of a descriptor, it may go past the end of file (the gap a later write leaves reads as zero)
+ *
+ * @param table  Descriptor table of the process
+ * @param fd     File descriptor
+ * @param offset Signed distance from whence
+ * @param whence FILE_SEEK_SET, FILE_SEEK_CUR or FILE_SEEK_END
+ * @return       New position, negative FILE_ERROR_* on failure
+ */
+int32_t file_lseek(struct FileDescriptorTable *table, int32_t fd, int32_t offset, uint32_t whence);
+
+/**
+ * Metadata of the file a descriptor refers to, without a path lookup
+ *
+ * @param table Descriptor table of the process
+ * @param fd    File descriptor
+ * @param stat  Output
+ * @return      0, negative FILE_ERROR_* on failure
+ */
+int32_t file_fstat(struct FileDescriptorTable *table, int32_t fd, struct EXT2Stat *stat);
+
+/**
+ * Close a descriptor
+ *
+ * @param table Descriptor table of the process
+ * @param fd    File descriptor
+ * @return      0, negative FILE_ERROR_* on failure
+ */
+int32_t file_close(struct FileDescriptorTable *table, int32_t fd);
+
+/**
+ * Close every open descriptor, used when the process is destroyed
+ * @param table Descriptor table of the process
+ */
+void file_close_all(struct FileDescriptorTable *table);
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef _INODE_CACHE_H
+#define _INODE_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "header/filesystem/ext2.h"
+
+/* -- Inode cache constants -- */
+#define INODE_CACHE_ENTRY_COUNT 64 // number of cached inodes
+#define INODE_CACHE_HASH_BITS 6
+#define INODE_CACHE_HASH_SIZE (1u << INODE_CACHE_HASH_BITS) // hash buckets
+#define INODE_CACHE_NONE -1        // null index for hash chain and LRU list
+#define INODE_CACHE_PINNED_MAX 48  // referenced entries at which open() fails, the rest is left for short ext2 references
+
+/**
+ * InodeCacheStats - Counters exposed for diagnostics
+ *
+ * @param hits       Inode lookups served from memory
+ * @param misses     Inode lookups that had to read the inode table
+ * @param evictions  Valid entries reused for another inode
+ * @param writebacks Dirty inodes written back to the inode table (eviction or flush)
+ */
+struct InodeCacheStats
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;
+};
+
+/**
+ * InodeCacheEntry - One cached inode
+ *
+ * @param inode_num Inode number of the cached inode
+ * @param refcount  Holders of the entry, a referenced entry is never evicted
+ * @param valid     Entry holds inode_num
+ * @param dirty     Inode is newer than the inode table and must be written back
+ * @param hash_next Next entry index in the same hash bucket
+ * @param lru_prev  Previous (more recently used) entry index
+ * @param lru_next  Next (less recently used) entry index
+ * @param inode     Cached inode content
+ */
+struct InodeCacheEntry
+{
+    uint32_t inode_num;
+    uint16_t refcount;
+    bool valid;
+    bool dirty;
+    int16_t hash_next;
+    int16_t lru_prev;
+    int16_t lru_next;
+    struct EXT2Inode inode;
+};
+
+/**
+ * Get a referenced inode, read from the inode table on a miss.
+ * Entry stays valid and is not evicted until inode_cache_put().
+ * Callers that change entry->inode must call inode_cache_mark_dirty().
+ *
+ * @param inode_num Inode number
+ * @return          Cache entry of the inode
+ */
+struct InodeCacheEntry *inode_cache_get(uint32_t inode_num);
+
+/**
+ * Drop a reference taken with inode_cache_get()
+ * @param entry Entry to release
+ */
+void inode_cache_put(struct InodeCacheEntry *entry);
+
+/**
+ * References currently held on an inode, without taking one
+ * @param inode_num Inode number
+ * @return          Reference count, 0 when the inode is not cached
+ */
+uint16_t inode_cache_refcount(uint32_t inode_num);
+
+/**
+ * Count the entries that are referenced and cannot be evicted
+ * @return Referenced entries
+ */
+uint32_t inode_cache_referenced_count(void);
+
+/**
+ * Mark a referenced inode as changed. It reaches the inode table on eviction or inode_cache_flush().
+ * @param entry Changed entry
+ */
+void inode_cache_mark_dirty(struct InodeCacheEntry *entry);
+
+/**
+ * Write every dirty inode back to the inode table (through the block cache)
+ */
+void inode_cache_flush(void);
+
+/**
+ * Count the inodes that would be written back by inode_cache_flush()
+ * @return Dirty entries
+ */
+uint32_t inode_cache_dirty_count(void);
+
+/**
+ * Drop every cached inode without writing it back, used when a filesystem is (re)mounted
+ */
+void inode_cache_invalidate(void);
+
+/**
+ * Copy current cache counters
+ * @param stats Output counters
+ */
+void inode_cache_get_stats(struct InodeCacheStats *stats);
+
+#endif
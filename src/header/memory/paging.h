@@ -160,6 +160,25 @@ bool paging_free_page_directory(struct PageDirectory *page_dir);
  */
 struct PageDirectory *paging_get_current_page_directory_addr(void);
 
+/**
+ * Translate a virtual address with the currently active page directory.
+ * Used by drivers that hand buffers to bus master devices.
+ *
+ * @param virtual_addr Virtual address to translate
+ * @return             Physical address, 0 if the address is not mapped
+ */
+uint32_t paging_virtual_to_physical(void *virtual_addr);
+
+/**
+ * Identity map the 4 MiB frame holding a device register block into the kernel page directory,
+ * uncached and supervisor only. Must be called before any process page directory is created,
+ * those copy the kernel page directory.
+ *
+ * @param physical_addr Physical address of the registers (PCI memory BAR)
+ * @return              Virtual address to access the registers with
+ */
+void *paging_map_kernel_mmio(uint32_t physical_addr);
+
 /**
  * Change active page directory (indirectly trigger TLB flush for all non-global entry)
  *
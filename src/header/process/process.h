@@ -8,10 +8,12 @@
 #include "header/cpu/interrupt.h"
 #include "header/memory/paging.h"
 #include "header/filesystem/ext2.h"
+#include "header/filesystem/file.h"
 
 #define PROCESS_NAME_LENGTH_MAX 32
 #define PROCESS_PAGE_FRAME_COUNT_MAX 8
 #define PROCESS_COUNT_MAX 16
+#define PROCESS_KERNEL_STACK_SIZE 0x2000 // 8 KiB kernel stack per process, used while inside syscall / interrupt
 
 #define KERNEL_RESERVED_PAGE_FRAME_COUNT 4
 #define KERNEL_VIRTUAL_ADDRESS_BASE 0xC0000000
@@ -82,6 +84,8 @@ struct Context
  * @param metadata Informasi metadata tentang process
  * @param context  Context untuk context saving & switching
  * @param memory   Informasi memory yang digunakan process
+ * @param kernel   Kernel state saat process tidur di dalam syscall (menunggu disk / lock)
+ * @param files    File yang sedang dibuka process, index = file descriptor
  */
 struct ProcessControlBlock
 {
@@ -102,6 +106,17 @@ struct ProcessControlBlock
         void *virtual_addr_used[PROCESS_PAGE_FRAME_COUNT_MAX];
         uint32_t page_frame_used_count;
     } memory;
+
+    // Kernel state, valid while process is suspended inside the kernel
+    struct
+    {
+        uint32_t saved_esp;                         // Kernel esp saved on sleep, 0 if process will resume in user mode
+        struct PageDirectory *saved_page_directory; // Active page directory when process went to sleep
+        void *wait_channel;                         // Object the process is waiting for, NULL if not sleeping
+    } kernel;
+
+    // Open files, closed by process_destroy() and cleared with the rest of the PCB on create
+    struct FileDescriptorTable files;
 } __attribute__((packed));
 
 /**
@@ -145,6 +160,14 @@ int32_t process_create_user_process(struct EXT2DriverRequest request);
  */
 bool process_destroy(uint32_t pid);
 
+/**
+ * Get top of the kernel stack owned by a process, loaded into TSS esp0 when the process runs
+ *
+ * @param pcb Process control block
+ * @return    Kernel stack top address
+ */
+uint32_t process_get_kernel_stack_top(struct ProcessControlBlock *pcb);
+
 /**
  * Get process control block by index (for testing/debugging)
  *
@@ -12,6 +12,34 @@
  */
 __attribute__((noreturn)) extern void process_context_switch(struct Context ctx);
 
+/**
+ * Save callee-saved registers on current kernel stack and call scheduler_suspend_current_process().
+ * Return when the process is resumed with process_kernel_context_resume()
+ *
+ * @note Implemented in assembly
+ */
+extern void process_kernel_context_save_and_switch(void);
+
+/**
+ * Switch to kernel stack saved by process_kernel_context_save_and_switch() and return from it
+ *
+ * @note            Implemented in assembly
+ * @param saved_esp Kernel esp to resume from
+ */
+__attribute__((noreturn)) extern void process_kernel_context_resume(uint32_t saved_esp);
+
+/**
+ * SleepLock - Lock that puts waiting process to sleep instead of spinning
+ *
+ * @param locked Lock is currently held
+ * @param owner  Process holding the lock, NULL when held by the kernel before scheduling starts
+ */
+struct SleepLock
+{
+    volatile bool locked;
+    struct ProcessControlBlock *owner;
+};
+
 
 
 /* --- Scheduler --- */
@@ -32,4 +60,35 @@ void scheduler_save_context_to_current_running_pcb(struct Context ctx);
  */
 __attribute__((noreturn)) void scheduler_switch_to_next_process(void);
 
+/**
+ * Record kernel esp of current process and switch to next process.
+ * Only called by process_kernel_context_save_and_switch()
+ *
+ * @param saved_esp Kernel esp to resume the current process from
+ */
+__attribute__((noreturn)) void scheduler_suspend_current_process(uint32_t saved_esp);
+
+/**
+ * Put current process to sleep until scheduler_wakeup() is called with the same channel.
+ * Caller must run with interrupt disabled and recheck its condition in a loop.
+ * When no process is running (early boot), this only halts until the next interrupt.
+ *
+ * @param channel Any address identifying the awaited event
+ */
+void scheduler_sleep(void *channel);
+
+/**
+ * Make every process sleeping on channel READY again. Safe to call from interrupt handler
+ *
+ * @param channel Address given to scheduler_sleep()
+ * @return        True if at least one process was woken up
+ */
+bool scheduler_wakeup(void *channel);
+
+// Acquire sleep lock, sleeping while it is held by another process - @param lock Target lock
+void sleep_lock_acquire(struct SleepLock *lock);
+
+// Release sleep lock and wake up waiting processes - @param lock Target lock
+void sleep_lock_release(struct SleepLock *lock);
+
 #endif
\ No newline at end of file
@@ -26,7 +26,8 @@ void kernel_setup(void)
     clear_screen();
     draw_cursor();
 
-    initialize_filesystem_ext2();
+    block_device_set_tsc_rate(calibrate_tsc());
+    initialize_filesystem_ext2(disk_init());
     gdt_install_tss();
     set_tss_register();
 
@@ -173,6 +173,30 @@ struct PageDirectory *paging_get_current_page_directory_addr(void)
     return (struct PageDirectory *)virtual_addr_page_dir;
 }
 
+uint32_t paging_virtual_to_physical(void *virtual_addr)
+{
+    struct PageDirectory *page_dir = paging_get_current_page_directory_addr();
+    uint32_t page_index = ((uint32_t)virtual_addr >> 22) & 0x3FF;
+    if (!page_dir->table[page_index].flag.present_bit)
+        return 0;
+    uint32_t frame_addr = (uint32_t)page_dir->table[page_index].lower_address << 22;
+    return frame_addr | ((uint32_t)virtual_addr & (PAGE_FRAME_SIZE - 1));
+}
+
+void *paging_map_kernel_mmio(uint32_t physical_addr)
+{
+    struct PageDirectoryEntryFlag mmio_flags = {0};
+    mmio_flags.present_bit = 1;
+    mmio_flags.write_bit = 1;
+    mmio_flags.write_through = 1;
+    mmio_flags.cache_disable = 1;
+    mmio_flags.use_pagesize_4_mb = 1;
+
+    void *frame_addr = (void *)(physical_addr & ~(PAGE_FRAME_SIZE - 1));
+    update_page_directory_entry(&_paging_kernel_page_directory, frame_addr, frame_addr, mmio_flags);
+    return (void *)physical_addr;
+}
+
 void paging_use_page_directory(struct PageDirectory *page_dir_virtual_addr)
 {
     uint32_t physical_addr_page_dir = (uint32_t)page_dir_virtual_addr;
@@ -10,6 +10,9 @@
 
 struct ProcessControlBlock _process_list[PROCESS_COUNT_MAX];
 
+// Every process own a kernel stack, so a process can sleep in the middle of a syscall
+static uint8_t process_kernel_stack[PROCESS_COUNT_MAX][PROCESS_KERNEL_STACK_SIZE] __attribute__((aligned(16)));
+
 struct ProcessManagerState process_manager_state = {
     .process_slot_used = {[0 ... PROCESS_COUNT_MAX - 1] = false},
     .active_process_count = 0,
@@ -268,6 +271,10 @@ bool process_destroy(uint32_t pid)
 
     struct ProcessControlBlock *pcb = &_process_list[index];
 
+    // Process sleeping inside the kernel may hold the filesystem lock or an in-flight disk buffer
+    if (pcb->metadata.state == PROCESS_STATE_BLOCKED || pcb->kernel.saved_esp != 0)
+        return false;
+
     if (strcmp(pcb->metadata.process_name, "clock") == 0)
     {
         // Jam format "HH:MM:SS" = 8 karakter
@@ -290,6 +297,9 @@ bool process_destroy(uint32_t pid)
     // Free page directory
     paging_free_page_directory(pcb->context.page_directory_virtual_addr);
 
+    // Release the inodes held by open files, they can be deleted again
+    file_close_all(&pcb->files);
+
     memset(pcb, 0, sizeof(struct ProcessControlBlock));
 
     // Update state manager
@@ -317,6 +327,12 @@ int32_t get_process_info(ProcessInfo *buffer, uint32_t bufsize)
     return (int32_t)count;
 }
 
+uint32_t process_get_kernel_stack_top(struct ProcessControlBlock *pcb)
+{
+    uint32_t index = pcb - _process_list;
+    return (uint32_t)&process_kernel_stack[index][PROCESS_KERNEL_STACK_SIZE];
+}
+
 struct ProcessControlBlock *process_get_pcb_by_index(uint32_t index)
 {
     if (index >= PROCESS_COUNT_MAX)
@@ -2,6 +2,8 @@
 #include "header/memory/paging.h"
 
 static int32_t current_process_index = -1;
+// Process woken up by an interrupt, run it first since its I/O is already done
+static int32_t wakeup_hint_index = -1;
 
 static int32_t find_next_ready_process(int32_t start)
 {
@@ -17,6 +19,7 @@ static int32_t find_next_ready_process(int32_t start)
 void scheduler_init(void)
 {
     current_process_index = -1;
+    wakeup_hint_index = -1;
 }
 
 /**
@@ -33,44 +36,107 @@ void scheduler_save_context_to_current_running_pcb(struct Context ctx)
 
 __attribute__((noreturn)) void scheduler_switch_to_next_process(void)
 {
+    int32_t next_index = -1;
 
-    int32_t next_index;
-
-    // Kasus pertama: belum ada process berjalan
-    if (current_process_index == -1)
+    // Kembalikan process lama ke READY
+    if (current_process_index != -1)
     {
-        for (int32_t i = 0; i < PROCESS_COUNT_MAX; i++)
-        {
-            if (_process_list[i].metadata.state == PROCESS_STATE_READY)
-            {
-                next_index = i;
-                goto switch_process;
-            }
-        }
-        while (1)
-            ; // tidak ada process
+        struct ProcessControlBlock *old =
+            &_process_list[current_process_index];
+        if (old->metadata.state == PROCESS_STATE_RUNNING)
+            old->metadata.state = PROCESS_STATE_READY;
     }
 
-    // Kembalikan process lama ke READY
-    struct ProcessControlBlock *old =
-        &_process_list[current_process_index];
-    if (old->metadata.state == PROCESS_STATE_RUNNING)
-        old->metadata.state = PROCESS_STATE_READY;
+    if (wakeup_hint_index != -1 &&
+        _process_list[wakeup_hint_index].metadata.state == PROCESS_STATE_READY)
+        next_index = wakeup_hint_index;
+    wakeup_hint_index = -1;
 
-    next_index = find_next_ready_process(current_process_index);
-
-    if (next_index == -1)
-        next_index = current_process_index;
+    // Semua process sedang tidur: idle sampai ada interrupt yang membangunkan process
+    while (next_index == -1)
+    {
+        next_index = find_next_ready_process(current_process_index);
+        if (next_index == -1)
+            __asm__ volatile("sti; hlt; cli");
+    }
 
-switch_process:
     struct ProcessControlBlock *next =
         &_process_list[next_index];
 
     next->metadata.state = PROCESS_STATE_RUNNING;
     current_process_index = next_index;
+    _interrupt_tss_entry.esp0 = process_get_kernel_stack_top(next);
+
+    // Process tidur di tengah syscall, lanjutkan di kernel stack miliknya
+    if (next->kernel.saved_esp != 0)
+    {
+        uint32_t saved_esp = next->kernel.saved_esp;
+        next->kernel.saved_esp = 0;
+        paging_use_page_directory(next->kernel.saved_page_directory);
+        process_kernel_context_resume(saved_esp);
+    }
 
     paging_use_page_directory(
         next->context.page_directory_virtual_addr);
 
     process_context_switch(next->context);
 }
+
+__attribute__((noreturn)) void scheduler_suspend_current_process(uint32_t saved_esp)
+{
+    _process_list[current_process_index].kernel.saved_esp = saved_esp;
+    scheduler_switch_to_next_process();
+}
+
+void scheduler_sleep(void *channel)
+{
+    struct ProcessControlBlock *pcb = process_get_current_running_pcb_pointer();
+    if (pcb == NULL)
+    {
+        // Belum ada process (boot), cukup tunggu interrupt berikutnya
+        __asm__ volatile("sti; hlt; cli");
+        return;
+    }
+
+    pcb->kernel.wait_channel = channel;
+    pcb->kernel.saved_page_directory = paging_get_current_page_directory_addr();
+    pcb->metadata.state = PROCESS_STATE_BLOCKED;
+    process_kernel_context_save_and_switch();
+}
+
+bool scheduler_wakeup(void *channel)
+{
+    bool woken = false;
+    for (int32_t i = 0; i < PROCESS_COUNT_MAX; i++)
+    {
+        struct ProcessControlBlock *pcb = &_process_list[i];
+        if (pcb->metadata.state == PROCESS_STATE_BLOCKED && pcb->kernel.wait_channel == channel)
+        {
+            pcb->kernel.wait_channel = NULL;
+            pcb->metadata.state = PROCESS_STATE_READY;
+            if (!woken)
+                wakeup_hint_index = i;
+            woken = true;
+        }
+    }
+    return woken;
+}
+
+void sleep_lock_acquire(struct SleepLock *lock)
+{
+    uint32_t eflags = interrupt_disable_save();
+    while (lock->locked)
+        scheduler_sleep(lock);
+    lock->locked = true;
+    lock->owner = process_get_current_running_pcb_pointer();
+    interrupt_restore(eflags);
+}
+
+void sleep_lock_release(struct SleepLock *lock)
+{
+    uint32_t eflags = interrupt_disable_save();
+    lock->locked = false;
+    lock->owner = NULL;
+    scheduler_wakeup(lock);
+    interrupt_restore(eflags);
+}
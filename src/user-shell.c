@@ -1,12 +1,14 @@
 #include <stdint.h>
 #include "header/stdlib/string.h"
 #include "header/filesystem/ext2.h"
+#include "header/filesystem/file.h"
 
 #define BLOCK_COUNT 16
 #define MAX_PATH_LEN 1024
 #define MAX_CMD_LEN (MAX_PATH_LEN * 2 + MAX_ARGS)
 #define MAX_ARGS 16
 #define FILE_BUFFER_SIZE 4096
+#define DIR_RECORD_COUNT 8 // record direktori per SYS_GETDENTS
 
 #define MAX_HISTORY 16
 
@@ -57,7 +59,20 @@ enum SYSCALL_NUMBERS
     SYS_BADAPPLE = 24,        // bad_apple(frame_buffer, width, height)
     SYS_SLEEP = 25,           // sleep(milliseconds)
     SYS_CHECK_TERMINATE = 26, // check_terminate_badapple(retcode)
-    SYS_RESET_TERMINAL = 27   // reset_terminal()
+    SYS_RESET_TERMINAL = 27,  // reset_terminal()
+    SYS_IOSTAT = 28,          // iostat(stats_buf, name_buf, uptime_ms)
+    SYS_PREAD = 29,           // pread(request, 0, retcode)
+    SYS_PWRITE = 30,          // pwrite(request, 0, retcode)
+    SYS_TRUNCATE = 31,        // truncate(path, size, retcode)
+    SYS_OPEN = 32,            // open(path, flags, retcode_fd)
+    SYS_READ_FD = 33,         // read(request, 0, retcode)
+    SYS_WRITE_FD = 34,        // write(request, 0, retcode)
+    SYS_LSEEK = 35,           // lseek(request, 0, retcode)
+    SYS_CLOSE = 36,           // close(fd, 0, retcode)
+    SYS_SYNC = 37,            // sync() - tulis metadata filesystem ke disk
+    SYS_GETDENTS = 38,        // getdents(request, 0, retcode)
+    SYS_STAT_INODE = 39,      // stat(path, stat_buf, retcode) - metadata inode lengkap
+    SYS_FSTAT = 40            // fstat(fd, stat_buf, retcode)
 };
 
 void syscall(uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx)
@@ -96,6 +111,51 @@ void build_full_path(char *full_path, const char *path)
     }
 }
 
+// Buka file, return file descriptor atau kode error FILE_ERROR_* (negatif)
+int32_t fd_open(const char *path, uint32_t flags)
+{
+    int32_t retcode = FILE_ERROR_INVALID;
+    syscall(SYS_OPEN, (uint32_t)path, flags, (uint32_t)&retcode);
+    return retcode;
+}
+
+// Baca dari posisi file descriptor, return jumlah byte terbaca (0 di akhir file) atau kode error
+int32_t fd_read(int32_t fd, void *buf, uint32_t count)
+{
+    struct FileIORequest request = {.fd = fd, .buf = buf, .count = count};
+    int32_t retcode = FILE_ERROR_INVALID;
+    syscall(SYS_READ_FD, (uint32_t)&request, 0, (uint32_t)&retcode);
+    return retcode;
+}
+
+// Tulis ke posisi file descriptor, return jumlah byte tertulis atau kode error
+int32_t fd_write(int32_t fd, const void *buf, uint32_t count)
+{
+    struct FileIORequest request = {.fd = fd, .buf = (void *)buf, .count = count};
+    int32_t retcode = FILE_ERROR_INVALID;
+    syscall(SYS_WRITE_FD, (uint32_t)&request, 0, (uint32_t)&retcode);
+    return retcode;
+}
+
+void fd_close(int32_t fd)
+{
+    int32_t retcode;
+    syscall(SYS_CLOSE, (uint32_t)fd, 0, (uint32_t)&retcode);
+}
+
+// Baca entri direktori berikutnya mulai dari *cookie (0 untuk awal), return jumlah record (0 di akhir direktori) atau kode error
+int32_t dir_read(const char *path, uint32_t *cookie, struct EXT2DirentRecord *records, uint32_t max_records)
+{
+    struct EXT2GetdentsRequest request = {.path = path, .records = records, .max_records = max_records, .cookie = *cookie};
+    int32_t retcode = -1;
+    syscall(SYS_GETDENTS, (uint32_t)&request, 0, (uint32_t)&retcode);
+    if (retcode != 0)
+        return retcode;
+
+    *cookie = request.cookie;
+    return (int32_t)request.count;
+}
+
 uint32_t str_to_uint(const char *str)
 {
     uint32_t result = 0;
@@ -467,65 +527,43 @@ void read_line(char *buffer)
 
 void find_recursive(const char *current_path, const char *target_name)
 {
-    char ls_buffer[MAX_CMD_LEN];
-    char path_buffer[MAX_PATH_LEN];
+    struct EXT2DirentRecord records[DIR_RECORD_COUNT];
     char full_path[MAX_PATH_LEN];
-    int32_t retcode = -1;
-
-    memset(ls_buffer, 0, MAX_CMD_LEN);
-    syscall(SYS_LS, (uint32_t)current_path, (uint32_t)ls_buffer, (uint32_t)&retcode);
-
-    if (retcode != 0)
-    {
-        return; // Gagal ls di path ini
-    }
+    uint32_t cookie = 0;
+    int32_t count;
 
-    char *entry_name = strtok(ls_buffer, "\n");
-    while (entry_name != NULL)
+    // Jenis entri ikut di record, subdirektori dikenali tanpa SYS_STAT
+    while ((count = dir_read(current_path, &cookie, records, DIR_RECORD_COUNT)) > 0)
     {
-        if (strcmp(entry_name, target_name) == 0)
+        for (int32_t i = 0; i < count; i++)
         {
             strcpy(full_path, current_path);
             if (strcmp(current_path, "/") != 0)
             {
                 strcat(full_path, "/");
             }
-            strcat(full_path, entry_name);
+            strcat(full_path, records[i].name);
 
-            syscall(SYS_PUTS, (uint32_t)full_path, COLOR_WHITE, 0);
-            char newline = '\n';
-            syscall(SYS_PUTC, (uint32_t)&newline, COLOR_WHITE, 0);
-        }
-
-        if (strcmp(entry_name, ".") != 0 && strcmp(entry_name, "..") != 0)
-        {
-            strcpy(path_buffer, current_path);
-            if (strcmp(current_path, "/") != 0)
+            if (strcmp(records[i].name, target_name) == 0)
             {
-                strcat(path_buffer, "/");
+                syscall(SYS_PUTS, (uint32_t)full_path, COLOR_WHITE, 0);
+                syscall(SYS_PUTC, (uint32_t)&newline, COLOR_WHITE, 0);
             }
-            strcat(path_buffer, entry_name);
 
-            retcode = -1;
-            syscall(SYS_STAT, (uint32_t)path_buffer, (uint32_t)&retcode, 0);
-
-            if (retcode == 0)
+            if (records[i].file_type == EXT2_FT_DIR)
             {
-                find_recursive(path_buffer, target_name);
+                find_recursive(full_path, target_name);
             }
         }
-        entry_name = strtok(NULL, "\n");
     }
 }
 
 int32_t copy_file(const char *source_path, const char *dest_path)
 {
     char read_buf[FILE_BUFFER_SIZE];
-    memset(read_buf, 0, FILE_BUFFER_SIZE);
-    int32_t ret_read = -1;
 
-    syscall(SYS_READ, (uint32_t)source_path, (uint32_t)read_buf, (uint32_t)&ret_read);
-    if (ret_read != 0)
+    int32_t source_fd = fd_open(source_path, FILE_OPEN_READ);
+    if (source_fd < 0)
     {
         syscall(SYS_PUTS, (uint32_t)"Gagal membaca file sumber: ", COLOR_RED, 0);
         syscall(SYS_PUTS, (uint32_t)source_path, COLOR_RED, 0);
@@ -533,17 +571,38 @@ int32_t copy_file(const char *source_path, const char *dest_path)
         return -1;
     }
 
-    int32_t ret_write = -1;
-    syscall(SYS_WRITE, (uint32_t)dest_path, (uint32_t)read_buf, (uint32_t)&ret_write);
-    if (ret_write != 0)
+    // isi lama file tujuan dibuang, lalu file disalin per FILE_BUFFER_SIZE byte
+    int32_t dest_fd = fd_open(dest_path, FILE_OPEN_WRITE | FILE_OPEN_CREATE | FILE_OPEN_TRUNCATE);
+    int32_t result = 0;
+    int32_t bytes_read = 0;
+    while (dest_fd >= 0 && (bytes_read = fd_read(source_fd, read_buf, FILE_BUFFER_SIZE)) > 0)
+    {
+        if (fd_write(dest_fd, read_buf, bytes_read) != bytes_read)
+        {
+            result = -1;
+            break;
+        }
+    }
+
+    if (bytes_read < 0)
+    {
+        syscall(SYS_PUTS, (uint32_t)"Gagal membaca file sumber: ", COLOR_RED, 0);
+        syscall(SYS_PUTS, (uint32_t)source_path, COLOR_RED, 0);
+        syscall(SYS_PUTC, (uint32_t)&newline, COLOR_RED, 0);
+        result = -1;
+    }
+    else if (dest_fd < 0 || result != 0)
     {
         syscall(SYS_PUTS, (uint32_t)"Gagal menulis file tujuan: ", COLOR_RED, 0);
         syscall(SYS_PUTS, (uint32_t)dest_path, COLOR_RED, 0);
         syscall(SYS_PUTC, (uint32_t)&newline, COLOR_RED, 0);
-        return -1;
+        result = -1;
     }
 
-    return 0; // Sukses
+    fd_close(source_fd);
+    if (dest_fd >= 0)
+        fd_close(dest_fd);
+    return result; // 0: Sukses
 }
 
 int32_t parse_path_for_parent(const char *full_path, char *parent_buf, char *name_buf)
@@ -803,7 +862,6 @@ void handle_cat(int argc, char *argv[])
     }
 
     char file_buffer[FILE_BUFFER_SIZE];
-    int32_t retcode = -1;
 
     char full_path[MAX_PATH_LEN];
     strcpy(full_path, g_cwd);
@@ -811,16 +869,30 @@ void handle_cat(int argc, char *argv[])
         strcat(full_path, "/");
     strcat(full_path, argv[1]);
 
-    syscall(SYS_READ, (uint32_t)full_path, (uint32_t)file_buffer, (uint32_t)&retcode);
+    int32_t fd = fd_open(full_path, FILE_OPEN_READ);
+    if (fd < 0)
+    {
+        syscall(SYS_PUTS, (uint32_t)"File tidak ditemukan.\n", COLOR_RED, 0);
+        return;
+    }
 
-    if (retcode == 0)
+    // file dibaca per FILE_BUFFER_SIZE byte, ukuran file tidak dibatasi buffer
+    int32_t bytes_read;
+    while ((bytes_read = fd_read(fd, file_buffer, FILE_BUFFER_SIZE - 1)) > 0)
     {
+        file_buffer[bytes_read] = '\0';
         syscall(SYS_PUTS, (uint32_t)file_buffer, COLOR_WHITE, 0);
-        syscall(SYS_PUTC, (uint32_t)&newline, COLOR_WHITE, 0);
     }
-    else
+    fd_close(fd);
+    syscall(SYS_PUTC, (uint32_t)&newline, COLOR_WHITE, 0);
+}
+
+static void grep_line(const char *pattern, const char *line)
+{
+    if (line[0] != '\0' && regex_match(pattern, line) == 1)
     {
-        syscall(SYS_PUTS, (uint32_t)"File tidak ditemukan.\n", COLOR_RED, 0);
+        syscall(SYS_PUTS, (uint32_t)line, COLOR_WHITE, 0);
+        syscall(SYS_PUTC, (uint32_t)&newline, COLOR_WHITE, 0);
     }
 }
 
@@ -837,31 +909,51 @@ void handle_grep(int argc, char *argv[])
 
     char file_buffer[FILE_BUFFER_SIZE];
     memset(file_buffer, 0, FILE_BUFFER_SIZE);
-    int32_t retcode = -1;
 
     char full_path[MAX_PATH_LEN];
     build_full_path(full_path, file_path);
 
-    syscall(SYS_READ, (uint32_t)full_path, (uint32_t)file_buffer, (uint32_t)&retcode);
-
-    if (retcode != 0)
+    int32_t fd = fd_open(full_path, FILE_OPEN_READ);
+    if (fd < 0)
     {
         syscall(SYS_PUTS, (uint32_t)"File tidak ditemukan.\n", COLOR_RED, 0);
         return;
     }
 
-    char *line = strtok(file_buffer, "\n");
-    char newline = '\n';
-    while (line != NULL)
+    // file dibaca per potongan, baris yang terpotong di akhir buffer disimpan (pending) untuk potongan berikutnya
+    uint32_t pending = 0;
+    while (true)
     {
-        if (regex_match(pattern, line) == 1)
+        int32_t bytes_read = fd_read(fd, file_buffer + pending, FILE_BUFFER_SIZE - 1 - pending);
+        if (bytes_read < 0)
+            bytes_read = 0;
+
+        uint32_t end = pending + bytes_read;
+        file_buffer[end] = '\0';
+
+        uint32_t line_start = 0;
+        for (uint32_t i = 0; i < end; i++)
         {
-            syscall(SYS_PUTS, (uint32_t)line, COLOR_WHITE, 0);
-            syscall(SYS_PUTC, (uint32_t)&newline, COLOR_WHITE, 0);
+            if (file_buffer[i] != '\n')
+                continue;
+            file_buffer[i] = '\0';
+            grep_line(pattern, &file_buffer[line_start]);
+            line_start = i + 1;
         }
+        pending = end - line_start;
 
-        line = strtok(NULL, "\n");
+        // akhir file, atau satu baris lebih panjang dari buffer
+        if (bytes_read == 0 || pending == FILE_BUFFER_SIZE - 1)
+        {
+            grep_line(pattern, &file_buffer[line_start]);
+            pending = 0;
+            if (bytes_read == 0)
+                break;
+            continue;
+        }
+        memmove(file_buffer, &file_buffer[line_start], pending);
     }
+    fd_close(fd);
 }
 
 void handle_mv(int argc, char *argv[])
@@ -890,45 +982,124 @@ void handle_mv(int argc, char *argv[])
 
 void handle_ls(void)
 {
+    struct EXT2DirentRecord records[DIR_RECORD_COUNT];
+    uint32_t cookie = 0;
+    int32_t count;
 
-    char ls_buffer[FILE_BUFFER_SIZE];
-    int32_t retcode = -1;
-
-    syscall(SYS_LS, (uint32_t)g_cwd, (uint32_t)ls_buffer, (uint32_t)&retcode);
-
-    if (retcode == 0)
+    // Satu pass atas blok direktori, warna dari file_type di record tanpa SYS_STAT per entri
+    while ((count = dir_read(g_cwd, &cookie, records, DIR_RECORD_COUNT)) > 0)
     {
-        char *token = strtok(ls_buffer, "\n");
-        char newline = '\n';
-
-        while (token != NULL)
+        for (int32_t i = 0; i < count; i++)
         {
-            char full_path[MAX_PATH_LEN];
-            build_full_path(full_path, token);
+            uint32_t color = records[i].file_type == EXT2_FT_DIR ? COLOR_FOLDER : COLOR_FILE;
+            syscall(SYS_PUTS, (uint32_t)records[i].name, color, 0);
+            syscall(SYS_PUTC, (uint32_t)&newline, 0, 0);
+        }
+    }
 
-            int32_t stat_ret = -1;
-            syscall(SYS_STAT, (uint32_t)full_path, (uint32_t)&stat_ret, 0);
+    if (count < 0)
+    {
+        syscall(SYS_PUTS, (uint32_t)"Gagal membaca direktori.\n", COLOR_RED, 0);
+    }
+}
 
-            uint32_t color;
-            if (stat_ret == 0)
-            {
-                color = COLOR_FOLDER;
-            }
-            else
-            {
-                color = COLOR_FILE;
-            }
+// Tulis angka rata kanan dengan lebar width
+static void put_padded_uint(uint32_t value, int width, uint32_t color)
+{
+    char num_buf[16];
+    uint_to_str(value, num_buf);
+    for (int i = strlen(num_buf); i < width; i++)
+        syscall(SYS_PUTC, (uint32_t)&space, color, 0);
+    syscall(SYS_PUTS, (uint32_t)num_buf, color, 0);
+}
 
-            syscall(SYS_PUTS, (uint32_t)token, color, 0);
-            syscall(SYS_PUTC, (uint32_t)&newline, 0, 0);
+void handle_iostat(void)
+{
+    struct BlockDeviceStats stats;
+    char device_name[BLOCK_DEVICE_NAME_LENGTH];
+    uint32_t uptime_ms = 0;
+    syscall(SYS_IOSTAT, (uint32_t)&stats, (uint32_t)device_name, (uint32_t)&uptime_ms);
+
+    uint32_t commands = stats.reads + stats.writes + stats.flushes;
+    uint32_t uptime_s = uptime_ms / 1000;
+    uint32_t busy_ms = stats.busy_us / 1000;
+
+    syscall(SYS_PUTS, (uint32_t)"Device ", COLOR_BLUE_LT, 0);
+    syscall(SYS_PUTS, (uint32_t)device_name, COLOR_YELLOW, 0);
+    syscall(SYS_PUTS, (uint32_t)", uptime ", COLOR_BLUE_LT, 0);
+    put_padded_uint(uptime_s, 0, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)" s\n", COLOR_BLUE_LT, 0);
+
+    syscall(SYS_PUTS, (uint32_t)"  read   : ", COLOR_WHITE, 0);
+    put_padded_uint(stats.reads, 8, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)" cmd ", COLOR_GRAY_DK, 0);
+    put_padded_uint(stats.sectors_read, 10, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)" sektor\n", COLOR_GRAY_DK, 0);
+    syscall(SYS_PUTS, (uint32_t)"  write  : ", COLOR_WHITE, 0);
+    put_padded_uint(stats.writes, 8, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)" cmd ", COLOR_GRAY_DK, 0);
+    put_padded_uint(stats.sectors_written, 10, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)" sektor\n", COLOR_GRAY_DK, 0);
+    syscall(SYS_PUTS, (uint32_t)"  flush  : ", COLOR_WHITE, 0);
+    put_padded_uint(stats.flushes, 8, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)" cmd\n", COLOR_GRAY_DK, 0);
+
+    syscall(SYS_PUTS, (uint32_t)"  busy   : ", COLOR_WHITE, 0);
+    put_padded_uint(busy_ms, 8, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)" ms  ", COLOR_GRAY_DK, 0);
+    put_padded_uint(uptime_ms ? busy_ms * 100 / uptime_ms : 0, 3, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)"%  ", COLOR_GRAY_DK, 0);
+    put_padded_uint(uptime_s ? commands / uptime_s : commands, 0, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)" cmd/s\n", COLOR_GRAY_DK, 0);
+
+    // Hanya bucket yang terisi, batas bawah bucket i adalah 2^i us
+    syscall(SYS_PUTS, (uint32_t)"  latency >= us     read    write\n", COLOR_BLUE_LT, 0);
+    for (uint32_t i = 0; i < BLOCK_STATS_HISTOGRAM_BUCKETS; i++)
+    {
+        if (stats.read_latency[i] == 0 && stats.write_latency[i] == 0)
+            continue;
+        put_padded_uint(i == 0 ? 0 : 1u << i, 15, COLOR_WHITE);
+        put_padded_uint(stats.read_latency[i], 9, COLOR_WHITE);
+        put_padded_uint(stats.write_latency[i], 9, COLOR_WHITE);
+        syscall(SYS_PUTC, (uint32_t)&newline, COLOR_WHITE, 0);
+    }
+}
 
-            token = strtok(NULL, "\n");
-        }
+void handle_stat(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        syscall(SYS_PUTS, (uint32_t)"Penggunaan: stat <file|direktori>\n", COLOR_RED, 0);
+        return;
     }
-    else
+
+    char full_path[MAX_PATH_LEN];
+    build_full_path(full_path, argv[1]);
+
+    // Ukuran dan jumlah blok langsung dari inode, isi file tidak dibaca
+    struct EXT2Stat stat;
+    int32_t retcode = -1;
+    syscall(SYS_STAT_INODE, (uint32_t)full_path, (uint32_t)&stat, (uint32_t)&retcode);
+    if (retcode != 0)
     {
-        syscall(SYS_PUTS, (uint32_t)"Gagal membaca direktori.\n", COLOR_RED, 0);
+        syscall(SYS_PUTS, (uint32_t)"File tidak ditemukan.\n", COLOR_RED, 0);
+        return;
     }
+
+    syscall(SYS_PUTS, (uint32_t)"  inode  : ", COLOR_WHITE, 0);
+    put_padded_uint(stat.inode, 0, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)"\n  tipe   : ", COLOR_WHITE, 0);
+    if ((stat.mode & EXT2_S_IFDIR) != 0)
+        syscall(SYS_PUTS, (uint32_t)"direktori", COLOR_FOLDER, 0);
+    else
+        syscall(SYS_PUTS, (uint32_t)"file", COLOR_FILE, 0);
+    syscall(SYS_PUTS, (uint32_t)"\n  ukuran : ", COLOR_WHITE, 0);
+    put_padded_uint(stat.size, 0, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)" byte\n  blok   : ", COLOR_WHITE, 0);
+    put_padded_uint(stat.blocks, 0, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)" sektor, blok I/O ", COLOR_GRAY_DK, 0);
+    put_padded_uint(stat.block_size, 0, COLOR_WHITE);
+    syscall(SYS_PUTS, (uint32_t)" byte\n", COLOR_GRAY_DK, 0);
 }
 
 void handle_help(void)
@@ -937,6 +1108,7 @@ void handle_help(void)
     syscall(SYS_PUTS, (uint32_t)"  cd <direktori>      : Ganti direktori saat ini\n", COLOR_WHITE, 0);
     syscall(SYS_PUTS, (uint32_t)"  ls                  : Daftar isi direktori saat ini\n", COLOR_WHITE, 0);
     syscall(SYS_PUTS, (uint32_t)"  cat <file>          : Tampilkan isi file\n", COLOR_WHITE, 0);
+    syscall(SYS_PUTS, (uint32_t)"  stat <path>         : Tampilkan inode, ukuran dan blok\n", COLOR_WHITE, 0);
     syscall(SYS_PUTS, (uint32_t)"  mkdir <nama_dir>    : Buat direktori baru\n", COLOR_WHITE, 0);
     syscall(SYS_PUTS, (uint32_t)"  cp <sumber> <tujuan>: Salin file atau direktori\n", COLOR_WHITE, 0);
     syscall(SYS_PUTS, (uint32_t)"  rm <file>           : Hapus file\n", COLOR_WHITE, 0);
@@ -946,6 +1118,8 @@ void handle_help(void)
     syscall(SYS_PUTS, (uint32_t)"  exec <path_program> : Jalankan program baru\n", COLOR_WHITE, 0);
     syscall(SYS_PUTS, (uint32_t)"  ps                  : Tampilkan daftar proses berjalan\n", COLOR_WHITE, 0);
     syscall(SYS_PUTS, (uint32_t)"  kill <pid|nama>     : Hentikan proses berdasarkan PID atau nama\n", COLOR_WHITE, 0);
+    syscall(SYS_PUTS, (uint32_t)"  iostat              : Tampilkan statistik I/O disk\n", COLOR_WHITE, 0);
+    syscall(SYS_PUTS, (uint32_t)"  sync                : Tulis perubahan filesystem ke disk\n", COLOR_WHITE, 0);
     syscall(SYS_PUTS, (uint32_t)"  clear               : Bersihkan layar terminal\n", COLOR_WHITE, 0);
     syscall(SYS_PUTS, (uint32_t)"  help                : Tampilkan menu bantuan\n", COLOR_WHITE, 0);
 }
@@ -1038,7 +1212,11 @@ int main(void)
             {
                 int32_t retcode = -1;
                 syscall(SYS_RM, (uint32_t)g_cwd, (uint32_t)argv[1], (uint32_t)&retcode);
-                if (retcode != 0)
+                if (retcode == 4)
+                {
+                    syscall(SYS_PUTS, (uint32_t)"Gagal menghapus: file sedang dibuka.\n", COLOR_RED, 0);
+                }
+                else if (retcode != 0)
                 {
                     syscall(SYS_PUTS, (uint32_t)"Gagal menghapus file.\n", COLOR_RED, 0);
                 }
@@ -1073,6 +1251,18 @@ int main(void)
             handle_kill(argc, argv);
             syscall(SYS_PUTS_AT, 24, 44, (uint32_t)"                    ");
         }
+        else if (strcmp(argv[0], "iostat") == 0)
+        {
+            handle_iostat();
+        }
+        else if (strcmp(argv[0], "stat") == 0)
+        {
+            handle_stat(argc, argv);
+        }
+        else if (strcmp(argv[0], "sync") == 0)
+        {
+            syscall(SYS_SYNC, 0, 0, 0);
+        }
         else if (strcmp(argv[0], "clear") == 0)
         {
             syscall(SYS_CLEAR, 0, 0, 0);
@@ -1083,16 +1273,15 @@ int main(void)
         }
         else if (strcmp(argv[0], "badapple") == 0)
         {
-#define SIZE 1400000
 #define FRAME_WIDTH 64
 #define FRAME_HEIGHT 24
 #define BYTES_PER_FRAME (FRAME_WIDTH * FRAME_HEIGHT / 8)
+#define FRAMES_PER_READ 32
 
-            char buffer[SIZE] = {0};
-            int32_t ret = -1;
-            syscall(SYS_READ, (uint32_t)"/badapplebit", (uint32_t)buffer, (uint32_t)&ret);
-
-            if (ret != 0)
+            // file di-stream FRAMES_PER_READ frame sekali baca, tidak dimuat seluruhnya ke stack
+            char buffer[FRAMES_PER_READ * BYTES_PER_FRAME];
+            int32_t fd = fd_open("/badapplebit", FILE_OPEN_READ);
+            if (fd < 0)
             {
                 syscall(SYS_PUTS, (uint32_t)"File badapplebit.bin tidak ditemukan.\n", COLOR_RED, 0);
                 continue;
@@ -1101,15 +1290,25 @@ int main(void)
             syscall(SYS_RESET_TERMINAL, 0, 0, 0); // SYS_CLEAR_TERMINATE
 
             char frame[FRAME_HEIGHT * FRAME_WIDTH] = {0};
-            uint32_t num_frames_in_buffer = SIZE / BYTES_PER_FRAME;
+            int32_t bytes_read = fd_read(fd, buffer, sizeof(buffer));
+            uint32_t num_frames_in_buffer = bytes_read > 0 ? bytes_read / BYTES_PER_FRAME : 0;
 
-            for (uint32_t frame_idx = 0; frame_idx < num_frames_in_buffer; frame_idx++)
+            for (uint32_t frame_idx = 0; num_frames_in_buffer > 0; frame_idx++)
             {
                 int32_t terminate_ret = 0;
                 syscall(SYS_CHECK_TERMINATE, 0, 0, (uint32_t)&terminate_ret);
                 if (terminate_ret)
                     break;
 
+                if (frame_idx == num_frames_in_buffer)
+                {
+                    bytes_read = fd_read(fd, buffer, sizeof(buffer));
+                    num_frames_in_buffer = bytes_read > 0 ? bytes_read / BYTES_PER_FRAME : 0;
+                    frame_idx = 0;
+                    if (num_frames_in_buffer == 0)
+                        break;
+                }
+
                 uint32_t current_frame_data_offset = frame_idx * BYTES_PER_FRAME;
 
                 // Convert packed binary to frame of chars
@@ -1132,6 +1331,7 @@ int main(void)
                 // Sleep between frames
                 syscall(SYS_SLEEP, 100, 0, 0);
             }
+            fd_close(fd);
             syscall(SYS_CLEAR, 0, 0, 0);          // Clear screen after playing
             syscall(SYS_RESET_TERMINAL, 0, 0, 0); // Reset terminal
         }